@@ -4,19 +4,18 @@ import 'package:path_provider/path_provider.dart';
 import 'dart:async';
 import 'package:file_picker/file_picker.dart';
 import 'dart:io';
-import 'package:ffi/ffi.dart';
+import 'dart:typed_data';
 import 'package:graphics/graphics.dart' as graphics;
-import 'dart:ffi' as ffi;
 import 'dart:ui' as ui;
-import 'package:image_size_getter/image_size_getter.dart';
-import 'package:image_size_getter/file_input.dart';
 import 'package:full_screen_image/full_screen_image.dart';
-import 'dart:math';
 import 'package:flutter_cache_manager/flutter_cache_manager.dart';
 import 'package:gallery_saver/gallery_saver.dart';
 
 void main() {
   int res = graphics.libGraphInit();
+  // Image work shares the fast cores instead of each job spreading over
+  // all of them.
+  const graphics.ThreadPolicy(affinity: graphics.Affinity.fastCores).apply();
   runApp(const MyApp());
 }
 
@@ -50,7 +49,13 @@ class PointPainter extends CustomPainter {
   }
 }
 
-Future<void> saveImage(File file) async {
+Future<void> saveImage(Uint8List bytes) async {
+  // Exporting is the only step that writes the edited image to disk.
+  final tempDir = await getTemporaryDirectory();
+  final file = await File(
+          '${tempDir.path}/export_${DateTime.now().millisecondsSinceEpoch}.jpg')
+      .writeAsBytes(bytes);
+
   // Save to gallery
   final result = await GallerySaver.saveImage(file.path);
 
@@ -62,109 +67,155 @@ Future<void> saveImage(File file) async {
 }
 
 class _MyAppState extends State<MyApp> {
-  File? _image;
+  ui.Image? _image;
+  graphics.ImageSession? _session;
+  // Collects the touch points natively, scaled to preview pixels.
+  graphics.Selection? _selection;
+  // Paints brush strokes natively; only the pixels each frame changes come
+  // back as patches.
+  graphics.Stroke? _stroke;
+  Future<void> _strokeUpdates = Future<void>.value();
   final ImagePicker _picker = ImagePicker();
   List<Offset> _points = [];
   final GlobalKey _imageKey = GlobalKey();
-  double _scaleWidth = 1;
-  double _scaleHeight = 1;
   bool _isDrawing = false; // State variable to track drawing mode
+  bool _isPainting = false;
 
   Future<void> _pickImage(ImageSource source) async {
-    var appDir = (await getTemporaryDirectory()).path;
-    new Directory(appDir).delete(recursive: true);
-
     final pickedFile = await _picker.pickImage(source: source);
     if (pickedFile != null) {
-      final imageFile = File(pickedFile.path);
-      final tempDir = await getTemporaryDirectory();
-      final copyImagePath = '${tempDir.path}/copy_image.jpg';
-
-      // Copy the image to the new location
-      final copiedImage = await imageFile.copy(copyImagePath);
+      // Keep the encoded image in memory, edits never go through the disk.
+      final imageBytes = await pickedFile.readAsBytes();
 
-      // Get the dimensions of the image
-      final size = ImageSizeGetter.getSize(FileInput(copiedImage));
-      final imageWidth = size.width.toDouble();
-      final imageHeight = size.height.toDouble();
-      double screenWidth = MediaQuery.of(context).size.width;
+      // Decode once at roughly the display resolution, every edit then works
+      // on the resident preview and the export replays it at full size.
+      final mediaQuery = MediaQuery.of(context);
+      double screenWidth = mediaQuery.size.width;
+      _session?.close();
+      _selection?.close();
+      _stroke?.close();
+      final session = graphics.ImageSession.previewFromBytes(imageBytes,
+          maxWidth: (screenWidth * mediaQuery.devicePixelRatio).round());
+      // Undo steps only keep the preview pixels each edit changed.
+      session.setUndoBudget(64 << 20, compression: graphics.RawCompression.lz4);
 
-      double scale_img = imageWidth / screenWidth;
+      // Touch points are converted to preview pixels.
+      double scale_img = session.size.width / screenWidth;
       print("scale img = ${scale_img}");
 
-      if (scale_img < 1.0) {
-        scale_img == 1.0;
-      }
+      final selection = graphics.Selection.forSession(session, scale: scale_img);
+      final stroke = graphics.Stroke.forSession(
+          session,
+          const graphics.Brush(
+              color: <double>[40, 40, 220], size: 24, hardness: 0.6),
+          scale: scale_img);
 
+      final image = await (await session.exportRgbaAsync()).toImage();
       setState(() {
-        _image = copiedImage;
-        _scaleWidth = scale_img;
+        _session = session;
+        _selection = selection;
+        _stroke = stroke;
+        _points.clear();
       });
+      _show(image);
     }
   }
 
+  void _show(ui.Image image) {
+    setState(() {
+      _image?.dispose();
+      _image = image;
+    });
+  }
+
   void _addPoint(Offset point) {
+    _selection?.add(point.dx, point.dy);
     setState(() {
       _points.add(point);
     });
   }
 
+  void _paint(Offset point) {
+    _stroke?.add(point.dx, point.dy);
+    // Patches are drawn in order, each over the frame before it.
+    _strokeUpdates = _strokeUpdates.then((_) => _drawStrokePatch());
+  }
+
+  Future<void> _drawStrokePatch() async {
+    final image = _image;
+    final patch = _session?.previewStroke(_stroke!);
+    if (image == null || patch == null) {
+      return;
+    }
+    final pixels = await patch.image.toImage();
+    final recorder = ui.PictureRecorder();
+    Canvas(recorder)
+      ..drawImage(image, Offset.zero, Paint())
+      ..drawImage(pixels, Offset(patch.x.toDouble(), patch.y.toDouble()),
+          Paint());
+    final frame =
+        recorder.endRecording().toImageSync(image.width, image.height);
+    pixels.dispose();
+    _show(frame);
+  }
+
+  void _commitStroke() {
+    final session = _session;
+    final stroke = _stroke;
+    if (session == null || stroke == null) {
+      return;
+    }
+    _strokeUpdates = _strokeUpdates.then((_) async {
+      await _drawStrokePatch();
+      // Blends the layer that was previewed, nothing is rendered again.
+      await session.applyStrokeAsync(stroke);
+      stroke.clear();
+      // The image on screen already shows the committed stroke; drop the
+      // patch the clear leaves behind.
+      session.previewStroke(stroke);
+    });
+  }
+
+  Future<void> _undo({bool redo = false}) async {
+    final session = _session;
+    if (session == null || !(redo ? session.redo() : session.undo())) {
+      return;
+    }
+    _show(await (await session.exportRgbaAsync()).toImage());
+  }
+
   @override
   void dispose() {
     DefaultCacheManager().emptyCache();
+    _stroke?.close();
+    _selection?.close();
+    _session?.close();
+    _image?.dispose();
     super.dispose();
   }
 
-  String _generateRandomName(int length) {
-    final random = Random();
-    const chars =
-        'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789';
-    return String.fromCharCodes(Iterable.generate(
-        length, (_) => chars.codeUnitAt(random.nextInt(chars.length))));
-  }
-
   Future<void> _processImage(String key) async {
-    final tempDir = await getTemporaryDirectory();
-    final randomName =
-        _generateRandomName(10); // Generate a 10 character random name
-    final processedImagePath = '${tempDir.path}/$randomName.jpg';
-    final processImage = await _image!.copy(processedImagePath);
-
-    final imagePathPointer = processImage.path.toNativeUtf8();
-    final pointsPointer = _convertPointsToNative(_points);
+    final session = _session!;
+    final selection = _selection!;
 
-    int result = -1;
+    // The edit runs on a native worker thread, the UI isolate stays free, and
+    // the points never leave native memory.
     if (key == "GRAY") {
       print("gray scale start");
-      result = graphics.processImageWithPointsGrayScale(
-          imagePathPointer, pointsPointer, _points.length);
-    }
-
-    if (key == "DRAW") {
-      result = graphics.processImageWithPoints(
-          imagePathPointer, pointsPointer, _points.length);
-    }
-    calloc.free(imagePathPointer);
-    calloc.free(pointsPointer);
-    final temp = _image!;
-    if (result != 0) {
+      await session.grayScaleSelectionAsync(selection);
+    } else if (key == "DRAW") {
+      await session.drawSelectionAsync(selection);
+    } else {
       throw Exception('Image processing failed');
     }
+    selection.clear();
+
+    // The edited pixels go straight to the GPU, nothing is encoded.
+    final image = await (await session.exportRgbaAsync()).toImage();
+    _show(image);
     setState(() {
-      _image = processImage;
       _points.clear();
     });
-
-    temp.delete();
-  }
-
-  ffi.Pointer<ffi.Float> _convertPointsToNative(List<Offset> points) {
-    final pointer = calloc<ffi.Float>(points.length * 2);
-    for (int i = 0; i < points.length; i++) {
-      pointer[i * 2] = points[i].dx * _scaleWidth;
-      pointer[i * 2 + 1] = points[i].dy * _scaleWidth;
-    }
-    return pointer;
   }
 
   @override
@@ -186,6 +237,14 @@ class _MyAppState extends State<MyApp> {
               icon: const Icon(Icons.refresh),
               onPressed: () => _processImage("DRAW"),
             ),
+            IconButton(
+              icon: const Icon(Icons.undo),
+              onPressed: () => _undo(),
+            ),
+            IconButton(
+              icon: const Icon(Icons.redo),
+              onPressed: () => _undo(redo: true),
+            ),
             IconButton(
               onPressed: () => _pickImage(ImageSource.gallery),
               icon: const Icon(Icons.photo),
@@ -197,24 +256,37 @@ class _MyAppState extends State<MyApp> {
             ),
             IconButton(
               icon: const Icon(Icons.save),
-              onPressed: () => saveImage(_image!),
+              // The only lossy encode, so it gets the best settings.
+              onPressed: () async => saveImage(await _session!
+                  .exportBytesAsync(
+                      options: const graphics.EncodeOptions.jpeg(
+                          quality: 95, progressive: true, optimize: true))),
             ),
           ],
         ),
         body: Center(
           child: GestureDetector(
             onPanUpdate: (details) {
-              if (_isDrawing) {
+              if (_isDrawing || _isPainting) {
                 RenderBox renderBox = context.findRenderObject() as RenderBox;
                 Offset localPosition =
                     renderBox.globalToLocal(details.localPosition);
-                _addPoint(localPosition);
+                if (_isPainting) {
+                  _paint(localPosition);
+                } else {
+                  _addPoint(localPosition);
+                }
+              }
+            },
+            onPanEnd: (details) {
+              if (_isPainting) {
+                _commitStroke();
               }
             },
             child: Stack(
               children: [
                 if (_image != null)
-                  Image.file(_image!, key: _imageKey)
+                  RawImage(image: _image, key: _imageKey)
                 else
                   const Text('No image selected.'),
                 CustomPaint(
@@ -295,13 +367,16 @@ class _MyAppState extends State<MyApp> {
                       child: Row(
                         mainAxisSize: MainAxisSize.min,
                         children: [
-                          Icon(Icons.star, size: 20),
+                          Icon(Icons.brush, size: 20),
                           SizedBox(width: 8),
-                          Text('Option 1.1'),
+                          Text('brush'),
                         ],
                       ),
                       onPressed: () {
-                        // Handle Option 1.1
+                        setState(() {
+                          _isPainting = !_isPainting;
+                          _isDrawing = false;
+                        });
                       },
                     ),
                     MenuItemButton(
@@ -4,6 +4,8 @@ import 'package:ffi/ffi.dart';
 
 import 'dart:io';
 import 'dart:isolate';
+import 'dart:typed_data';
+import 'dart:ui' as ui;
 
 import 'graphics_bindings_generated.dart';
 
@@ -136,6 +138,30 @@ typedef ClibGraphInit = Uint8 Function();
 final DlibGraphInit libGraphInit =
     _dylib.lookup<NativeFunction<ClibGraphInit>>("init").asFunction();
 
+/// Values of `graphics_log_mode` in `src/graphics.hpp`.
+abstract final class LogMode {
+  /// Log lines are written by the calling thread.
+  static const int sync = 0;
+
+  /// Log lines are queued without locking and written by a background
+  /// thread, lines are dropped when the queue is full.
+  static const int async = 1;
+}
+
+typedef DInitLogging = int Function(int);
+typedef CInitLogging = Int32 Function(Int32);
+
+final DInitLogging initLogging = _dylib
+    .lookup<NativeFunction<CInitLogging>>("init_logging")
+    .asFunction();
+
+typedef DDroppedLogLines = int Function();
+typedef CDroppedLogLines = Int64 Function();
+
+final DDroppedLogLines droppedLogLines = _dylib
+    .lookup<NativeFunction<CDroppedLogLines>>("dropped_log_lines")
+    .asFunction();
+
 typedef Dprocess_image = int Function(Pointer<Utf8>);
 typedef Cprocess_image = Uint8 Function(Pointer<Utf8>);
 
@@ -161,3 +187,2262 @@ final DProcessImageWithPointsGrayScale processImageWithPointsGrayScale = _dylib
     .lookup<NativeFunction<CProcessImageWithPointsGrayScale>>(
         "process_image_gray_scale")
     .asFunction();
+
+/// Pixel layouts understood by the raw buffer functions such as
+/// [processImagePixels]. Mirrors `graphics_pixel_format` in `graphics.hpp`.
+abstract final class PixelFormat {
+  static const int gray8 = 0;
+  static const int bgr8 = 1;
+  static const int rgb8 = 2;
+  static const int bgra8 = 3;
+  static const int rgba8 = 4;
+}
+
+typedef DProcessImageEncoded = int Function(Pointer<Uint8>, int, Pointer<Utf8>,
+    Pointer<Pointer<Uint8>>, Pointer<Int32>);
+typedef CProcessImageEncoded = Int32 Function(Pointer<Uint8>, Int32,
+    Pointer<Utf8>, Pointer<Pointer<Uint8>>, Pointer<Int32>);
+
+final DProcessImageEncoded processImageEncoded = _dylib
+    .lookup<NativeFunction<CProcessImageEncoded>>("process_image_encoded")
+    .asFunction();
+
+typedef DProcessImageWithPointsEncoded = int Function(
+    Pointer<Uint8>,
+    int,
+    Pointer<Utf8>,
+    Pointer<Float>,
+    int,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>);
+typedef CProcessImageWithPointsEncoded = Int32 Function(
+    Pointer<Uint8>,
+    Int32,
+    Pointer<Utf8>,
+    Pointer<Float>,
+    Int32,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>);
+
+final DProcessImageWithPointsEncoded processImageWithPointsEncoded = _dylib
+    .lookup<NativeFunction<CProcessImageWithPointsEncoded>>(
+        "process_image_with_points_encoded")
+    .asFunction();
+
+final DProcessImageWithPointsEncoded processImageGrayScaleEncoded = _dylib
+    .lookup<NativeFunction<CProcessImageWithPointsEncoded>>(
+        "process_image_gray_scale_encoded")
+    .asFunction();
+
+typedef DProcessImagePixels = int Function(Pointer<Uint8>, int, int, int, int);
+typedef CProcessImagePixels = Int32 Function(
+    Pointer<Uint8>, Int32, Int32, Int32, Int32);
+
+final DProcessImagePixels processImagePixels = _dylib
+    .lookup<NativeFunction<CProcessImagePixels>>("process_image_pixels")
+    .asFunction();
+
+typedef DProcessImageWithPointsPixels = int Function(
+    Pointer<Uint8>, int, int, int, int, Pointer<Float>, int);
+typedef CProcessImageWithPointsPixels = Int32 Function(
+    Pointer<Uint8>, Int32, Int32, Int32, Int32, Pointer<Float>, Int32);
+
+final DProcessImageWithPointsPixels processImageWithPointsPixels = _dylib
+    .lookup<NativeFunction<CProcessImageWithPointsPixels>>(
+        "process_image_with_points_pixels")
+    .asFunction();
+
+final DProcessImageWithPointsPixels processImageGrayScalePixels = _dylib
+    .lookup<NativeFunction<CProcessImageWithPointsPixels>>(
+        "process_image_gray_scale_pixels")
+    .asFunction();
+
+typedef DProcessImageFilterPixels = int Function(Pointer<Uint8>, int, int, int,
+    int, Pointer<Float>, int, Pointer<GraphicsFilterParams>);
+typedef CProcessImageFilterPixels = Int32 Function(Pointer<Uint8>, Int32, Int32,
+    Int32, Int32, Pointer<Float>, Int32, Pointer<GraphicsFilterParams>);
+
+final DProcessImageFilterPixels processImageFilterPixels = _dylib
+    .lookup<NativeFunction<CProcessImageFilterPixels>>(
+        "process_image_filter_pixels")
+    .asFunction();
+
+typedef DFreeBuffer = void Function(Pointer<Uint8>);
+typedef CFreeBuffer = Void Function(Pointer<Uint8>);
+
+final DFreeBuffer freeBuffer =
+    _dylib.lookup<NativeFunction<CFreeBuffer>>("free_buffer").asFunction();
+
+/// free_buffer() as a finalizer, for typed data viewing native buffers.
+final Pointer<NativeFinalizerFunction> _freeBufferFinalizer =
+    _dylib.lookup<NativeFinalizerFunction>("free_buffer");
+
+/// Wraps a native-owned buffer in a Uint8List without copying it. The buffer
+/// is released once the list is garbage collected.
+Uint8List _externalBuffer(Pointer<Uint8> buffer, int length) =>
+    buffer.asTypedList(length,
+        finalizer: _freeBufferFinalizer, token: buffer.cast<Void>());
+
+/// Converts an encoded image held in memory to grayscale.
+///
+/// The result is encoded with the codec selected by [ext] and returned
+/// without going through the file system.
+Uint8List processImageBytes(Uint8List encoded, {String ext = '.jpg'}) {
+  return using((Arena arena) {
+    final Pointer<Uint8> data = _copyBytes(encoded, arena);
+    final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+    final Pointer<Int32> outLength = arena<Int32>();
+    final int result = processImageEncoded(data, encoded.length,
+        ext.toNativeUtf8(allocator: arena), outData, outLength);
+    return _takeBuffer(result, outData, outLength);
+  });
+}
+
+/// Draws the outline of the polygon [points] (interleaved x, y pairs in image
+/// coordinates) onto an encoded image held in memory.
+Uint8List processImageWithPointsBytes(Uint8List encoded, Float32List points,
+    {String ext = '.jpg'}) {
+  return _processPointsBytes(
+      processImageWithPointsEncoded, encoded, points, ext);
+}
+
+/// Converts the area inside the polygon [points] (interleaved x, y pairs in
+/// image coordinates) of an encoded image held in memory to grayscale.
+Uint8List processImageGrayScaleBytes(Uint8List encoded, Float32List points,
+    {String ext = '.jpg'}) {
+  return _processPointsBytes(
+      processImageGrayScaleEncoded, encoded, points, ext);
+}
+
+Uint8List _processPointsBytes(DProcessImageWithPointsEncoded function,
+    Uint8List encoded, Float32List points, String ext) {
+  return using((Arena arena) {
+    final Pointer<Uint8> data = _copyBytes(encoded, arena);
+    final Pointer<Float> nativePoints = arena<Float>(points.length);
+    nativePoints.asTypedList(points.length).setAll(0, points);
+    final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+    final Pointer<Int32> outLength = arena<Int32>();
+    final int result = function(
+        data,
+        encoded.length,
+        ext.toNativeUtf8(allocator: arena),
+        nativePoints,
+        points.length ~/ 2,
+        outData,
+        outLength);
+    return _takeBuffer(result, outData, outLength);
+  });
+}
+
+Pointer<Uint8> _copyBytes(Uint8List bytes, Allocator allocator) {
+  final Pointer<Uint8> data = allocator<Uint8>(bytes.length);
+  data.asTypedList(bytes.length).setAll(0, bytes);
+  return data;
+}
+
+/// Copies a native-owned result buffer into Dart memory and releases it.
+Uint8List _takeBuffer(
+    int result, Pointer<Pointer<Uint8>> outData, Pointer<Int32> outLength) {
+  if (result != 0) {
+    throw Exception('Image processing failed');
+  }
+  final Pointer<Uint8> buffer = outData.value;
+  final Uint8List bytes = Uint8List.fromList(buffer.asTypedList(outLength.value));
+  freeBuffer(buffer);
+  return bytes;
+}
+
+typedef DOpenImage = Pointer<Void> Function(Pointer<Utf8>);
+typedef COpenImage = Pointer<Void> Function(Pointer<Utf8>);
+
+final DOpenImage openImage =
+    _dylib.lookup<NativeFunction<COpenImage>>("open_image").asFunction();
+
+typedef DOpenImageEncoded = Pointer<Void> Function(Pointer<Uint8>, int);
+typedef COpenImageEncoded = Pointer<Void> Function(Pointer<Uint8>, Int32);
+
+final DOpenImageEncoded openImageEncoded = _dylib
+    .lookup<NativeFunction<COpenImageEncoded>>("open_image_encoded")
+    .asFunction();
+
+typedef DSessionGetSize = int Function(
+    Pointer<Void>, Pointer<Int32>, Pointer<Int32>);
+typedef CSessionGetSize = Int32 Function(
+    Pointer<Void>, Pointer<Int32>, Pointer<Int32>);
+
+final DSessionGetSize sessionGetSize = _dylib
+    .lookup<NativeFunction<CSessionGetSize>>("session_get_size")
+    .asFunction();
+
+typedef DOpenImagePreview = Pointer<Void> Function(Pointer<Utf8>, int, int);
+typedef COpenImagePreview = Pointer<Void> Function(Pointer<Utf8>, Int32, Int32);
+
+final DOpenImagePreview openImagePreview = _dylib
+    .lookup<NativeFunction<COpenImagePreview>>("open_image_preview")
+    .asFunction();
+
+typedef DOpenImageEncodedPreview = Pointer<Void> Function(
+    Pointer<Uint8>, int, int, int);
+typedef COpenImageEncodedPreview = Pointer<Void> Function(
+    Pointer<Uint8>, Int32, Int32, Int32);
+
+final DOpenImageEncodedPreview openImageEncodedPreview = _dylib
+    .lookup<NativeFunction<COpenImageEncodedPreview>>(
+        "open_image_encoded_preview")
+    .asFunction();
+
+final DSessionGetSize sessionGetSourceSize = _dylib
+    .lookup<NativeFunction<CSessionGetSize>>("session_get_source_size")
+    .asFunction();
+
+final DOpenImage openImageTiled =
+    _dylib.lookup<NativeFunction<COpenImage>>("open_image_tiled").asFunction();
+
+final DOpenImageEncoded openImageEncodedTiled = _dylib
+    .lookup<NativeFunction<COpenImageEncoded>>("open_image_encoded_tiled")
+    .asFunction();
+
+typedef DSessionGrayScale = int Function(Pointer<Void>);
+typedef CSessionGrayScale = Int32 Function(Pointer<Void>);
+
+final DSessionGrayScale sessionGrayScale = _dylib
+    .lookup<NativeFunction<CSessionGrayScale>>("session_gray_scale")
+    .asFunction();
+
+typedef DSessionWithPoints = int Function(Pointer<Void>, Pointer<Float>, int);
+typedef CSessionWithPoints = Int32 Function(
+    Pointer<Void>, Pointer<Float>, Int32);
+
+final DSessionWithPoints sessionDrawPolygon = _dylib
+    .lookup<NativeFunction<CSessionWithPoints>>("session_draw_polygon")
+    .asFunction();
+
+final DSessionWithPoints sessionGrayScalePolygon = _dylib
+    .lookup<NativeFunction<CSessionWithPoints>>("session_gray_scale_polygon")
+    .asFunction();
+
+typedef DSessionFilterPolygon = int Function(
+    Pointer<Void>, Pointer<Float>, int, Pointer<GraphicsFilterParams>);
+typedef CSessionFilterPolygon = Int32 Function(
+    Pointer<Void>, Pointer<Float>, Int32, Pointer<GraphicsFilterParams>);
+
+final DSessionFilterPolygon sessionFilterPolygon = _dylib
+    .lookup<NativeFunction<CSessionFilterPolygon>>("session_filter_polygon")
+    .asFunction();
+
+typedef DExportImage = int Function(Pointer<Void>, Pointer<Utf8>);
+typedef CExportImage = Int32 Function(Pointer<Void>, Pointer<Utf8>);
+
+final DExportImage exportImage =
+    _dylib.lookup<NativeFunction<CExportImage>>("export_image").asFunction();
+
+typedef DExportImageEncoded = int Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<Pointer<Uint8>>, Pointer<Int32>);
+typedef CExportImageEncoded = Int32 Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<Pointer<Uint8>>, Pointer<Int32>);
+
+final DExportImageEncoded exportImageEncoded = _dylib
+    .lookup<NativeFunction<CExportImageEncoded>>("export_image_encoded")
+    .asFunction();
+
+/// Output codecs, mirrors `graphics_image_format` in `graphics.hpp`.
+abstract final class ImageFormat {
+  /// Picks the codec from the file extension, JPEG for in-memory exports.
+  static const int auto = 0;
+  static const int jpeg = 1;
+  static const int png = 2;
+  static const int webp = 3;
+
+  /// Lossless working format: a small header and the raw pixels, optionally
+  /// LZ4 compressed. Every decoding function accepts it.
+  static const int raw = 4;
+}
+
+/// Mirrors `graphics_raw_compression` in `graphics.hpp`.
+abstract final class RawCompression {
+  static const int none = 0;
+  static const int lz4 = 1;
+}
+
+/// Mirrors `graphics_encode_options` in `graphics.hpp`.
+final class GraphicsEncodeOptions extends Struct {
+  @Int32()
+  external int format;
+  @Int32()
+  external int quality;
+  @Int32()
+  external int progressive;
+  @Int32()
+  external int optimize;
+  @Int32()
+  external int pngCompression;
+  @Int32()
+  external int rawCompression;
+}
+
+/// Encoder settings for [ImageSession.export] and friends. Settings left at
+/// -1 keep the codec's default.
+class EncodeOptions {
+  final int format;
+  final int quality;
+  final int progressive;
+  final int optimize;
+  final int pngCompression;
+  final int rawCompression;
+
+  const EncodeOptions({
+    this.format = ImageFormat.auto,
+    this.quality = -1,
+    this.progressive = -1,
+    this.optimize = -1,
+    this.pngCompression = -1,
+    this.rawCompression = RawCompression.none,
+  });
+
+  const EncodeOptions.jpeg(
+      {int quality = 95, bool progressive = false, bool optimize = false})
+      : this(
+            format: ImageFormat.jpeg,
+            quality: quality,
+            progressive: progressive ? 1 : 0,
+            optimize: optimize ? 1 : 0);
+
+  /// [compression] is the zlib level, from 0 (fastest) to 9 (smallest).
+  const EncodeOptions.png({int compression = 3})
+      : this(format: ImageFormat.png, pngCompression: compression);
+
+  /// A [quality] above 100 selects lossless WebP.
+  const EncodeOptions.webp({int quality = 90})
+      : this(format: ImageFormat.webp, quality: quality);
+
+  /// Lossless working copy, a near memcpy without [lz4].
+  const EncodeOptions.raw({bool lz4 = false})
+      : this(
+            format: ImageFormat.raw,
+            rawCompression: lz4 ? RawCompression.lz4 : RawCompression.none);
+
+  Pointer<GraphicsEncodeOptions> _toNative(Allocator allocator) {
+    final Pointer<GraphicsEncodeOptions> options =
+        allocator<GraphicsEncodeOptions>();
+    options.ref
+      ..format = format
+      ..quality = quality
+      ..progressive = progressive
+      ..optimize = optimize
+      ..pngCompression = pngCompression
+      ..rawCompression = rawCompression;
+    return options;
+  }
+}
+
+typedef DExportImageWithOptions = int Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<GraphicsEncodeOptions>);
+typedef CExportImageWithOptions = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<GraphicsEncodeOptions>);
+
+final DExportImageWithOptions exportImageWithOptions = _dylib
+    .lookup<NativeFunction<CExportImageWithOptions>>(
+        "export_image_with_options")
+    .asFunction();
+
+typedef DExportImageEncodedWithOptions = int Function(Pointer<Void>,
+    Pointer<GraphicsEncodeOptions>, Pointer<Pointer<Uint8>>, Pointer<Int32>);
+typedef CExportImageEncodedWithOptions = Int32 Function(Pointer<Void>,
+    Pointer<GraphicsEncodeOptions>, Pointer<Pointer<Uint8>>, Pointer<Int32>);
+
+final DExportImageEncodedWithOptions exportImageEncodedWithOptions = _dylib
+    .lookup<NativeFunction<CExportImageEncodedWithOptions>>(
+        "export_image_encoded_with_options")
+    .asFunction();
+
+typedef DProcessImageStreaming = int Function(
+    Pointer<Utf8>, Pointer<Utf8>, Pointer<GraphicsEncodeOptions>);
+typedef CProcessImageStreaming = Int32 Function(
+    Pointer<Utf8>, Pointer<Utf8>, Pointer<GraphicsEncodeOptions>);
+
+final DProcessImageStreaming processImageStreaming = _dylib
+    .lookup<NativeFunction<CProcessImageStreaming>>("process_image_streaming")
+    .asFunction();
+
+/// Converts the JPEG or PNG at [inputPath] to grayscale into [outputPath],
+/// which may be the same file, in bands of rows so memory does not grow with
+/// the image height. Returns 0 on success. Blocks the calling thread, so run
+/// it off the main isolate.
+int grayScaleFileStreaming(String inputPath, String outputPath,
+        {EncodeOptions? options}) =>
+    using((Arena arena) => processImageStreaming(
+        inputPath.toNativeUtf8(allocator: arena),
+        outputPath.toNativeUtf8(allocator: arena),
+        options == null ? nullptr : options._toNative(arena)));
+
+typedef DExportImageRgba = int Function(Pointer<Void>,
+    Pointer<Pointer<Uint8>>, Pointer<Int32>, Pointer<Int32>);
+typedef CExportImageRgba = Int32 Function(Pointer<Void>,
+    Pointer<Pointer<Uint8>>, Pointer<Int32>, Pointer<Int32>);
+
+final DExportImageRgba exportImageRgba = _dylib
+    .lookup<NativeFunction<CExportImageRgba>>("export_image_rgba")
+    .asFunction();
+
+/// Opaque pixels in [ui.PixelFormat.rgba8888] layout, tightly packed.
+///
+/// [pixels] views native memory directly; it is released once the list is
+/// garbage collected.
+class RgbaImage {
+  final int width;
+  final int height;
+  final Uint8List pixels;
+
+  const RgbaImage(this.width, this.height, this.pixels);
+
+  /// Uploads the pixels as a [ui.Image] without any codec work.
+  Future<ui.Image> toImage() {
+    final Completer<ui.Image> completer = Completer<ui.Image>();
+    ui.decodeImageFromPixels(
+        pixels, width, height, ui.PixelFormat.rgba8888, completer.complete);
+    return completer.future;
+  }
+}
+
+typedef DCloseImage = void Function(Pointer<Void>);
+typedef CCloseImage = Void Function(Pointer<Void>);
+
+final DCloseImage closeImage =
+    _dylib.lookup<NativeFunction<CCloseImage>>("close_image").asFunction();
+
+/// An image decoded once and kept resident in native memory.
+///
+/// Edits are applied to the decoded pixels directly, so their cost depends
+/// only on the operation and not on decoding or encoding the image. The image
+/// is encoded again only by [export] and [exportBytes]. The native memory is
+/// released by [close], or by a finalizer once the session is unreachable.
+class ImageSession implements Finalizable {
+  static final NativeFinalizer _finalizer =
+      NativeFinalizer(_dylib.lookup<NativeFunction<CCloseImage>>("close_image"));
+
+  Pointer<Void> _handle;
+
+  ImageSession._(this._handle) {
+    _finalizer.attach(this, _handle, detach: this);
+  }
+
+  /// Decodes the image file at [path].
+  factory ImageSession.open(String path) {
+    final Pointer<Void> handle =
+        using((Arena arena) => openImage(path.toNativeUtf8(allocator: arena)));
+    if (handle == nullptr) {
+      throw Exception('Could not open the image $path');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// Decodes an encoded image (JPEG, PNG, ...) held in memory.
+  factory ImageSession.fromBytes(Uint8List encoded) {
+    final Pointer<Void> handle = using((Arena arena) =>
+        openImageEncoded(_copyBytes(encoded, arena), encoded.length));
+    if (handle == nullptr) {
+      throw Exception('Could not decode the image');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// Decodes the image file at [path] at the smallest of 1/2, 1/4 or 1/8
+  /// scale that still covers [maxWidth] x [maxHeight].
+  ///
+  /// Edits apply to the preview immediately and take coordinates in preview
+  /// pixels (see [size]). They are recorded, and the exports replay them on
+  /// the full resolution image.
+  factory ImageSession.openPreview(String path,
+      {int maxWidth = 0, int maxHeight = 0}) {
+    final Pointer<Void> handle = using((Arena arena) => openImagePreview(
+        path.toNativeUtf8(allocator: arena), maxWidth, maxHeight));
+    if (handle == nullptr) {
+      throw Exception('Could not open the image $path');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// Like [ImageSession.openPreview] for an encoded image held in memory.
+  factory ImageSession.previewFromBytes(Uint8List encoded,
+      {int maxWidth = 0, int maxHeight = 0}) {
+    final Pointer<Void> handle = using((Arena arena) => openImageEncodedPreview(
+        _copyBytes(encoded, arena), encoded.length, maxWidth, maxHeight));
+    if (handle == nullptr) {
+      throw Exception('Could not decode the image');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// Decodes the image file at [path] into 256x256 copy-on-write tiles.
+  ///
+  /// Meant for very large images: an edit only copies the tiles under it,
+  /// and exports encode a snapshot while later edits go on. Tiled sessions
+  /// have no layers.
+  factory ImageSession.openTiled(String path) {
+    final Pointer<Void> handle = using(
+        (Arena arena) => openImageTiled(path.toNativeUtf8(allocator: arena)));
+    if (handle == nullptr) {
+      throw Exception('Could not open the image $path');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// Like [ImageSession.openTiled] for an encoded image held in memory.
+  factory ImageSession.tiledFromBytes(Uint8List encoded) {
+    final Pointer<Void> handle = using((Arena arena) =>
+        openImageEncodedTiled(_copyBytes(encoded, arena), encoded.length));
+    if (handle == nullptr) {
+      throw Exception('Could not decode the image');
+    }
+    return ImageSession._(handle);
+  }
+
+  /// The native handle, valid until [close] is called.
+  Pointer<Void> get handle {
+    if (_handle == nullptr) {
+      throw StateError('The image session is closed');
+    }
+    return _handle;
+  }
+
+  /// Width and height of the decoded image in pixels.
+  ({int width, int height}) get size {
+    return using((Arena arena) {
+      final Pointer<Int32> width = arena<Int32>();
+      final Pointer<Int32> height = arena<Int32>();
+      _check(sessionGetSize(handle, width, height));
+      return (width: width.value, height: height.value);
+    });
+  }
+
+  /// Width and height of the image the exports produce. Equal to [size]
+  /// except for preview sessions.
+  ({int width, int height}) get sourceSize {
+    return using((Arena arena) {
+      final Pointer<Int32> width = arena<Int32>();
+      final Pointer<Int32> height = arena<Int32>();
+      _check(sessionGetSourceSize(handle, width, height));
+      return (width: width.value, height: height.value);
+    });
+  }
+
+  /// Converts the whole image to grayscale.
+  void grayScale() => _check(sessionGrayScale(handle));
+
+  /// Draws the outline of the polygon [points] (interleaved x, y pairs in
+  /// image coordinates).
+  void drawPolygon(Float32List points) =>
+      _withPoints(points, sessionDrawPolygon);
+
+  /// Converts the area inside the polygon [points] (interleaved x, y pairs in
+  /// image coordinates) to grayscale.
+  void grayScalePolygon(Float32List points) =>
+      _withPoints(points, sessionGrayScalePolygon);
+
+  /// Runs [filter] on the area inside the polygon [points] (interleaved x, y
+  /// pairs in image coordinates), blended in over [feather] pixels on either
+  /// side of the outline.
+  void filterPolygon(Float32List points, RegionFilter filter,
+      {double feather = 0}) {
+    using((Arena arena) {
+      final Pointer<Float> nativePoints = arena<Float>(points.length);
+      nativePoints.asTypedList(points.length).setAll(0, points);
+      _check(sessionFilterPolygon(handle, nativePoints, points.length ~/ 2,
+          filter._toNative(arena, feather)));
+    });
+  }
+
+  /// Applies every command of [commands] in one native call.
+  void execute(CommandBuffer commands) {
+    final Uint8List bytes = commands.toBytes();
+    using((Arena arena) => _check(
+        sessionExecute(handle, _copyBytes(bytes, arena), bytes.length)));
+  }
+
+  /// Applies every command of [commands] on a native worker thread.
+  ///
+  /// Jobs on the same session run one after another, jobs on different
+  /// sessions run concurrently.
+  Future<void> executeAsync(CommandBuffer commands) async {
+    final Uint8List bytes = commands.toBytes();
+    final Future<_JobResult> result = _JobQueue.instance.submit((int port) =>
+        using((Arena arena) => submitSessionCommands(
+            handle, _copyBytes(bytes, arena), bytes.length, port)));
+    // Keep the session reachable until the native side is done with it.
+    (await result).check(this);
+  }
+
+  /// Encodes the image with the codec selected by [ext], or by [options] if
+  /// given, on a native worker thread.
+  Future<Uint8List> exportBytesAsync(
+      {String ext = '.jpg', EncodeOptions? options}) async {
+    final _JobResult result = await _JobQueue.instance.submit((int port) =>
+        using((Arena arena) => options == null
+            ? submitSessionExport(
+                handle, ext.toNativeUtf8(allocator: arena), port)
+            : submitSessionExportWithOptions(
+                handle, options._toNative(arena), port)));
+    return result.take(this);
+  }
+
+  /// The resident image (the preview of preview sessions) as RGBA for display.
+  ///
+  /// Nothing is encoded or copied on the Dart side, the result views the
+  /// native conversion buffer.
+  RgbaImage exportRgba() {
+    return using((Arena arena) {
+      final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+      final Pointer<Int32> width = arena<Int32>();
+      final Pointer<Int32> height = arena<Int32>();
+      _check(exportImageRgba(handle, outData, width, height));
+      return RgbaImage(width.value, height.value,
+          _externalBuffer(outData.value, width.value * height.value * 4));
+    });
+  }
+
+  /// Like [exportRgba] on a native worker thread.
+  Future<RgbaImage> exportRgbaAsync() async {
+    final ({int width, int height}) size = this.size;
+    final _JobResult result = await _JobQueue.instance
+        .submit((int port) => submitSessionExportRgba(handle, port));
+    return RgbaImage(size.width, size.height, result.takeExternal(this));
+  }
+
+  /// Encodes the image to the file at [path]. The codec follows its extension
+  /// unless [options] selects one.
+  void export(String path, {EncodeOptions? options}) =>
+      using((Arena arena) => _check(options == null
+          ? exportImage(handle, path.toNativeUtf8(allocator: arena))
+          : exportImageWithOptions(handle,
+              path.toNativeUtf8(allocator: arena), options._toNative(arena))));
+
+  /// Encodes the image with the codec selected by [ext], or by [options] if
+  /// given, into memory.
+  Uint8List exportBytes({String ext = '.jpg', EncodeOptions? options}) {
+    return using((Arena arena) {
+      final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+      final Pointer<Int32> outLength = arena<Int32>();
+      final int result = options == null
+          ? exportImageEncoded(
+              handle, ext.toNativeUtf8(allocator: arena), outData, outLength)
+          : exportImageEncodedWithOptions(
+              handle, options._toNative(arena), outData, outLength);
+      return _takeBuffer(result, outData, outLength);
+    });
+  }
+
+  /// Releases the native image. The session can't be used afterwards.
+  void close() {
+    if (_handle == nullptr) {
+      return;
+    }
+    _finalizer.detach(this);
+    closeImage(_handle);
+    _handle = nullptr;
+  }
+
+  /// Converts the area inside [selection] to grayscale, like
+  /// [CommandBuffer.grayScalePolygon]. The selection's points and mask stay
+  /// native, nothing is copied per point.
+  void grayScaleSelection(Selection selection,
+          {double feather = 0, double? simplify}) =>
+      _applySelection(selection, CommandOp.grayScalePolygon,
+          _grayScalePolygonParams(feather, simplify));
+
+  /// Draws the outline of [selection], like [CommandBuffer.drawPolygon].
+  void drawSelection(Selection selection,
+          {List<double> color = const <double>[0, 255, 0],
+          double thickness = 2,
+          double? simplify}) =>
+      _applySelection(selection, CommandOp.drawPolygon,
+          _drawPolygonParams(color, thickness, simplify));
+
+  /// Like [grayScaleSelection] on a native worker thread. The selection is
+  /// used as it is when the job runs.
+  Future<void> grayScaleSelectionAsync(Selection selection,
+          {double feather = 0, double? simplify}) =>
+      _applySelectionAsync(selection, CommandOp.grayScalePolygon,
+          _grayScalePolygonParams(feather, simplify));
+
+  /// Like [drawSelection] on a native worker thread.
+  Future<void> drawSelectionAsync(Selection selection,
+          {List<double> color = const <double>[0, 255, 0],
+          double thickness = 2,
+          double? simplify}) =>
+      _applySelectionAsync(selection, CommandOp.drawPolygon,
+          _drawPolygonParams(color, thickness, simplify));
+
+  /// Runs [filter] on the area inside [selection], like
+  /// [CommandBuffer.filterPolygon].
+  void filterSelection(Selection selection, RegionFilter filter,
+          {double feather = 0, double? simplify}) =>
+      _applySelection(selection, CommandOp.filterPolygon,
+          _filterPolygonParams(filter, feather, simplify));
+
+  /// Like [filterSelection] on a native worker thread.
+  Future<void> filterSelectionAsync(Selection selection, RegionFilter filter,
+          {double feather = 0, double? simplify}) =>
+      _applySelectionAsync(selection, CommandOp.filterPolygon,
+          _filterPolygonParams(filter, feather, simplify));
+
+  /// The image with [stroke] blended in, as a patch of only the pixels that
+  /// changed since the previous call; null if none did. Draw each patch over
+  /// the image last exported (or the previous frame) to show the stroke.
+  StrokePatch? previewStroke(Stroke stroke) {
+    return using((Arena arena) {
+      final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+      final Pointer<Int32> rect = arena<Int32>(4);
+      _check(sessionPreviewStroke(
+          handle, stroke.handle, outData, rect, rect + 1, rect + 2, rect + 3));
+      if (outData.value == nullptr) {
+        return null;
+      }
+      return StrokePatch(
+          rect[0],
+          rect[1],
+          RgbaImage(rect[2], rect[3],
+              _externalBuffer(outData.value, rect[2] * rect[3] * 4)));
+    });
+  }
+
+  /// Blends [stroke] into the image, exactly as [previewStroke] showed it,
+  /// and records it for the exports of preview sessions. Clear the stroke
+  /// before painting the next one.
+  void applyStroke(Stroke stroke) =>
+      _check(sessionApplyStroke(handle, stroke.handle));
+
+  /// Like [applyStroke] on a native worker thread. The stroke is used as it
+  /// is when the job runs.
+  Future<void> applyStrokeAsync(Stroke stroke) async {
+    final Future<_JobResult> result = _JobQueue.instance.submit(
+        (int port) => submitSessionStroke(handle, stroke.handle, port));
+    // Keep both handles reachable until the native side is done with them.
+    (await result).check(<Object>[this, stroke]);
+  }
+
+  /// Adds a layer on top of the session's layer stack and returns its id: an
+  /// adjustment layer running [filter] over everything below it, or an empty
+  /// paint layer for [paintLayer] when [filter] is null. [blendMode] is one
+  /// of [BlendMode].
+  ///
+  /// The stack is composited natively in tiles, and a change only
+  /// composites again the tiles it can affect, so toggling or editing a
+  /// layer costs the pixels it covers. [exportRgba] returns the composite
+  /// and the exports flatten the layers at full resolution.
+  int addLayer(
+      {RegionFilter? filter,
+      int blendMode = BlendMode.normal,
+      double opacity = 1}) {
+    return using((Arena arena) {
+      final Pointer<Int32> id = arena<Int32>();
+      _check(sessionAddLayer(
+          handle, _layerParams(arena, filter, blendMode, opacity), id));
+      return id.value;
+    });
+  }
+
+  /// Changes the blend mode, opacity and filter values of layer [id].
+  /// [filter] must be the same kind of filter the layer was added with.
+  void updateLayer(int id,
+          {RegionFilter? filter,
+          int blendMode = BlendMode.normal,
+          double opacity = 1}) =>
+      using((Arena arena) => _check(sessionUpdateLayer(
+          handle, id, _layerParams(arena, filter, blendMode, opacity))));
+
+  void setLayerVisible(int id, bool visible) =>
+      _check(sessionSetLayerVisible(handle, id, visible ? 1 : 0));
+
+  /// Limits layer [id] to the area inside [selection], feathered by
+  /// [feather] pixels, or everywhere again when [selection] is null.
+  void setLayerMask(int id, Selection? selection, {double feather = 0}) =>
+      _check(sessionSetLayerMask(
+          handle, id, selection?.handle ?? nullptr, feather));
+
+  /// Paints [stroke] onto paint layer [id] instead of the image. Clear the
+  /// stroke before painting the next one.
+  void paintLayer(int id, Stroke stroke) =>
+      _check(sessionPaintLayer(handle, id, stroke.handle));
+
+  void removeLayer(int id) => _check(sessionRemoveLayer(handle, id));
+
+  /// Keeps undo steps of the edits to the image, holding up to [memoryBytes]
+  /// of saved pixels, [RawCompression.lz4] compressed if asked. Past that the
+  /// oldest steps go to a file in [spillDirectory], or are forgotten without
+  /// one. A budget of 0 turns the history off. Layer changes are not undone.
+  void setUndoBudget(int memoryBytes,
+          {int compression = RawCompression.none, String? spillDirectory}) =>
+      using((Arena arena) => _check(sessionSetUndoBudget(
+          handle,
+          memoryBytes,
+          compression,
+          spillDirectory?.toNativeUtf8(allocator: arena) ?? nullptr)));
+
+  /// Takes back the last edit; false if there is none.
+  bool undo() => sessionUndo(handle) == 0;
+
+  /// Applies the last undone edit again; false if there is none.
+  bool redo() => sessionRedo(handle) == 0;
+
+  UndoInfo get undoInfo => using((Arena arena) {
+        final Pointer<GraphicsUndoInfo> info = arena<GraphicsUndoInfo>();
+        _check(sessionGetUndoInfo(handle, info));
+        return UndoInfo._(info.ref.undoSteps, info.ref.redoSteps,
+            info.ref.memoryBytes, info.ref.diskBytes);
+      });
+
+  void _applySelection(Selection selection, int op, List<double> params) {
+    using((Arena arena) {
+      final Pointer<Float> nativeParams = arena<Float>(params.length + 1);
+      nativeParams.asTypedList(params.length).setAll(0, params);
+      _check(sessionApplySelection(
+          handle, selection.handle, op, nativeParams, params.length));
+    });
+  }
+
+  Future<void> _applySelectionAsync(
+      Selection selection, int op, List<double> params) async {
+    final Future<_JobResult> result =
+        _JobQueue.instance.submit((int port) => using((Arena arena) {
+              final Pointer<Float> nativeParams =
+                  arena<Float>(params.length + 1);
+              nativeParams.asTypedList(params.length).setAll(0, params);
+              return submitSessionSelection(handle, selection.handle, op,
+                  nativeParams, params.length, port);
+            }));
+    // Keep both handles reachable until the native side is done with them.
+    (await result).check(<Object>[this, selection]);
+  }
+
+  void _withPoints(Float32List points, DSessionWithPoints function) {
+    using((Arena arena) {
+      final Pointer<Float> nativePoints = arena<Float>(points.length);
+      nativePoints.asTypedList(points.length).setAll(0, points);
+      _check(function(handle, nativePoints, points.length ~/ 2));
+    });
+  }
+
+  static void _check(int result) {
+    if (result != 0) {
+      throw Exception('Image processing failed');
+    }
+  }
+}
+
+typedef DCreateSelection = Pointer<Void> Function(int, int, double, double);
+typedef CCreateSelection = Pointer<Void> Function(Int32, Int32, Float, Float);
+
+final DCreateSelection createSelection = _dylib
+    .lookup<NativeFunction<CCreateSelection>>("create_selection")
+    .asFunction();
+
+typedef DSelectionAppendPoints = int Function(Pointer<Void>, Pointer<Float>, int);
+typedef CSelectionAppendPoints = Int32 Function(
+    Pointer<Void>, Pointer<Float>, Int32);
+
+final DSelectionAppendPoints selectionAppendPoints = _dylib
+    .lookup<NativeFunction<CSelectionAppendPoints>>("selection_append_points")
+    .asFunction();
+
+typedef DSelectionClear = int Function(Pointer<Void>);
+typedef CSelectionClear = Int32 Function(Pointer<Void>);
+
+final DSelectionClear selectionClear = _dylib
+    .lookup<NativeFunction<CSelectionClear>>("selection_clear")
+    .asFunction();
+
+final DSelectionClear selectionGetLength = _dylib
+    .lookup<NativeFunction<CSelectionClear>>("selection_get_length")
+    .asFunction();
+
+typedef DSelectionGetBounds = int Function(Pointer<Void>, Pointer<Int32>,
+    Pointer<Int32>, Pointer<Int32>, Pointer<Int32>);
+typedef CSelectionGetBounds = Int32 Function(Pointer<Void>, Pointer<Int32>,
+    Pointer<Int32>, Pointer<Int32>, Pointer<Int32>);
+
+final DSelectionGetBounds selectionGetBounds = _dylib
+    .lookup<NativeFunction<CSelectionGetBounds>>("selection_get_bounds")
+    .asFunction();
+
+typedef DSessionApplySelection = int Function(
+    Pointer<Void>, Pointer<Void>, int, Pointer<Float>, int);
+typedef CSessionApplySelection = Int32 Function(
+    Pointer<Void>, Pointer<Void>, Int32, Pointer<Float>, Int32);
+
+final DSessionApplySelection sessionApplySelection = _dylib
+    .lookup<NativeFunction<CSessionApplySelection>>("session_apply_selection")
+    .asFunction();
+
+typedef DCloseSelection = void Function(Pointer<Void>);
+typedef CCloseSelection = Void Function(Pointer<Void>);
+
+final DCloseSelection closeSelection = _dylib
+    .lookup<NativeFunction<CCloseSelection>>("close_selection")
+    .asFunction();
+
+List<double> _drawPolygonParams(
+        List<double> color, double thickness, double? simplify) =>
+    <double>[...color, thickness, if (simplify != null) simplify];
+
+List<double> _grayScalePolygonParams(double feather, double? simplify) =>
+    <double>[
+      if (feather > 0 || simplify != null) feather,
+      if (simplify != null) simplify,
+    ];
+
+List<double> _filterPolygonParams(
+        RegionFilter filter, double feather, double? simplify) =>
+    <double>[
+      filter.id.toDouble(),
+      feather,
+      ...filter.values,
+      if (simplify != null) simplify,
+    ];
+
+/// Mirrors `graphics_filter_params` in `graphics.hpp`.
+final class GraphicsFilterParams extends Struct {
+  @Int32()
+  external int filter;
+  @Float()
+  external double feather;
+  @Array(3)
+  external Array<Float> values;
+}
+
+/// Ids of the region filters. Mirrors `graphics_filter` in `graphics.hpp`.
+abstract final class FilterId {
+  static const int gaussianBlur = 1;
+  static const int boxBlur = 2;
+  static const int unsharpMask = 3;
+  static const int brightnessContrast = 4;
+  static const int saturation = 5;
+}
+
+/// A local adjustment applied inside a polygon or a [Selection], see
+/// [CommandBuffer.filterPolygon].
+///
+/// Only the selection's bounding box is read and written, and its rows are
+/// filtered in bands on all cores, so the cost follows the selection rather
+/// than the image. Blur radii are in pixels of the image being edited;
+/// preview sessions scale them along with the points.
+class RegionFilter {
+  final int id;
+  final List<double> values;
+
+  const RegionFilter._(this.id, this.values);
+
+  /// Gaussian blur with a standard deviation of [sigma] pixels.
+  RegionFilter.gaussianBlur({double sigma = 4})
+      : this._(FilterId.gaussianBlur, <double>[sigma]);
+
+  /// Mean over a square of 2 * [radius] + 1 pixels, as fast for large radii
+  /// as for small ones.
+  RegionFilter.boxBlur({double radius = 4})
+      : this._(FilterId.boxBlur, <double>[radius]);
+
+  /// Sharpens by [amount] times the difference to a Gaussian blur of [sigma]
+  /// pixels, leaving differences below [threshold] levels alone.
+  RegionFilter.unsharpMask(
+      {double sigma = 2, double amount = 1, double threshold = 0})
+      : this._(FilterId.unsharpMask, <double>[sigma, amount, threshold]);
+
+  /// Applies [gamma], then scales by [contrast] around mid gray and adds
+  /// [brightness] (-255 to 255).
+  RegionFilter.brightnessContrast(
+      {double brightness = 0, double contrast = 1, double gamma = 1})
+      : this._(
+            FilterId.brightnessContrast, <double>[brightness, contrast, gamma]);
+
+  /// Scales the saturation by [factor]; 0 is grayscale, 1 leaves the colors
+  /// as they are.
+  RegionFilter.saturation({double factor = 1})
+      : this._(FilterId.saturation, <double>[factor]);
+
+  Pointer<GraphicsFilterParams> _toNative(Allocator allocator, double feather) {
+    final Pointer<GraphicsFilterParams> params =
+        allocator<GraphicsFilterParams>();
+    params.ref.filter = id;
+    params.ref.feather = feather;
+    for (int i = 0; i < 3; i++) {
+      params.ref.values[i] = i < values.length ? values[i] : 0;
+    }
+    return params;
+  }
+}
+
+typedef DSetSimplifyTolerance = void Function(double);
+typedef CSetSimplifyTolerance = Void Function(Float);
+
+final DSetSimplifyTolerance setSimplifyTolerance = _dylib
+    .lookup<NativeFunction<CSetSimplifyTolerance>>("set_simplify_tolerance")
+    .asFunction();
+
+/// Native simplification of polygon outlines before they are rasterized.
+///
+/// Freehand gestures produce long runs of near-collinear touch points; the
+/// vertices that move the outline by at most [tolerance] pixels are dropped
+/// (Ramer-Douglas-Peucker), which speeds up masks and keeps recorded edits
+/// small. Per call tolerances (the `simplify` arguments) take precedence.
+/// [Stats] counts the vertices before and after.
+abstract final class Simplification {
+  /// The process wide tolerance in pixels; 0, the default, keeps every vertex.
+  static set tolerance(double pixels) => setSimplifyTolerance(pixels);
+}
+
+/// A polygon selection kept in native memory while the user draws it.
+///
+/// Points are appended as they arrive, in view coordinates; the native side
+/// scales them to image pixels and keeps the bounds and the coverage mask up
+/// to date, so applying the selection to an [ImageSession] marshals no points
+/// at all, even for freehand outlines with tens of thousands of vertices.
+class Selection implements Finalizable {
+  static final NativeFinalizer _finalizer = NativeFinalizer(
+      _dylib.lookup<NativeFunction<CCloseSelection>>("close_selection"));
+
+  Pointer<Void> _handle;
+
+  Selection._(this._handle) {
+    _finalizer.attach(this, _handle, detach: this);
+  }
+
+  /// A selection on an image of [width] x [height] pixels. Appended points
+  /// are multiplied by [scaleX] and [scaleY].
+  factory Selection(int width, int height,
+      {double scaleX = 1, double scaleY = 1}) {
+    final Pointer<Void> handle = createSelection(width, height, scaleX, scaleY);
+    if (handle == nullptr) {
+      throw ArgumentError('Invalid selection size or scale');
+    }
+    return Selection._(handle);
+  }
+
+  /// A selection on the image of [session] (the preview of preview sessions),
+  /// with points given in view coordinates that [scale] maps to its pixels.
+  factory Selection.forSession(ImageSession session, {double scale = 1}) {
+    final ({int width, int height}) size = session.size;
+    return Selection(size.width, size.height, scaleX: scale, scaleY: scale);
+  }
+
+  /// The native handle, valid until [close] is called.
+  Pointer<Void> get handle {
+    if (_handle == nullptr) {
+      throw StateError('The selection is closed');
+    }
+    return _handle;
+  }
+
+  /// Appends the point ([x], [y]).
+  void add(double x, double y) {
+    using((Arena arena) {
+      final Pointer<Float> point = arena<Float>(2);
+      point[0] = x;
+      point[1] = y;
+      _check(selectionAppendPoints(handle, point, 1));
+    });
+  }
+
+  /// Appends [points], interleaved x, y pairs.
+  void addAll(Float32List points) {
+    if (points.length.isOdd) {
+      throw ArgumentError('Points must be interleaved x, y pairs');
+    }
+    using((Arena arena) {
+      final Pointer<Float> nativePoints = arena<Float>(points.length + 1);
+      nativePoints.asTypedList(points.length).setAll(0, points);
+      _check(selectionAppendPoints(handle, nativePoints, points.length ~/ 2));
+    });
+  }
+
+  /// Removes every point.
+  void clear() => _check(selectionClear(handle));
+
+  /// Number of points appended since the selection was created or cleared.
+  int get length => selectionGetLength(handle);
+
+  /// The pixels the selection overlaps, clipped to the image.
+  ({int x, int y, int width, int height}) get bounds {
+    return using((Arena arena) {
+      final Pointer<Int32> values = arena<Int32>(4);
+      _check(selectionGetBounds(
+          handle, values, values + 1, values + 2, values + 3));
+      return (x: values[0], y: values[1], width: values[2], height: values[3]);
+    });
+  }
+
+  /// Releases the native selection. Jobs already queued keep their own
+  /// reference.
+  void close() {
+    if (_handle == nullptr) {
+      return;
+    }
+    _finalizer.detach(this);
+    closeSelection(_handle);
+    _handle = nullptr;
+  }
+
+  static void _check(int result) {
+    if (result != 0) {
+      throw Exception('Selection update failed');
+    }
+  }
+}
+
+/// Mirrors `graphics_brush` in `graphics.hpp`.
+final class GraphicsBrush extends Struct {
+  @Float()
+  external double blue;
+  @Float()
+  external double green;
+  @Float()
+  external double red;
+  @Float()
+  external double size;
+  @Float()
+  external double hardness;
+  @Float()
+  external double opacity;
+  @Float()
+  external double spacing;
+}
+
+/// A round brush for [Stroke] and [CommandBuffer.stroke].
+///
+/// Stamps of [size] pixels are placed along the path every [spacing] times
+/// the size. The inner [hardness] fraction of the radius is painted fully,
+/// the rest fades out smoothly. [opacity] applies to the stroke as a whole:
+/// where stamps overlap the color does not build up. [color] is given as
+/// blue, green, red.
+class Brush {
+  final List<double> color;
+  final double size;
+  final double hardness;
+  final double opacity;
+  final double spacing;
+
+  const Brush(
+      {this.color = const <double>[0, 255, 0],
+      this.size = 12,
+      this.hardness = 0.8,
+      this.opacity = 1,
+      this.spacing = 0.1});
+
+  List<double> get _params =>
+      <double>[...color, size, hardness, opacity, spacing];
+
+  Pointer<GraphicsBrush> _toNative(Allocator allocator) {
+    final Pointer<GraphicsBrush> brush = allocator<GraphicsBrush>();
+    brush.ref.blue = color[0];
+    brush.ref.green = color[1];
+    brush.ref.red = color[2];
+    brush.ref.size = size;
+    brush.ref.hardness = hardness;
+    brush.ref.opacity = opacity;
+    brush.ref.spacing = spacing;
+    return brush;
+  }
+}
+
+typedef DCreateStroke = Pointer<Void> Function(
+    int, int, Pointer<GraphicsBrush>, double, double);
+typedef CCreateStroke = Pointer<Void> Function(
+    Int32, Int32, Pointer<GraphicsBrush>, Float, Float);
+
+final DCreateStroke createStroke = _dylib
+    .lookup<NativeFunction<CCreateStroke>>("create_stroke")
+    .asFunction();
+
+final DSelectionAppendPoints strokeAppendPoints = _dylib
+    .lookup<NativeFunction<CSelectionAppendPoints>>("stroke_append_points")
+    .asFunction();
+
+final DSelectionClear strokeClear = _dylib
+    .lookup<NativeFunction<CSelectionClear>>("stroke_clear")
+    .asFunction();
+
+final DSelectionClear strokeGetLength = _dylib
+    .lookup<NativeFunction<CSelectionClear>>("stroke_get_length")
+    .asFunction();
+
+final DSelectionGetBounds strokeGetBounds = _dylib
+    .lookup<NativeFunction<CSelectionGetBounds>>("stroke_get_bounds")
+    .asFunction();
+
+typedef DSessionPreviewStroke = int Function(
+    Pointer<Void>,
+    Pointer<Void>,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>,
+    Pointer<Int32>,
+    Pointer<Int32>,
+    Pointer<Int32>);
+typedef CSessionPreviewStroke = Int32 Function(
+    Pointer<Void>,
+    Pointer<Void>,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>,
+    Pointer<Int32>,
+    Pointer<Int32>,
+    Pointer<Int32>);
+
+final DSessionPreviewStroke sessionPreviewStroke = _dylib
+    .lookup<NativeFunction<CSessionPreviewStroke>>("session_preview_stroke")
+    .asFunction();
+
+typedef DSessionApplyStroke = int Function(Pointer<Void>, Pointer<Void>);
+typedef CSessionApplyStroke = Int32 Function(Pointer<Void>, Pointer<Void>);
+
+final DSessionApplyStroke sessionApplyStroke = _dylib
+    .lookup<NativeFunction<CSessionApplyStroke>>("session_apply_stroke")
+    .asFunction();
+
+typedef DSubmitSessionStroke = int Function(Pointer<Void>, Pointer<Void>, int);
+typedef CSubmitSessionStroke = Int64 Function(
+    Pointer<Void>, Pointer<Void>, Int64);
+
+final DSubmitSessionStroke submitSessionStroke = _dylib
+    .lookup<NativeFunction<CSubmitSessionStroke>>("submit_session_stroke")
+    .asFunction();
+
+final DCloseSelection closeStroke = _dylib
+    .lookup<NativeFunction<CCloseSelection>>("close_stroke")
+    .asFunction();
+
+/// A brush stroke kept in native memory while the user paints it.
+///
+/// Points are appended in view coordinates as they arrive. The native side
+/// places the brush stamps along the path and renders them in batches into
+/// an alpha layer, remembering which pixels each batch changed, so
+/// [ImageSession.previewStroke] only converts and uploads those pixels and a
+/// frame costs the same however long the stroke gets.
+/// [ImageSession.applyStroke] blends that same layer into the image, so the
+/// committed stroke is exactly the previewed one.
+class Stroke implements Finalizable {
+  static final NativeFinalizer _finalizer = NativeFinalizer(
+      _dylib.lookup<NativeFunction<CCloseSelection>>("close_stroke"));
+
+  Pointer<Void> _handle;
+
+  Stroke._(this._handle) {
+    _finalizer.attach(this, _handle, detach: this);
+  }
+
+  /// A stroke painted with [brush] on an image of [width] x [height] pixels.
+  /// Appended points are multiplied by [scaleX] and [scaleY].
+  factory Stroke(int width, int height, Brush brush,
+      {double scaleX = 1, double scaleY = 1}) {
+    final Pointer<Void> handle = using((Arena arena) => createStroke(
+        width, height, brush._toNative(arena), scaleX, scaleY));
+    if (handle == nullptr) {
+      throw ArgumentError('Invalid stroke size, scale or brush');
+    }
+    return Stroke._(handle);
+  }
+
+  /// A stroke on the image of [session] (the preview of preview sessions),
+  /// with points given in view coordinates that [scale] maps to its pixels.
+  factory Stroke.forSession(ImageSession session, Brush brush,
+      {double scale = 1}) {
+    final ({int width, int height}) size = session.size;
+    return Stroke(size.width, size.height, brush,
+        scaleX: scale, scaleY: scale);
+  }
+
+  /// The native handle, valid until [close] is called.
+  Pointer<Void> get handle {
+    if (_handle == nullptr) {
+      throw StateError('The stroke is closed');
+    }
+    return _handle;
+  }
+
+  /// Appends the point ([x], [y]).
+  void add(double x, double y) {
+    using((Arena arena) {
+      final Pointer<Float> point = arena<Float>(2);
+      point[0] = x;
+      point[1] = y;
+      _check(strokeAppendPoints(handle, point, 1));
+    });
+  }
+
+  /// Appends [points], interleaved x, y pairs.
+  void addAll(Float32List points) {
+    if (points.length.isOdd) {
+      throw ArgumentError('Points must be interleaved x, y pairs');
+    }
+    using((Arena arena) {
+      final Pointer<Float> nativePoints = arena<Float>(points.length + 1);
+      nativePoints.asTypedList(points.length).setAll(0, points);
+      _check(strokeAppendPoints(handle, nativePoints, points.length ~/ 2));
+    });
+  }
+
+  /// Removes the path and the painted pixels; the next
+  /// [ImageSession.previewStroke] restores them.
+  void clear() => _check(strokeClear(handle));
+
+  /// Number of points appended since the stroke was created or cleared.
+  int get length => strokeGetLength(handle);
+
+  /// The pixels painted so far, clipped to the image.
+  ({int x, int y, int width, int height}) get bounds {
+    return using((Arena arena) {
+      final Pointer<Int32> values = arena<Int32>(4);
+      _check(
+          strokeGetBounds(handle, values, values + 1, values + 2, values + 3));
+      return (x: values[0], y: values[1], width: values[2], height: values[3]);
+    });
+  }
+
+  /// Releases the native stroke. Jobs already queued keep their own
+  /// reference.
+  void close() {
+    if (_handle == nullptr) {
+      return;
+    }
+    _finalizer.detach(this);
+    closeStroke(_handle);
+    _handle = nullptr;
+  }
+
+  static void _check(int result) {
+    if (result != 0) {
+      throw Exception('Stroke update failed');
+    }
+  }
+}
+
+/// The pixels of an image that changed since the previous
+/// [ImageSession.previewStroke], to be drawn at ([x], [y]) over what is
+/// displayed.
+class StrokePatch {
+  final int x;
+  final int y;
+  final RgbaImage image;
+
+  const StrokePatch(this.x, this.y, this.image);
+}
+
+/// Blend modes of layers. Mirrors `graphics_blend_mode` in `graphics.hpp`.
+abstract final class BlendMode {
+  static const int normal = 0;
+  static const int multiply = 1;
+  static const int screen = 2;
+  static const int overlay = 3;
+}
+
+/// Mirrors `graphics_layer_params` in `graphics.hpp`.
+final class GraphicsLayerParams extends Struct {
+  @Int32()
+  external int filter;
+  @Int32()
+  external int blendMode;
+  @Float()
+  external double opacity;
+  @Array(3)
+  external Array<Float> values;
+}
+
+Pointer<GraphicsLayerParams> _layerParams(
+    Allocator allocator, RegionFilter? filter, int blendMode, double opacity) {
+  final Pointer<GraphicsLayerParams> params = allocator<GraphicsLayerParams>();
+  params.ref.filter = filter?.id ?? 0;
+  params.ref.blendMode = blendMode;
+  params.ref.opacity = opacity;
+  for (int i = 0; i < 3; i++) {
+    params.ref.values[i] =
+        filter != null && i < filter.values.length ? filter.values[i] : 0;
+  }
+  return params;
+}
+
+typedef DSessionAddLayer = int Function(
+    Pointer<Void>, Pointer<GraphicsLayerParams>, Pointer<Int32>);
+typedef CSessionAddLayer = Int32 Function(
+    Pointer<Void>, Pointer<GraphicsLayerParams>, Pointer<Int32>);
+
+final DSessionAddLayer sessionAddLayer = _dylib
+    .lookup<NativeFunction<CSessionAddLayer>>("session_add_layer")
+    .asFunction();
+
+typedef DSessionUpdateLayer = int Function(
+    Pointer<Void>, int, Pointer<GraphicsLayerParams>);
+typedef CSessionUpdateLayer = Int32 Function(
+    Pointer<Void>, Int32, Pointer<GraphicsLayerParams>);
+
+final DSessionUpdateLayer sessionUpdateLayer = _dylib
+    .lookup<NativeFunction<CSessionUpdateLayer>>("session_update_layer")
+    .asFunction();
+
+typedef DSessionSetLayerVisible = int Function(Pointer<Void>, int, int);
+typedef CSessionSetLayerVisible = Int32 Function(Pointer<Void>, Int32, Int32);
+
+final DSessionSetLayerVisible sessionSetLayerVisible = _dylib
+    .lookup<NativeFunction<CSessionSetLayerVisible>>(
+        "session_set_layer_visible")
+    .asFunction();
+
+typedef DSessionSetLayerMask = int Function(
+    Pointer<Void>, int, Pointer<Void>, double);
+typedef CSessionSetLayerMask = Int32 Function(
+    Pointer<Void>, Int32, Pointer<Void>, Float);
+
+final DSessionSetLayerMask sessionSetLayerMask = _dylib
+    .lookup<NativeFunction<CSessionSetLayerMask>>("session_set_layer_mask")
+    .asFunction();
+
+typedef DSessionPaintLayer = int Function(Pointer<Void>, int, Pointer<Void>);
+typedef CSessionPaintLayer = Int32 Function(
+    Pointer<Void>, Int32, Pointer<Void>);
+
+final DSessionPaintLayer sessionPaintLayer = _dylib
+    .lookup<NativeFunction<CSessionPaintLayer>>("session_paint_layer")
+    .asFunction();
+
+typedef DSessionRemoveLayer = int Function(Pointer<Void>, int);
+typedef CSessionRemoveLayer = Int32 Function(Pointer<Void>, Int32);
+
+final DSessionRemoveLayer sessionRemoveLayer = _dylib
+    .lookup<NativeFunction<CSessionRemoveLayer>>("session_remove_layer")
+    .asFunction();
+
+/// Mirrors `graphics_undo_info` in `graphics.hpp`.
+final class GraphicsUndoInfo extends Struct {
+  @Int32()
+  external int undoSteps;
+  @Int32()
+  external int redoSteps;
+  @Int64()
+  external int memoryBytes;
+  @Int64()
+  external int diskBytes;
+}
+
+/// State of the undo history of an [ImageSession].
+class UndoInfo {
+  final int undoSteps;
+  final int redoSteps;
+
+  /// Saved pixels held in memory and in the spill file.
+  final int memoryBytes;
+  final int diskBytes;
+
+  const UndoInfo._(
+      this.undoSteps, this.redoSteps, this.memoryBytes, this.diskBytes);
+
+  bool get canUndo => undoSteps > 0;
+  bool get canRedo => redoSteps > 0;
+}
+
+typedef DSessionSetUndoBudget = int Function(
+    Pointer<Void>, int, int, Pointer<Utf8>);
+typedef CSessionSetUndoBudget = Int32 Function(
+    Pointer<Void>, Int64, Int32, Pointer<Utf8>);
+
+final DSessionSetUndoBudget sessionSetUndoBudget = _dylib
+    .lookup<NativeFunction<CSessionSetUndoBudget>>("session_set_undo_budget")
+    .asFunction();
+
+typedef DSessionUndo = int Function(Pointer<Void>);
+typedef CSessionUndo = Int32 Function(Pointer<Void>);
+
+final DSessionUndo sessionUndo =
+    _dylib.lookup<NativeFunction<CSessionUndo>>("session_undo").asFunction();
+
+final DSessionUndo sessionRedo =
+    _dylib.lookup<NativeFunction<CSessionUndo>>("session_redo").asFunction();
+
+typedef DSessionGetUndoInfo = int Function(
+    Pointer<Void>, Pointer<GraphicsUndoInfo>);
+typedef CSessionGetUndoInfo = Int32 Function(
+    Pointer<Void>, Pointer<GraphicsUndoInfo>);
+
+final DSessionGetUndoInfo sessionGetUndoInfo = _dylib
+    .lookup<NativeFunction<CSessionGetUndoInfo>>("session_get_undo_info")
+    .asFunction();
+
+typedef DProcessImageCommands = int Function(
+    Pointer<Utf8>, Pointer<Uint8>, int);
+typedef CProcessImageCommands = Int32 Function(
+    Pointer<Utf8>, Pointer<Uint8>, Int32);
+
+final DProcessImageCommands processImageCommands = _dylib
+    .lookup<NativeFunction<CProcessImageCommands>>("process_image_commands")
+    .asFunction();
+
+typedef DProcessImageCommandsEncoded = int Function(
+    Pointer<Uint8>,
+    int,
+    Pointer<Utf8>,
+    Pointer<Uint8>,
+    int,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>);
+typedef CProcessImageCommandsEncoded = Int32 Function(
+    Pointer<Uint8>,
+    Int32,
+    Pointer<Utf8>,
+    Pointer<Uint8>,
+    Int32,
+    Pointer<Pointer<Uint8>>,
+    Pointer<Int32>);
+
+final DProcessImageCommandsEncoded processImageCommandsEncoded = _dylib
+    .lookup<NativeFunction<CProcessImageCommandsEncoded>>(
+        "process_image_commands_encoded")
+    .asFunction();
+
+typedef DSessionExecute = int Function(Pointer<Void>, Pointer<Uint8>, int);
+typedef CSessionExecute = Int32 Function(Pointer<Void>, Pointer<Uint8>, Int32);
+
+final DSessionExecute sessionExecute = _dylib
+    .lookup<NativeFunction<CSessionExecute>>("session_execute")
+    .asFunction();
+
+/// Applies [commands] to an encoded image held in memory with a single decode
+/// and a single encode.
+Uint8List processImageCommandsBytes(Uint8List encoded, CommandBuffer commands,
+    {String ext = '.jpg'}) {
+  final Uint8List bytes = commands.toBytes();
+  return using((Arena arena) {
+    final Pointer<Pointer<Uint8>> outData = arena<Pointer<Uint8>>();
+    final Pointer<Int32> outLength = arena<Int32>();
+    final int result = processImageCommandsEncoded(
+        _copyBytes(encoded, arena),
+        encoded.length,
+        ext.toNativeUtf8(allocator: arena),
+        _copyBytes(bytes, arena),
+        bytes.length,
+        outData,
+        outLength);
+    return _takeBuffer(result, outData, outLength);
+  });
+}
+
+/// Operation codes of a [CommandBuffer]. Mirrors `graphics_command_op` in
+/// `graphics.hpp`.
+abstract final class CommandOp {
+  static const int grayScale = 1;
+  static const int drawPolygon = 2;
+  static const int grayScalePolygon = 3;
+  static const int filterPolygon = 4;
+  static const int stroke = 5;
+}
+
+/// A batch of operations executed by a single native call.
+///
+/// The serialized form returned by [toBytes] is the native wire format (see
+/// `GRAPHICS_COMMAND_MAGIC` in `graphics.hpp`), so it can be logged, stored
+/// and replayed with [CommandBuffer.fromBytes].
+class CommandBuffer {
+  static const int magic = 0x31424347;
+
+  final List<_Command> _commands = <_Command>[];
+
+  CommandBuffer();
+
+  /// Parses a buffer produced by [toBytes].
+  factory CommandBuffer.fromBytes(Uint8List bytes) {
+    final ByteData data = ByteData.sublistView(bytes);
+    if (data.getUint32(0, Endian.little) != magic) {
+      throw const FormatException('Not a command buffer');
+    }
+    final CommandBuffer buffer = CommandBuffer();
+    final int count = data.getUint32(4, Endian.little);
+    int offset = 8;
+    for (int i = 0; i < count; i++) {
+      final int op = data.getUint16(offset, Endian.little);
+      final int numParams = data.getUint16(offset + 2, Endian.little);
+      final int numPoints = data.getUint32(offset + 4, Endian.little);
+      offset += 8;
+      final Float32List params = Float32List(numParams);
+      for (int p = 0; p < numParams; p++, offset += 4) {
+        params[p] = data.getFloat32(offset, Endian.little);
+      }
+      final Float32List points = Float32List(numPoints * 2);
+      for (int p = 0; p < numPoints * 2; p++, offset += 4) {
+        points[p] = data.getFloat32(offset, Endian.little);
+      }
+      buffer._add(op, params, points);
+    }
+    return buffer;
+  }
+
+  /// Number of commands in the batch.
+  int get length => _commands.length;
+
+  /// Converts the whole image to grayscale.
+  void grayScale() => _add(CommandOp.grayScale, Float32List(0), Float32List(0));
+
+  /// Draws the outline of the polygon [points] (interleaved x, y pairs in
+  /// image coordinates). [color] is given as blue, green, red.
+  ///
+  /// [simplify] drops the vertices that move the outline by at most that
+  /// many pixels before drawing; when omitted, the tolerance set with
+  /// [Simplification.tolerance] applies.
+  void drawPolygon(Float32List points,
+      {List<double> color = const <double>[0, 255, 0],
+      double thickness = 2,
+      double? simplify}) {
+    _add(
+        CommandOp.drawPolygon,
+        Float32List.fromList(_drawPolygonParams(color, thickness, simplify)),
+        points);
+  }
+
+  /// Converts the area inside the polygon [points] to grayscale, with
+  /// anti-aliased edges softened over [feather] pixels on either side.
+  /// [simplify] works as for [drawPolygon].
+  void grayScalePolygon(Float32List points,
+          {double feather = 0, double? simplify}) =>
+      _add(
+          CommandOp.grayScalePolygon,
+          Float32List.fromList(_grayScalePolygonParams(feather, simplify)),
+          points);
+
+  /// Runs [filter] on the area inside the polygon [points], blended in over
+  /// [feather] pixels on either side of the outline. [simplify] works as for
+  /// [drawPolygon].
+  void filterPolygon(Float32List points, RegionFilter filter,
+          {double feather = 0, double? simplify}) =>
+      _add(
+          CommandOp.filterPolygon,
+          Float32List.fromList(_filterPolygonParams(filter, feather, simplify)),
+          points);
+
+  /// Paints a stroke with [brush] along [points] (interleaved x, y pairs in
+  /// image coordinates), the same way a [Stroke] is painted.
+  void stroke(Float32List points, {Brush brush = const Brush()}) =>
+      _add(CommandOp.stroke, Float32List.fromList(brush._params), points);
+
+  void _add(int op, Float32List params, Float32List points) {
+    if (points.length.isOdd) {
+      throw ArgumentError.value(points, 'points', 'must hold x, y pairs');
+    }
+    _commands.add(_Command(op, params, points));
+  }
+
+  /// Serializes the batch to the native wire format.
+  Uint8List toBytes() {
+    int size = 8;
+    for (final _Command command in _commands) {
+      size += 8 + 4 * (command.params.length + command.points.length);
+    }
+
+    final ByteData data = ByteData(size);
+    data.setUint32(0, magic, Endian.little);
+    data.setUint32(4, _commands.length, Endian.little);
+    int offset = 8;
+    for (final _Command command in _commands) {
+      data.setUint16(offset, command.op, Endian.little);
+      data.setUint16(offset + 2, command.params.length, Endian.little);
+      data.setUint32(offset + 4, command.points.length ~/ 2, Endian.little);
+      offset += 8;
+      for (final double value in command.params) {
+        data.setFloat32(offset, value, Endian.little);
+        offset += 4;
+      }
+      for (final double value in command.points) {
+        data.setFloat32(offset, value, Endian.little);
+        offset += 4;
+      }
+    }
+    return data.buffer.asUint8List();
+  }
+}
+
+class _Command {
+  final int op;
+  final Float32List params;
+  final Float32List points;
+
+  const _Command(this.op, this.params, this.points);
+}
+
+typedef DInitDartApi = int Function(Pointer<Void>);
+typedef CInitDartApi = IntPtr Function(Pointer<Void>);
+
+final DInitDartApi initDartApi =
+    _dylib.lookup<NativeFunction<CInitDartApi>>("init_dart_api").asFunction();
+
+typedef DSubmitSessionCommands = int Function(
+    Pointer<Void>, Pointer<Uint8>, int, int);
+typedef CSubmitSessionCommands = Int64 Function(
+    Pointer<Void>, Pointer<Uint8>, Int32, Int64);
+
+final DSubmitSessionCommands submitSessionCommands = _dylib
+    .lookup<NativeFunction<CSubmitSessionCommands>>("submit_session_commands")
+    .asFunction();
+
+typedef DSubmitSessionExport = int Function(Pointer<Void>, Pointer<Utf8>, int);
+typedef CSubmitSessionExport = Int64 Function(
+    Pointer<Void>, Pointer<Utf8>, Int64);
+
+final DSubmitSessionExport submitSessionExport = _dylib
+    .lookup<NativeFunction<CSubmitSessionExport>>("submit_session_export")
+    .asFunction();
+
+typedef DSubmitSessionExportRgba = int Function(Pointer<Void>, int);
+typedef CSubmitSessionExportRgba = Int64 Function(Pointer<Void>, Int64);
+
+final DSubmitSessionExportRgba submitSessionExportRgba = _dylib
+    .lookup<NativeFunction<CSubmitSessionExportRgba>>(
+        "submit_session_export_rgba")
+    .asFunction();
+
+typedef DSubmitSessionSelection = int Function(
+    Pointer<Void>, Pointer<Void>, int, Pointer<Float>, int, int);
+typedef CSubmitSessionSelection = Int64 Function(
+    Pointer<Void>, Pointer<Void>, Int32, Pointer<Float>, Int32, Int64);
+
+final DSubmitSessionSelection submitSessionSelection = _dylib
+    .lookup<NativeFunction<CSubmitSessionSelection>>(
+        "submit_session_selection")
+    .asFunction();
+
+typedef DSubmitSessionExportWithOptions = int Function(
+    Pointer<Void>, Pointer<GraphicsEncodeOptions>, int);
+typedef CSubmitSessionExportWithOptions = Int64 Function(
+    Pointer<Void>, Pointer<GraphicsEncodeOptions>, Int64);
+
+final DSubmitSessionExportWithOptions submitSessionExportWithOptions = _dylib
+    .lookup<NativeFunction<CSubmitSessionExportWithOptions>>(
+        "submit_session_export_with_options")
+    .asFunction();
+
+typedef DSubmitImageCommands = int Function(
+    Pointer<Utf8>, Pointer<Uint8>, int, int);
+typedef CSubmitImageCommands = Int64 Function(
+    Pointer<Utf8>, Pointer<Uint8>, Int32, Int64);
+
+final DSubmitImageCommands submitImageCommands = _dylib
+    .lookup<NativeFunction<CSubmitImageCommands>>("submit_image_commands")
+    .asFunction();
+
+typedef DSubmitEncodedCommands = int Function(
+    Pointer<Uint8>, int, Pointer<Utf8>, Pointer<Uint8>, int, int);
+typedef CSubmitEncodedCommands = Int64 Function(
+    Pointer<Uint8>, Int32, Pointer<Utf8>, Pointer<Uint8>, Int32, Int64);
+
+final DSubmitEncodedCommands submitEncodedCommands = _dylib
+    .lookup<NativeFunction<CSubmitEncodedCommands>>("submit_encoded_commands")
+    .asFunction();
+
+/// Applies [commands] to the image file at [path] on a native worker thread,
+/// overwriting the file with the result.
+Future<void> processImageCommandsAsync(
+    String path, CommandBuffer commands) async {
+  final Uint8List bytes = commands.toBytes();
+  final _JobResult result = await _JobQueue.instance.submit((int port) =>
+      using((Arena arena) => submitImageCommands(
+          path.toNativeUtf8(allocator: arena),
+          _copyBytes(bytes, arena),
+          bytes.length,
+          port)));
+  result.check();
+}
+
+/// Applies [commands] to an encoded image held in memory on a native worker
+/// thread, with a single decode and a single encode.
+Future<Uint8List> processImageCommandsBytesAsync(
+    Uint8List encoded, CommandBuffer commands,
+    {String ext = '.jpg'}) async {
+  final Uint8List bytes = commands.toBytes();
+  final _JobResult result = await _JobQueue.instance.submit((int port) =>
+      using((Arena arena) => submitEncodedCommands(
+          _copyBytes(encoded, arena),
+          encoded.length,
+          ext.toNativeUtf8(allocator: arena),
+          _copyBytes(bytes, arena),
+          bytes.length,
+          port)));
+  return result.take();
+}
+
+/// The completion message of a native job.
+class _JobResult {
+  final int status;
+  final Pointer<Uint8> buffer;
+  final int length;
+
+  const _JobResult(this.status, this.buffer, this.length);
+
+  /// Throws if the job failed. [keepAlive] is only referenced so that whatever
+  /// the job worked on stays reachable until it has completed.
+  void check([Object? keepAlive]) {
+    if (status != 0) {
+      _release();
+      throw Exception('Image processing failed');
+    }
+  }
+
+  /// Copies the result buffer into Dart memory and releases it.
+  Uint8List take([Object? keepAlive]) {
+    check(keepAlive);
+    final Uint8List bytes = Uint8List.fromList(buffer.asTypedList(length));
+    _release();
+    return bytes;
+  }
+
+  /// Hands the result buffer over to Dart without copying it.
+  Uint8List takeExternal([Object? keepAlive]) {
+    check(keepAlive);
+    return _externalBuffer(buffer, length);
+  }
+
+  void _release() {
+    if (buffer != nullptr) {
+      freeBuffer(buffer);
+    }
+  }
+}
+
+/// Routes completion messages of native jobs to their futures.
+///
+/// The native worker pool posts `[job id, status, result address, result
+/// length]` to a single port with `Dart_PostCObject`, so any number of jobs can
+/// be in flight without spawning isolates.
+class _JobQueue {
+  static final _JobQueue instance = _JobQueue._();
+
+  final ReceivePort _port = ReceivePort();
+  final Map<int, Completer<_JobResult>> _pending =
+      <int, Completer<_JobResult>>{};
+
+  _JobQueue._() {
+    if (initDartApi(NativeApi.initializeApiDLData) != 0) {
+      throw UnsupportedError('The graphics library has no Dart API support');
+    }
+    _port.listen(_onMessage);
+  }
+
+  /// Queues a job through [submitNative], which receives the native port and
+  /// returns the job id.
+  Future<_JobResult> submit(int Function(int port) submitNative) {
+    final int jobId = submitNative(_port.sendPort.nativePort);
+    if (jobId < 0) {
+      return Future<_JobResult>.error(Exception('Could not queue the job'));
+    }
+    // Completion messages are delivered through the event loop, so the
+    // completer is always registered before the message is handled.
+    final Completer<_JobResult> completer = Completer<_JobResult>();
+    _pending[jobId] = completer;
+    return completer.future;
+  }
+
+  void _onMessage(dynamic message) {
+    final List<dynamic> values = message as List<dynamic>;
+    final Completer<_JobResult>? completer = _pending.remove(values[0] as int);
+    final _JobResult result = _JobResult(values[1] as int,
+        Pointer<Uint8>.fromAddress(values[2] as int), values[3] as int);
+    if (completer == null) {
+      result._release();
+      return;
+    }
+    completer.complete(result);
+  }
+}
+
+/// Mirrors `graphics_stage_stats` in `src/graphics.hpp`.
+final class GraphicsStageStats extends Struct {
+  @Uint64()
+  external int calls;
+  @Uint64()
+  external int totalNs;
+  @Uint64()
+  external int maxNs;
+  @Uint64()
+  external int lastNs;
+}
+
+/// Mirrors `graphics_stats` in `src/graphics.hpp`.
+final class GraphicsStatsStruct extends Struct {
+  @Array(8)
+  external Array<GraphicsStageStats> stages;
+  @Uint64()
+  external int operations;
+  @Uint64()
+  external int bytesDecoded;
+  @Uint64()
+  external int bytesEncoded;
+  @Uint64()
+  external int peakTemporaryBytes;
+  @Uint64()
+  external int lastTemporaryBytes;
+  @Uint64()
+  external int maskCacheHits;
+  @Uint64()
+  external int maskCacheMisses;
+  @Uint64()
+  external int simplifiedVerticesIn;
+  @Uint64()
+  external int simplifiedVerticesOut;
+  @Uint64()
+  external int compositedTiles;
+  @Uint64()
+  external int copiedTiles;
+  @Uint64()
+  external int parallelLoops;
+  @Uint64()
+  external int parallelWallNs;
+  @Uint64()
+  external int parallelBusyNs;
+  @Uint64()
+  external int peakRunningJobs;
+}
+
+typedef DGetStats = int Function(Pointer<GraphicsStatsStruct>);
+typedef CGetStats = Int32 Function(Pointer<GraphicsStatsStruct>);
+
+final DGetStats getStats =
+    _dylib.lookup<NativeFunction<CGetStats>>("get_stats").asFunction();
+
+typedef DResetStats = void Function();
+typedef CResetStats = Void Function();
+
+final DResetStats resetStats =
+    _dylib.lookup<NativeFunction<CResetStats>>("reset_stats").asFunction();
+
+/// Native pipeline stages, in the order of `graphics_stage`.
+enum Stage { decode, mask, convert, blend, draw, encode, filter, composite }
+
+/// Timings of one [Stage] since the last [Stats.reset].
+class StageStats {
+  final int calls;
+  final Duration total;
+  final Duration max;
+  final Duration last;
+
+  const StageStats(this.calls, this.total, this.max, this.last);
+
+  Duration get average =>
+      calls == 0 ? Duration.zero : Duration(microseconds: total.inMicroseconds ~/ calls);
+
+  Map<String, Object> toJson() => <String, Object>{
+        'calls': calls,
+        'total_us': total.inMicroseconds,
+        'max_us': max.inMicroseconds,
+        'last_us': last.inMicroseconds,
+      };
+}
+
+/// Snapshot of the process wide counters kept by the native library.
+///
+/// Every native call records its decode, mask, conversion, blend, draw and
+/// encode stages, whichever thread or API it came through.
+class Stats {
+  final Map<Stage, StageStats> stages;
+  final int operations;
+  final int bytesDecoded;
+  final int bytesEncoded;
+  final int peakTemporaryBytes;
+  final int lastTemporaryBytes;
+
+  /// Polygon masks reused from, and rasterized for, the mask cache.
+  final int maskCacheHits;
+  final int maskCacheMisses;
+
+  /// Polygon vertices passed through [Simplification], and those it kept.
+  final int simplifiedVerticesIn;
+  final int simplifiedVerticesOut;
+
+  /// Layer stack tiles composited again after a change.
+  final int compositedTiles;
+
+  /// Tiles of tiled sessions copied by their first write while shared.
+  final int copiedTiles;
+
+  /// Parallel loops run by native operations, their wall time, and the time
+  /// their threads spent in them.
+  final int parallelLoops;
+  final Duration parallelWall;
+  final Duration parallelBusy;
+
+  /// Most asynchronous jobs seen running at once.
+  final int peakRunningJobs;
+
+  const Stats._(
+      this.stages,
+      this.operations,
+      this.bytesDecoded,
+      this.bytesEncoded,
+      this.peakTemporaryBytes,
+      this.lastTemporaryBytes,
+      this.maskCacheHits,
+      this.maskCacheMisses,
+      this.simplifiedVerticesIn,
+      this.simplifiedVerticesOut,
+      this.compositedTiles,
+      this.copiedTiles,
+      this.parallelLoops,
+      this.parallelWall,
+      this.parallelBusy,
+      this.peakRunningJobs);
+
+  /// Threads kept busy on average by the parallel loops, at most the
+  /// `jobThreads` of the [ThreadPolicy].
+  double get parallelism => parallelWall == Duration.zero
+      ? 0
+      : parallelBusy.inMicroseconds / parallelWall.inMicroseconds;
+
+  static Stats read() {
+    return using((Arena arena) {
+      final Pointer<GraphicsStatsStruct> native = arena<GraphicsStatsStruct>();
+      if (getStats(native) != 0) {
+        throw Exception('Could not read the native stats');
+      }
+      final GraphicsStatsStruct stats = native.ref;
+      final Map<Stage, StageStats> stages = <Stage, StageStats>{
+        for (final Stage stage in Stage.values)
+          stage: StageStats(
+            stats.stages[stage.index].calls,
+            _duration(stats.stages[stage.index].totalNs),
+            _duration(stats.stages[stage.index].maxNs),
+            _duration(stats.stages[stage.index].lastNs),
+          ),
+      };
+      return Stats._(stages, stats.operations, stats.bytesDecoded,
+          stats.bytesEncoded, stats.peakTemporaryBytes, stats.lastTemporaryBytes,
+          stats.maskCacheHits, stats.maskCacheMisses,
+          stats.simplifiedVerticesIn, stats.simplifiedVerticesOut,
+          stats.compositedTiles, stats.copiedTiles, stats.parallelLoops,
+          _duration(stats.parallelWallNs), _duration(stats.parallelBusyNs),
+          stats.peakRunningJobs);
+    });
+  }
+
+  /// Clears the native counters.
+  static void reset() => resetStats();
+
+  Map<String, Object> toJson() => <String, Object>{
+        'stages': <String, Object>{
+          for (final MapEntry<Stage, StageStats> entry in stages.entries)
+            entry.key.name: entry.value.toJson(),
+        },
+        'operations': operations,
+        'bytes_decoded': bytesDecoded,
+        'bytes_encoded': bytesEncoded,
+        'peak_temporary_bytes': peakTemporaryBytes,
+        'last_temporary_bytes': lastTemporaryBytes,
+        'mask_cache_hits': maskCacheHits,
+        'mask_cache_misses': maskCacheMisses,
+        'simplified_vertices_in': simplifiedVerticesIn,
+        'simplified_vertices_out': simplifiedVerticesOut,
+        'composited_tiles': compositedTiles,
+        'copied_tiles': copiedTiles,
+        'parallel_loops': parallelLoops,
+        'parallel_wall_us': parallelWall.inMicroseconds,
+        'parallel_busy_us': parallelBusy.inMicroseconds,
+        'parallelism': parallelism,
+        'peak_running_jobs': peakRunningJobs,
+      };
+
+  static Duration _duration(int nanoseconds) =>
+      Duration(microseconds: nanoseconds ~/ 1000);
+}
+
+/// Mirrors `graphics_buffer_pool_stats` in `src/graphics.hpp`.
+final class GraphicsBufferPoolStats extends Struct {
+  @Uint64()
+  external int hits;
+  @Uint64()
+  external int misses;
+  @Uint64()
+  external int bytesRetained;
+  @Uint64()
+  external int buffersRetained;
+  @Uint64()
+  external int bytesLimit;
+  @Uint64()
+  external int bytesInUse;
+  @Uint64()
+  external int bytesReleased;
+}
+
+typedef DSetBufferPoolLimit = void Function(int);
+typedef CSetBufferPoolLimit = Void Function(Int64);
+
+final DSetBufferPoolLimit setBufferPoolLimit = _dylib
+    .lookup<NativeFunction<CSetBufferPoolLimit>>("set_buffer_pool_limit")
+    .asFunction();
+
+typedef DTrimBufferPool = int Function(int);
+typedef CTrimBufferPool = Int64 Function(Int64);
+
+final DTrimBufferPool trimBufferPool = _dylib
+    .lookup<NativeFunction<CTrimBufferPool>>("trim_buffer_pool")
+    .asFunction();
+
+typedef DGetBufferPoolStats = int Function(Pointer<GraphicsBufferPoolStats>);
+typedef CGetBufferPoolStats = Int32 Function(Pointer<GraphicsBufferPoolStats>);
+
+final DGetBufferPoolStats getBufferPoolStats = _dylib
+    .lookup<NativeFunction<CGetBufferPoolStats>>("get_buffer_pool_stats")
+    .asFunction();
+
+/// The native pool the pixel buffers of decoded images and edit temporaries
+/// come from.
+///
+/// Released buffers stay in the pool for the next image of a similar size,
+/// up to [limit] idle bytes. Call [trim] when the app gets a memory warning.
+abstract final class BufferPool {
+  /// Sets the most idle bytes the pool keeps; 0 disables reuse.
+  static set limit(int bytes) => setBufferPoolLimit(bytes);
+
+  /// Frees idle buffers until at most [keepBytes] remain. Returns the number
+  /// of bytes freed.
+  static int trim([int keepBytes = 0]) => trimBufferPool(keepBytes);
+
+  static BufferPoolStats stats() {
+    return using((Arena arena) {
+      final Pointer<GraphicsBufferPoolStats> native =
+          arena<GraphicsBufferPoolStats>();
+      if (getBufferPoolStats(native) != 0) {
+        throw Exception('Could not read the buffer pool stats');
+      }
+      final GraphicsBufferPoolStats stats = native.ref;
+      return BufferPoolStats._(
+          stats.hits,
+          stats.misses,
+          stats.bytesRetained,
+          stats.buffersRetained,
+          stats.bytesLimit,
+          stats.bytesInUse,
+          stats.bytesReleased);
+    });
+  }
+}
+
+/// Snapshot of the [BufferPool] counters.
+class BufferPoolStats {
+  final int hits;
+  final int misses;
+  final int bytesRetained;
+  final int buffersRetained;
+  final int bytesLimit;
+  final int bytesInUse;
+  final int bytesReleased;
+
+  const BufferPoolStats._(this.hits, this.misses, this.bytesRetained,
+      this.buffersRetained, this.bytesLimit, this.bytesInUse, this.bytesReleased);
+
+  /// Share of pooled allocations served without the system allocator.
+  double get hitRate => hits + misses == 0 ? 0 : hits / (hits + misses);
+
+  Map<String, Object> toJson() => <String, Object>{
+        'hits': hits,
+        'misses': misses,
+        'hit_rate': hitRate,
+        'bytes_retained': bytesRetained,
+        'buffers_retained': buffersRetained,
+        'bytes_limit': bytesLimit,
+        'bytes_in_use': bytesInUse,
+        'bytes_released': bytesReleased,
+      };
+}
+
+/// Mirrors `graphics_thread_policy` in `src/graphics.hpp`.
+final class GraphicsThreadPolicy extends Struct {
+  @Int32()
+  external int totalThreads;
+  @Int32()
+  external int jobThreads;
+  @Int32()
+  external int affinity;
+  @Uint64()
+  external int cpuMask;
+}
+
+typedef DSetThreadPolicy = int Function(Pointer<GraphicsThreadPolicy>);
+typedef CSetThreadPolicy = Int32 Function(Pointer<GraphicsThreadPolicy>);
+
+final DSetThreadPolicy setThreadPolicy = _dylib
+    .lookup<NativeFunction<CSetThreadPolicy>>("set_thread_policy")
+    .asFunction();
+
+typedef DGetThreadPolicy = int Function(Pointer<GraphicsThreadPolicy>);
+typedef CGetThreadPolicy = Int32 Function(Pointer<GraphicsThreadPolicy>);
+
+final DGetThreadPolicy getThreadPolicy = _dylib
+    .lookup<NativeFunction<CGetThreadPolicy>>("get_thread_policy")
+    .asFunction();
+
+/// Where native threads may run, in the order of `graphics_affinity`.
+enum Affinity {
+  /// Wherever the scheduler puts them.
+  any,
+
+  /// Off the slowest cores of a big.LITTLE CPU.
+  fastCores,
+
+  /// On the CPUs of [ThreadPolicy.cpuMask].
+  mask,
+}
+
+/// How native work is spread over threads.
+///
+/// Without a policy every operation may use all cores, so a few jobs running
+/// at once oversubscribe them. Under one, each operation uses at most
+/// [jobThreads] threads and `totalThreads ~/ jobThreads` asynchronous jobs
+/// run at once. Affinity only applies on Android and Linux.
+class ThreadPolicy {
+  /// Threads native work keeps busy at once, 0 for one per allowed core.
+  final int totalThreads;
+
+  /// Threads one operation keeps busy, 0 for [totalThreads].
+  final int jobThreads;
+
+  final Affinity affinity;
+
+  /// Bit n allows CPU n, for [Affinity.mask]. In the policy [current]
+  /// returns, the CPUs threads were moved to, or 0.
+  final int cpuMask;
+
+  const ThreadPolicy(
+      {this.totalThreads = 0,
+      this.jobThreads = 0,
+      this.affinity = Affinity.any,
+      this.cpuMask = 0});
+
+  /// Puts this policy in force; throws [ArgumentError] for negative counts
+  /// or a mask without an allowed CPU.
+  void apply() {
+    using((Arena arena) {
+      final Pointer<GraphicsThreadPolicy> native = arena<GraphicsThreadPolicy>();
+      native.ref
+        ..totalThreads = totalThreads
+        ..jobThreads = jobThreads
+        ..affinity = affinity.index
+        ..cpuMask = cpuMask;
+      if (setThreadPolicy(native) != 0) {
+        throw ArgumentError('Invalid thread policy $this');
+      }
+    });
+  }
+
+  /// The policy in force, with its zeros resolved.
+  static ThreadPolicy current() {
+    return using((Arena arena) {
+      final Pointer<GraphicsThreadPolicy> native = arena<GraphicsThreadPolicy>();
+      if (getThreadPolicy(native) != 0) {
+        throw Exception('Could not read the thread policy');
+      }
+      final GraphicsThreadPolicy policy = native.ref;
+      return ThreadPolicy(
+          totalThreads: policy.totalThreads,
+          jobThreads: policy.jobThreads,
+          affinity: Affinity.values[policy.affinity],
+          cpuMask: policy.cpuMask);
+    });
+  }
+
+  Map<String, Object> toJson() => <String, Object>{
+        'total_threads': totalThreads,
+        'job_threads': jobThreads,
+        'affinity': affinity.name,
+        'cpu_mask': cpuMask,
+      };
+
+  @override
+  String toString() => toJson().toString();
+}
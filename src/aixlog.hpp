@@ -36,8 +36,11 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <ctime>
 #include <fstream>
@@ -85,7 +88,25 @@
 #define AIXLOG_INTERNAL__FUNC __func__
 #endif
 
+/// Compile time severity threshold
+// LOG statements below AIXLOG_MIN_SEVERITY (a SEVERITY value, or
+// AIXLOG_SEVERITY_OFF to drop every statement) compile to nothing: the stream,
+// the lock and all streamed arguments are eliminated, the statement is only
+// type checked. Statements at or above it are still subject to the sinks'
+// runtime filters.
+#define AIXLOG_SEVERITY_OFF 7
+#ifndef AIXLOG_MIN_SEVERITY
+#define AIXLOG_MIN_SEVERITY 0
+#endif
+
 /// Internal helper macros (exposed, but shouldn't be used directly)
+#define AIXLOG_INTERNAL__FIRST_ARG(FIRST_, ...) FIRST_
+// Written as "if (!enabled) ; else stream", so a constant false condition
+// removes the whole statement and a trailing "else" still binds correctly.
+#define AIXLOG_INTERNAL__IF_ENABLED(...) \
+    if (!(static_cast<int>(AIXLOG_INTERNAL__FIRST_ARG(__VA_ARGS__, )) >= AIXLOG_MIN_SEVERITY)) \
+        ;                                                                                    \
+    else
 #define AIXLOG_INTERNAL__LOG_SEVERITY(SEVERITY_) std::clog << static_cast<AixLog::Severity>(SEVERITY_) << TAG()
 #define AIXLOG_INTERNAL__LOG_SEVERITY_TAG(SEVERITY_, TAG_) std::clog << static_cast<AixLog::Severity>(SEVERITY_) << TAG(TAG_)
 
@@ -101,7 +122,7 @@
 // usage: LOG(SEVERITY) or LOG(SEVERITY, TAG)
 // e.g.: LOG(NOTICE) or LOG(NOTICE, "my tag")
 #ifndef WIN32
-#define LOG(...) AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << TIMESTAMP << FUNC
+#define LOG(...) AIXLOG_INTERNAL__IF_ENABLED(__VA_ARGS__) AIXLOG_INTERNAL__LOG_MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << TIMESTAMP << FUNC
 #endif
 
 // usage: COLOR(TEXT_COLOR, BACKGROUND_COLOR) or COLOR(TEXT_COLOR)
@@ -126,7 +147,7 @@
 #define FUNC_RECOMPOSER(argsWithParentheses) FUNC_CHOOSER argsWithParentheses
 #define CHOOSE_FROM_ARG_COUNT(...) FUNC_RECOMPOSER((__VA_ARGS__, LOG_2, LOG_1, FUNC_, ...))
 #define MACRO_CHOOSER(...) CHOOSE_FROM_ARG_COUNT(__VA_ARGS__())
-#define LOG(...) MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << TIMESTAMP << FUNC
+#define LOG(...) AIXLOG_INTERNAL__IF_ENABLED(__VA_ARGS__) MACRO_CHOOSER(__VA_ARGS__)(__VA_ARGS__) << TIMESTAMP << FUNC
 #endif
 
 /**
@@ -540,6 +561,229 @@ struct Sink
     Filter filter;
 };
 
+/**
+ * @brief
+ * Bounded lock-free multi producer, single consumer queue
+ *
+ * Every slot carries a sequence number that tells producers whether it is
+ * free and the consumer whether it is filled, so pushes never block and never
+ * wait for the consumer. A full queue rejects the push instead of growing.
+ */
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity) : mask_(round_up(capacity) - 1), slots_(new Slot[mask_ + 1])
+    {
+        for (size_t n = 0; n <= mask_; ++n)
+            slots_[n].sequence.store(n, std::memory_order_relaxed);
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    /// Safe to call from any thread, returns false if the queue is full
+    bool try_push(T&& value)
+    {
+        Slot* slot;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot = &slots_[pos & mask_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer thread only
+    bool try_pop(T& value)
+    {
+        Slot& slot = slots_[head_ & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != head_ + 1)
+            return false;
+        value = std::move(slot.value);
+        slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+        return true;
+    }
+
+    /// Consumer thread only, whether try_pop would find nothing
+    bool empty() const
+    {
+        return slots_[head_ & mask_].sequence.load(std::memory_order_acquire) != head_ + 1;
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence{0};
+        T value;
+    };
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) size_t head_ = 0;
+};
+
+/**
+ * @brief
+ * Asynchronous log sink
+ *
+ * Queues log lines in a lock-free ring buffer and forwards them to the wrapped
+ * sinks from a background thread, so the logging thread never waits for I/O.
+ * If the ring is full the line is dropped and counted, the next drained batch
+ * reports how many lines were lost.
+ * Use it through "Log::init_async", which also bypasses the Log mutex.
+ */
+struct SinkAsync : public Sink
+{
+    SinkAsync(const Filter& filter, const std::vector<std::shared_ptr<Sink>>& log_sinks, size_t capacity = 4096)
+        : Sink(filter), log_sinks_(log_sinks), ring_(capacity)
+    {
+        worker_ = std::thread(&SinkAsync::run, this);
+    }
+
+    ~SinkAsync() override
+    {
+        stop();
+    }
+
+    void log(const Metadata& metadata, const std::string& message) override
+    {
+        push(Metadata(metadata), std::string(message));
+    }
+
+    /// Queues a line without blocking, drops it if the ring is full
+    void push(Metadata&& metadata, std::string&& message)
+    {
+        if (!running_.load(std::memory_order_relaxed) || !ring_.try_push(Entry{std::move(metadata), std::move(message)}))
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // Pairs with the worker setting idle_ before it looks at the ring:
+        // either it sees the line or this sees it idle.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed))
+            wake_.notify_one();
+    }
+
+    /// Lines lost because the ring was full or the sink was stopped
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    /// Drains the queued lines and joins the background thread
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            if (!running_.exchange(false))
+                return;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+
+private:
+    struct Entry
+    {
+        Metadata metadata;
+        std::string message;
+    };
+
+    void run()
+    {
+        while (running_.load())
+        {
+            if (drain())
+                continue;
+            // Producers only notify while the worker is idle and never take
+            // the mutex, the timeout bounds the latency of a wakeup sent
+            // between the check of the ring and the wait.
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            idle_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake_.wait_for(lock, std::chrono::milliseconds(20), [this] { return !running_.load() || !ring_.empty(); });
+            idle_.store(false, std::memory_order_relaxed);
+        }
+        drain();
+    }
+
+    bool drain()
+    {
+        bool drained = false;
+        Entry entry;
+        while (ring_.try_pop(entry))
+        {
+            forward(entry.metadata, entry.message);
+            drained = true;
+        }
+
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_)
+        {
+            Metadata metadata;
+            metadata.severity = Severity::warning;
+            metadata.tag = "aixlog";
+            metadata.timestamp = std::chrono::system_clock::now();
+            forward(metadata, "dropped " + std::to_string(dropped - reported_) + " log lines, the async queue was full");
+            reported_ = dropped;
+        }
+        return drained;
+    }
+
+    void forward(const Metadata& metadata, const std::string& message)
+    {
+        for (const auto& sink : log_sinks_)
+        {
+            if (sink->filter.match(metadata))
+                sink->log(metadata, message);
+        }
+    }
+
+    std::vector<std::shared_ptr<Sink>> log_sinks_;
+    MpscRing<Entry> ring_;
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reported_ = 0;
+    std::atomic<bool> running_{true};
+    std::atomic<bool> idle_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::thread worker_;
+};
+
 /// ostream operators << for the meta data structs
 static std::ostream& operator<<(std::ostream& os, const Severity& log_severity);
 static std::ostream& operator<<(std::ostream& os, const Timestamp& timestamp);
@@ -571,12 +815,25 @@ public:
     /// Without "init" every LOG(X) will simply go to clog
     static void init(const std::vector<log_sink_ptr> log_sinks = {})
     {
+        Log::instance().set_async_sink(nullptr);
         Log::instance().log_sinks_.clear();
 
         for (const auto& sink : log_sinks)
             Log::instance().add_logsink(sink);
     }
 
+    /// Like "init", but log lines are queued without locking and written to
+    /// log_sinks by a background thread. Lines that do not fit into the
+    /// queue of "capacity" entries are dropped and counted.
+    static std::shared_ptr<SinkAsync> init_async(const std::vector<log_sink_ptr>& log_sinks, const Filter& filter = Filter(),
+                                                 size_t capacity = 4096)
+    {
+        auto sink = std::make_shared<SinkAsync>(filter, log_sinks, capacity);
+        init({sink});
+        Log::instance().set_async_sink(sink);
+        return sink;
+    }
+
     template <typename T, typename... Ts>
     static std::shared_ptr<T> init(Ts&&... params)
     {
@@ -608,7 +865,7 @@ public:
     }
 
 protected:
-    Log() noexcept : last_buffer_(nullptr), do_log_(true)
+    Log() noexcept
     {
         std::clog.rdbuf(this);
         std::clog << Severity() << Tag() << Function() << Conditional() << AixLog::Color::NONE << std::flush;
@@ -621,19 +878,31 @@ protected:
 
     int sync() override
     {
-        std::lock_guard<std::recursive_mutex> lock(mutex_);
-        if (!get_stream().str().empty())
+        LineState& state = line_state();
+        if (!state.line.empty())
         {
-            if (do_log_)
+            if (state.do_log)
             {
-                for (const auto& sink : log_sinks_)
+                SinkAsync* async_sink = async_sink_.load(std::memory_order_acquire);
+                if (async_sink != nullptr)
+                {
+                    // A LOG statement with std::endl in the middle syncs
+                    // once per line with the same meta data, so it is
+                    // copied; the line is cleared below anyway.
+                    if (async_sink->filter.match(state.metadata))
+                        async_sink->push(Metadata(state.metadata), std::move(state.line));
+                }
+                else
                 {
-                    if (sink->filter.match(metadata_))
-                        sink->log(metadata_, get_stream().str());
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    for (const auto& sink : log_sinks_)
+                    {
+                        if (sink->filter.match(state.metadata))
+                            sink->log(state.metadata, state.line);
+                    }
                 }
             }
-            get_stream().str("");
-            get_stream().clear();
+            state.line.clear();
         }
 
         return 0;
@@ -641,13 +910,12 @@ protected:
 
     int overflow(int c) override
     {
-        std::lock_guard<std::recursive_mutex> lock(mutex_);
         if (c != EOF)
         {
             if (c == '\n')
                 sync();
-            else if (do_log_)
-                get_stream() << static_cast<char>(c);
+            else if (line_state().do_log)
+                line_state().line.push_back(static_cast<char>(c));
         }
         else
         {
@@ -656,6 +924,23 @@ protected:
         return c;
     }
 
+    std::streamsize xsputn(const char* s, std::streamsize count) override
+    {
+        LineState& state = line_state();
+        const char* end = s + count;
+        while (s != end)
+        {
+            const char* newline = std::find(s, end, '\n');
+            if (state.do_log)
+                state.line.append(s, newline);
+            if (newline == end)
+                break;
+            sync();
+            s = newline + 1;
+        }
+        return count;
+    }
+
 private:
     friend std::ostream& operator<<(std::ostream& os, const Severity& log_severity);
     friend std::ostream& operator<<(std::ostream& os, const Timestamp& timestamp);
@@ -663,27 +948,40 @@ private:
     friend std::ostream& operator<<(std::ostream& os, const Function& function);
     friend std::ostream& operator<<(std::ostream& os, const Conditional& conditional);
 
-    std::stringstream& get_stream()
+    /// The line being written by the calling thread and its meta data
+    struct LineState
     {
-        auto id = std::this_thread::get_id();
-        if ((last_buffer_ == nullptr) || (last_id_ != id))
+        Metadata metadata;
+        bool do_log = true;
+        std::string line;
+    };
+
+    /// one state per thread to avoid mixed log lines without locking
+    static LineState& line_state()
+    {
+        static thread_local LineState state;
+        return state;
+    }
+
+    void set_async_sink(const std::shared_ptr<SinkAsync>& sink)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        if (async_sink_owner_ != nullptr)
         {
-            last_id_ = id;
-            last_buffer_ = &(buffer_[id]);
+            // Other threads may still hold the raw pointer, so a replaced sink
+            // is stopped (lines pushed later are dropped) but kept alive.
+            async_sink_owner_->stop();
+            retired_async_sinks_.push_back(async_sink_owner_);
         }
-        return *last_buffer_;
+        async_sink_owner_ = sink;
+        async_sink_.store(sink.get(), std::memory_order_release);
     }
 
-    /// one buffer per thread to avoid mixed log lines
-    std::map<std::thread::id, std::stringstream> buffer_;
-    /// the last thread id
-    std::thread::id last_id_;
-    /// the last buffer
-    std::stringstream* last_buffer_ = nullptr;
-    Metadata metadata_;
-    bool do_log_;
     std::vector<log_sink_ptr> log_sinks_;
     std::recursive_mutex mutex_;
+    std::atomic<SinkAsync*> async_sink_{nullptr};
+    std::shared_ptr<SinkAsync> async_sink_owner_;
+    std::vector<std::shared_ptr<SinkAsync>> retired_async_sinks_;
 };
 
 /**
@@ -1145,15 +1443,15 @@ static std::ostream& operator<<(std::ostream& os, const Severity& log_severity)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        if (log->metadata_.severity != log_severity)
+        Log::LineState& state = Log::line_state();
+        if (state.metadata.severity != log_severity)
         {
             log->sync();
-            log->metadata_.severity = log_severity;
-            log->metadata_.timestamp = nullptr;
-            log->metadata_.tag = nullptr;
-            log->metadata_.function = nullptr;
-            log->do_log_ = true;
+            state.metadata.severity = log_severity;
+            state.metadata.timestamp = nullptr;
+            state.metadata.tag = nullptr;
+            state.metadata.function = nullptr;
+            state.do_log = true;
         }
     }
     else
@@ -1168,8 +1466,7 @@ static std::ostream& operator<<(std::ostream& os, const Timestamp& timestamp)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.timestamp = timestamp;
+        Log::line_state().metadata.timestamp = timestamp;
     }
     else if (timestamp)
     {
@@ -1183,8 +1480,7 @@ static std::ostream& operator<<(std::ostream& os, const Tag& tag)
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.tag = tag;
+        Log::line_state().metadata.tag = tag;
     }
     else if (tag)
     {
@@ -1197,9 +1493,8 @@ static std::ostream& operator<<(std::ostream& os, const Function& function)
 {
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
-      {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->metadata_.function = function;
+    {
+        Log::line_state().metadata.function = function;
     }
     else if (function)
     {
@@ -1213,8 +1508,7 @@ static std::ostream& operator<<(std::ostream& os, const Conditional& conditional
     Log* log = dynamic_cast<Log*>(os.rdbuf());
     if (log != nullptr)
     {
-        std::lock_guard<std::recursive_mutex> lock(log->mutex_);
-        log->do_log_ = conditional.is_true();
+        Log::line_state().do_log = conditional.is_true();
     }
     return os;
 }
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aixlog.hpp"
+#include "graphics.hpp"
+#include "image_session.hpp"
+#include "selection.hpp"
+#include "stroke.hpp"
+#include "worker_pool.hpp"
+
+#if GRAPHICS_HAS_DART_API_DL
+#include "dart_api_dl.h"
+#endif
+
+namespace
+{
+  std::atomic<bool> dart_api_ready{false};
+  std::atomic<int64_t> next_job_id{1};
+
+  // Posts [job_id, status, result address, result length] to port. A result
+  // buffer Dart can no longer receive is released here.
+  void post_result(int64_t port, int64_t job_id, int status, uint8_t *result, int32_t result_length)
+  {
+#if GRAPHICS_HAS_DART_API_DL
+    Dart_CObject values[4];
+    values[0].type = Dart_CObject_kInt64;
+    values[0].value.as_int64 = job_id;
+    values[1].type = Dart_CObject_kInt64;
+    values[1].value.as_int64 = status;
+    values[2].type = Dart_CObject_kInt64;
+    values[2].value.as_int64 = static_cast<int64_t>(reinterpret_cast<intptr_t>(result));
+    values[3].type = Dart_CObject_kInt64;
+    values[3].value.as_int64 = result_length;
+
+    Dart_CObject *items[4] = {&values[0], &values[1], &values[2], &values[3]};
+    Dart_CObject message;
+    message.type = Dart_CObject_kArray;
+    message.value.as_array.length = 4;
+    message.value.as_array.values = items;
+
+    if (Dart_PostCObject_DL(port, &message))
+    {
+      return;
+    }
+    LOG(WARNING) << "Could not post the result of job " << job_id << std::endl;
+#else
+    (void)port;
+    (void)job_id;
+    (void)status;
+    (void)result_length;
+#endif
+    free(result);
+  }
+
+  // Queues job on the worker pool and reports its outcome to port.
+  int64_t submit(int64_t port, std::function<int(uint8_t **, int32_t *)> job)
+  {
+    if (!dart_api_ready.load(std::memory_order_acquire))
+    {
+      LOG(ERROR) << "init_dart_api() must be called before submitting jobs" << std::endl;
+      return -1;
+    }
+
+    int64_t job_id = next_job_id.fetch_add(1, std::memory_order_relaxed);
+    graphics::worker_pool().submit([port, job_id, job]()
+                                   {
+                                     uint8_t *result = nullptr;
+                                     int32_t result_length = 0;
+                                     int status = 1;
+                                     // An exception escaping a worker thread
+                                     // would terminate the app.
+                                     try
+                                     {
+                                       status = job(&result, &result_length);
+                                     }
+                                     catch (const std::exception &e)
+                                     {
+                                       LOG(ERROR) << "Job " << job_id << " failed: " << e.what() << std::endl;
+                                     }
+                                     catch (...)
+                                     {
+                                       LOG(ERROR) << "Job " << job_id << " failed" << std::endl;
+                                     }
+                                     if (status != 0 && result != nullptr)
+                                     {
+                                       free(result);
+                                       result = nullptr;
+                                       result_length = 0;
+                                     }
+                                     post_result(port, job_id, status, result, result_length);
+                                   });
+    return job_id;
+  }
+
+  // References held by a queued job on the objects it uses. Each is
+  // released with the last copy of the job, whether it ran, threw or was
+  // never queued.
+  std::shared_ptr<graphics_session> hold(graphics_session *session)
+  {
+    graphics::retain_session(session);
+    return std::shared_ptr<graphics_session>(session, graphics::release_session);
+  }
+
+  std::shared_ptr<graphics_selection> hold(graphics_selection *selection)
+  {
+    graphics::retain_selection(selection);
+    return std::shared_ptr<graphics_selection>(selection, graphics::release_selection);
+  }
+
+  std::shared_ptr<graphics_stroke> hold(graphics_stroke *stroke)
+  {
+    graphics::retain_stroke(stroke);
+    return std::shared_ptr<graphics_stroke>(stroke, graphics::release_stroke);
+  }
+
+  std::shared_ptr<std::vector<uint8_t>> copy_bytes(const uint8_t *data, int32_t length)
+  {
+    if (data == nullptr || length <= 0)
+    {
+      return std::make_shared<std::vector<uint8_t>>();
+    }
+    return std::make_shared<std::vector<uint8_t>>(data, data + length);
+  }
+
+  int32_t size_of(const std::vector<uint8_t> &bytes)
+  {
+    return static_cast<int32_t>(bytes.size());
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT intptr_t init_dart_api(void *data)
+  try
+  {
+#if GRAPHICS_HAS_DART_API_DL
+    intptr_t result = Dart_InitializeApiDL(data);
+    dart_api_ready.store(result == 0, std::memory_order_release);
+    return result;
+#else
+    (void)data;
+    LOG(ERROR) << "The graphics library was built without the Dart API" << std::endl;
+    return -1;
+#endif
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_commands(graphics_session *session, const uint8_t *commands,
+                                                    int32_t length, int64_t port)
+  try
+  {
+    if (session == nullptr)
+    {
+      return -1;
+    }
+
+    auto command_bytes = copy_bytes(commands, length);
+    auto held = hold(session);
+    return submit(port, [held, command_bytes](uint8_t **, int32_t *)
+                  { return session_execute(held.get(), command_bytes->data(), size_of(*command_bytes)); });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_export(graphics_session *session, const char *ext, int64_t port)
+  try
+  {
+    if (session == nullptr)
+    {
+      return -1;
+    }
+
+    std::string extension = ext != nullptr ? ext : ".jpg";
+    auto held = hold(session);
+    return submit(port, [held, extension](uint8_t **out_data, int32_t *out_length)
+                  { return export_image_encoded(held.get(), extension.c_str(), out_data, out_length); });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_export_with_options(graphics_session *session,
+                                                               const graphics_encode_options *options,
+                                                               int64_t port)
+  try
+  {
+    if (session == nullptr)
+    {
+      return -1;
+    }
+
+    // The options are copied, the caller may release them once this returns.
+    bool has_options = options != nullptr;
+    graphics_encode_options settings = has_options ? *options : graphics_encode_options();
+    auto held = hold(session);
+    return submit(port, [held, has_options, settings](uint8_t **out_data, int32_t *out_length)
+                  {
+                    return export_image_encoded_with_options(held.get(), has_options ? &settings : nullptr, out_data,
+                                                             out_length);
+                  });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_export_rgba(graphics_session *session, int64_t port)
+  try
+  {
+    if (session == nullptr)
+    {
+      return -1;
+    }
+
+    auto held = hold(session);
+    return submit(port, [held](uint8_t **out_data, int32_t *out_length)
+                  {
+                    int32_t width = 0;
+                    int32_t height = 0;
+                    int status = export_image_rgba(held.get(), out_data, &width, &height);
+                    // A result the int32 length cannot describe is a failure,
+                    // whose buffer submit() frees.
+                    const int64_t length = static_cast<int64_t>(width) * height * 4;
+                    if (status == 0 && length > INT32_MAX)
+                    {
+                      LOG(ERROR) << "RGBA export of " << width << "x" << height << " is too large" << std::endl;
+                      return 1;
+                    }
+                    *out_length = static_cast<int32_t>(length);
+                    return status;
+                  });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_selection(graphics_session *session, graphics_selection *selection,
+                                                     int32_t op, const float *params, int32_t num_params,
+                                                     int64_t port)
+  try
+  {
+    if (session == nullptr || selection == nullptr || num_params < 0 || (params == nullptr && num_params > 0))
+    {
+      return -1;
+    }
+
+    auto param_values = std::make_shared<std::vector<float>>(params, params + num_params);
+    auto held_session = hold(session);
+    auto held_selection = hold(selection);
+    return submit(port, [held_session, held_selection, op, param_values](uint8_t **, int32_t *)
+                  {
+                    return session_apply_selection(held_session.get(), held_selection.get(), op,
+                                                   param_values->data(), static_cast<int32_t>(param_values->size()));
+                  });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_session_stroke(graphics_session *session, graphics_stroke *stroke, int64_t port)
+  try
+  {
+    if (session == nullptr || stroke == nullptr)
+    {
+      return -1;
+    }
+
+    auto held_session = hold(session);
+    auto held_stroke = hold(stroke);
+    return submit(port, [held_session, held_stroke](uint8_t **, int32_t *)
+                  { return session_apply_stroke(held_session.get(), held_stroke.get()); });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_image_commands(const char *image_path, const uint8_t *commands,
+                                                  int32_t length, int64_t port)
+  try
+  {
+    if (image_path == nullptr)
+    {
+      return -1;
+    }
+
+    std::string path = image_path;
+    auto command_bytes = copy_bytes(commands, length);
+    return submit(port, [path, command_bytes](uint8_t **, int32_t *)
+                  { return process_image_commands(path.c_str(), command_bytes->data(), size_of(*command_bytes)); });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t submit_encoded_commands(const uint8_t *data, int32_t length, const char *ext,
+                                                    const uint8_t *commands, int32_t commands_length,
+                                                    int64_t port)
+  try
+  {
+    std::string extension = ext != nullptr ? ext : ".jpg";
+    auto image_bytes = copy_bytes(data, length);
+    auto command_bytes = copy_bytes(commands, commands_length);
+    return submit(port, [extension, image_bytes, command_bytes](uint8_t **out_data, int32_t *out_length)
+                  {
+                    return process_image_commands_encoded(image_bytes->data(), size_of(*image_bytes),
+                                                          extension.c_str(), command_bytes->data(),
+                                                          size_of(*command_bytes), out_data, out_length);
+                  });
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return -1;
+  }
+}
@@ -0,0 +1,187 @@
+#include "bench_util.hpp"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace bench
+{
+  namespace
+  {
+    long read_status_kb(const char *key)
+    {
+      FILE *file = fopen("/proc/self/status", "r");
+      if (file == nullptr)
+      {
+        return -1;
+      }
+
+      char line[256];
+      long value = -1;
+      size_t key_length = strlen(key);
+      while (fgets(line, sizeof(line), file) != nullptr)
+      {
+        if (strncmp(line, key, key_length) == 0)
+        {
+          value = strtol(line + key_length + 1, nullptr, 10);
+          break;
+        }
+      }
+      fclose(file);
+      return value;
+    }
+
+    void reset_peak_rss()
+    {
+      FILE *file = fopen("/proc/self/clear_refs", "w");
+      if (file != nullptr)
+      {
+        fputs("5", file);
+        fclose(file);
+      }
+    }
+
+    std::string json_string(const std::string &value)
+    {
+      std::string escaped = "\"";
+      for (char c : value)
+      {
+        if (c == '"' || c == '\\')
+        {
+          escaped += '\\';
+        }
+        escaped += c;
+      }
+      return escaped + "\"";
+    }
+  }
+
+  Measurement measure(int repetitions, const std::function<void()> &prepare, const std::function<void()> &op)
+  {
+    std::vector<double> times;
+    long peak_kb = 0;
+    for (int i = 0; i < std::max(repetitions, 1); i++)
+    {
+      if (prepare)
+      {
+        prepare();
+      }
+      malloc_trim(0);
+      long rss_before = read_status_kb("VmRSS:");
+      reset_peak_rss();
+
+      auto start = std::chrono::steady_clock::now();
+      op();
+      auto end = std::chrono::steady_clock::now();
+
+      long hwm = read_status_kb("VmHWM:");
+      peak_kb = std::max(peak_kb, hwm - rss_before);
+      times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    Measurement measurement;
+    measurement.median_ms = times[times.size() / 2];
+    measurement.min_ms = times.front();
+    measurement.peak_kb = peak_kb;
+    return measurement;
+  }
+
+  cv::Mat make_image(cv::Size size)
+  {
+    cv::Mat image(size, CV_8UC3);
+    for (int y = 0; y < size.height; y++)
+    {
+      uint8_t *row = image.ptr<uint8_t>(y);
+      for (int x = 0; x < size.width; x++)
+      {
+        row[x * 3 + 0] = static_cast<uint8_t>(255 * x / size.width);
+        row[x * 3 + 1] = static_cast<uint8_t>(255 * y / size.height);
+        row[x * 3 + 2] = static_cast<uint8_t>((x + y) & 0xff);
+      }
+    }
+
+    cv::Mat noise(size, CV_8UC3);
+    cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(16));
+    cv::add(image, noise, image);
+    return image;
+  }
+
+  std::vector<cv::Point> make_selection(cv::Size size, double fraction, int vertices)
+  {
+    cv::RNG rng(static_cast<uint64_t>(vertices));
+    double scale = std::sqrt(fraction);
+    double rx = size.width * scale / 2.0;
+    double ry = size.height * scale / 2.0;
+    double jitter = vertices > 64 ? 0.02 : 0.0;
+
+    std::vector<cv::Point> points;
+    points.reserve(vertices);
+    for (int i = 0; i < vertices; i++)
+    {
+      double angle = 2.0 * M_PI * i / vertices;
+      double r = 1.0 - rng.uniform(0.0, jitter);
+      points.push_back(cv::Point(static_cast<int>(size.width / 2.0 + r * rx * std::cos(angle)),
+                                 static_cast<int>(size.height / 2.0 + r * ry * std::sin(angle))));
+    }
+    return points;
+  }
+
+  std::vector<cv::Point2f> make_freehand(cv::Size size, double fraction, int vertices)
+  {
+    cv::RNG rng(static_cast<uint64_t>(vertices) + 1);
+    double scale = std::sqrt(fraction);
+    double rx = size.width * scale / 2.0;
+    double ry = size.height * scale / 2.0;
+
+    std::vector<cv::Point2f> points;
+    points.reserve(vertices);
+    for (int i = 0; i < vertices; i++)
+    {
+      double angle = 2.0 * M_PI * i / vertices;
+      double r = 1.0 + 0.1 * std::sin(3 * angle) + 0.05 * std::sin(7 * angle + 1);
+      double x = size.width / 2.0 + r * rx * std::cos(angle) + rng.gaussian(0.3);
+      double y = size.height / 2.0 + r * ry * std::sin(angle) + rng.gaussian(0.3);
+      points.push_back(cv::Point2f(static_cast<float>(x), static_cast<float>(y)));
+    }
+    return points;
+  }
+
+  void Report::set_context(const std::string &key, const std::string &value)
+  {
+    context_.emplace_back(key, value);
+  }
+
+  void Report::add(const Record &record)
+  {
+    records_.push_back(record);
+  }
+
+  void Report::write_json(FILE *file) const
+  {
+    fprintf(file, "{\n  \"context\": {");
+    for (size_t i = 0; i < context_.size(); i++)
+    {
+      fprintf(file, "%s\n    %s: %s", i == 0 ? "" : ",", json_string(context_[i].first).c_str(),
+              json_string(context_[i].second).c_str());
+    }
+    fprintf(file, "\n  },\n  \"results\": [");
+    for (size_t i = 0; i < records_.size(); i++)
+    {
+      const Record &r = records_[i];
+      fprintf(file,
+              "%s\n    {\"suite\": %s, \"operation\": %s, \"stage\": %s, \"variant\": %s, "
+              "\"width\": %d, \"height\": %d, \"megapixels\": %.2f, \"selection\": %.4f, \"vertices\": %d, "
+              "\"output_bytes\": %ld, \"median_ms\": %.3f, \"min_ms\": %.3f, \"peak_kb\": %ld}",
+              i == 0 ? "" : ",", json_string(r.suite).c_str(), json_string(r.operation).c_str(),
+              json_string(r.stage).c_str(), json_string(r.variant).c_str(), r.size.width, r.size.height,
+              r.size.area() / 1e6, r.selection, r.vertices, r.output_bytes, r.measurement.median_ms,
+              r.measurement.min_ms, r.measurement.peak_kb);
+    }
+    fprintf(file, "\n  ]\n}\n");
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef GRAPHICS_BENCH_UTIL_HPP
+#define GRAPHICS_BENCH_UTIL_HPP
+
+#include <stdio.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace bench
+{
+  struct Measurement
+  {
+    double median_ms = 0;
+    double min_ms = 0;
+    long peak_kb = 0;
+  };
+
+  // Times op over repetitions runs. prepare runs before every run and is not
+  // timed, so op can consume fresh inputs. peak_kb is the largest growth of the
+  // resident set during op, measured by resetting the kernel's RSS high water
+  // mark (/proc/self/clear_refs) before each run.
+  Measurement measure(int repetitions, const std::function<void()> &prepare, const std::function<void()> &op);
+
+  // A smooth synthetic photo: gradients with some noise, so codecs see
+  // realistic entropy rather than white noise.
+  cv::Mat make_image(cv::Size size);
+
+  // A closed polygon with the given vertex count whose bounding box covers
+  // fraction of the image. High vertex counts get a small radial jitter, like
+  // a freehand selection.
+  std::vector<cv::Point> make_selection(cv::Size size, double fraction, int vertices);
+
+  // A freehand outline as a touch screen samples it: a smooth closed curve
+  // with vertices sub-pixel apart and a little tremor, covering about
+  // fraction of the image.
+  std::vector<cv::Point2f> make_freehand(cv::Size size, double fraction, int vertices);
+
+  // One benchmark result.
+  struct Record
+  {
+    std::string suite;
+    std::string operation;
+    std::string stage;
+    std::string variant;
+    cv::Size size;
+    double selection = 0;
+    int vertices = 0;
+    // Size of the produced output (encoded image, ...) where it matters.
+    long output_bytes = 0;
+    Measurement measurement;
+  };
+
+  // Collects records and writes them as a JSON document of the form
+  // {"context": {...}, "results": [{...}, ...]} for regression tracking.
+  class Report
+  {
+  public:
+    void set_context(const std::string &key, const std::string &value);
+    void add(const Record &record);
+    void write_json(FILE *file) const;
+
+  private:
+    std::vector<std::pair<std::string, std::string>> context_;
+    std::vector<Record> records_;
+  };
+}
+
+#endif // GRAPHICS_BENCH_UTIL_HPP
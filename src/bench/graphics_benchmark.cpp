@@ -0,0 +1,1129 @@
+// Benchmark suite for the native image operations.
+//
+// Build with -DGRAPHICS_BUILD_BENCHMARKS=ON and run on a Linux box:
+//
+//   graphics_benchmark [--quick] [--sizes 1,12,48] [--repetitions 3]
+//                      [--suite kernels|roi|filters|strokes|layers|tiles|streaming|undo|stages|encoders|
+//                               logging|threads]
+//                      [--json results.json]
+//
+// Every suite runs on synthetic images, a summary goes to stderr and the
+// machine-readable results (see bench::Report) to stdout or the --json file.
+// It only times; graphics_tests checks that the code it times is correct.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../aixlog.hpp"
+#include "../brush.hpp"
+#include "../command_buffer.hpp"
+#include "../graphics.hpp"
+#include "../image_io.hpp"
+#include "../image_ops.hpp"
+#include "../layers.hpp"
+#include "../pixel_kernels.hpp"
+#include "../polygon_mask.hpp"
+#include "../region_filters.hpp"
+#include "../simplify.hpp"
+#include "../tiled_image.hpp"
+#include "../undo_history.hpp"
+#include "../worker_pool.hpp"
+#include "bench_util.hpp"
+#include "log_probes.hpp"
+#include "scenes.hpp"
+
+namespace
+{
+  struct Options
+  {
+    std::vector<double> megapixels = {1, 12, 24, 48, 100};
+    int repetitions = 3;
+    std::string suite;
+    std::string json_path;
+  };
+
+  const double kFractions[] = {0.01, 0.1, 0.5};
+  const int kVertexCounts[] = {16, 256, 4096};
+
+  cv::Size size_for(double megapixels)
+  {
+    // 4:3, the aspect ratio of most phone cameras.
+    int width = static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 * 4.0 / 3.0)));
+    return cv::Size(width, width * 3 / 4);
+  }
+
+  void print(const bench::Record &r)
+  {
+    fprintf(stderr, "%-8s %-26s %-14s %-8s %6.1f MP sel %5.1f%% v %5d %10.2f ms %10ld KB\n", r.suite.c_str(),
+            r.operation.c_str(), r.stage.c_str(), r.variant.c_str(), r.size.area() / 1e6, r.selection * 100.0,
+            r.vertices, r.measurement.median_ms, r.measurement.peak_kb);
+  }
+
+  void add(bench::Report &report, const bench::Record &record)
+  {
+    print(record);
+    report.add(record);
+  }
+
+  // The pre-ROI implementation of gray_scale_polygon, kept to compare against.
+  void full_frame_gray_scale_polygon(cv::Mat &image, const std::vector<cv::Point> &points)
+  {
+    cv::Mat mask = cv::Mat::zeros(image.size(), CV_8UC1);
+    cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{points}, cv::Scalar(255));
+
+    cv::Mat gray_image;
+    cv::cvtColor(image, gray_image, cv::COLOR_BGR2GRAY);
+
+    cv::Mat gray_bgr;
+    cv::cvtColor(gray_image, gray_bgr, cv::COLOR_GRAY2BGR);
+
+    cv::Mat result;
+    image.copyTo(result);
+    gray_bgr.copyTo(result, mask);
+    result.copyTo(image);
+  }
+
+  void run_kernels(const Options &options, bench::Report &report)
+  {
+    const cv::Size size = size_for(24);
+    cv::Mat image = bench::make_image(size);
+    cv::Mat mask(size, CV_8UC1, cv::Scalar(255));
+    cv::Mat work;
+    auto prepare = [&]()
+    { image.copyTo(work); };
+
+    bench::Record record;
+    record.suite = "kernels";
+    record.operation = "desaturate";
+    record.stage = "convert_blend";
+    record.size = size;
+    record.selection = 1.0;
+
+    record.variant = "four_pass";
+    record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                        { bench::four_pass_desaturate(work, mask); });
+    add(report, record);
+
+    graphics::KernelLevel initial = graphics::kernel_level();
+    for (graphics::KernelLevel level : bench::kernel_levels())
+    {
+      if (!graphics::set_kernel_level(level))
+      {
+        continue;
+      }
+      record.variant = graphics::kernel_level_name(level);
+      record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                          { graphics::desaturate_masked(work, mask); });
+      add(report, record);
+    }
+
+    // Anti-aliased and feathered selections blend by weight.
+    cv::Mat weights(size, CV_8UC1);
+    cv::randu(weights, cv::Scalar::all(0), cv::Scalar::all(256));
+    record.operation = "desaturate_weighted";
+    for (graphics::KernelLevel level : bench::kernel_levels())
+    {
+      if (!graphics::set_kernel_level(level))
+      {
+        continue;
+      }
+      record.variant = graphics::kernel_level_name(level);
+      record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                          { graphics::desaturate_weighted(work, weights); });
+      add(report, record);
+    }
+    graphics::set_kernel_level(initial);
+
+    // The display handoff: one BGR -> RGBA pass into a fresh buffer.
+    cv::Mat rgba(size, CV_8UC4);
+    record.operation = "bgr_to_rgba";
+    record.stage = "convert";
+    record.variant = "cvtColor";
+    record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                        { cv::cvtColor(image, rgba, cv::COLOR_BGR2RGBA); });
+    add(report, record);
+
+    for (graphics::KernelLevel level : bench::kernel_levels())
+    {
+      if (!graphics::set_kernel_level(level))
+      {
+        continue;
+      }
+      record.variant = graphics::kernel_level_name(level);
+      record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                          { graphics::bgr_to_rgba(image, rgba.ptr<uint8_t>()); });
+      add(report, record);
+    }
+
+    // The blend mode pass of one full image layer, row by row like the
+    // compositor.
+    cv::Mat layer(size, CV_8UC3);
+    cv::randu(layer, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mixed(size, CV_8UC3);
+    record.operation = "blend_mode_overlay";
+    record.stage = "composite";
+    for (graphics::KernelLevel level : bench::kernel_levels())
+    {
+      if (!graphics::set_kernel_level(level))
+      {
+        continue;
+      }
+      record.variant = graphics::kernel_level_name(level);
+      record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                          {
+                                            for (int y = 0; y < size.height; y++)
+                                            {
+                                              graphics::blend_mode_row(image.ptr<uint8_t>(y), layer.ptr<uint8_t>(y),
+                                                                       mixed.ptr<uint8_t>(y), size.width * 3,
+                                                                       graphics::BlendMode::overlay);
+                                            } });
+      add(report, record);
+    }
+    graphics::set_kernel_level(initial);
+  }
+
+  void run_roi(const Options &options, bench::Report &report)
+  {
+    const double fractions[] = {0.01, 0.02, 0.1, 0.25, 0.5, 1.0};
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      cv::Mat work;
+      auto prepare = [&]()
+      { image.copyTo(work); };
+
+      for (double fraction : fractions)
+      {
+        std::vector<cv::Point> points = bench::make_selection(size, fraction, 64);
+        std::vector<cv::Point2f> polygon(points.begin(), points.end());
+        bench::Record record;
+        record.suite = "roi";
+        record.operation = "gray_scale_polygon";
+        record.stage = "total";
+        record.size = size;
+        record.selection = fraction;
+        record.vertices = 64;
+
+        // Cold rasterizes the mask on every run, cached reuses it like
+        // repeated edits of one selection do.
+        record.variant = "roi";
+        record.measurement = bench::measure(options.repetitions, [&]()
+                                            {
+                                              prepare();
+                                              graphics::clear_mask_cache();
+                                            },
+                                            [&]()
+                                            { graphics::gray_scale_polygon(work, polygon); });
+        add(report, record);
+
+        record.variant = "roi_cached";
+        record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                            { graphics::gray_scale_polygon(work, polygon); });
+        add(report, record);
+
+        record.variant = "full_frame";
+        record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                            { full_frame_gray_scale_polygon(work, points); });
+        add(report, record);
+      }
+
+      // A freehand selection drawn point by point: streamed into a native
+      // selection, whose mask follows each append, against rasterizing the
+      // whole outline when the edit starts.
+      const int freehand = 16384;
+      std::vector<cv::Point2f> polygon = bench::make_freehand(size, 0.1, freehand);
+      bench::Record record;
+      record.suite = "roi";
+      record.operation = "freehand_selection";
+      record.size = size;
+      record.selection = 0.1;
+      record.vertices = freehand;
+
+      record.stage = "mask";
+      record.variant = "incremental";
+      record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                          {
+                                            graphics::IncrementalPolygonMask selection(size);
+                                            for (const cv::Point2f &point : polygon)
+                                            {
+                                              selection.append(&point, 1);
+                                            }
+                                            selection.mask(0);
+                                          });
+      add(report, record);
+
+      record.variant = "full";
+      record.measurement = bench::measure(options.repetitions, graphics::clear_mask_cache, [&]()
+                                          { graphics::polygon_mask(polygon, 0, size); });
+      add(report, record);
+
+      // What is left once the edit starts: resolving the rows the last
+      // append touched.
+      graphics::IncrementalPolygonMask selection(size);
+      selection.append(polygon.data(), polygon.size() - 1);
+      selection.mask(0);
+      record.variant = "incremental_last_point";
+      record.measurement = bench::measure(options.repetitions, [&]()
+                                          {
+                                            selection.clear();
+                                            selection.append(polygon.data(), polygon.size() - 1);
+                                            selection.mask(0);
+                                          },
+                                          [&]()
+                                          {
+                                            selection.append(&polygon.back(), 1);
+                                            selection.mask(0);
+                                          });
+      add(report, record);
+
+      // Simplification before rasterizing: vertices is what is left of the
+      // outline at each tolerance.
+      record.operation = "simplify_polygon";
+      for (float tolerance : {0.0f, 0.25f, 0.5f, 1.0f, 2.0f})
+      {
+        char variant[32];
+        snprintf(variant, sizeof(variant), "tol_%.2f", tolerance);
+        record.variant = variant;
+        std::vector<cv::Point2f> simplified = graphics::simplify_polygon(polygon, tolerance);
+        record.vertices = static_cast<int>(simplified.size());
+
+        record.stage = "simplify";
+        record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                            { graphics::simplify_polygon(polygon, tolerance); });
+        add(report, record);
+
+        cv::Rect roi = graphics::polygon_bounds(simplified, size);
+        cv::Mat mask;
+        record.stage = "mask";
+        record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                            { graphics::rasterize_coverage(simplified, roi, mask); });
+        add(report, record);
+      }
+    }
+  }
+
+  // Region filters on selections of growing size: in bands on all cores,
+  // the same on one thread, and the whole frame filtered before the masked
+  // blend.
+  void run_filters(const Options &options, bench::Report &report)
+  {
+    int threads = cv::getNumThreads();
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      cv::Mat work;
+      auto prepare = [&]()
+      { image.copyTo(work); };
+
+      for (double fraction : kFractions)
+      {
+        std::vector<cv::Point2f> polygon = bench::make_freehand(size, fraction, 4096);
+        std::shared_ptr<const graphics::PolygonMask> mask = graphics::polygon_mask(polygon, 2, size);
+        for (const bench::FilterCase &filter_case : bench::filter_cases())
+        {
+          const graphics::RegionFilter &filter = *graphics::find_region_filter(filter_case.filter);
+          bench::Record record;
+          record.suite = "filters";
+          record.operation = filter.name;
+          record.stage = filter_case.variant;
+          record.size = size;
+          record.selection = fraction;
+          record.vertices = 4096;
+
+          record.variant = "bands";
+          record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                              { graphics::filter_mask(work, *mask, filter, filter_case.values); });
+          add(report, record);
+
+          record.variant = "1_thread";
+          cv::setNumThreads(1);
+          record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                              { graphics::filter_mask(work, *mask, filter, filter_case.values); });
+          cv::setNumThreads(threads);
+          add(report, record);
+
+          record.variant = "full";
+          cv::Mat filtered;
+          record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                              {
+                                                filter.apply(work, cv::Rect(0, 0, size.width, size.height),
+                                                             filtered, filter_case.values);
+                                                cv::Mat region = work(mask->roi);
+                                                graphics::blend_weighted(region, filtered(mask->roi),
+                                                                         mask->coverage);
+                                              });
+          add(report, record);
+        }
+      }
+    }
+  }
+
+  // Live strokes along a freehand path: every frame blending only its dirty
+  // pixels, every frame blending the whole stroke, and the commit of the
+  // finished stroke.
+  void run_strokes(const Options &options, bench::Report &report)
+  {
+    const int points = 4096;
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      cv::Mat work;
+      auto prepare = [&]()
+      { image.copyTo(work); };
+      std::vector<cv::Point2f> path = bench::make_freehand(size, 0.5, points);
+
+      for (const graphics_brush &brush : bench::brushes())
+      {
+        bench::Record record;
+        record.suite = "strokes";
+        record.operation = "stroke";
+        record.stage = "size_" + std::to_string(static_cast<int>(brush.size));
+        record.size = size;
+        record.selection = 0.5;
+        record.vertices = points;
+
+        record.variant = "dirty";
+        record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                            { bench::paint_frames(work, image, path, brush, false); });
+        add(report, record);
+
+        record.variant = "redraw";
+        record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                            { bench::paint_frames(work, image, path, brush, true); });
+        add(report, record);
+
+        record.variant = "commit";
+        graphics::Command command = graphics::stroke_command(brush, path);
+        record.measurement = bench::measure(options.repetitions, prepare, [&]()
+                                            { graphics::execute_command(work, command); });
+        add(report, record);
+      }
+    }
+  }
+
+  // The layer stack: compositing every tile, toggling a small paint layer
+  // and the masked blur (recompositing only their tiles), against flattening
+  // the layers over the whole image.
+  void run_layers(const Options &options, bench::Report &report)
+  {
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      graphics::LayerStack stack(size);
+      bench::LayerIds ids = bench::make_layers(stack);
+      stack.composite(image);
+
+      bench::Record record;
+      record.suite = "layers";
+      record.operation = "composite";
+      record.stage = "composite";
+      record.size = size;
+      record.selection = 1.0;
+
+      record.variant = "all_tiles";
+      record.measurement = bench::measure(options.repetitions, [&]()
+                                          { stack.invalidate(cv::Rect(0, 0, size.width, size.height)); }, [&]()
+                                          { stack.composite(image); });
+      add(report, record);
+
+      record.variant = "whole_image";
+      record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                          { bench::flatten_layers(image, stack); });
+      add(report, record);
+
+      bool visible = true;
+      record.operation = "toggle";
+      record.variant = "paint_layer";
+      record.selection = 0.05;
+      record.measurement = bench::measure(options.repetitions, [&]()
+                                          { stack.composite(image); }, [&]()
+                                          {
+                                            visible = !visible;
+                                            stack.set_visible(ids.paint, visible);
+                                            stack.composite(image); });
+      add(report, record);
+
+      record.variant = "masked_blur";
+      record.selection = 0.3;
+      record.measurement = bench::measure(options.repetitions, [&]()
+                                          { stack.composite(image); }, [&]()
+                                          {
+                                            visible = !visible;
+                                            stack.set_visible(ids.blur, visible);
+                                            stack.composite(image); });
+      add(report, record);
+    }
+  }
+
+  // A feathered selection edited on the whole image and on a tiled one,
+  // with and without a snapshot taken first (a clone of the whole image
+  // against a copy of the tiles, which the edit copies on write).
+  void run_tiles(const Options &options, bench::Report &report)
+  {
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      graphics::TiledImage tiles(image.clone());
+      for (double fraction : kFractions)
+      {
+        graphics::Command command;
+        command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+        command.params = {2};
+        command.points = bench::make_freehand(size, fraction, 256);
+
+        bench::Record record;
+        record.suite = "tiles";
+        record.operation = "edit";
+        record.stage = "blend";
+        record.size = size;
+        record.selection = fraction;
+        record.vertices = 256;
+
+        record.variant = "image";
+        record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                            { graphics::execute_command(image, command); });
+        add(report, record);
+
+        record.variant = "tiled";
+        record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                            { graphics::execute_command(tiles, command); });
+        add(report, record);
+
+        cv::Mat copy;
+        graphics::TiledImage snapshot;
+        record.operation = "snapshot_edit";
+        record.variant = "image";
+        record.measurement = bench::measure(options.repetitions, [&]()
+                                            { copy.release(); }, [&]()
+                                            {
+                                              copy = image.clone();
+                                              graphics::execute_command(image, command); });
+        add(report, record);
+
+        record.variant = "tiled";
+        record.measurement = bench::measure(options.repetitions, [&]()
+                                            { snapshot = graphics::TiledImage(); }, [&]()
+                                            {
+                                              snapshot = tiles;
+                                              graphics::execute_command(tiles, command); });
+        add(report, record);
+      }
+    }
+  }
+
+  bool copy_file(const std::string &from, const std::string &to)
+  {
+    std::vector<uint8_t> bytes;
+    FILE *file = graphics::read_file(from.c_str(), bytes) ? fopen(to.c_str(), "wb") : nullptr;
+    if (file == nullptr)
+    {
+      return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && written;
+  }
+
+  // Converts a JPEG and a PNG file of every size to grayscale with
+  // process_image, which holds the whole image, and with
+  // process_image_streaming, whose peak should stay flat as the images grow.
+  void run_streaming(const Options &options, bench::Report &report)
+  {
+    const std::string base = bench::temp_directory() + "/graphics_benchmark_" + std::to_string(getpid());
+
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      for (const char *ext : {".jpg", ".png"})
+      {
+        const std::string input = base + "_input" + ext;
+        const std::string whole = base + "_whole" + ext;
+        const std::string streamed = base + "_streamed" + ext;
+        cv::imwrite(input, image);
+
+        bench::Record record;
+        record.suite = "streaming";
+        record.operation = std::string("gray_scale_") + (ext[1] == 'j' ? "jpeg" : "png");
+        record.stage = "transcode";
+        record.size = size;
+
+        record.variant = "whole_image";
+        record.measurement = bench::measure(options.repetitions, [&]()
+                                            { copy_file(input, whole); }, [&]()
+                                            { process_image(whole.c_str()); });
+        add(report, record);
+
+        record.variant = "streamed";
+        record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                            { process_image_streaming(input.c_str(), streamed.c_str(), nullptr); });
+        add(report, record);
+        remove(input.c_str());
+        remove(whole.c_str());
+        remove(streamed.c_str());
+      }
+    }
+  }
+
+  // A feathered selection edited with an undo history, then undone and
+  // redone, on the whole image and on a tiled one, with and without LZ4.
+  // The output bytes are the memory the step holds, which should follow the
+  // selection rather than the image.
+  void run_undo(const Options &options, bench::Report &report)
+  {
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      graphics::TiledImage tiles(image.clone());
+      for (double fraction : kFractions)
+      {
+        graphics::Command command;
+        command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+        command.params = {2};
+        command.points = bench::make_freehand(size, fraction, 256);
+
+        for (int32_t compression : {GRAPHICS_RAW_UNCOMPRESSED, GRAPHICS_RAW_LZ4})
+        {
+          for (bool tiled : {false, true})
+          {
+            graphics::UndoHistory history;
+            std::vector<graphics::Command> replays;
+            std::vector<cv::Rect> changed;
+            bench::Record record;
+            record.suite = "undo";
+            record.stage = "history";
+            record.variant = std::string(tiled ? "tiled" : "image") + (compression == GRAPHICS_RAW_LZ4 ? "_lz4" : "");
+            record.size = size;
+            record.selection = fraction;
+            record.vertices = 256;
+
+            record.operation = "edit";
+            record.measurement = bench::measure(options.repetitions, [&]()
+                                                {
+                                                  history.configure(0, compression, nullptr);
+                                                  history.configure(size_t(1) << 40, compression, nullptr); }, [&]()
+                                                {
+                                                  if (tiled)
+                                                  {
+                                                    bench::edit_with_history(history, tiles, command);
+                                                  }
+                                                  else
+                                                  {
+                                                    bench::edit_with_history(history, image, command);
+                                                  } });
+            record.output_bytes = static_cast<long>(history.memory_bytes());
+            add(report, record);
+
+            // Undo and redo alternate, the untimed one sets up the next run.
+            auto step = [&](bool undo)
+            {
+              if (tiled)
+              {
+                return undo ? history.undo(tiles, replays, changed) : history.redo(tiles, replays, changed);
+              }
+              return undo ? history.undo(image, replays, changed) : history.redo(image, replays, changed);
+            };
+            record.operation = "undo";
+            record.measurement = bench::measure(options.repetitions, [&]()
+                                                { step(false); }, [&]()
+                                                { step(true); });
+            add(report, record);
+
+            record.operation = "redo";
+            record.measurement = bench::measure(options.repetitions, [&]()
+                                                { step(true); }, [&]()
+                                                { step(false); });
+            add(report, record);
+          }
+        }
+      }
+    }
+  }
+
+  // Times the stages of one exported operation on one image. Selection and
+  // vertices only apply to the polygon operations.
+  void run_stages_for(const Options &options, bench::Report &report, const std::string &operation,
+                      const cv::Mat &image, const std::vector<uchar> &jpeg, double fraction, int vertices)
+  {
+    std::vector<cv::Point> points;
+    if (vertices > 0)
+    {
+      points = bench::make_selection(image.size(), fraction, vertices);
+    }
+
+    bench::Record record;
+    record.suite = "stages";
+    record.operation = operation;
+    record.variant = graphics::kernel_level_name(graphics::kernel_level());
+    record.size = image.size();
+    record.selection = vertices > 0 ? fraction : 0;
+    record.vertices = vertices;
+
+    cv::Mat work;
+    auto prepare = [&]()
+    { image.copyTo(work); };
+
+    auto stage = [&](const char *name, const std::function<void()> &before, const std::function<void()> &op)
+    {
+      record.stage = name;
+      record.measurement = bench::measure(options.repetitions, before, op);
+      add(report, record);
+    };
+
+    stage("decode", nullptr, [&]()
+          { cv::imdecode(jpeg, cv::IMREAD_COLOR); });
+
+    cv::Mat gray_image;
+    std::vector<uchar> encoded;
+    if (operation == "process_image")
+    {
+      stage("convert", nullptr, [&]()
+            { cv::cvtColor(image, gray_image, cv::COLOR_BGR2GRAY); });
+      stage("encode", nullptr, [&]()
+            { cv::imencode(".jpg", gray_image, encoded); });
+    }
+    else if (operation == "process_image_with_points")
+    {
+      stage("draw", prepare, [&]()
+            { graphics::draw_polygon(work, points); });
+      stage("encode", nullptr, [&]()
+            { cv::imencode(".jpg", image, encoded); });
+    }
+    else
+    {
+      std::vector<cv::Point2f> polygon(points.begin(), points.end());
+      cv::Rect roi = graphics::polygon_bounds(polygon, image.size());
+      cv::Mat mask;
+      stage("mask", nullptr, [&]()
+            { graphics::rasterize_coverage(polygon, roi, mask); });
+      stage("mask_feather", graphics::clear_mask_cache, [&]()
+            { graphics::polygon_mask(polygon, 8, image.size()); });
+      stage("convert_blend", prepare, [&]()
+            {
+              cv::Mat region = work(roi);
+              graphics::desaturate_weighted(region, mask);
+            });
+      stage("encode", nullptr, [&]()
+            { cv::imencode(".jpg", image, encoded); });
+    }
+
+    // The exported entry point end to end, through the in-memory API.
+    std::vector<float> flat;
+    for (const cv::Point &point : points)
+    {
+      flat.push_back(static_cast<float>(point.x));
+      flat.push_back(static_cast<float>(point.y));
+    }
+    stage("total", nullptr, [&]()
+          {
+            uint8_t *out_data = nullptr;
+            int32_t out_length = 0;
+            const uint8_t *data = jpeg.data();
+            int32_t length = static_cast<int32_t>(jpeg.size());
+            if (operation == "process_image")
+            {
+              process_image_encoded(data, length, ".jpg", &out_data, &out_length);
+            }
+            else if (operation == "process_image_with_points")
+            {
+              process_image_with_points_encoded(data, length, ".jpg", flat.data(), vertices, &out_data, &out_length);
+            }
+            else
+            {
+              process_image_gray_scale_encoded(data, length, ".jpg", flat.data(), vertices, &out_data, &out_length);
+            }
+            free_buffer(out_data);
+          });
+  }
+
+  // Encodes every image size with each output configuration, then decodes the
+  // result again.
+  void run_encoders(const Options &options, bench::Report &report)
+  {
+    struct Config
+    {
+      const char *name;
+      graphics_encode_options options;
+    };
+    // format, quality, progressive, optimize, png compression, raw compression
+    const Config configs[] = {
+        {"jpeg_default", {GRAPHICS_FORMAT_JPEG, -1, -1, -1, -1, 0}},
+        {"jpeg_q85_prog_opt", {GRAPHICS_FORMAT_JPEG, 85, 1, 1, -1, 0}},
+        {"png_1", {GRAPHICS_FORMAT_PNG, -1, -1, -1, 1, 0}},
+        {"png_6", {GRAPHICS_FORMAT_PNG, -1, -1, -1, 6, 0}},
+        {"webp_90", {GRAPHICS_FORMAT_WEBP, 90, -1, -1, -1, 0}},
+        {"raw", {GRAPHICS_FORMAT_RAW, -1, -1, -1, -1, GRAPHICS_RAW_UNCOMPRESSED}},
+        {"raw_lz4", {GRAPHICS_FORMAT_RAW, -1, -1, -1, -1, GRAPHICS_RAW_LZ4}},
+    };
+
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      for (const Config &config : configs)
+      {
+        bench::Record record;
+        record.suite = "encoders";
+        record.operation = "export";
+        record.variant = config.name;
+        record.size = size;
+
+        uint8_t *data = nullptr;
+        int32_t length = 0;
+        auto release = [&]()
+        {
+          free(data);
+          data = nullptr;
+        };
+        record.stage = "encode";
+        record.measurement = bench::measure(options.repetitions, release, [&]()
+                                            { graphics::encode_image(image, nullptr, &config.options, &data, &length); });
+        record.output_bytes = length;
+        add(report, record);
+
+        cv::Mat decoded;
+        record.stage = "decode";
+        record.measurement = bench::measure(options.repetitions, [&]()
+                                            { decoded.release(); },
+                                            [&]()
+                                            { graphics::decode_image(data, length, cv::IMREAD_COLOR, decoded); });
+        add(report, record);
+        release();
+      }
+    }
+  }
+
+  // Times kStatements LOG(INFO) statements spread over threads, with probe
+  // being either the enabled or the compiled out statement.
+  bench::Measurement measure_logging(const Options &options, int threads, void (*probe)(int))
+  {
+    const int kStatements = 100000;
+    return bench::measure(options.repetitions, []() {}, [&]()
+                          {
+                            std::vector<std::thread> workers;
+                            for (int t = 0; t < threads; t++)
+                            {
+                              workers.emplace_back([&, t]()
+                                                   {
+                                                     for (int i = t; i < kStatements; i += threads)
+                                                     {
+                                                       probe(i);
+                                                     }
+                                                   });
+                            }
+                            for (std::thread &worker : workers)
+                            {
+                              worker.join();
+                            }
+                          });
+  }
+
+  // Cost of 100k log statements per configuration: synchronous sinks, a sink
+  // filtering the line out at runtime, the asynchronous sink, and statements
+  // removed by AIXLOG_MIN_SEVERITY.
+  void run_logging(const Options &options, bench::Report &report)
+  {
+    auto null_sink = std::make_shared<AixLog::SinkNull>();
+    auto filtered_sink = std::make_shared<AixLog::SinkCallback>(
+        AixLog::Severity::warning, [](const AixLog::Metadata &, const std::string &) {});
+
+    bench::Record record;
+    record.suite = "logging";
+    record.operation = "log_statement_x100k";
+    record.stage = "total";
+
+    for (int threads : {1, 4})
+    {
+      const std::string suffix = "_" + std::to_string(threads) + "t";
+
+      AixLog::Log::init({null_sink});
+      record.variant = "sync" + suffix;
+      record.measurement = measure_logging(options, threads, bench::log_probe_enabled);
+      add(report, record);
+
+      AixLog::Log::init({filtered_sink});
+      record.variant = "filtered" + suffix;
+      record.measurement = measure_logging(options, threads, bench::log_probe_enabled);
+      add(report, record);
+
+      AixLog::Log::init_async({null_sink}, AixLog::Filter(), 1 << 16);
+      record.variant = "async" + suffix;
+      record.measurement = measure_logging(options, threads, bench::log_probe_enabled);
+      add(report, record);
+
+      record.variant = "compiled_out" + suffix;
+      record.measurement = measure_logging(options, threads, bench::log_probe_compiled_out);
+      add(report, record);
+    }
+
+    AixLog::Log::init();
+  }
+
+  // Runs jobs feathered blurs of image on the worker pool and waits for them.
+  void blur_on_workers(const cv::Mat &image, const std::vector<cv::Point2f> &polygon, int jobs)
+  {
+    const graphics::RegionFilter &filter = *graphics::find_region_filter(GRAPHICS_FILTER_GAUSSIAN_BLUR);
+    const float values[graphics::kFilterValues] = {8, 0, 0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    int left = jobs;
+    for (int i = 0; i < jobs; i++)
+    {
+      graphics::worker_pool().submit([&]()
+                                     {
+                                       cv::Mat work = image.clone();
+                                       graphics::filter_polygon(work, polygon, 4, filter, values);
+                                       std::lock_guard<std::mutex> lock(mutex);
+                                       if (--left == 0)
+                                       {
+                                         finished.notify_one();
+                                       } });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]()
+                  { return left == 0; });
+  }
+
+  // Throughput of a batch of blurs with 1 to all cores' worth of them
+  // running at once, either sharing the cores under a thread policy or each
+  // free to use all of them, as without one. Prints the jobs per second and
+  // the parallelism the loops of each job achieved.
+  void run_threads(const Options &options, bench::Report &report)
+  {
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> concurrencies;
+    for (int jobs = 1; jobs < cores; jobs *= 2)
+    {
+      concurrencies.push_back(jobs);
+    }
+    concurrencies.push_back(cores);
+    const int batch = 2 * cores;
+
+    for (double megapixels : options.megapixels)
+    {
+      cv::Size size = size_for(megapixels);
+      cv::Mat image = bench::make_image(size);
+      std::vector<cv::Point2f> polygon = bench::make_freehand(size, 0.5, 4096);
+
+      bench::Record record;
+      record.suite = "threads";
+      record.operation = "filter_polygon_x" + std::to_string(batch);
+      record.size = size;
+      record.selection = 0.5;
+      record.vertices = 4096;
+      for (int jobs : concurrencies)
+      {
+        record.stage = std::to_string(jobs) + "_at_once";
+        for (bool shared : {true, false})
+        {
+          graphics_thread_policy policy = {shared ? cores : cores * jobs, shared ? std::max(1, cores / jobs) : cores,
+                                           GRAPHICS_AFFINITY_ANY, 0};
+          set_thread_policy(&policy);
+          reset_stats();
+          record.variant = shared ? "shared_budget" : "unbounded";
+          record.measurement = bench::measure(options.repetitions, []() {}, [&]()
+                                              { blur_on_workers(image, polygon, batch); });
+          add(report, record);
+
+          graphics_stats stats;
+          get_stats(&stats);
+          fprintf(stderr, "%d jobs at once, %d threads each: %.2f jobs/s, loop parallelism %.2f\n", jobs,
+                  policy.job_threads, batch * 1000.0 / record.measurement.median_ms,
+                  stats.parallel_wall_ns > 0 ? static_cast<double>(stats.parallel_busy_ns) / stats.parallel_wall_ns
+                                             : 0.0);
+        }
+      }
+    }
+
+    graphics_thread_policy defaults = {0, 0, GRAPHICS_AFFINITY_ANY, 0};
+    set_thread_policy(&defaults);
+  }
+
+  void run_stages(const Options &options, bench::Report &report)
+  {
+    for (double megapixels : options.megapixels)
+    {
+      cv::Mat image = bench::make_image(size_for(megapixels));
+      std::vector<uchar> jpeg;
+      cv::imencode(".jpg", image, jpeg);
+
+      run_stages_for(options, report, "process_image", image, jpeg, 0, 0);
+      for (double fraction : kFractions)
+      {
+        for (int vertices : kVertexCounts)
+        {
+          run_stages_for(options, report, "process_image_with_points", image, jpeg, fraction, vertices);
+          run_stages_for(options, report, "process_image_gray_scale", image, jpeg, fraction, vertices);
+        }
+      }
+    }
+  }
+
+  std::vector<double> parse_list(const char *text)
+  {
+    std::vector<double> values;
+    std::string item;
+    for (const char *c = text;; c++)
+    {
+      if (*c == ',' || *c == '\0')
+      {
+        if (!item.empty())
+        {
+          values.push_back(atof(item.c_str()));
+        }
+        item.clear();
+        if (*c == '\0')
+        {
+          break;
+        }
+      }
+      else
+      {
+        item += *c;
+      }
+    }
+    return values;
+  }
+
+  bool parse_options(int argc, char **argv, Options &options)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      bool has_value = i + 1 < argc;
+      if (arg == "--quick")
+      {
+        options.megapixels = {1, 12};
+        options.repetitions = 1;
+      }
+      else if (arg == "--sizes" && has_value)
+      {
+        options.megapixels = parse_list(argv[++i]);
+      }
+      else if (arg == "--repetitions" && has_value)
+      {
+        options.repetitions = atoi(argv[++i]);
+      }
+      else if (arg == "--suite" && has_value)
+      {
+        options.suite = argv[++i];
+      }
+      else if (arg == "--json" && has_value)
+      {
+        options.json_path = argv[++i];
+      }
+      else
+      {
+        fprintf(stderr,
+                "usage: %s [--quick] [--sizes MP,MP,...] [--repetitions N] "
+                "[--suite kernels|roi|filters|strokes|layers|tiles|streaming|undo|stages|encoders|logging|threads] "
+                "[--json PATH]\n",
+                argv[0]);
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, options))
+  {
+    return 2;
+  }
+
+  // A fixed threshold keeps large temporaries in mmap'd chunks that go back to
+  // the kernel on free, otherwise a recycled heap would hide their footprint.
+  mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+
+  bench::Report report;
+  report.set_context("opencv_version", CV_VERSION);
+  report.set_context("kernel_level", graphics::kernel_level_name(graphics::kernel_level()));
+  report.set_context("opencv_threads", std::to_string(cv::getNumThreads()));
+  report.set_context("repetitions", std::to_string(options.repetitions));
+
+  if (options.suite.empty() || options.suite == "kernels")
+  {
+    run_kernels(options, report);
+  }
+  if (options.suite.empty() || options.suite == "roi")
+  {
+    run_roi(options, report);
+  }
+  if (options.suite.empty() || options.suite == "filters")
+  {
+    run_filters(options, report);
+  }
+  if (options.suite.empty() || options.suite == "strokes")
+  {
+    run_strokes(options, report);
+  }
+  if (options.suite.empty() || options.suite == "layers")
+  {
+    run_layers(options, report);
+  }
+  if (options.suite.empty() || options.suite == "tiles")
+  {
+    run_tiles(options, report);
+  }
+  if (options.suite.empty() || options.suite == "streaming")
+  {
+    run_streaming(options, report);
+  }
+  if (options.suite.empty() || options.suite == "undo")
+  {
+    run_undo(options, report);
+  }
+  if (options.suite.empty() || options.suite == "stages")
+  {
+    run_stages(options, report);
+  }
+  if (options.suite.empty() || options.suite == "encoders")
+  {
+    run_encoders(options, report);
+  }
+  if (options.suite.empty() || options.suite == "logging")
+  {
+    run_logging(options, report);
+  }
+  if (options.suite.empty() || options.suite == "threads")
+  {
+    run_threads(options, report);
+  }
+
+  FILE *output = stdout;
+  if (!options.json_path.empty())
+  {
+    output = fopen(options.json_path.c_str(), "w");
+    if (output == nullptr)
+    {
+      fprintf(stderr, "could not write %s\n", options.json_path.c_str());
+      return 1;
+    }
+  }
+  report.write_json(output);
+  if (output != stdout)
+  {
+    fclose(output);
+  }
+  return 0;
+}
@@ -0,0 +1,15 @@
+// Built like a release binary: INFO statements are below the threshold.
+#undef AIXLOG_MIN_SEVERITY
+#define AIXLOG_MIN_SEVERITY WARNING
+
+#include "log_probes.hpp"
+
+#include "../aixlog.hpp"
+
+namespace bench
+{
+  void log_probe_compiled_out(int index)
+  {
+    LOG(INFO) << "execute command " << log_argument(index) << " on /tmp/image.jpg" << std::endl;
+  }
+}
@@ -0,0 +1,23 @@
+// Built with every LOG statement enabled, whatever the target defines.
+#undef AIXLOG_MIN_SEVERITY
+#define AIXLOG_MIN_SEVERITY 0
+
+#include "log_probes.hpp"
+
+#include "../aixlog.hpp"
+
+namespace bench
+{
+  std::atomic<long> log_argument_evaluations{0};
+
+  int log_argument(int value)
+  {
+    log_argument_evaluations.fetch_add(1, std::memory_order_relaxed);
+    return value;
+  }
+
+  void log_probe_enabled(int index)
+  {
+    LOG(INFO) << "execute command " << log_argument(index) << " on /tmp/image.jpg" << std::endl;
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef GRAPHICS_LOG_PROBES_HPP
+#define GRAPHICS_LOG_PROBES_HPP
+
+#include <atomic>
+
+namespace bench
+{
+  // Counts how often a probe evaluated its streamed arguments, so the logging
+  // suite can prove that compiled out statements skip them.
+  extern std::atomic<long> log_argument_evaluations;
+  int log_argument(int value);
+
+  // One LOG(INFO) statement shaped like the ones on the image paths. The two
+  // probes only differ in AIXLOG_MIN_SEVERITY, each lives in its own
+  // translation unit because aixlog.hpp reads it once.
+  void log_probe_enabled(int index);
+  void log_probe_compiled_out(int index);
+}
+
+#endif // GRAPHICS_LOG_PROBES_HPP
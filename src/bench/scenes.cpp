@@ -0,0 +1,171 @@
+#include "scenes.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "../polygon_mask.hpp"
+#include "bench_util.hpp"
+
+namespace bench
+{
+  const std::vector<graphics::KernelLevel> &kernel_levels()
+  {
+    static const std::vector<graphics::KernelLevel> levels = {
+        graphics::KernelLevel::scalar, graphics::KernelLevel::sse41, graphics::KernelLevel::avx2,
+        graphics::KernelLevel::neon};
+    return levels;
+  }
+
+  void four_pass_desaturate(cv::Mat &image, const cv::Mat &mask)
+  {
+    cv::Mat gray_image;
+    cv::cvtColor(image, gray_image, cv::COLOR_BGR2GRAY);
+
+    cv::Mat gray_bgr;
+    cv::cvtColor(gray_image, gray_bgr, cv::COLOR_GRAY2BGR);
+
+    cv::Mat result;
+    image.copyTo(result);
+    gray_bgr.copyTo(result, mask);
+    result.copyTo(image);
+  }
+
+  const std::vector<FilterCase> &filter_cases()
+  {
+    static const std::vector<FilterCase> cases = {
+        {GRAPHICS_FILTER_GAUSSIAN_BLUR, "sigma_4", {4, 0, 0}},
+        {GRAPHICS_FILTER_GAUSSIAN_BLUR, "sigma_16", {16, 0, 0}},
+        {GRAPHICS_FILTER_BOX_BLUR, "radius_16", {16, 0, 0}},
+        {GRAPHICS_FILTER_UNSHARP_MASK, "sigma_2", {2, 1, 2}},
+        {GRAPHICS_FILTER_BRIGHTNESS_CONTRAST, "levels", {20, 1.2f, 0.8f}},
+        {GRAPHICS_FILTER_SATURATION, "x1.5", {1.5f, 0, 0}},
+    };
+    return cases;
+  }
+
+  const std::vector<graphics_brush> &brushes()
+  {
+    static const std::vector<graphics_brush> brushes = {
+        {40, 40, 220, 8, 1, 1, 0.1f},
+        {40, 40, 220, 64, 0.3f, 0.6f, 0.1f},
+    };
+    return brushes;
+  }
+
+  void paint_frames(cv::Mat &preview, const cv::Mat &image, const std::vector<cv::Point2f> &path,
+                    const graphics_brush &brush, bool full_redraw)
+  {
+    graphics::BrushStroke stroke(image.size(), brush);
+    for (size_t i = 0; i < path.size(); i += kPointsPerFrame)
+    {
+      stroke.append(path.data() + i, std::min<size_t>(kPointsPerFrame, path.size() - i));
+      stroke.render();
+      cv::Rect dirty = full_redraw ? stroke.bounds() : stroke.take_dirty();
+      if (dirty.empty())
+      {
+        continue;
+      }
+      cv::Mat patch = image(dirty).clone();
+      stroke.composite(patch, dirty);
+      patch.copyTo(preview(dirty));
+    }
+  }
+
+  cv::Mat flatten_layers(const cv::Mat &image, const graphics::LayerStack &stack)
+  {
+    const cv::Size size = image.size();
+    cv::Mat result = image.clone();
+    std::vector<uint8_t> mixed(static_cast<size_t>(size.width) * 3);
+    for (const graphics::Layer &layer : stack.layers())
+    {
+      if (!layer.visible || layer.opacity <= 0 || (layer.filter == nullptr && layer.color.empty()))
+      {
+        continue;
+      }
+      cv::Mat pixels = layer.color;
+      cv::Mat weights = layer.filter != nullptr ? cv::Mat(size, CV_8UC1, cv::Scalar(255)) : layer.alpha.clone();
+      if (layer.filter != nullptr)
+      {
+        // Filtered as a view, like the tiles, so OpenCV takes the same code
+        // path (its IPP kernels only run on whole images).
+        cv::Mat canvas;
+        cv::copyMakeBorder(result, canvas, 1, 1, 1, 1, cv::BORDER_REFLECT_101);
+        layer.filter->apply(canvas, cv::Rect(1, 1, size.width, size.height), pixels, layer.values);
+      }
+      if (layer.mask != nullptr)
+      {
+        cv::Mat coverage = cv::Mat::zeros(size, CV_8UC1);
+        layer.mask->coverage.copyTo(coverage(layer.mask->roi));
+        cv::multiply(weights, coverage, weights, 1.0 / 255);
+      }
+      const int opacity = static_cast<int>(std::lround(layer.opacity * 255));
+      for (int y = 0; y < size.height; y++)
+      {
+        uint8_t *w = weights.ptr<uint8_t>(y);
+        for (int x = 0; x < size.width && opacity < 255; x++)
+        {
+          w[x] = static_cast<uint8_t>((w[x] * opacity + 127) / 255);
+        }
+        const uint8_t *source = pixels.ptr<uint8_t>(y);
+        if (layer.mode != graphics::BlendMode::normal)
+        {
+          graphics::blend_mode_row_scalar(result.ptr<uint8_t>(y), source, mixed.data(), size.width * 3, layer.mode);
+          source = mixed.data();
+        }
+        graphics::blend_weighted_row_scalar(result.ptr<uint8_t>(y), source, w, size.width);
+      }
+    }
+    return result;
+  }
+
+  LayerIds make_layers(graphics::LayerStack &stack)
+  {
+    const cv::Size size = stack.size();
+    const graphics_brush small_brush = {40, 40, 220, 24, 0.5f, 0.9f, 0.1f};
+    const graphics_brush large_brush = {200, 120, 30, 48, 0.8f, 1, 0.1f};
+    LayerIds ids;
+
+    ids.paint = stack.add(nullptr, nullptr, graphics::BlendMode::multiply, 0.8f);
+    std::vector<cv::Point2f> path = make_freehand(size, 0.05, 400);
+    graphics::BrushStroke stroke(size, small_brush);
+    stroke.append(path.data(), path.size());
+    stroke.render();
+    stack.paint(ids.paint, stroke, graphics::stroke_command(small_brush, path));
+
+    const float sigma[graphics::kFilterValues] = {4, 0, 0};
+    ids.blur = stack.add(graphics::find_region_filter(GRAPHICS_FILTER_GAUSSIAN_BLUR), sigma,
+                         graphics::BlendMode::normal, 1);
+    std::vector<cv::Point2f> polygon = make_freehand(size, 0.3, 2000);
+    stack.set_mask(ids.blur, graphics::polygon_mask(polygon, 3, size), polygon, 3);
+
+    ids.overlay = stack.add(nullptr, nullptr, graphics::BlendMode::overlay, 1);
+    path = make_freehand(size, 0.5, 1500);
+    graphics::BrushStroke large(size, large_brush);
+    large.append(path.data(), path.size());
+    large.render();
+    stack.paint(ids.overlay, large, graphics::stroke_command(large_brush, path));
+
+    const float factor[graphics::kFilterValues] = {1.5f, 0, 0};
+    ids.saturation = stack.add(graphics::find_region_filter(GRAPHICS_FILTER_SATURATION), factor,
+                               graphics::BlendMode::screen, 0.5f);
+    return ids;
+  }
+
+  std::string temp_directory()
+  {
+    const char *tmp = getenv("TMPDIR");
+    return tmp != nullptr ? tmp : "/tmp";
+  }
+
+  cv::Mat pixels_of(const cv::Mat &image)
+  {
+    return image.clone();
+  }
+
+  cv::Mat pixels_of(const graphics::TiledImage &image)
+  {
+    return image.to_mat();
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef GRAPHICS_BENCH_SCENES_HPP
+#define GRAPHICS_BENCH_SCENES_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../brush.hpp"
+#include "../command_buffer.hpp"
+#include "../layers.hpp"
+#include "../pixel_kernels.hpp"
+#include "../region_filters.hpp"
+#include "../tiled_image.hpp"
+#include "../undo_history.hpp"
+
+// Inputs and reference implementations shared by graphics_benchmark, which
+// times them, and graphics_tests, which checks the native code against them.
+namespace bench
+{
+  // Every kernel level, supported here or not.
+  const std::vector<graphics::KernelLevel> &kernel_levels();
+
+  // cvtColor BGR2GRAY -> GRAY2BGR followed by a masked copy: the four pass
+  // pipeline the fused desaturation kernel replaces.
+  void four_pass_desaturate(cv::Mat &image, const cv::Mat &mask);
+
+  // Filter settings: a moderate and a strong blur, and the per-pixel
+  // adjustments at typical values.
+  struct FilterCase
+  {
+    int filter;
+    const char *variant;
+    float values[graphics::kFilterValues];
+  };
+
+  const std::vector<FilterCase> &filter_cases();
+
+  // Soft and hard brushes, small and large.
+  const std::vector<graphics_brush> &brushes();
+
+  // Points a touch screen delivers per frame while painting.
+  const int kPointsPerFrame = 16;
+
+  // Paints path as a live stroke would: kPointsPerFrame points per frame,
+  // each frame rendered as one batch and only its dirty pixels blended into
+  // a patch of preview, which ends up holding what was shown. With
+  // full_redraw, every frame blends the whole stroke again instead.
+  void paint_frames(cv::Mat &preview, const cv::Mat &image, const std::vector<cv::Point2f> &path,
+                    const graphics_brush &brush, bool full_redraw);
+
+  // Composites the visible layers of stack over image one after the other,
+  // each in one pass over the whole image: the reference for the tiles.
+  cv::Mat flatten_layers(const cv::Mat &image, const graphics::LayerStack &stack);
+
+  // Layer ids of make_layers().
+  struct LayerIds
+  {
+    int paint, blur, overlay, saturation;
+  };
+
+  // A small paint layer that multiplies, a feathered blur inside a
+  // selection clear of the edges, a large overlay paint layer and a
+  // saturation boost over everything.
+  LayerIds make_layers(graphics::LayerStack &stack);
+
+  // TMPDIR, or /tmp.
+  std::string temp_directory();
+
+  cv::Mat pixels_of(const cv::Mat &image);
+  cv::Mat pixels_of(const graphics::TiledImage &image);
+
+  // Saves the pixels command can change, like session edits do, and runs it.
+  template <typename Image>
+  void edit_with_history(graphics::UndoHistory &history, Image &image, const graphics::Command &command)
+  {
+    const cv::Size size = image.size();
+    cv::Rect bounds = graphics::command_bounds(command, size);
+    if (command.stroke)
+    {
+      bounds |= command.stroke->bounds();
+    }
+    history.save(image, bounds);
+    graphics::execute_command(image, command);
+    history.commit();
+  }
+}
+
+#endif // GRAPHICS_BENCH_SCENES_HPP
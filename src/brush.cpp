@@ -0,0 +1,355 @@
+#include "brush.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "buffer_pool.hpp"
+#include "pixel_kernels.hpp"
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Entries of the stamp profile. It is indexed by the squared distance,
+    // which is dense enough near the edge, where the alpha changes, for
+    // brushes of several hundred pixels.
+    const int kProfileSize = 1024;
+    // Smallest distance between stamps, in pixels.
+    const float kMinStep = 0.5f;
+    // Rows rendered or blended per task.
+    const int kBandRows = 32;
+    // Stamps times their area below which a batch renders on the calling
+    // thread.
+    const double kParallelArea = 64 * 1024;
+
+    bool in_range(float value, float low, float high)
+    {
+      return isfinite(value) && value >= low && value <= high;
+    }
+
+    // Narrows [begin, end], distances along a segment leaving start in the
+    // unit direction, to the part whose coordinate lies in [low, high].
+    // Returns false when no part does.
+    bool clip_axis(double start, double unit, double low, double high, double &begin, double &end)
+    {
+      if (unit == 0)
+      {
+        return start >= low && start <= high;
+      }
+      double enter = (low - start) / unit;
+      double leave = (high - start) / unit;
+      if (enter > leave)
+      {
+        std::swap(enter, leave);
+      }
+      begin = std::max(begin, enter);
+      end = std::min(end, leave);
+      return begin <= end;
+    }
+
+    // Runs rows(begin, end) over bands of [top, bottom), in parallel when
+    // the work is worth it.
+    template <typename Rows>
+    void for_each_band(int top, int bottom, bool parallel, const Rows &rows)
+    {
+      const int bands = (bottom - top + kBandRows - 1) / kBandRows;
+      auto run = [&](const cv::Range &range)
+      {
+        for (int band = range.start; band < range.end; band++)
+        {
+          int begin = top + band * kBandRows;
+          rows(begin, std::min(begin + kBandRows, bottom));
+        }
+      };
+      if (parallel && bands > 1)
+      {
+        parallel_for(cv::Range(0, bands), run);
+      }
+      else
+      {
+        run(cv::Range(0, bands));
+      }
+    }
+  }
+
+  bool valid_brush(const graphics_brush &brush)
+  {
+    return in_range(brush.blue, 0, 255) && in_range(brush.green, 0, 255) && in_range(brush.red, 0, 255) &&
+           in_range(brush.size, 0.5f, 4096) && in_range(brush.hardness, 0, 1) && in_range(brush.opacity, 0, 1) &&
+           in_range(brush.spacing, 0.01f, 10);
+  }
+
+  BrushStroke::BrushStroke(cv::Size image_size, const graphics_brush &brush)
+      : BrushStroke(image_size, brush, cv::Rect(0, 0, image_size.width, image_size.height))
+  {
+  }
+
+  BrushStroke::BrushStroke(cv::Size image_size, const graphics_brush &brush, const cv::Rect &area)
+      : image_size_(image_size), area_(area & cv::Rect(0, 0, image_size.width, image_size.height)), brush_(brush)
+  {
+    // Alpha is 1 up to hardness * radius and falls off smoothly to 0 half a
+    // pixel beyond the radius; hard brushes keep a one pixel anti-aliased
+    // edge centered on the radius.
+    const float radius = brush.size / 2;
+    const float inner = std::max(0.0f, std::min(brush.hardness * radius, radius - 0.5f));
+    radius_ = radius + 0.5f;
+    step_ = std::max(kMinStep, brush.spacing * brush.size);
+
+    profile_.resize(kProfileSize);
+    profile_scale_ = (kProfileSize - 1) / (radius_ * radius_);
+    for (int i = 0; i < kProfileSize; i++)
+    {
+      float distance = sqrtf(i / profile_scale_);
+      float t = std::min(1.0f, std::max(0.0f, (distance - inner) / (radius_ - inner)));
+      float alpha = 1 - t * t * (3 - 2 * t);
+      profile_[i] = static_cast<uint8_t>(lroundf(alpha * 255));
+    }
+  }
+
+  void BrushStroke::append(const cv::Point2f *points, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      cv::Point2f point = points[i];
+      if (!isfinite(point.x) || !isfinite(point.y))
+      {
+        continue;
+      }
+      if (points_.empty())
+      {
+        stamp(point);
+        carry_ = step_;
+        points_.push_back(point);
+        continue;
+      }
+
+      // Stamps continue along the new segment where the previous one left
+      // off, so the spacing does not depend on how far apart the points are.
+      // They fall every step_ from carry_ on, but only the ones within the
+      // stamp radius of the area are placed: a point far off the image must
+      // not walk the whole segment.
+      const cv::Point2d last = points_.back();
+      const cv::Point2d delta = cv::Point2d(point) - last;
+      const double length = sqrt(delta.dot(delta));
+      if (length > 0)
+      {
+        double begin = carry_;
+        double end = length;
+        if (clip_axis(last.x, delta.x / length, area_.x - radius_, area_.x + area_.width - 1 + radius_, begin, end) &&
+            clip_axis(last.y, delta.y / length, area_.y - radius_, area_.y + area_.height - 1 + radius_, begin, end))
+        {
+          const double from = ceil((begin - carry_) / step_);
+          const double to = floor((end - carry_) / step_);
+          for (double k = from; k <= to; k++)
+          {
+            const cv::Point2d center = last + delta * ((carry_ + k * step_) / length);
+            stamp(cv::Point2f(static_cast<float>(center.x), static_cast<float>(center.y)));
+          }
+        }
+      }
+      const double passed = carry_ <= length ? floor((length - carry_) / step_) + 1 : 0;
+      carry_ = static_cast<float>(carry_ + passed * step_ - length);
+      points_.push_back(point);
+    }
+  }
+
+  void BrushStroke::clear()
+  {
+    if (!bounds_.empty())
+    {
+      layer_(bounds_ - area_.tl()).setTo(0);
+      dirty_ |= bounds_;
+    }
+    points_.clear();
+    pending_.clear();
+    carry_ = 0;
+    stamps_ = 0;
+    bounds_ = cv::Rect();
+    extent_ = cv::Rect();
+  }
+
+  void BrushStroke::stamp(cv::Point2f center)
+  {
+    pending_.push_back(center);
+    stamps_++;
+    extent_ |= stamp_rect(center);
+  }
+
+  cv::Rect BrushStroke::stamp_rect(cv::Point2f center) const
+  {
+    int left = static_cast<int>(ceilf(center.x - radius_));
+    int top = static_cast<int>(ceilf(center.y - radius_));
+    int right = static_cast<int>(floorf(center.x + radius_));
+    int bottom = static_cast<int>(floorf(center.y + radius_));
+    return cv::Rect(left, top, right - left + 1, bottom - top + 1) & area_;
+  }
+
+  void BrushStroke::render_rows(const std::vector<cv::Point2f> &stamps, int begin, int end)
+  {
+    const float radius2 = radius_ * radius_;
+    for (const cv::Point2f &center : stamps)
+    {
+      cv::Rect rect = stamp_rect(center);
+      int top = std::max(rect.y, begin);
+      int bottom = std::min(rect.y + rect.height, end);
+      for (int y = top; y < bottom; y++)
+      {
+        const float dy = y - center.y;
+        const float dy2 = dy * dy;
+        if (dy2 >= radius2)
+        {
+          continue;
+        }
+        const float half = sqrtf(radius2 - dy2);
+        const int left = std::max(rect.x, static_cast<int>(ceilf(center.x - half)));
+        const int right = std::min(rect.x + rect.width - 1, static_cast<int>(floorf(center.x + half)));
+        uint8_t *row = layer_.ptr<uint8_t>(y - area_.y);
+        for (int x = left; x <= right; x++)
+        {
+          const float dx = x - center.x;
+          const float distance2 = dx * dx + dy2;
+          if (distance2 < radius2)
+          {
+            uint8_t alpha = profile_[static_cast<int>(distance2 * profile_scale_)];
+            uint8_t &pixel = row[x - area_.x];
+            pixel = std::max(pixel, alpha);
+          }
+        }
+      }
+    }
+  }
+
+  cv::Rect BrushStroke::render()
+  {
+    if (pending_.empty())
+    {
+      return cv::Rect();
+    }
+
+    StageTimer timer(GRAPHICS_STAGE_DRAW);
+    cv::Rect batch;
+    for (const cv::Point2f &center : pending_)
+    {
+      batch |= stamp_rect(center);
+    }
+    if (!batch.empty())
+    {
+      if (layer_.empty())
+      {
+        pooled(layer_).create(area_.size(), CV_8UC1);
+        layer_.setTo(0);
+      }
+      // Every band visits every stamp but only rasterizes the rows it owns,
+      // so no two tasks write the same pixel.
+      const std::vector<cv::Point2f> &stamps = pending_;
+      const bool parallel = static_cast<double>(stamps.size()) * radius_ * radius_ * 4 > kParallelArea;
+      for_each_band(batch.y, batch.y + batch.height, parallel,
+                    [&](int begin, int end)
+                    { render_rows(stamps, begin, end); });
+      bounds_ |= batch;
+      dirty_ |= batch;
+    }
+    pending_.clear();
+    return batch;
+  }
+
+  cv::Rect BrushStroke::take_dirty()
+  {
+    cv::Rect dirty = dirty_;
+    dirty_ = cv::Rect();
+    return dirty;
+  }
+
+  void BrushStroke::composite(cv::Mat &target, const cv::Rect &rect) const
+  {
+    CV_Assert(target.type() == CV_8UC3 && target.size() == rect.size());
+    const cv::Rect area = rect & bounds_;
+    if (area.empty())
+    {
+      return;
+    }
+
+    StageTimer timer(GRAPHICS_STAGE_BLEND);
+    const int opacity = static_cast<int>(lroundf(brush_.opacity * 255));
+    const uint8_t color[3] = {cv::saturate_cast<uint8_t>(brush_.blue), cv::saturate_cast<uint8_t>(brush_.green),
+                              cv::saturate_cast<uint8_t>(brush_.red)};
+    for_each_band(area.y, area.y + area.height, area.area() > kParallelArea,
+                  [&](int begin, int end)
+                  {
+                    std::vector<uint8_t> fill(static_cast<size_t>(area.width) * 3);
+                    for (int x = 0; x < area.width; x++)
+                    {
+                      std::copy(color, color + 3, &fill[x * 3]);
+                    }
+                    std::vector<uint8_t> weights(area.width);
+                    for (int y = begin; y < end; y++)
+                    {
+                      const uint8_t *alpha = layer_.ptr<uint8_t>(y - area_.y) + (area.x - area_.x);
+                      if (opacity < 255)
+                      {
+                        for (int x = 0; x < area.width; x++)
+                        {
+                          weights[x] = static_cast<uint8_t>((alpha[x] * opacity + 127) / 255);
+                        }
+                        alpha = weights.data();
+                      }
+                      uint8_t *row = target.ptr<uint8_t>(y - rect.y) + (area.x - rect.x) * 3;
+                      blend_weighted_row(row, fill.data(), alpha, area.width);
+                    }
+                  });
+  }
+
+  void BrushStroke::composite(cv::Mat &image) const
+  {
+    CV_Assert(image.size() == image_size_);
+    if (bounds_.empty())
+    {
+      return;
+    }
+    cv::Mat target = image(bounds_);
+    composite(target, bounds_);
+  }
+
+  void BrushStroke::paint(cv::Mat &color, cv::Mat &alpha) const
+  {
+    CV_Assert(color.type() == CV_8UC3 && alpha.type() == CV_8UC1 && color.size() == image_size_ &&
+              alpha.size() == image_size_);
+    if (bounds_.empty())
+    {
+      return;
+    }
+
+    StageTimer timer(GRAPHICS_STAGE_DRAW);
+    const int opacity = static_cast<int>(lroundf(brush_.opacity * 255));
+    const uint8_t brush_color[3] = {cv::saturate_cast<uint8_t>(brush_.blue),
+                                    cv::saturate_cast<uint8_t>(brush_.green), cv::saturate_cast<uint8_t>(brush_.red)};
+    const cv::Rect area = bounds_;
+    for_each_band(area.y, area.y + area.height, area.area() > kParallelArea,
+                  [&](int begin, int end)
+                  {
+                    std::vector<uint8_t> fill(static_cast<size_t>(area.width) * 3);
+                    for (int x = 0; x < area.width; x++)
+                    {
+                      std::copy(brush_color, brush_color + 3, &fill[x * 3]);
+                    }
+                    std::vector<uint8_t> weights(area.width);
+                    for (int y = begin; y < end; y++)
+                    {
+                      const uint8_t *stamp = layer_.ptr<uint8_t>(y - area_.y) + (area.x - area_.x);
+                      uint8_t *coverage = alpha.ptr<uint8_t>(y) + area.x;
+                      for (int x = 0; x < area.width; x++)
+                      {
+                        int w = (stamp[x] * opacity + 127) / 255;
+                        int combined = w + (coverage[x] * (255 - w) + 127) / 255;
+                        // The share of the stroke in the combined color.
+                        weights[x] = combined == 0 ? 0 : static_cast<uint8_t>((w * 255 + combined / 2) / combined);
+                        coverage[x] = static_cast<uint8_t>(combined);
+                      }
+                      blend_weighted_row(color.ptr<uint8_t>(y) + area.x * 3, fill.data(), weights.data(), area.width);
+                    }
+                  });
+  }
+}
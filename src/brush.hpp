@@ -0,0 +1,103 @@
+#ifndef GRAPHICS_BRUSH_HPP
+#define GRAPHICS_BRUSH_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Rejects brushes a stroke can't be painted with, e.g. a negative size.
+  bool valid_brush(const graphics_brush &brush);
+
+  // A brush stroke painted as round stamps placed along its path every
+  // spacing * size pixels. Stamps are queued as points arrive and rendered
+  // in batches into an alpha layer, each pixel keeping the largest alpha of
+  // the stamps covering it, so overlapping stamps never build up and the
+  // result depends neither on how the points were batched nor on the order
+  // the stamps were rendered in. The layer is blended into an image with the
+  // brush color and opacity. Not thread safe.
+  class BrushStroke
+  {
+  public:
+    BrushStroke(cv::Size image_size, const graphics_brush &brush);
+    // A stroke that only renders the pixels of area, e.g. the part of a
+    // large image an edit copied out. Stamps still land in image
+    // coordinates, exactly where they land on the whole image.
+    BrushStroke(cv::Size image_size, const graphics_brush &brush, const cv::Rect &area);
+
+    // Appends points of the path in image coordinates and queues the stamps
+    // up to the last one; non-finite points are skipped, and so are stamps
+    // that would not touch the area.
+    void append(const cv::Point2f *points, size_t count);
+    // Removes the path and the layer. The pixels it covered become dirty.
+    void clear();
+
+    const std::vector<cv::Point2f> &points() const { return points_; }
+    const graphics_brush &brush() const { return brush_; }
+    cv::Size image_size() const { return image_size_; }
+
+    // Stamps placed so far, rendered or not.
+    size_t stamps() const { return stamps_; }
+
+    // Pixels the rendered stamps cover, clipped to the image and the area.
+    cv::Rect bounds() const { return bounds_; }
+    // Pixels all the stamps placed so far cover once rendered, without
+    // rendering them.
+    cv::Rect extent() const { return extent_; }
+
+    // Renders the queued stamps into the layer in one batch, on all cores
+    // for large batches. Returns the pixels the batch covered.
+    cv::Rect render();
+
+    // Pixels rendered or cleared since the previous call.
+    cv::Rect take_dirty();
+
+    // Blends the rendered layer over rect into target, a BGR image of rect's
+    // size showing that part of the image.
+    void composite(cv::Mat &target, const cv::Rect &rect) const;
+
+    // Blends the rendered layer into a BGR image of image_size().
+    void composite(cv::Mat &image) const;
+
+    // Paints the rendered layer over a layer with its own coverage: color
+    // (CV_8UC3) and alpha (CV_8UC1), both image_size(). The alphas combine
+    // like "over", and the colors so that a stroke on a transparent pixel
+    // takes the brush color.
+    void paint(cv::Mat &color, cv::Mat &alpha) const;
+
+  private:
+    void stamp(cv::Point2f center);
+    cv::Rect stamp_rect(cv::Point2f center) const;
+    void render_rows(const std::vector<cv::Point2f> &stamps, int begin, int end);
+
+    cv::Size image_size_;
+    // Pixels the layer covers, the whole image by default.
+    cv::Rect area_;
+    graphics_brush brush_;
+    // Stamp radius including the anti-aliased edge, and the distance between
+    // stamps along the path.
+    float radius_ = 0;
+    float step_ = 0;
+    // Alpha by squared distance from the stamp center, scaled by
+    // profile_scale_.
+    std::vector<uint8_t> profile_;
+    float profile_scale_ = 0;
+    std::vector<cv::Point2f> points_;
+    // Distance along the path from the last point to the next stamp.
+    float carry_ = 0;
+    std::vector<cv::Point2f> pending_;
+    size_t stamps_ = 0;
+    // CV_8UC1, area_ sized and zero outside bounds_; allocated on first use.
+    cv::Mat layer_;
+    cv::Rect bounds_;
+    cv::Rect extent_;
+    cv::Rect dirty_;
+  };
+}
+
+#endif // GRAPHICS_BRUSH_HPP
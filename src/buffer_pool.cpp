@@ -0,0 +1,261 @@
+#include "buffer_pool.hpp"
+
+#include "image_session.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Rounds bytes up to a multiple of a quarter of its power of two.
+    size_t bucket_of(size_t bytes)
+    {
+      size_t power = BufferPool::kMinBytes;
+      while (power <= bytes / 2)
+      {
+        power *= 2;
+      }
+      size_t step = power / 4;
+      return (bytes + step - 1) / step * step;
+    }
+
+    // cv::StdMatAllocator with the memory coming from buffer_pool().
+    class PoolAllocator : public cv::MatAllocator
+    {
+    public:
+      cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                             cv::AccessFlag, cv::UMatUsageFlags) const override
+      {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; i--)
+        {
+          if (step != nullptr)
+          {
+            if (data != nullptr && step[i] != CV_AUTOSTEP)
+            {
+              CV_Assert(total <= step[i]);
+              total = step[i];
+            }
+            else
+            {
+              step[i] = total;
+            }
+          }
+          total *= sizes[i];
+        }
+
+        cv::UMatData *u = new cv::UMatData(this);
+        u->data = u->origdata = static_cast<uchar *>(data != nullptr ? data : buffer_pool().acquire(total));
+        u->size = total;
+        if (data != nullptr)
+        {
+          u->flags |= cv::UMatData::USER_ALLOCATED;
+        }
+        return u;
+      }
+
+      bool allocate(cv::UMatData *u, cv::AccessFlag, cv::UMatUsageFlags) const override
+      {
+        return u != nullptr;
+      }
+
+      void deallocate(cv::UMatData *u) const override
+      {
+        if (u == nullptr)
+        {
+          return;
+        }
+
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+        {
+          buffer_pool().release(u->origdata, u->size);
+          u->origdata = nullptr;
+        }
+        delete u;
+      }
+    };
+  }
+
+  BufferPool::~BufferPool()
+  {
+    trim(0);
+  }
+
+  void *BufferPool::acquire(size_t bytes)
+  {
+    if (bytes < kMinBytes)
+    {
+      return cv::fastMalloc(bytes);
+    }
+
+    size_t capacity = bucket_of(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_use_ += capacity;
+      auto bucket = buckets_.find(capacity);
+      if (bucket != buckets_.end() && !bucket->second.empty())
+      {
+        // The most recently returned buffer is the most likely to be cached.
+        void *data = bucket->second.back().data;
+        bucket->second.pop_back();
+        retained_ -= capacity;
+        buffers_--;
+        hits_++;
+        return data;
+      }
+      misses_++;
+    }
+
+    try
+    {
+      return cv::fastMalloc(capacity);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_use_ -= capacity;
+      throw;
+    }
+  }
+
+  void BufferPool::release(void *data, size_t bytes)
+  {
+    if (data == nullptr)
+    {
+      return;
+    }
+    if (bytes < kMinBytes)
+    {
+      cv::fastFree(data);
+      return;
+    }
+
+    size_t capacity = bucket_of(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_use_ -= capacity;
+      if (capacity <= limit_)
+      {
+        buckets_[capacity].push_back(Idle{data, clock_++});
+        retained_ += capacity;
+        buffers_++;
+        trim_locked(limit_);
+        return;
+      }
+      released_ += capacity;
+    }
+    cv::fastFree(data);
+  }
+
+  void BufferPool::set_limit(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = bytes;
+    trim_locked(limit_);
+  }
+
+  size_t BufferPool::trim(size_t keep_bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return trim_locked(keep_bytes);
+  }
+
+  size_t BufferPool::trim_locked(size_t keep_bytes)
+  {
+    size_t freed = 0;
+    while (retained_ > keep_bytes)
+    {
+      // Each bucket is ordered by release time, so the oldest idle buffer is
+      // at the front of one of them.
+      auto oldest = buckets_.end();
+      for (auto bucket = buckets_.begin(); bucket != buckets_.end(); ++bucket)
+      {
+        if (!bucket->second.empty() &&
+            (oldest == buckets_.end() || bucket->second.front().released_at < oldest->second.front().released_at))
+        {
+          oldest = bucket;
+        }
+      }
+
+      cv::fastFree(oldest->second.front().data);
+      oldest->second.pop_front();
+      retained_ -= oldest->first;
+      buffers_--;
+      freed += oldest->first;
+      if (oldest->second.empty())
+      {
+        buckets_.erase(oldest);
+      }
+    }
+    released_ += freed;
+    return freed;
+  }
+
+  void BufferPool::snapshot(graphics_buffer_pool_stats &stats)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.bytes_retained = retained_;
+    stats.buffers_retained = buffers_;
+    stats.bytes_limit = limit_;
+    stats.bytes_in_use = in_use_;
+    stats.bytes_released = released_;
+  }
+
+  BufferPool &buffer_pool()
+  {
+    // Never destroyed: images released during static destruction still hand
+    // their buffers back.
+    static BufferPool *instance = new BufferPool();
+    return *instance;
+  }
+
+  cv::MatAllocator *pool_allocator()
+  {
+    static PoolAllocator *instance = new PoolAllocator();
+    return instance;
+  }
+
+  cv::Mat &pooled(cv::Mat &mat)
+  {
+    mat.allocator = pool_allocator();
+    return mat;
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT void set_buffer_pool_limit(int64_t bytes)
+  {
+    graphics::buffer_pool().set_limit(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+  }
+
+  FFI_PLUGIN_EXPORT int64_t trim_buffer_pool(int64_t keep_bytes)
+  try
+  {
+    return static_cast<int64_t>(graphics::buffer_pool().trim(keep_bytes > 0 ? static_cast<size_t>(keep_bytes) : 0));
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 0;
+  }
+
+  FFI_PLUGIN_EXPORT int get_buffer_pool_stats(graphics_buffer_pool_stats *stats)
+  try
+  {
+    if (stats == nullptr)
+    {
+      return 1;
+    }
+    graphics::buffer_pool().snapshot(*stats);
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+}
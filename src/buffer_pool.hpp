@@ -0,0 +1,82 @@
+#ifndef GRAPHICS_BUFFER_POOL_HPP
+#define GRAPHICS_BUFFER_POOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include <opencv2/opencv.hpp>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Idle pixel buffers kept for reuse, so the large temporaries of every edit
+  // (decoded frames, masks, conversions) stop going back and forth to the
+  // system allocator. Requests are rounded up to one of four buckets per power
+  // of two, which keeps the slack under 25%. Idle bytes are capped by a
+  // high-water mark; the buffers returned longest ago are freed first.
+  class BufferPool
+  {
+  public:
+    // Smaller requests bypass the pool.
+    static const size_t kMinBytes = 64 * 1024;
+    static const size_t kDefaultLimit = 256 * 1024 * 1024;
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Returns a buffer of at least bytes; throws cv::Exception when out of
+    // memory, like cv::fastMalloc. release() takes the same byte count back.
+    void *acquire(size_t bytes);
+    void release(void *data, size_t bytes);
+
+    // Sets the high-water mark and frees idle buffers above it.
+    void set_limit(size_t bytes);
+
+    // Frees idle buffers, oldest first, until at most keep_bytes stay idle.
+    // Returns the number of bytes freed.
+    size_t trim(size_t keep_bytes);
+
+    void snapshot(graphics_buffer_pool_stats &stats);
+
+  private:
+    struct Idle
+    {
+      void *data;
+      uint64_t released_at;
+    };
+
+    size_t trim_locked(size_t keep_bytes);
+
+    std::mutex mutex_;
+    std::map<size_t, std::deque<Idle>> buckets_;
+    size_t limit_ = kDefaultLimit;
+    size_t retained_ = 0;
+    size_t buffers_ = 0;
+    size_t in_use_ = 0;
+    uint64_t clock_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t released_ = 0;
+  };
+
+  // The pool shared by all native operations.
+  BufferPool &buffer_pool();
+
+  // A cv::MatAllocator over buffer_pool(). Mats allocated through it hand
+  // their memory back to the pool once the last reference goes away.
+  cv::MatAllocator *pool_allocator();
+
+  // Routes every later allocation of mat, by create() or by an OpenCV
+  // function writing into it, through the pool. Returns mat.
+  cv::Mat &pooled(cv::Mat &mat);
+}
+
+#endif // GRAPHICS_BUFFER_POOL_HPP
@@ -0,0 +1,629 @@
+#include "command_buffer.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "aixlog.hpp"
+#include "buffer_pool.hpp"
+#include "graphics.hpp"
+#include "image_ops.hpp"
+#include "region_filters.hpp"
+#include "simplify.hpp"
+#include "stats.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Bounds-checked little-endian reader over the command buffer.
+    class Reader
+    {
+    public:
+      Reader(const uint8_t *data, int32_t length) : data_(data), remaining_(length > 0 ? length : 0) {}
+
+      template <typename T>
+      bool read(T &value)
+      {
+        if (remaining_ < sizeof(T))
+        {
+          return false;
+        }
+        memcpy(&value, data_, sizeof(T));
+        data_ += sizeof(T);
+        remaining_ -= sizeof(T);
+        return true;
+      }
+
+      bool done() const { return remaining_ == 0; }
+      size_t remaining() const { return remaining_; }
+
+    private:
+      const uint8_t *data_;
+      size_t remaining_;
+    };
+
+    const char *op_name(uint16_t op)
+    {
+      switch (op)
+      {
+      case GRAPHICS_OP_GRAY_SCALE:
+        return "gray_scale";
+      case GRAPHICS_OP_DRAW_POLYGON:
+        return "draw_polygon";
+      case GRAPHICS_OP_GRAY_SCALE_POLYGON:
+        return "gray_scale_polygon";
+      case GRAPHICS_OP_FILTER_POLYGON:
+        return "filter_polygon";
+      case GRAPHICS_OP_STROKE:
+        return "stroke";
+      default:
+        return "unknown";
+      }
+    }
+
+    float param_or(const Command &command, size_t index, float fallback)
+    {
+      return index < command.params.size() ? command.params[index] : fallback;
+    }
+
+    // op, param count and point count of every command.
+    const size_t kCommandHeaderBytes = 8;
+
+    // Default blue, green, red and thickness of GRAPHICS_OP_DRAW_POLYGON.
+    const float kDrawDefaults[] = {0, 255, 0, 2};
+    // The thickest outline cv::polylines draws.
+    const float kMaxThickness = 32767;
+
+    // Default blue, green, red, size, hardness, opacity and spacing of
+    // GRAPHICS_OP_STROKE, the fields of graphics_brush in order.
+    const float kStrokeDefaults[] = {0, 255, 0, 12, 0.8f, 1, 0.1f};
+    const size_t kStrokeParams = sizeof(kStrokeDefaults) / sizeof(kStrokeDefaults[0]);
+    const size_t kStrokeSizeParam = 3;
+
+    // Param layout of GRAPHICS_OP_FILTER_POLYGON: filter id, feather, the
+    // filter's values, tolerance.
+    const size_t kFilterIdParam = 0;
+    const size_t kFilterValuesParam = 2;
+
+    // Index of the simplification tolerance param, -1 for ops without one.
+    int tolerance_param(uint16_t op)
+    {
+      switch (op)
+      {
+      case GRAPHICS_OP_DRAW_POLYGON:
+        return 4;
+      case GRAPHICS_OP_GRAY_SCALE_POLYGON:
+        return 1;
+      case GRAPHICS_OP_FILTER_POLYGON:
+        return static_cast<int>(kFilterValuesParam) + kFilterValues;
+      default:
+        return -1;
+      }
+    }
+
+    const RegionFilter *command_filter(const Command &command)
+    {
+      return find_region_filter(static_cast<int>(param_or(command, kFilterIdParam, 0)));
+    }
+
+    // The values of a filter command, with the filter's defaults for those
+    // left out.
+    void command_filter_values(const Command &command, const RegionFilter &filter, float *values)
+    {
+      for (int i = 0; i < kFilterValues; i++)
+      {
+        values[i] = param_or(command, kFilterValuesParam + i, filter.defaults[i]);
+      }
+    }
+
+    // Scales the values of a filter command that are lengths in pixels.
+    void scale_filter_values(Command &command, float factor)
+    {
+      const RegionFilter *filter = command_filter(command);
+      if (filter == nullptr)
+      {
+        return;
+      }
+      for (int i = 0; i < kFilterValues; i++)
+      {
+        if (!filter->spatial[i])
+        {
+          continue;
+        }
+        // Values left out are filled in first, their defaults are in pixels
+        // of the image the command was recorded on.
+        size_t index = kFilterValuesParam + i;
+        while (command.params.size() <= index)
+        {
+          size_t next = command.params.size();
+          command.params.push_back(next < kFilterValuesParam ? 0 : filter->defaults[next - kFilterValuesParam]);
+        }
+        command.params[index] *= factor;
+      }
+    }
+  }
+
+  int feather_param(uint16_t op)
+  {
+    switch (op)
+    {
+    case GRAPHICS_OP_GRAY_SCALE_POLYGON:
+      return 0;
+    case GRAPHICS_OP_FILTER_POLYGON:
+      return 1;
+    default:
+      return -1;
+    }
+  }
+
+  cv::Rect command_bounds(const Command &command, cv::Size size)
+  {
+    const cv::Rect image(0, 0, size.width, size.height);
+    if (command.op == GRAPHICS_OP_GRAY_SCALE || command.points.empty())
+    {
+      return image;
+    }
+    // Outlines, stamps and feathering reach beyond the vertices; a pixel of
+    // slack covers the anti-aliased edges.
+    float reach = 1;
+    switch (command.op)
+    {
+    case GRAPHICS_OP_DRAW_POLYGON:
+      reach += param_or(command, 3, kDrawDefaults[3]) / 2 + 1;
+      break;
+    case GRAPHICS_OP_STROKE:
+      reach += param_or(command, kStrokeSizeParam, kStrokeDefaults[kStrokeSizeParam]) / 2 + 1;
+      break;
+    default:
+      reach += std::max(0.0f, param_or(command, feather_param(command.op), 0));
+      break;
+    }
+    if (!isfinite(reach) || reach > size.width + size.height)
+    {
+      return image;
+    }
+    // Vertices up to pad pixels outside the image still reach into it, so
+    // the bounds are taken on the image grown by pad.
+    const int pad = static_cast<int>(ceilf(reach));
+    std::vector<cv::Point2f> shifted = command.points;
+    for (cv::Point2f &point : shifted)
+    {
+      point += cv::Point2f(pad, pad);
+    }
+    const cv::Rect bounds = polygon_bounds(shifted, cv::Size(size.width + 2 * pad, size.height + 2 * pad));
+    if (bounds.empty())
+    {
+      return cv::Rect();
+    }
+    return cv::Rect(bounds.x - 2 * pad, bounds.y - 2 * pad, bounds.width + 2 * pad, bounds.height + 2 * pad) & image;
+  }
+
+  bool parse_commands(const uint8_t *data, int32_t length, std::vector<Command> &commands)
+  {
+    Reader reader(data, length);
+    uint32_t magic = 0;
+    uint32_t count = 0;
+    if (data == nullptr || !reader.read(magic) || magic != GRAPHICS_COMMAND_MAGIC || !reader.read(count))
+    {
+      LOG(ERROR) << "Invalid command buffer header" << std::endl;
+      return false;
+    }
+
+    // Counts are checked against the bytes left before anything is sized
+    // by them, so a forged count cannot trigger a huge allocation.
+    if (count > reader.remaining() / kCommandHeaderBytes)
+    {
+      LOG(ERROR) << "Command count " << count << " exceeds the buffer" << std::endl;
+      return false;
+    }
+    std::vector<Command> parsed(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Command &command = parsed[i];
+      uint16_t num_params = 0;
+      uint32_t num_points = 0;
+      if (!reader.read(command.op) || !reader.read(num_params) || !reader.read(num_points) ||
+          num_params > reader.remaining() / sizeof(float) || num_points > reader.remaining() / (2 * sizeof(float)))
+      {
+        LOG(ERROR) << "Truncated command " << i << std::endl;
+        return false;
+      }
+
+      command.params.resize(num_params);
+      for (float &param : command.params)
+      {
+        if (!reader.read(param))
+        {
+          LOG(ERROR) << "Truncated parameters in command " << i << std::endl;
+          return false;
+        }
+      }
+
+      command.points.reserve(num_points);
+      for (uint32_t p = 0; p < num_points; p++)
+      {
+        float x = 0;
+        float y = 0;
+        if (!reader.read(x) || !reader.read(y))
+        {
+          LOG(ERROR) << "Truncated points in command " << i << std::endl;
+          return false;
+        }
+        command.points.push_back(cv::Point2f(x, y));
+      }
+      if (!valid_command(command))
+      {
+        LOG(ERROR) << "Invalid command " << i << ": " << describe_command(command) << std::endl;
+        return false;
+      }
+    }
+
+    if (!reader.done())
+    {
+      LOG(ERROR) << "Trailing bytes after " << count << " commands" << std::endl;
+      return false;
+    }
+
+    commands.swap(parsed);
+    return true;
+  }
+
+  bool valid_command(const Command &command)
+  {
+    for (float param : command.params)
+    {
+      if (!isfinite(param))
+      {
+        return false;
+      }
+    }
+    for (const cv::Point2f &point : command.points)
+    {
+      if (!isfinite(point.x) || !isfinite(point.y))
+      {
+        return false;
+      }
+    }
+    switch (command.op)
+    {
+    case GRAPHICS_OP_GRAY_SCALE:
+      return true;
+    case GRAPHICS_OP_DRAW_POLYGON:
+    case GRAPHICS_OP_GRAY_SCALE_POLYGON:
+      return !command.points.empty();
+    case GRAPHICS_OP_FILTER_POLYGON:
+    {
+      const RegionFilter *filter = command_filter(command);
+      if (command.points.empty() || filter == nullptr)
+      {
+        return false;
+      }
+      float values[kFilterValues];
+      command_filter_values(command, *filter, values);
+      return filter->valid(values);
+    }
+    case GRAPHICS_OP_STROKE:
+      return !command.points.empty() && valid_brush(command_brush(command));
+    default:
+      return false;
+    }
+  }
+
+  bool execute_command(cv::Mat &image, const Command &command)
+  {
+    switch (command.op)
+    {
+    case GRAPHICS_OP_GRAY_SCALE:
+      gray_scale_in_place(image);
+      return true;
+    case GRAPHICS_OP_DRAW_POLYGON:
+    {
+      if (command.points.empty())
+      {
+        return false;
+      }
+      cv::Scalar color(param_or(command, 0, kDrawDefaults[0]), param_or(command, 1, kDrawDefaults[1]),
+                       param_or(command, 2, kDrawDefaults[2]));
+      const float width = param_or(command, 3, kDrawDefaults[3]);
+      if (!isfinite(width))
+      {
+        return false;
+      }
+      const int thickness = static_cast<int>(std::min(std::max(width + 0.5f, 1.0f), kMaxThickness));
+      std::vector<cv::Point> points = to_cv_points(command.points);
+      StageTimer timer(GRAPHICS_STAGE_DRAW);
+      cv::polylines(image, points, true, color, thickness);
+      return true;
+    }
+    case GRAPHICS_OP_GRAY_SCALE_POLYGON:
+      if (command.points.empty())
+      {
+        return false;
+      }
+      if (command.mask && command.mask->image_size == image.size())
+      {
+        gray_scale_mask(image, *command.mask);
+        return true;
+      }
+      gray_scale_polygon(image, command.points, param_or(command, 0, 0));
+      return true;
+    case GRAPHICS_OP_FILTER_POLYGON:
+    {
+      const RegionFilter *filter = command_filter(command);
+      if (command.points.empty() || filter == nullptr)
+      {
+        LOG(ERROR) << "Unknown region filter " << param_or(command, kFilterIdParam, 0) << std::endl;
+        return false;
+      }
+      float values[kFilterValues];
+      command_filter_values(command, *filter, values);
+      if (!filter->valid(values))
+      {
+        LOG(ERROR) << "Invalid values for " << filter->name << std::endl;
+        return false;
+      }
+      if (command.mask && command.mask->image_size == image.size())
+      {
+        filter_mask(image, *command.mask, *filter, values);
+        return true;
+      }
+      filter_polygon(image, command.points, param_or(command, feather_param(command.op), 0), *filter, values);
+      return true;
+    }
+    case GRAPHICS_OP_STROKE:
+    {
+      if (command.points.empty())
+      {
+        return false;
+      }
+      if (command.stroke && command.stroke->image_size() == image.size())
+      {
+        command.stroke->composite(image);
+        return true;
+      }
+      graphics_brush brush = command_brush(command);
+      if (!valid_brush(brush))
+      {
+        LOG(ERROR) << "Invalid brush" << std::endl;
+        return false;
+      }
+      // The same engine as live strokes: on an image of the same size the
+      // stamps land and render exactly like those of the previewed stroke.
+      BrushStroke stroke(image.size(), brush);
+      stroke.append(command.points.data(), command.points.size());
+      stroke.render();
+      stroke.composite(image);
+      return true;
+    }
+    default:
+      LOG(ERROR) << "Unknown command op " << command.op << std::endl;
+      return false;
+    }
+  }
+
+  bool execute_command(TiledImage &image, const Command &command)
+  {
+    const cv::Size size = image.size();
+    const cv::Rect whole(0, 0, size.width, size.height);
+    if (command.op == GRAPHICS_OP_GRAY_SCALE)
+    {
+      image.for_each_tile(whole, [](cv::Mat &tile, const cv::Rect &)
+                          { gray_scale_in_place(tile); });
+      return true;
+    }
+
+    cv::Mat pixels;
+    pooled(pixels);
+    if (command.op == GRAPHICS_OP_STROKE && !command.points.empty())
+    {
+      // Strokes blend over the pixels they cover; a replayed one is rendered
+      // over the pixels it can reach only.
+      std::shared_ptr<const BrushStroke> stroke = command.stroke;
+      if (!stroke || stroke->image_size() != size)
+      {
+        const graphics_brush brush = command_brush(command);
+        if (!valid_brush(brush))
+        {
+          LOG(ERROR) << "Invalid brush" << std::endl;
+          return false;
+        }
+        auto replayed = std::make_shared<BrushStroke>(size, brush, command_bounds(command, size));
+        replayed->append(command.points.data(), command.points.size());
+        replayed->render();
+        stroke = replayed;
+      }
+      const cv::Rect bounds = stroke->bounds();
+      image.read(bounds, pixels);
+      record_temporary(pixels.total() * pixels.elemSize());
+      stroke->composite(pixels, bounds);
+      image.write(bounds, pixels);
+      return true;
+    }
+
+    // Everything else runs on a copy of the pixels it can change, plus the
+    // margin a region filter reads around them, with its points and mask
+    // moved into the copy's coordinates. A command missing the image still
+    // runs, on a single pixel that is not written back, so it is validated
+    // like on a whole image.
+    Command local = command;
+    cv::Rect bounds = command_bounds(command, size);
+    const int feather = feather_param(command.op);
+    if (feather >= 0 && !command.points.empty())
+    {
+      std::shared_ptr<const PolygonMask> mask = command.mask;
+      if (!mask || mask->image_size != size)
+      {
+        mask = polygon_mask(command.points, param_or(command, feather, 0), size);
+      }
+      bounds |= mask->roi;
+      local.mask = mask;
+    }
+    int margin = 0;
+    const RegionFilter *filter = command.op == GRAPHICS_OP_FILTER_POLYGON ? command_filter(command) : nullptr;
+    if (filter != nullptr)
+    {
+      float values[kFilterValues];
+      command_filter_values(command, *filter, values);
+      margin = filter->valid(values) ? filter->margin(values) : 0;
+    }
+    const cv::Rect region =
+        bounds.empty() ? cv::Rect(0, 0, std::min(1, size.width), std::min(1, size.height))
+                       : cv::Rect(bounds.x - margin, bounds.y - margin, bounds.width + 2 * margin,
+                                  bounds.height + 2 * margin) &
+                             whole;
+
+    const cv::Point2f offset(static_cast<float>(region.x), static_cast<float>(region.y));
+    for (cv::Point2f &point : local.points)
+    {
+      point -= offset;
+    }
+    if (local.mask)
+    {
+      auto moved = std::make_shared<PolygonMask>(*local.mask);
+      moved->roi = moved->roi - region.tl();
+      moved->image_size = region.size();
+      local.mask = moved;
+    }
+
+    image.read(region, pixels);
+    record_temporary(pixels.total() * pixels.elemSize());
+    if (!execute_command(pixels, local))
+    {
+      return false;
+    }
+    if (!bounds.empty())
+    {
+      image.write(bounds, pixels(bounds - region.tl()));
+    }
+    return true;
+  }
+
+  bool execute_commands(cv::Mat &image, const uint8_t *data, int32_t length)
+  {
+    std::vector<Command> commands;
+    if (!parse_commands(data, length, commands))
+    {
+      return false;
+    }
+
+    for (Command &command : commands)
+    {
+      simplify_command(command);
+      LOG(INFO) << "execute " << describe_command(command) << std::endl;
+      if (!execute_command(image, command))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void simplify_command(Command &command)
+  {
+    int index = tolerance_param(command.op);
+    if (index < 0)
+    {
+      return;
+    }
+    float tolerance = param_or(command, index, simplify_tolerance());
+    if (tolerance > 0)
+    {
+      command.points = simplify_polygon(command.points, tolerance);
+    }
+  }
+
+  Command scale_command(const Command &command, float fx, float fy)
+  {
+    Command scaled = command;
+    scaled.mask.reset();
+    scaled.stroke.reset();
+    for (cv::Point2f &point : scaled.points)
+    {
+      point.x *= fx;
+      point.y *= fy;
+    }
+    if (scaled.op == GRAPHICS_OP_DRAW_POLYGON)
+    {
+      for (size_t i = scaled.params.size(); i < 4; i++)
+      {
+        scaled.params.push_back(kDrawDefaults[i]);
+      }
+      scaled.params[3] *= (fx + fy) / 2;
+    }
+    if (scaled.op == GRAPHICS_OP_STROKE)
+    {
+      for (size_t i = scaled.params.size(); i <= kStrokeSizeParam; i++)
+      {
+        scaled.params.push_back(kStrokeDefaults[i]);
+      }
+      scaled.params[kStrokeSizeParam] *= (fx + fy) / 2;
+    }
+    int feather = feather_param(scaled.op);
+    if (feather >= 0 && static_cast<size_t>(feather) < scaled.params.size())
+    {
+      scaled.params[feather] *= (fx + fy) / 2;
+    }
+    if (scaled.op == GRAPHICS_OP_FILTER_POLYGON)
+    {
+      scale_filter_values(scaled, (fx + fy) / 2);
+    }
+    int index = tolerance_param(scaled.op);
+    if (index >= 0 && static_cast<size_t>(index) < scaled.params.size())
+    {
+      scaled.params[index] *= (fx + fy) / 2;
+    }
+    return scaled;
+  }
+
+  Command filter_command(const graphics_filter_params &params, const float *points, int num_points)
+  {
+    Command command;
+    command.op = GRAPHICS_OP_FILTER_POLYGON;
+    command.params = {static_cast<float>(params.filter), params.feather};
+    command.params.insert(command.params.end(), params.values, params.values + kFilterValues);
+    command.points = to_polygon(points, num_points);
+    return command;
+  }
+
+  Command stroke_command(const graphics_brush &brush, const std::vector<cv::Point2f> &points)
+  {
+    Command command;
+    command.op = GRAPHICS_OP_STROKE;
+    command.params = {brush.blue, brush.green, brush.red, brush.size, brush.hardness, brush.opacity, brush.spacing};
+    command.points = points;
+    return command;
+  }
+
+  graphics_brush command_brush(const Command &command)
+  {
+    float values[kStrokeParams];
+    for (size_t i = 0; i < kStrokeParams; i++)
+    {
+      values[i] = param_or(command, i, kStrokeDefaults[i]);
+    }
+    graphics_brush brush;
+    brush.blue = values[0];
+    brush.green = values[1];
+    brush.red = values[2];
+    brush.size = values[3];
+    brush.hardness = values[4];
+    brush.opacity = values[5];
+    brush.spacing = values[6];
+    return brush;
+  }
+
+  std::string describe_command(const Command &command)
+  {
+    std::ostringstream description;
+    description << op_name(command.op) << "(points=" << command.points.size();
+    for (size_t i = 0; i < command.params.size(); i++)
+    {
+      description << (i == 0 ? ", params=" : " ") << command.params[i];
+    }
+    description << ")";
+    return description.str();
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef GRAPHICS_COMMAND_BUFFER_HPP
+#define GRAPHICS_COMMAND_BUFFER_HPP
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "brush.hpp"
+#include "graphics.hpp"
+#include "polygon_mask.hpp"
+#include "tiled_image.hpp"
+
+namespace graphics
+{
+  // One decoded entry of a command buffer, see graphics_command_op in
+  // graphics.hpp for the wire format.
+  struct Command
+  {
+    uint16_t op = 0;
+    std::vector<float> params;
+    // Kept as sent, so a command can be rescaled without compounding the
+    // rounding to whole pixels.
+    std::vector<cv::Point2f> points;
+    // The coverage of points when it is already known, e.g. from a
+    // selection. Only used on an image of the size it was built for.
+    std::shared_ptr<const PolygonMask> mask;
+    // The rendered stroke of a GRAPHICS_OP_STROKE when it is already known,
+    // e.g. from a live stroke. Only used on an image of the size it was
+    // painted on.
+    std::shared_ptr<const BrushStroke> stroke;
+  };
+
+  // Parses a complete command buffer. Nothing is returned for a malformed
+  // buffer, so a batch is either executed whole or rejected up front.
+  bool parse_commands(const uint8_t *data, int32_t length, std::vector<Command> &commands);
+
+  // Whether command can run: a known op, the points and filter or brush it
+  // needs, and finite params and points. parse_commands() checks every
+  // command with it.
+  bool valid_command(const Command &command);
+
+  // Applies one command to a BGR image.
+  bool execute_command(cv::Mat &image, const Command &command);
+
+  // Applies one command to a tiled image with the same result. Only the
+  // tiles the command can change are written, and only the pixels it can
+  // change, plus what a region filter reads around them, are copied out.
+  bool execute_command(TiledImage &image, const Command &command);
+
+  // Simplifies the outline of a polygon command by its tolerance param, or
+  // the process wide default. Done once, before a command is executed and
+  // recorded, so replays keep the simplified outline.
+  void simplify_command(Command &command);
+
+  // Maps a command recorded on one image onto a version of it scaled by fx
+  // and fy: points are scaled, outlines, feathering, brushes and the blur radii
+  // of region filters get a proportional thickness, radius and size.
+  Command scale_command(const Command &command, float fx, float fy);
+
+  // Index of the feather radius param of op, -1 for ops without one.
+  int feather_param(uint16_t op);
+
+  // Pixels of an image of size that executing command can change, clipped
+  // to the image; the whole image for whole image ops.
+  cv::Rect command_bounds(const Command &command, cv::Size size);
+
+  // A GRAPHICS_OP_FILTER_POLYGON command with the settings of params, for
+  // num_points interleaved (x, y) pairs.
+  Command filter_command(const graphics_filter_params &params, const float *points, int num_points);
+
+  // A GRAPHICS_OP_STROKE command painting points, in image coordinates,
+  // with brush.
+  Command stroke_command(const graphics_brush &brush, const std::vector<cv::Point2f> &points);
+
+  // The brush of a GRAPHICS_OP_STROKE command, with defaults for the params
+  // it leaves out.
+  graphics_brush command_brush(const Command &command);
+
+  // Parses and applies a command buffer to a BGR image.
+  bool execute_commands(cv::Mat &image, const uint8_t *data, int32_t length);
+
+  // A one line summary of a command for the log, e.g. "draw_polygon(points=42)".
+  std::string describe_command(const Command &command);
+}
+
+#endif // GRAPHICS_COMMAND_BUFFER_HPP
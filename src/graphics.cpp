@@ -1,6 +1,18 @@
 #include "graphics.hpp"
 #include <opencv2/opencv.hpp>
 #include "aixlog.hpp"
+#include "command_buffer.hpp"
+#include "image_io.hpp"
+#include "image_ops.hpp"
+#include "image_session.hpp"
+#include "pixel_kernels.hpp"
+#include "stats.hpp"
+#include "stream_transcode.hpp"
+
+// Sink installed by the last init_logging(GRAPHICS_LOG_ASYNC) call. Only
+// touched through std::atomic_load() and std::atomic_store(), as
+// dropped_log_lines() may run on another isolate while it is replaced.
+static std::shared_ptr<AixLog::SinkAsync> async_log_sink;
 
 extern "C"
 {
@@ -29,9 +41,18 @@ extern "C"
 
   FFI_PLUGIN_EXPORT int init()
   {
+    return init_logging(GRAPHICS_LOG_SYNC);
+  }
+
+  FFI_PLUGIN_EXPORT int init_logging(int32_t mode)
+  try
+  {
+    if (mode != GRAPHICS_LOG_SYNC && mode != GRAPHICS_LOG_ASYNC)
+    {
+      return 1;
+    }
 
     AixLog::Severity aix_log_level = AixLog::Severity::info;
-    ;
 
     auto cout_sink = std::make_shared<AixLog::SinkCout>(
         aix_log_level,
@@ -40,14 +61,35 @@ extern "C"
     auto native =
         std::make_shared<AixLog::SinkNative>("native_log", aix_log_level);
 
-    AixLog::Log::init({cout_sink, native});
+    if (mode == GRAPHICS_LOG_ASYNC)
+    {
+      std::atomic_store(&async_log_sink, AixLog::Log::init_async({cout_sink, native}, aix_log_level));
+    }
+    else
+    {
+      AixLog::Log::init({cout_sink, native});
+      std::atomic_store(&async_log_sink, std::shared_ptr<AixLog::SinkAsync>());
+    }
 
     return 0;
   }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int64_t dropped_log_lines()
+  {
+    std::shared_ptr<AixLog::SinkAsync> sink = std::atomic_load(&async_log_sink);
+    return sink != nullptr ? static_cast<int64_t>(sink->dropped()) : 0;
+  }
 
   FFI_PLUGIN_EXPORT int process_image(const char *image_path)
+  try
   {
-    cv::Mat image = cv::imread(image_path, cv::IMREAD_COLOR);
+    graphics::OperationScope operation;
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
     if (image.empty())
     {
       std::cerr << "Could not open or find the image" << std::endl;
@@ -56,82 +98,365 @@ extern "C"
 
     // Example processing: Convert to grayscale
     cv::Mat gray_image;
-    cv::cvtColor(image, gray_image, cv::COLOR_BGR2GRAY);
+    graphics::gray_scale(image, gray_image);
 
     // Save the processed image
-    cv::imwrite(image_path, gray_image);
+    graphics::write_image(image_path, gray_image);
 
     return 0;
   }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_streaming(const char *input_path, const char *output_path,
+                                              const graphics_encode_options *options)
+  try
+  {
+    graphics::OperationScope operation;
+    if (input_path == nullptr || output_path == nullptr)
+    {
+      return 1;
+    }
+
+    switch (graphics::stream_transcode(input_path, output_path, options, graphics::bgr_to_gray_row, 1))
+    {
+    case graphics::TranscodeResult::done:
+      return 0;
+    case graphics::TranscodeResult::failed:
+      LOG(ERROR) << "Could not stream " << input_path << " to " << output_path << std::endl;
+      return 1;
+    default:
+      break;
+    }
+
+    // Inputs and outputs the band codecs don't cover go through the whole
+    // image, like process_image.
+    cv::Mat image = graphics::read_image(input_path, cv::IMREAD_COLOR);
+    if (image.empty())
+    {
+      LOG(ERROR) << "Could not open or find the image" << std::endl;
+      return 1;
+    }
+    cv::Mat gray_image;
+    graphics::gray_scale(image, gray_image);
+    return graphics::write_image(output_path, gray_image, options) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
 
   FFI_PLUGIN_EXPORT int process_image_with_points(const char *image_path, const float *points, int num_points)
+  try
   {
+    graphics::OperationScope operation;
     LOG(INFO) << "input path " << image_path << std::endl;
-    cv::Mat image = cv::imread(image_path, cv::IMREAD_COLOR);
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
     if (image.empty())
     {
       LOG(INFO) << "Could not open or find the image" << std::endl;
       return 1;
     }
 
-    // Convert points to a vector of cv::Point
-    std::vector<cv::Point> cv_points;
-    for (int i = 0; i < num_points; i++)
-    {
-      cv_points.push_back(cv::Point(points[i * 2], points[i * 2 + 1]));
-    }
+    // Convert points to a vector of cv::Point, dropping redundant vertices
+    std::vector<cv::Point> cv_points = graphics::to_cv_points(graphics::to_simplified_polygon(points, num_points));
 
     // Example processing: Draw a polygon around the points
-    cv::polylines(image, cv_points, true, cv::Scalar(0, 255, 0), 2);
+    graphics::draw_polygon(image, cv_points);
 
     // Save the processed image
-    cv::imwrite(image_path, image);
+    graphics::write_image(image_path, image);
 
     LOG(INFO) << "process image done!" << std::endl;
 
     return 0;
   }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
 
   FFI_PLUGIN_EXPORT int process_image_gray_scale(const char *image_path, const float *points, int num_points)
+  try
   {
+    graphics::OperationScope operation;
 
     LOG(INFO) << "process_image_gray_scale " << std::endl;
-    cv::Mat image = cv::imread(image_path, cv::IMREAD_COLOR);
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
     if (image.empty())
     {
       std::cerr << "Could not open or find the image" << std::endl;
       return 1;
     }
 
-    // Convert points to a vector of cv::Point
-    std::vector<cv::Point> cv_points;
-    for (int i = 0; i < num_points; i++)
+    // Convert points to a sub-pixel polygon, dropping redundant vertices
+    std::vector<cv::Point2f> polygon = graphics::to_simplified_polygon(points, num_points);
+
+    // Convert the pixels inside the polygon to grayscale
+    graphics::gray_scale_polygon(image, polygon);
+
+    // Save the processed image
+    graphics::write_image(image_path, image);
+
+    LOG(INFO) << "Process image done!" << std::endl;
+
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                              uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
     {
-      cv_points.push_back(cv::Point(points[i * 2], points[i * 2 + 1]));
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return 1;
     }
 
-    // Create a mask using the polygon defined by the points
-    cv::Mat mask = cv::Mat::zeros(image.size(), CV_8UC1);
-    cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{cv_points}, cv::Scalar(255));
-
-    // Convert the image to grayscale
     cv::Mat gray_image;
-    cv::cvtColor(image, gray_image, cv::COLOR_BGR2GRAY);
+    graphics::gray_scale(image, gray_image);
 
-    // Convert grayscale back to BGR for blending
-    cv::Mat gray_bgr;
-    cv::cvtColor(gray_image, gray_bgr, cv::COLOR_GRAY2BGR);
+    if (!graphics::encode_image(gray_image, ext, out_data, out_length))
+    {
+      LOG(ERROR) << "Could not encode the image as " << (ext ? ext : "null") << std::endl;
+      return 1;
+    }
 
-    // Blend the original image and the grayscale image using the mask
-    cv::Mat result;
-    image.copyTo(result);
-    gray_bgr.copyTo(result, mask);
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
 
-    // Save the processed image
-    cv::imwrite(image_path, result);
+  FFI_PLUGIN_EXPORT int process_image_with_points_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                          const float *points, int num_points,
+                                                          uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
+    {
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return 1;
+    }
 
-    LOG(INFO) << "Process image done!" << std::endl;
+    graphics::draw_polygon(image, graphics::to_cv_points(graphics::to_simplified_polygon(points, num_points)));
+
+    if (!graphics::encode_image(image, ext, out_data, out_length))
+    {
+      LOG(ERROR) << "Could not encode the image as " << (ext ? ext : "null") << std::endl;
+      return 1;
+    }
 
     return 0;
   }
-}
\ No newline at end of file
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_gray_scale_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                         const float *points, int num_points,
+                                                         uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
+    {
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return 1;
+    }
+
+    graphics::gray_scale_polygon(image, graphics::to_simplified_polygon(points, num_points));
+
+    if (!graphics::encode_image(image, ext, out_data, out_length))
+    {
+      LOG(ERROR) << "Could not encode the image as " << (ext ? ext : "null") << std::endl;
+      return 1;
+    }
+
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                             int32_t stride, int32_t format)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::wrap_pixels(pixels, width, height, stride, format, image))
+    {
+      LOG(ERROR) << "Invalid pixel buffer " << width << "x" << height << " format " << format << std::endl;
+      return 1;
+    }
+
+    return graphics::gray_scale_pixels(image, format) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_with_points_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                         int32_t stride, int32_t format,
+                                                         const float *points, int num_points)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::wrap_pixels(pixels, width, height, stride, format, image))
+    {
+      LOG(ERROR) << "Invalid pixel buffer " << width << "x" << height << " format " << format << std::endl;
+      return 1;
+    }
+
+    std::vector<cv::Point> cv_points = graphics::to_cv_points(graphics::to_simplified_polygon(points, num_points));
+    bool ok = graphics::with_bgr_view(image, format, [&](cv::Mat &bgr)
+                                      { graphics::draw_polygon(bgr, cv_points); });
+    return ok ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_gray_scale_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                        int32_t stride, int32_t format,
+                                                        const float *points, int num_points)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::wrap_pixels(pixels, width, height, stride, format, image))
+    {
+      LOG(ERROR) << "Invalid pixel buffer " << width << "x" << height << " format " << format << std::endl;
+      return 1;
+    }
+
+    std::vector<cv::Point2f> polygon = graphics::to_simplified_polygon(points, num_points);
+    bool ok = graphics::with_bgr_view(image, format, [&](cv::Mat &bgr)
+                                      { graphics::gray_scale_polygon(bgr, polygon); });
+    return ok ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_filter_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                    int32_t stride, int32_t format, const float *points,
+                                                    int num_points, const graphics_filter_params *params)
+  try
+  {
+    graphics::OperationScope operation;
+    if (params == nullptr || points == nullptr || num_points <= 0)
+    {
+      return 1;
+    }
+    cv::Mat image;
+    if (!graphics::wrap_pixels(pixels, width, height, stride, format, image))
+    {
+      LOG(ERROR) << "Invalid pixel buffer " << width << "x" << height << " format " << format << std::endl;
+      return 1;
+    }
+
+    graphics::Command command = graphics::filter_command(*params, points, num_points);
+    graphics::simplify_command(command);
+    bool filtered = false;
+    bool ok = graphics::with_bgr_view(image, format, [&](cv::Mat &bgr)
+                                      { filtered = graphics::execute_command(bgr, command); });
+    return ok && filtered ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT void free_buffer(uint8_t *buffer)
+  {
+    free(buffer);
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_commands(const char *image_path, const uint8_t *commands, int32_t length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
+    if (image.empty())
+    {
+      LOG(ERROR) << "Could not open or find the image" << std::endl;
+      return 1;
+    }
+
+    if (!graphics::execute_commands(image, commands, length))
+    {
+      return 1;
+    }
+
+    graphics::write_image(image_path, image);
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int process_image_commands_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                       const uint8_t *commands, int32_t commands_length,
+                                                       uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
+    {
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return 1;
+    }
+
+    if (!graphics::execute_commands(image, commands, commands_length))
+    {
+      return 1;
+    }
+
+    if (!graphics::encode_image(image, ext, out_data, out_length))
+    {
+      LOG(ERROR) << "Could not encode the image as " << (ext ? ext : "null") << std::endl;
+      return 1;
+    }
+
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+}
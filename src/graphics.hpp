@@ -1,3 +1,6 @@
+#ifndef GRAPHICS_HPP
+#define GRAPHICS_HPP
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,6 +18,260 @@
 #define FFI_PLUGIN_EXPORT
 #endif
 
+// Pixel layouts accepted by the raw buffer entry points.
+enum graphics_pixel_format
+{
+  GRAPHICS_PIXEL_GRAY8 = 0,
+  GRAPHICS_PIXEL_BGR8 = 1,
+  GRAPHICS_PIXEL_RGB8 = 2,
+  GRAPHICS_PIXEL_BGRA8 = 3,
+  GRAPHICS_PIXEL_RGBA8 = 4,
+};
+
+// Command buffers batch several operations into a single native call that
+// decodes and encodes the image once. All values are little-endian:
+//
+//   uint32 magic (GRAPHICS_COMMAND_MAGIC), uint32 command count, then per command
+//   uint16 op, uint16 param count, uint32 point count,
+//   float params[param count], float points[point count * 2] (x, y pairs).
+//
+// The buffer is plain bytes, so it can be stored and replayed as is.
+#define GRAPHICS_COMMAND_MAGIC 0x31424347u // "GCB1"
+
+enum graphics_command_op
+{
+  // Whole image to grayscale. No params, no points.
+  GRAPHICS_OP_GRAY_SCALE = 1,
+  // Closed outline through the points. Optional params: blue, green, red,
+  // thickness (default green, 2 px), simplification tolerance in pixels
+  // (default set by set_simplify_tolerance()).
+  GRAPHICS_OP_DRAW_POLYGON = 2,
+  // Area inside the polygon to grayscale, anti-aliased along the outline.
+  // Optional params: feather radius in pixels (default 0), simplification
+  // tolerance as above.
+  GRAPHICS_OP_GRAY_SCALE_POLYGON = 3,
+  // Area inside the polygon through a local adjustment, blended in by the
+  // anti-aliased coverage. Params: filter (graphics_filter), then optionally
+  // the feather radius in pixels (default 0), the filter's values (see
+  // graphics_filter) and the simplification tolerance.
+  GRAPHICS_OP_FILTER_POLYGON = 4,
+  // Brush stroke along the points, painted as round stamps (see
+  // graphics_brush). Optional params: blue, green, red, size, hardness,
+  // opacity, spacing (default green, 12 px, 0.8, 1, 0.1). Points are kept as
+  // sent, strokes are not simplified.
+  GRAPHICS_OP_STROKE = 5,
+};
+
+// Local adjustments of GRAPHICS_OP_FILTER_POLYGON and their values; values
+// left out take the defaults in parentheses.
+enum graphics_filter
+{
+  // sigma in pixels (4).
+  GRAPHICS_FILTER_GAUSSIAN_BLUR = 1,
+  // radius in pixels (4).
+  GRAPHICS_FILTER_BOX_BLUR = 2,
+  // sigma in pixels (2), amount (1), threshold in levels (0).
+  GRAPHICS_FILTER_UNSHARP_MASK = 3,
+  // brightness added, -255 to 255 (0), contrast factor around mid gray (1),
+  // gamma (1).
+  GRAPHICS_FILTER_BRIGHTNESS_CONTRAST = 4,
+  // saturation factor, 0 for grayscale (1).
+  GRAPHICS_FILTER_SATURATION = 5,
+};
+
+// One local adjustment for the *_filter_polygon exports. Unused values are
+// ignored; the simplification tolerance is the process wide one.
+typedef struct graphics_filter_params
+{
+  int32_t filter; // graphics_filter
+  float feather;  // pixels, 0 keeps the anti-aliased outline
+  float values[3];
+} graphics_filter_params;
+
+// Brush of a stroke, in the order of the GRAPHICS_OP_STROKE params.
+typedef struct graphics_brush
+{
+  float blue;
+  float green;
+  float red;
+  float size;     // stamp diameter in pixels
+  float hardness; // fraction of the radius painted fully opaque, 0 to 1
+  float opacity;  // of the whole stroke, 0 to 1; overlapping stamps don't add up
+  float spacing;  // distance between stamps as a fraction of size
+} graphics_brush;
+
+// How a layer combines with the pixels below it, per channel, before its
+// opacity and mask blend the result in.
+enum graphics_blend_mode
+{
+  GRAPHICS_BLEND_NORMAL = 0,   // the layer
+  GRAPHICS_BLEND_MULTIPLY = 1, // base * layer, darkens
+  GRAPHICS_BLEND_SCREEN = 2,   // inverse of multiplying the inverses, lightens
+  GRAPHICS_BLEND_OVERLAY = 3,  // multiply in the shadows, screen in the highlights of the base
+};
+
+// A layer of the session layer stack. Paint layers (filter 0) start empty
+// and are painted with strokes; adjustment layers run a region filter with
+// values over everything below them.
+typedef struct graphics_layer_params
+{
+  int32_t filter;     // graphics_filter, or 0 for a paint layer
+  int32_t blend_mode; // graphics_blend_mode
+  float opacity;      // 0 to 1
+  float values[3];    // filter values, see graphics_filter
+} graphics_layer_params;
+
+// Stages timed by every native operation, see get_stats().
+enum graphics_stage
+{
+  GRAPHICS_STAGE_DECODE = 0,    // imread / imdecode
+  GRAPHICS_STAGE_MASK = 1,      // polygon mask rasterization
+  GRAPHICS_STAGE_CONVERT = 2,   // whole image color conversion
+  GRAPHICS_STAGE_BLEND = 3,     // masked edits, including the fused desaturation
+  GRAPHICS_STAGE_DRAW = 4,      // outlines and brush stamps
+  GRAPHICS_STAGE_ENCODE = 5,    // imwrite / imencode
+  GRAPHICS_STAGE_FILTER = 6,    // region filters, including their blend
+  GRAPHICS_STAGE_COMPOSITE = 7, // layer stack tiles
+  GRAPHICS_STAGE_COUNT = 8,
+};
+
+typedef struct graphics_stage_stats
+{
+  uint64_t calls;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t last_ns;
+} graphics_stage_stats;
+
+typedef struct graphics_stats
+{
+  graphics_stage_stats stages[GRAPHICS_STAGE_COUNT];
+  // Exported operations completed, nested calls count once.
+  uint64_t operations;
+  // Encoded bytes read by decodes and written by encodes.
+  uint64_t bytes_decoded;
+  uint64_t bytes_encoded;
+  // Bytes of temporary images (decoded frames, masks, conversions, encode
+  // buffers) allocated by the largest and by the latest operation.
+  uint64_t peak_temporary_bytes;
+  uint64_t last_temporary_bytes;
+  // Polygon masks reused from the mask cache, and those rasterized.
+  uint64_t mask_cache_hits;
+  uint64_t mask_cache_misses;
+  // Polygon vertices passed through simplification, and those it kept.
+  uint64_t simplified_vertices_in;
+  uint64_t simplified_vertices_out;
+  // Layer stack tiles composited again after a change.
+  uint64_t composited_tiles;
+  // Tiles of tiled sessions copied by their first write while shared.
+  uint64_t copied_tiles;
+  // Parallel loops run by native operations, their wall time, and the time
+  // their threads spent in them; parallel_busy_ns / parallel_wall_ns is the
+  // parallelism they achieved.
+  uint64_t parallel_loops;
+  uint64_t parallel_wall_ns;
+  uint64_t parallel_busy_ns;
+  // Most asynchronous jobs seen running at once.
+  uint64_t peak_running_jobs;
+} graphics_stats;
+
+typedef struct graphics_buffer_pool_stats
+{
+  // Pooled allocations served by an idle buffer, and those that went to the
+  // system allocator.
+  uint64_t hits;
+  uint64_t misses;
+  // Idle bytes and buffers kept for reuse, and the high-water mark on them.
+  uint64_t bytes_retained;
+  uint64_t buffers_retained;
+  uint64_t bytes_limit;
+  // Pooled bytes held by live images.
+  uint64_t bytes_in_use;
+  // Idle bytes given back to the system by the high-water mark or trims.
+  uint64_t bytes_released;
+} graphics_buffer_pool_stats;
+
+enum graphics_affinity
+{
+  // Threads run wherever the scheduler puts them.
+  GRAPHICS_AFFINITY_ANY = 0,
+  // Threads stay off the slowest cores of a big.LITTLE CPU, those with the
+  // lowest maximum frequency. Same as ANY on CPUs with uniform cores.
+  GRAPHICS_AFFINITY_FAST_CORES = 1,
+  // Threads run on the CPUs of cpu_mask.
+  GRAPHICS_AFFINITY_MASK = 2,
+};
+
+// How native work is spread over threads, see set_thread_policy().
+typedef struct graphics_thread_policy
+{
+  // Threads native work keeps busy at once, 0 for one per allowed core.
+  int32_t total_threads;
+  // Threads one operation keeps busy, 0 for total_threads.
+  int32_t job_threads;
+  int32_t affinity; // graphics_affinity
+  // Bit n allows CPU n, for GRAPHICS_AFFINITY_MASK.
+  uint64_t cpu_mask;
+} graphics_thread_policy;
+
+// Output codecs for the *_with_options exports. GRAPHICS_FORMAT_AUTO picks the
+// codec from the file extension (or JPEG for in-memory exports).
+enum graphics_image_format
+{
+  GRAPHICS_FORMAT_AUTO = 0,
+  GRAPHICS_FORMAT_JPEG = 1,
+  GRAPHICS_FORMAT_PNG = 2,
+  GRAPHICS_FORMAT_WEBP = 3,
+  // Lossless working format for intermediate saves, see GRAPHICS_RAW_MAGIC.
+  GRAPHICS_FORMAT_RAW = 4,
+};
+
+enum graphics_raw_compression
+{
+  GRAPHICS_RAW_UNCOMPRESSED = 0,
+  GRAPHICS_RAW_LZ4 = 1,
+};
+
+// Encoder settings. Fields a codec does not use are ignored, negative values
+// keep the codec's default.
+typedef struct graphics_encode_options
+{
+  int32_t format;          // graphics_image_format
+  int32_t quality;         // JPEG and WebP, 1-100; WebP above 100 is lossless
+  int32_t progressive;     // JPEG, non-zero for a progressive scan
+  int32_t optimize;        // JPEG, non-zero to optimize the Huffman tables
+  int32_t png_compression; // PNG zlib level, 0 (fastest) to 9 (smallest)
+  int32_t raw_compression; // RAW, graphics_raw_compression
+} graphics_encode_options;
+
+// State of a session's undo history, see session_set_undo_budget().
+typedef struct graphics_undo_info
+{
+  int32_t undo_steps;
+  int32_t redo_steps;
+  // Saved pixels held in memory (compressed size if compressed), and those
+  // moved to the spill file.
+  int64_t memory_bytes;
+  int64_t disk_bytes;
+} graphics_undo_info;
+
+// The raw working format is a 24 byte little-endian header followed by the
+// pixels (8 bits per channel, BGR order, rows packed without padding):
+//
+//   uint32 magic (GRAPHICS_RAW_MAGIC), uint32 width, uint32 height,
+//   uint32 channels, uint32 compression (graphics_raw_compression),
+//   uint32 payload size in bytes
+//
+// LZ4 payloads are a single standard LZ4 block. Every decoding entry point
+// (open_image, open_image_encoded, process_image_*) accepts it next to the
+// regular codecs.
+#define GRAPHICS_RAW_MAGIC 0x31575247u // "GRW1"
+
+// Opaque handle to a decoded image kept in native memory, see open_image().
+typedef struct graphics_session graphics_session;
+typedef struct graphics_selection graphics_selection;
+typedef struct graphics_stroke graphics_stroke;
+
 extern "C" {
 // A very short-lived native function.
 //
@@ -29,4 +286,297 @@ FFI_PLUGIN_EXPORT int sum(int a, int b);
 // block Dart execution. This will cause dropped frames in Flutter applications.
 // Instead, call these native functions on a separate isolate.
 FFI_PLUGIN_EXPORT int sum_long_running(int a, int b);
-}
\ No newline at end of file
+
+// How log lines reach the console and the platform logger. Synchronous
+// logging writes from the calling thread under a global lock, asynchronous
+// logging queues lines without locking and writes them from a background
+// thread, dropping (and counting) lines when the queue is full.
+enum graphics_log_mode
+{
+  GRAPHICS_LOG_SYNC = 0,
+  GRAPHICS_LOG_ASYNC = 1,
+};
+
+// Same as init_logging(GRAPHICS_LOG_SYNC). Asynchronous logging is only
+// turned on by an explicit init_logging(GRAPHICS_LOG_ASYNC).
+FFI_PLUGIN_EXPORT int init();
+FFI_PLUGIN_EXPORT int init_logging(int32_t mode);
+// Log lines dropped by the asynchronous mode since the last init.
+FFI_PLUGIN_EXPORT int64_t dropped_log_lines();
+
+// Path based operations. Each call decodes image_path, applies the operation
+// and overwrites image_path with the result.
+FFI_PLUGIN_EXPORT int process_image(const char *image_path);
+FFI_PLUGIN_EXPORT int process_image_with_points(const char *image_path, const float *points, int num_points);
+FFI_PLUGIN_EXPORT int process_image_gray_scale(const char *image_path, const float *points, int num_points);
+// Same as process_image, streamed: the JPEG or PNG at input_path is decoded
+// in bands of rows, converted and encoded to output_path (which may be
+// input_path) as the bands arrive, on three overlapping threads, so memory
+// stays at a few bands of rows whatever the image height. The output codec
+// follows options like export_image_with_options; NULL options pick it by
+// output_path's extension with the defaults of process_image. Inputs or
+// outputs the band codecs don't cover (WebP, raw, interlaced PNG, JPEGs
+// with an EXIF orientation, builds without libjpeg and libpng) fall back to
+// decoding the whole image.
+FFI_PLUGIN_EXPORT int process_image_streaming(const char *input_path, const char *output_path,
+                                              const graphics_encode_options *options);
+
+// Encoded buffer operations. data holds a complete encoded image (JPEG, PNG,
+// ...) of length bytes. The result is encoded with the codec selected by ext
+// (".jpg", ".png", ...) into a native-owned buffer returned through out_data
+// and out_length, which must be released with free_buffer().
+FFI_PLUGIN_EXPORT int process_image_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                            uint8_t **out_data, int32_t *out_length);
+FFI_PLUGIN_EXPORT int process_image_with_points_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                        const float *points, int num_points,
+                                                        uint8_t **out_data, int32_t *out_length);
+FFI_PLUGIN_EXPORT int process_image_gray_scale_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                       const float *points, int num_points,
+                                                       uint8_t **out_data, int32_t *out_length);
+
+// Raw pixel operations. pixels is a caller-owned buffer of height rows of
+// stride bytes laid out as format (see graphics_pixel_format); a stride of 0
+// means tightly packed rows. The result is written back into pixels in place.
+FFI_PLUGIN_EXPORT int process_image_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                           int32_t stride, int32_t format);
+FFI_PLUGIN_EXPORT int process_image_with_points_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                       int32_t stride, int32_t format,
+                                                       const float *points, int num_points);
+FFI_PLUGIN_EXPORT int process_image_gray_scale_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                      int32_t stride, int32_t format,
+                                                      const float *points, int num_points);
+// Runs the region filter of params inside the polygon, like
+// GRAPHICS_OP_FILTER_POLYGON.
+FFI_PLUGIN_EXPORT int process_image_filter_pixels(uint8_t *pixels, int32_t width, int32_t height,
+                                                  int32_t stride, int32_t format, const float *points,
+                                                  int num_points, const graphics_filter_params *params);
+
+// Releases a buffer returned by one of the native functions above.
+FFI_PLUGIN_EXPORT void free_buffer(uint8_t *buffer);
+
+// Image sessions. open_image() and open_image_encoded() decode the image once
+// and return a handle (NULL on failure); the session_* functions edit the
+// decoded pixels in place without any codec work, and the image is only
+// encoded again by export_image() or export_image_encoded(). Every handle must
+// be released with close_image().
+FFI_PLUGIN_EXPORT graphics_session *open_image(const char *image_path);
+FFI_PLUGIN_EXPORT graphics_session *open_image_encoded(const uint8_t *data, int32_t length);
+FFI_PLUGIN_EXPORT int session_get_size(graphics_session *session, int32_t *width, int32_t *height);
+
+// Preview sessions decode the image at 1/2, 1/4 or 1/8 scale, the smallest
+// that still covers max_width x max_height (<= 0 leaves an axis free), so
+// edits give instant feedback on a display sized image. Points passed to the
+// session_* functions are in preview pixels as reported by
+// session_get_size(); the edits are recorded and the exports replay them on
+// the full resolution image with the coordinates rescaled.
+// session_get_source_size() reports the full resolution size.
+FFI_PLUGIN_EXPORT graphics_session *open_image_preview(const char *image_path, int32_t max_width,
+                                                       int32_t max_height);
+FFI_PLUGIN_EXPORT graphics_session *open_image_encoded_preview(const uint8_t *data, int32_t length,
+                                                               int32_t max_width, int32_t max_height);
+FFI_PLUGIN_EXPORT int session_get_source_size(graphics_session *session, int32_t *width, int32_t *height);
+
+// Tiled sessions keep the image as 256x256 copy-on-write tiles for very
+// large images. An edit copies out and writes back only the pixels it can
+// change, so its temporaries are bounded by the selection's bounding box
+// rather than the image, and exports encode a snapshot of the tiles while
+// later edits go on. Tiled sessions have no layers.
+FFI_PLUGIN_EXPORT graphics_session *open_image_tiled(const char *image_path);
+FFI_PLUGIN_EXPORT graphics_session *open_image_encoded_tiled(const uint8_t *data, int32_t length);
+
+FFI_PLUGIN_EXPORT int session_gray_scale(graphics_session *session);
+FFI_PLUGIN_EXPORT int session_draw_polygon(graphics_session *session, const float *points, int num_points);
+FFI_PLUGIN_EXPORT int session_gray_scale_polygon(graphics_session *session, const float *points, int num_points);
+// Same as GRAPHICS_OP_FILTER_POLYGON with the filter, feather and values of
+// params.
+FFI_PLUGIN_EXPORT int session_filter_polygon(graphics_session *session, const float *points, int num_points,
+                                           const graphics_filter_params *params);
+// Undo history. Every call editing the session's image (session_gray_scale,
+// session_execute, ...) is one step. Before it runs, the pixels it can
+// change are saved: its bounding box, or on tiled sessions the tiles under
+// it, shared until the edit copies them. Undo swaps them back and keeps the
+// pixels they replace for redo, so both cost the edited area rather than the
+// image. A new edit drops the redo steps. Layer changes are not recorded.
+// The history is off until session_set_undo_budget() gives it memory_bytes
+// for saved pixels, optionally LZ4 compressed (compression is a
+// graphics_raw_compression). Past the budget the oldest steps are written to
+// a file in spill_directory, or dropped if it is NULL; the most recent undo
+// and redo steps always stay in memory. A budget of 0 turns the history off
+// and frees it. session_undo() and session_redo() return 1 when there is
+// nothing to undo or redo.
+FFI_PLUGIN_EXPORT int session_set_undo_budget(graphics_session *session, int64_t memory_bytes, int32_t compression,
+                                              const char *spill_directory);
+FFI_PLUGIN_EXPORT int session_undo(graphics_session *session);
+FFI_PLUGIN_EXPORT int session_redo(graphics_session *session);
+FFI_PLUGIN_EXPORT int session_get_undo_info(graphics_session *session, graphics_undo_info *info);
+FFI_PLUGIN_EXPORT int export_image(graphics_session *session, const char *image_path);
+FFI_PLUGIN_EXPORT int export_image_encoded(graphics_session *session, const char *ext,
+                                           uint8_t **out_data, int32_t *out_length);
+// Same as export_image() and export_image_encoded() with explicit encoder
+// settings; options may be NULL for the defaults.
+FFI_PLUGIN_EXPORT int export_image_with_options(graphics_session *session, const char *image_path,
+                                                const graphics_encode_options *options);
+FFI_PLUGIN_EXPORT int export_image_encoded_with_options(graphics_session *session,
+                                                        const graphics_encode_options *options,
+                                                        uint8_t **out_data, int32_t *out_length);
+// Converts the resident image (the preview of preview sessions) to opaque
+// RGBA for display, without any codec work. The tightly packed
+// width * height * 4 byte buffer is returned through out_data and must be
+// released with free_buffer().
+FFI_PLUGIN_EXPORT int export_image_rgba(graphics_session *session, uint8_t **out_data,
+                                        int32_t *width, int32_t *height);
+FFI_PLUGIN_EXPORT void close_image(graphics_session *session);
+
+// Selections. A selection collects the vertices of a polygon as the user
+// draws it, for an image of width x height pixels; appended points are
+// interleaved (x, y) pairs multiplied by scale_x and scale_y, so they can be
+// passed on in view coordinates. The bounds and the coverage mask are updated
+// as points arrive, and session_apply_selection() runs GRAPHICS_OP_DRAW_POLYGON,
+// GRAPHICS_OP_GRAY_SCALE_POLYGON or GRAPHICS_OP_FILTER_POLYGON (with params as
+// in a command buffer) on the selection without copying its points through
+// Dart. The bounds are the pixels the polygon overlaps, clipped to the image.
+// Every handle must be released with close_selection().
+FFI_PLUGIN_EXPORT graphics_selection *create_selection(int32_t width, int32_t height, float scale_x,
+                                                      float scale_y);
+FFI_PLUGIN_EXPORT int selection_append_points(graphics_selection *selection, const float *points,
+                                              int32_t num_points);
+FFI_PLUGIN_EXPORT int selection_clear(graphics_selection *selection);
+FFI_PLUGIN_EXPORT int32_t selection_get_length(graphics_selection *selection);
+FFI_PLUGIN_EXPORT int selection_get_bounds(graphics_selection *selection, int32_t *x, int32_t *y,
+                                           int32_t *width, int32_t *height);
+FFI_PLUGIN_EXPORT int session_apply_selection(graphics_session *session, graphics_selection *selection,
+                                              int32_t op, const float *params, int32_t num_params);
+FFI_PLUGIN_EXPORT void close_selection(graphics_selection *selection);
+
+// Brush strokes. A stroke collects the path of a brush as the user paints,
+// for an image of width x height pixels, with points scaled like those of a
+// selection. Stamps are placed along the path as points arrive and rendered
+// in batches into a native alpha layer, tracking the pixels each batch
+// changes. session_preview_stroke() returns the session image with the
+// stroke blended in, as an RGBA patch of only the pixels changed since its
+// previous call (width and height 0 when nothing changed), so a frame costs
+// the same however long the stroke is. The patch is released with
+// free_buffer(). session_apply_stroke() blends the same layer into the
+// session image and records a GRAPHICS_OP_STROKE, so the committed stroke is
+// exactly the one previewed; clear the stroke before painting the next one.
+// Functions taking a stroke and a session lock the stroke first. Every handle
+// must be released with close_stroke().
+FFI_PLUGIN_EXPORT graphics_stroke *create_stroke(int32_t width, int32_t height, const graphics_brush *brush,
+                                                 float scale_x, float scale_y);
+FFI_PLUGIN_EXPORT int stroke_append_points(graphics_stroke *stroke, const float *points, int32_t num_points);
+FFI_PLUGIN_EXPORT int stroke_clear(graphics_stroke *stroke);
+FFI_PLUGIN_EXPORT int32_t stroke_get_length(graphics_stroke *stroke);
+// The pixels the points so far paint, clipped to the image, without rendering
+// the stroke.
+FFI_PLUGIN_EXPORT int stroke_get_bounds(graphics_stroke *stroke, int32_t *x, int32_t *y, int32_t *width,
+                                        int32_t *height);
+FFI_PLUGIN_EXPORT int session_preview_stroke(graphics_session *session, graphics_stroke *stroke,
+                                             uint8_t **out_data, int32_t *x, int32_t *y, int32_t *width,
+                                             int32_t *height);
+FFI_PLUGIN_EXPORT int session_apply_stroke(graphics_session *session, graphics_stroke *stroke);
+FFI_PLUGIN_EXPORT void close_stroke(graphics_stroke *stroke);
+
+// Layers. Every session has a stack of layers above its image, empty at
+// first, bottom to top in the order they were added. The stack is composited
+// in 256 x 256 tiles on all cores, and only the tiles a change can affect
+// (an edit of the image, or a layer added, removed, toggled, masked, painted
+// or updated) are composited again, so toggling a layer costs the pixels it
+// covers rather than the image. export_image_rgba() returns the composite
+// and the exports flatten the layers, replayed at full resolution for
+// preview sessions. session_add_layer() returns the new layer's id through
+// id; the other functions fail for an unknown id. A layer's mask limits it
+// to a selection, feathered by feather pixels (a NULL selection removes the
+// mask). session_paint_layer() paints a stroke onto a paint layer instead of
+// the image; clear the stroke before painting the next one.
+// session_update_layer() changes the blend mode, opacity and values of a
+// layer but not its kind or filter.
+FFI_PLUGIN_EXPORT int session_add_layer(graphics_session *session, const graphics_layer_params *params,
+                                        int32_t *id);
+FFI_PLUGIN_EXPORT int session_update_layer(graphics_session *session, int32_t id,
+                                           const graphics_layer_params *params);
+FFI_PLUGIN_EXPORT int session_set_layer_visible(graphics_session *session, int32_t id, int32_t visible);
+FFI_PLUGIN_EXPORT int session_set_layer_mask(graphics_session *session, int32_t id, graphics_selection *selection,
+                                             float feather);
+FFI_PLUGIN_EXPORT int session_paint_layer(graphics_session *session, int32_t id, graphics_stroke *stroke);
+FFI_PLUGIN_EXPORT int session_remove_layer(graphics_session *session, int32_t id);
+
+// Polygon simplification. Before a polygon is rasterized or recorded, the
+// vertices that move its outline by at most a tolerance in pixels are dropped
+// (Ramer-Douglas-Peucker), which thins out the near-collinear touch points of
+// freehand gestures. Commands and selections can pass their own tolerance as
+// a param; everything else uses the process wide one set here, 0 (keep every
+// vertex) by default. get_stats() counts the vertices before and after.
+FFI_PLUGIN_EXPORT void set_simplify_tolerance(float pixels);
+
+// Command buffer execution, see GRAPHICS_COMMAND_MAGIC for the format. The
+// whole buffer is validated before the first command runs.
+FFI_PLUGIN_EXPORT int process_image_commands(const char *image_path, const uint8_t *commands, int32_t length);
+FFI_PLUGIN_EXPORT int process_image_commands_encoded(const uint8_t *data, int32_t length, const char *ext,
+                                                     const uint8_t *commands, int32_t commands_length,
+                                                     uint8_t **out_data, int32_t *out_length);
+FFI_PLUGIN_EXPORT int session_execute(graphics_session *session, const uint8_t *commands, int32_t length);
+
+// Asynchronous jobs run on a fixed pool of native worker threads instead of a
+// Dart isolate. init_dart_api() must be called once with
+// NativeApi.initializeApiDLData and return 0 before anything is submitted.
+// Every submit_* call copies its inputs, queues the job and returns a job id,
+// or -1 if nothing was queued. On completion the array
+// [job id, status, result address, result length] is posted to port; status is
+// 0 on success and a non-null result buffer belongs to the receiver, which
+// releases it with free_buffer(). Sessions stay alive until their jobs finish
+// even if close_image() is called in the meantime.
+FFI_PLUGIN_EXPORT intptr_t init_dart_api(void *data);
+FFI_PLUGIN_EXPORT int64_t submit_session_commands(graphics_session *session, const uint8_t *commands,
+                                                  int32_t length, int64_t port);
+FFI_PLUGIN_EXPORT int64_t submit_session_export(graphics_session *session, const char *ext, int64_t port);
+FFI_PLUGIN_EXPORT int64_t submit_session_export_with_options(graphics_session *session,
+                                                             const graphics_encode_options *options,
+                                                             int64_t port);
+// The result of an RGBA export has the size reported by session_get_size().
+FFI_PLUGIN_EXPORT int64_t submit_session_export_rgba(graphics_session *session, int64_t port);
+// Applies the selection as it is when the job runs.
+FFI_PLUGIN_EXPORT int64_t submit_session_selection(graphics_session *session, graphics_selection *selection,
+                                                   int32_t op, const float *params, int32_t num_params,
+                                                   int64_t port);
+// Applies the stroke as it is when the job runs.
+FFI_PLUGIN_EXPORT int64_t submit_session_stroke(graphics_session *session, graphics_stroke *stroke,
+                                                int64_t port);
+FFI_PLUGIN_EXPORT int64_t submit_image_commands(const char *image_path, const uint8_t *commands,
+                                                int32_t length, int64_t port);
+FFI_PLUGIN_EXPORT int64_t submit_encoded_commands(const uint8_t *data, int32_t length, const char *ext,
+                                                  const uint8_t *commands, int32_t commands_length,
+                                                  int64_t port);
+
+// Native statistics. get_stats() copies a snapshot of the process wide
+// counters into stats; reset_stats() sets them back to zero. Both are cheap and
+// safe to call from any thread while operations are running.
+FFI_PLUGIN_EXPORT int get_stats(graphics_stats *stats);
+FFI_PLUGIN_EXPORT void reset_stats();
+
+// Buffer pool. Decoded images and the temporaries of every edit draw their
+// pixels from a size-bucketed pool that keeps released buffers for reuse, up
+// to a high-water mark of idle bytes (256 MB by default, 0 disables reuse).
+// trim_buffer_pool() frees idle buffers, oldest first, until at most
+// keep_bytes remain and returns the bytes freed; trim_buffer_pool(0) is the
+// answer to a memory warning. Pool counters are not affected by reset_stats().
+FFI_PLUGIN_EXPORT void set_buffer_pool_limit(int64_t bytes);
+FFI_PLUGIN_EXPORT int64_t trim_buffer_pool(int64_t keep_bytes);
+FFI_PLUGIN_EXPORT int get_buffer_pool_stats(graphics_buffer_pool_stats *stats);
+
+// Threading. By default OpenCV sizes its pool to the cores and a few
+// asynchronous jobs run at once, each free to use all of them.
+// set_thread_policy() caps OpenCV and the parallel loops of each operation at
+// job_threads and runs total_threads / job_threads asynchronous jobs at once,
+// so concurrent jobs share the budget instead of oversubscribing the cores.
+// With an affinity the worker threads and the pool threads move to the chosen
+// CPUs; threads calling the synchronous exports stay where they are. Affinity
+// needs Linux or Android and is ignored elsewhere. Returns 1 for negative
+// counts, an unknown affinity or a mask without an allowed CPU.
+// get_thread_policy() reports the policy in force with its zeros resolved and
+// cpu_mask set to the CPUs threads were moved to, 0 when they were not.
+// get_stats() reports the parallelism the operations achieved.
+FFI_PLUGIN_EXPORT int set_thread_policy(const graphics_thread_policy *policy);
+FFI_PLUGIN_EXPORT int get_thread_policy(graphics_thread_policy *policy);
+}
+
+#endif
@@ -0,0 +1,419 @@
+#include "image_io.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "graphics.hpp"
+#include "image_ops.hpp"
+#include "raw_image.hpp"
+#include "stats.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    uint64_t file_size(const char *path)
+    {
+      struct stat info;
+      return stat(path, &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+    }
+
+    bool has_extension(const char *path, const char *ext)
+    {
+      size_t length = strlen(path);
+      size_t ext_length = strlen(ext);
+      return length >= ext_length && strcasecmp(path + length - ext_length, ext) == 0;
+    }
+
+    const char *extension_of(const char *path)
+    {
+      const char *dot = strrchr(path, '.');
+      return dot != nullptr ? dot : "";
+    }
+
+    bool is_raw_extension(const char *ext)
+    {
+      return strcasecmp(ext, ".graw") == 0;
+    }
+
+    int32_t raw_compression(const graphics_encode_options *options)
+    {
+      return options != nullptr ? options->raw_compression : GRAPHICS_RAW_UNCOMPRESSED;
+    }
+
+    std::vector<int> codec_params(const graphics_encode_options *options)
+    {
+      std::vector<int> params;
+      if (options == nullptr)
+      {
+        return params;
+      }
+      if (options->quality >= 0)
+      {
+        params.insert(params.end(), {cv::IMWRITE_JPEG_QUALITY, options->quality});
+        params.insert(params.end(), {cv::IMWRITE_WEBP_QUALITY, options->quality});
+      }
+      if (options->progressive >= 0)
+      {
+        params.insert(params.end(), {cv::IMWRITE_JPEG_PROGRESSIVE, options->progressive != 0});
+      }
+      if (options->optimize >= 0)
+      {
+        params.insert(params.end(), {cv::IMWRITE_JPEG_OPTIMIZE, options->optimize != 0});
+      }
+      if (options->png_compression >= 0)
+      {
+        params.insert(params.end(), {cv::IMWRITE_PNG_COMPRESSION, options->png_compression});
+      }
+      return params;
+    }
+
+    bool write_file(const char *path, const uint8_t *data, size_t length)
+    {
+      FILE *file = fopen(path, "wb");
+      if (file == nullptr)
+      {
+        return false;
+      }
+      bool written = fwrite(data, 1, length, file) == length;
+      return fclose(file) == 0 && written;
+    }
+  }
+
+  const char *codec_extension(const graphics_encode_options *options, const char *ext)
+  {
+    switch (options != nullptr ? options->format : GRAPHICS_FORMAT_AUTO)
+    {
+    case GRAPHICS_FORMAT_JPEG:
+      return ".jpg";
+    case GRAPHICS_FORMAT_PNG:
+      return ".png";
+    case GRAPHICS_FORMAT_WEBP:
+      return ".webp";
+    case GRAPHICS_FORMAT_RAW:
+      return ".graw";
+    default:
+      return ext != nullptr && ext[0] != '\0' ? ext : ".jpg";
+    }
+  }
+
+  bool read_file(const char *path, std::vector<uint8_t> &bytes)
+  {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+      return false;
+    }
+    bytes.resize(static_cast<size_t>(file_size(path)));
+    bool ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    fclose(file);
+    return ok && !bytes.empty();
+  }
+
+  bool peek_image_size(const uint8_t *data, size_t length, cv::Size &size)
+  {
+    auto be16 = [&](size_t at)
+    { return (data[at] << 8) | data[at + 1]; };
+    auto be32 = [&](size_t at)
+    { return (static_cast<uint32_t>(be16(at)) << 16) | be16(at + 2); };
+
+    if (data == nullptr)
+    {
+      return false;
+    }
+
+    if (is_raw_image(data, length))
+    {
+      uint32_t header[3];
+      memcpy(header, data, sizeof(header));
+      size = cv::Size(static_cast<int>(header[1]), static_cast<int>(header[2]));
+      return size.width > 0 && size.height > 0;
+    }
+
+    static const uint8_t kPngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (length >= 24 && memcmp(data, kPngSignature, sizeof(kPngSignature)) == 0)
+    {
+      // The IHDR chunk always comes first.
+      size = cv::Size(static_cast<int>(be32(16)), static_cast<int>(be32(20)));
+      return size.width > 0 && size.height > 0;
+    }
+
+    if (length < 4 || data[0] != 0xff || data[1] != 0xd8)
+    {
+      return false;
+    }
+    // Walk the JPEG markers up to the first start of frame.
+    size_t at = 2;
+    while (at + 4 <= length)
+    {
+      if (data[at] != 0xff)
+      {
+        return false;
+      }
+      uint8_t marker = data[at + 1];
+      if (marker == 0xff)
+      {
+        at++; // fill byte
+        continue;
+      }
+      if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+      {
+        at += 2; // markers without a payload
+        continue;
+      }
+      bool frame = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+      if (frame)
+      {
+        if (at + 9 > length)
+        {
+          return false;
+        }
+        size = cv::Size(be16(at + 7), be16(at + 5));
+        return size.width > 0 && size.height > 0;
+      }
+      at += 2 + be16(at + 2);
+    }
+    return false;
+  }
+
+  cv::Mat read_image(const char *path, int flags)
+  {
+    // Decoding from memory lets the frame land in a pooled buffer, which
+    // imread can't do.
+    std::vector<uint8_t> bytes;
+    cv::Mat image;
+    if (path == nullptr || !read_file(path, bytes) || bytes.size() > INT32_MAX ||
+        !decode_image(bytes.data(), static_cast<int32_t>(bytes.size()), flags, image))
+    {
+      return cv::Mat();
+    }
+    return image;
+  }
+
+  bool write_image(const char *path, const cv::Mat &image, const graphics_encode_options *options)
+  {
+    if (path == nullptr)
+    {
+      return false;
+    }
+
+    const char *ext = codec_extension(options, extension_of(path));
+    bool written;
+    {
+      StageTimer timer(GRAPHICS_STAGE_ENCODE);
+      if (is_raw_extension(ext))
+      {
+        int32_t compression = raw_compression(options);
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[raw_image_bound(image, compression)]);
+        size_t length = encode_raw_image(image, compression, buffer.get());
+        written = length > 0 && write_file(path, buffer.get(), length);
+      }
+      else if (options == nullptr || options->format == GRAPHICS_FORMAT_AUTO)
+      {
+        written = cv::imwrite(path, image, codec_params(options));
+      }
+      else
+      {
+        // The codec is not the one the path's extension would select.
+        std::vector<uchar> encoded;
+        written = cv::imencode(ext, image, encoded, codec_params(options)) &&
+                  write_file(path, encoded.data(), encoded.size());
+      }
+    }
+    if (written)
+    {
+      record_bytes_encoded(file_size(path));
+    }
+    return written;
+  }
+
+  bool decode_image(const uint8_t *data, int32_t length, int flags, cv::Mat &image)
+  {
+    if (data == nullptr || length <= 0)
+    {
+      return false;
+    }
+
+    {
+      StageTimer timer(GRAPHICS_STAGE_DECODE);
+      cv::Mat decoded;
+      pooled(decoded);
+      if (is_raw_image(data, length))
+      {
+        decode_raw_image(data, length, flags, decoded);
+      }
+      else
+      {
+        // imdecode only reads the buffer, the header just avoids copying it.
+        cv::Mat encoded(1, length, CV_8UC1, const_cast<uint8_t *>(data));
+        cv::imdecode(encoded, flags, &decoded);
+      }
+      image = decoded;
+    }
+    if (image.empty())
+    {
+      return false;
+    }
+    record_bytes_decoded(length);
+    record_temporary(image.total() * image.elemSize());
+    return true;
+  }
+
+  bool encode_image(const cv::Mat &image, const char *ext, uint8_t **out_data, int32_t *out_length)
+  {
+    return encode_image(image, ext, nullptr, out_data, out_length);
+  }
+
+  bool encode_image(const cv::Mat &image, const char *ext, const graphics_encode_options *options,
+                    uint8_t **out_data, int32_t *out_length)
+  {
+    if (out_data == nullptr || out_length == nullptr)
+    {
+      return false;
+    }
+
+    ext = codec_extension(options, ext);
+    uint8_t *buffer = nullptr;
+    size_t length = 0;
+    {
+      StageTimer timer(GRAPHICS_STAGE_ENCODE);
+      if (is_raw_extension(ext))
+      {
+        // Encoded straight into the returned buffer, for uncompressed images
+        // this is a single copy of the pixels.
+        int32_t compression = raw_compression(options);
+        size_t bound = raw_image_bound(image, compression);
+        if (bound > INT32_MAX || (buffer = static_cast<uint8_t *>(malloc(bound))) == nullptr)
+        {
+          return false;
+        }
+        length = encode_raw_image(image, compression, buffer);
+        if (length == 0)
+        {
+          free(buffer);
+          return false;
+        }
+      }
+      else
+      {
+        std::vector<uchar> encoded;
+        if (!cv::imencode(ext, image, encoded, codec_params(options)) || encoded.size() > INT32_MAX ||
+            (buffer = static_cast<uint8_t *>(malloc(encoded.size()))) == nullptr)
+        {
+          return false;
+        }
+        memcpy(buffer, encoded.data(), encoded.size());
+        length = encoded.size();
+      }
+    }
+    record_bytes_encoded(length);
+    record_temporary(length);
+
+    *out_data = buffer;
+    *out_length = static_cast<int32_t>(length);
+    return true;
+  }
+
+  static int channels_of(int32_t format)
+  {
+    switch (format)
+    {
+    case GRAPHICS_PIXEL_GRAY8:
+      return 1;
+    case GRAPHICS_PIXEL_BGR8:
+    case GRAPHICS_PIXEL_RGB8:
+      return 3;
+    case GRAPHICS_PIXEL_BGRA8:
+    case GRAPHICS_PIXEL_RGBA8:
+      return 4;
+    default:
+      return 0;
+    }
+  }
+
+  bool wrap_pixels(uint8_t *pixels, int32_t width, int32_t height, int32_t stride,
+                   int32_t format, cv::Mat &image)
+  {
+    int channels = channels_of(format);
+    if (pixels == nullptr || width <= 0 || height <= 0 || channels == 0)
+    {
+      return false;
+    }
+    // The row and the buffer must stay addressable with int32 arithmetic,
+    // or a large width wraps around and passes the stride check.
+    const int64_t row_bytes = static_cast<int64_t>(width) * channels;
+    if (row_bytes > INT32_MAX)
+    {
+      return false;
+    }
+    if (stride == 0)
+    {
+      stride = static_cast<int32_t>(row_bytes);
+    }
+    if (stride < row_bytes || static_cast<int64_t>(stride) * height > INT32_MAX)
+    {
+      return false;
+    }
+
+    image = cv::Mat(height, width, CV_8UC(channels), pixels, stride);
+    return true;
+  }
+
+  bool with_bgr_view(cv::Mat &pixels, int32_t format, const std::function<void(cv::Mat &)> &op)
+  {
+    if (format == GRAPHICS_PIXEL_BGR8)
+    {
+      op(pixels);
+      return true;
+    }
+
+    cv::Mat bgr;
+    pooled(bgr);
+    switch (format)
+    {
+    case GRAPHICS_PIXEL_GRAY8:
+      cv::cvtColor(pixels, bgr, cv::COLOR_GRAY2BGR);
+      op(bgr);
+      cv::cvtColor(bgr, pixels, cv::COLOR_BGR2GRAY);
+      return true;
+    case GRAPHICS_PIXEL_RGB8:
+      cv::cvtColor(pixels, bgr, cv::COLOR_RGB2BGR);
+      op(bgr);
+      cv::cvtColor(bgr, pixels, cv::COLOR_BGR2RGB);
+      return true;
+    case GRAPHICS_PIXEL_BGRA8:
+    case GRAPHICS_PIXEL_RGBA8:
+    {
+      // Move only the color channels so the caller's alpha survives the round trip.
+      const int bgra_pairs[] = {0, 0, 1, 1, 2, 2};
+      const int rgba_pairs[] = {0, 2, 1, 1, 2, 0};
+      const int *from_to = format == GRAPHICS_PIXEL_BGRA8 ? bgra_pairs : rgba_pairs;
+
+      bgr.create(pixels.size(), CV_8UC3);
+      cv::mixChannels(&pixels, 1, &bgr, 1, from_to, 3);
+      op(bgr);
+      cv::mixChannels(&bgr, 1, &pixels, 1, from_to, 3);
+      return true;
+    }
+    default:
+      return false;
+    }
+  }
+
+  bool gray_scale_pixels(cv::Mat &pixels, int32_t format)
+  {
+    if (format == GRAPHICS_PIXEL_GRAY8)
+    {
+      return true;
+    }
+
+    return with_bgr_view(pixels, format, gray_scale_in_place);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef GRAPHICS_IMAGE_IO_HPP
+#define GRAPHICS_IMAGE_IO_HPP
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Extension selecting the codec: the options' format if set, else ext,
+  // else ".jpg".
+  const char *codec_extension(const graphics_encode_options *options, const char *ext);
+
+  // Reads the whole file at path into bytes.
+  bool read_file(const char *path, std::vector<uint8_t> &bytes);
+
+  // Reads and decodes the image file at path, empty on failure. Raw working
+  // images are recognized by their header.
+  cv::Mat read_image(const char *path, int flags);
+
+  // Encodes image to path with the codec of options, or the one selected by
+  // the path's extension for GRAPHICS_FORMAT_AUTO and NULL options.
+  bool write_image(const char *path, const cv::Mat &image, const graphics_encode_options *options = nullptr);
+
+  // Reads the pixel size of an encoded JPEG, PNG or raw image from its header
+  // without decoding it. False for other formats or a truncated header.
+  bool peek_image_size(const uint8_t *data, size_t length, cv::Size &size);
+
+  // Decodes an encoded image (JPEG, PNG, WebP, raw, ...) held in memory.
+  bool decode_image(const uint8_t *data, int32_t length, int flags, cv::Mat &image);
+
+  // Encodes image with the codec selected by ext (".jpg", ".png", ...) into a
+  // malloc'd buffer. The caller owns the buffer and releases it with free_buffer().
+  bool encode_image(const cv::Mat &image, const char *ext, uint8_t **out_data, int32_t *out_length);
+
+  // Same with explicit encoder settings; options' format takes precedence
+  // over ext unless it is GRAPHICS_FORMAT_AUTO.
+  bool encode_image(const cv::Mat &image, const char *ext, const graphics_encode_options *options,
+                    uint8_t **out_data, int32_t *out_length);
+
+  // Wraps caller-owned pixels in a cv::Mat header without copying them. Fails
+  // on a stride shorter than a row or a buffer larger than INT32_MAX bytes.
+  bool wrap_pixels(uint8_t *pixels, int32_t width, int32_t height, int32_t stride,
+                   int32_t format, cv::Mat &image);
+
+  // Runs op on a BGR view of pixels laid out as format. BGR8 buffers are handed
+  // to op directly; every other layout goes through a temporary and only the
+  // color channels are written back, so alpha is preserved.
+  bool with_bgr_view(cv::Mat &pixels, int32_t format, const std::function<void(cv::Mat &)> &op);
+
+  // Replaces the color channels of pixels with their luminance in place.
+  bool gray_scale_pixels(cv::Mat &pixels, int32_t format);
+}
+
+#endif // GRAPHICS_IMAGE_IO_HPP
@@ -0,0 +1,110 @@
+#include "image_ops.hpp"
+
+#include "buffer_pool.hpp"
+#include "pixel_kernels.hpp"
+#include "polygon_mask.hpp"
+#include "simplify.hpp"
+#include "stats.hpp"
+
+namespace graphics
+{
+  std::vector<cv::Point> to_cv_points(const float *points, int num_points)
+  {
+    std::vector<cv::Point> cv_points;
+    cv_points.reserve(num_points > 0 ? num_points : 0);
+    for (int i = 0; i < num_points; i++)
+    {
+      cv_points.push_back(cv::Point(points[i * 2], points[i * 2 + 1]));
+    }
+    return cv_points;
+  }
+
+  std::vector<cv::Point> to_cv_points(const std::vector<cv::Point2f> &polygon)
+  {
+    std::vector<cv::Point> cv_points;
+    cv_points.reserve(polygon.size());
+    for (const cv::Point2f &point : polygon)
+    {
+      cv_points.push_back(cv::Point(static_cast<int>(point.x), static_cast<int>(point.y)));
+    }
+    return cv_points;
+  }
+
+  std::vector<cv::Point2f> to_polygon(const float *points, int num_points)
+  {
+    std::vector<cv::Point2f> polygon;
+    polygon.reserve(num_points > 0 ? num_points : 0);
+    for (int i = 0; i < num_points; i++)
+    {
+      polygon.push_back(cv::Point2f(points[i * 2], points[i * 2 + 1]));
+    }
+    return polygon;
+  }
+
+  std::vector<cv::Point2f> to_simplified_polygon(const float *points, int num_points)
+  {
+    return simplify_polygon(to_polygon(points, num_points), simplify_tolerance());
+  }
+
+  void gray_scale(const cv::Mat &image, cv::Mat &gray)
+  {
+    StageTimer timer(GRAPHICS_STAGE_CONVERT);
+    cv::cvtColor(image, pooled(gray), cv::COLOR_BGR2GRAY);
+    record_temporary(gray.total());
+  }
+
+  void gray_scale_in_place(cv::Mat &image)
+  {
+    StageTimer timer(GRAPHICS_STAGE_CONVERT);
+    cv::Mat gray_image;
+    cv::cvtColor(image, pooled(gray_image), cv::COLOR_BGR2GRAY);
+    cv::cvtColor(gray_image, image, cv::COLOR_GRAY2BGR);
+    record_temporary(gray_image.total());
+  }
+
+  cv::Rect polygon_roi(const std::vector<cv::Point> &points, cv::Size size)
+  {
+    if (points.empty())
+    {
+      return cv::Rect();
+    }
+    return cv::boundingRect(points) & cv::Rect(0, 0, size.width, size.height);
+  }
+
+  void rasterize_mask(const std::vector<cv::Point> &points, const cv::Rect &roi, cv::Mat &mask)
+  {
+    StageTimer timer(GRAPHICS_STAGE_MASK);
+    pooled(mask).create(roi.size(), CV_8UC1);
+    mask.setTo(cv::Scalar(0));
+    cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{points}, cv::Scalar(255),
+                 cv::LINE_8, 0, -roi.tl());
+    record_temporary(mask.total());
+  }
+
+  void draw_polygon(cv::Mat &image, const std::vector<cv::Point> &points)
+  {
+    StageTimer timer(GRAPHICS_STAGE_DRAW);
+    cv::polylines(image, points, true, cv::Scalar(0, 255, 0), 2);
+  }
+
+  void gray_scale_polygon(cv::Mat &image, const std::vector<cv::Point2f> &polygon, float feather)
+  {
+    // Pixels outside the mask's region of interest never change, so all the
+    // work below is limited to it. Repeated selections reuse a cached mask.
+    gray_scale_mask(image, *polygon_mask(polygon, feather, image.size()));
+  }
+
+  void gray_scale_mask(cv::Mat &image, const PolygonMask &mask)
+  {
+    if (mask.roi.empty())
+    {
+      return;
+    }
+    cv::Mat region = image(mask.roi);
+
+    // Blend the region towards its luminance by the mask's coverage in a
+    // single fused pass
+    StageTimer timer(GRAPHICS_STAGE_BLEND);
+    desaturate_weighted(region, mask.coverage);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef GRAPHICS_IMAGE_OPS_HPP
+#define GRAPHICS_IMAGE_OPS_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "polygon_mask.hpp"
+
+namespace graphics
+{
+  // Converts num_points interleaved (x, y) pairs to OpenCV points.
+  std::vector<cv::Point> to_cv_points(const float *points, int num_points);
+
+  // Truncates a sub-pixel polygon to whole pixels.
+  std::vector<cv::Point> to_cv_points(const std::vector<cv::Point2f> &polygon);
+
+  // Converts num_points interleaved (x, y) pairs to a sub-pixel polygon.
+  std::vector<cv::Point2f> to_polygon(const float *points, int num_points);
+
+  // Same as to_polygon(), simplified by the process wide tolerance (see
+  // simplify_polygon()).
+  std::vector<cv::Point2f> to_simplified_polygon(const float *points, int num_points);
+
+  // Converts a BGR image to a single channel grayscale image.
+  void gray_scale(const cv::Mat &image, cv::Mat &gray);
+
+  // Converts a BGR image to grayscale while keeping it BGR, so later color
+  // edits still apply.
+  void gray_scale_in_place(cv::Mat &image);
+
+  // Bounding box of points clipped to an image of the given size. Empty when
+  // the polygon lies completely outside the image.
+  cv::Rect polygon_roi(const std::vector<cv::Point> &points, cv::Size size);
+
+  // Rasterizes the polygon (in image coordinates) into a CV_8UC1 mask that
+  // covers roi only: 255 inside the polygon, 0 outside, with aliased edges.
+  // The hard-edged reference for the anti-aliased masks of polygon_mask.hpp.
+  void rasterize_mask(const std::vector<cv::Point> &points, const cv::Rect &roi, cv::Mat &mask);
+
+  // Draws a closed outline through points onto a BGR image.
+  void draw_polygon(cv::Mat &image, const std::vector<cv::Point> &points);
+
+  // Converts the pixels of a BGR image inside the polygon to grayscale, with
+  // an anti-aliased outline softened by feather pixels (see polygon_mask()).
+  // Only the mask's bounding box is touched, so the cost scales with the
+  // selection.
+  void gray_scale_polygon(cv::Mat &image, const std::vector<cv::Point2f> &polygon, float feather = 0);
+
+  // Converts the pixels of a BGR image to grayscale by the coverage of mask,
+  // which must have been built for an image of this size.
+  void gray_scale_mask(cv::Mat &image, const PolygonMask &mask);
+}
+
+#endif // GRAPHICS_IMAGE_OPS_HPP
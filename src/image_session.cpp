@@ -0,0 +1,1141 @@
+#include "image_session.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <exception>
+
+#include "aixlog.hpp"
+#include "buffer_pool.hpp"
+#include "command_buffer.hpp"
+#include "graphics.hpp"
+#include "image_io.hpp"
+#include "image_ops.hpp"
+#include "pixel_kernels.hpp"
+#include "region_filters.hpp"
+#include "selection.hpp"
+#include "stats.hpp"
+#include "stroke.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  void retain_session(graphics_session *session)
+  {
+    session->references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release_session(graphics_session *session)
+  {
+    if (session->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      delete session;
+    }
+  }
+
+  void log_exception(const char *function)
+  {
+    try
+    {
+      throw;
+    }
+    catch (const std::exception &e)
+    {
+      LOG(ERROR) << function << " failed: " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << function << " failed" << std::endl;
+    }
+  }
+
+  namespace
+  {
+    // Largest of the IMREAD_REDUCED_* factors that keeps the image at least
+    // max_width x max_height; a bound <= 0 does not constrain its axis.
+    int preview_scale(cv::Size size, int32_t max_width, int32_t max_height)
+    {
+      for (int scale : {8, 4, 2})
+      {
+        int width = (size.width + scale - 1) / scale;
+        int height = (size.height + scale - 1) / scale;
+        if ((max_width <= 0 || width >= max_width) && (max_height <= 0 || height >= max_height))
+        {
+          return scale;
+        }
+      }
+      return 1;
+    }
+
+    int reduced_color_flag(int scale)
+    {
+      switch (scale)
+      {
+      case 8:
+        return cv::IMREAD_REDUCED_COLOR_8;
+      case 4:
+        return cv::IMREAD_REDUCED_COLOR_4;
+      case 2:
+        return cv::IMREAD_REDUCED_COLOR_2;
+      default:
+        return cv::IMREAD_COLOR;
+      }
+    }
+
+    graphics_session *open_preview(std::vector<uint8_t> &&source, int32_t max_width, int32_t max_height)
+    {
+      cv::Size size;
+      cv::Mat image;
+      int scale = 1;
+      int32_t length = static_cast<int32_t>(source.size());
+      if (graphics::peek_image_size(source.data(), source.size(), size))
+      {
+        // JPEG scales while decoding (IDCT scaling), the other codecs decode
+        // at full size first.
+        scale = preview_scale(size, max_width, max_height);
+        graphics::decode_image(source.data(), length, reduced_color_flag(scale), image);
+      }
+      else if (graphics::decode_image(source.data(), length, cv::IMREAD_COLOR, image))
+      {
+        size = image.size();
+        scale = preview_scale(size, max_width, max_height);
+      }
+      if (image.empty())
+      {
+        LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+        return nullptr;
+      }
+
+      // The header size ignores the EXIF orientation the decoder applied.
+      if ((size.width > size.height) != (image.cols > image.rows))
+      {
+        std::swap(size.width, size.height);
+      }
+      cv::Size preview((size.width + scale - 1) / scale, (size.height + scale - 1) / scale);
+      if (image.cols > preview.width)
+      {
+        cv::resize(image, image, preview, 0, 0, cv::INTER_AREA);
+      }
+
+      graphics_session *session = new graphics_session();
+      session->image = image;
+      session->source_size = size;
+      if (scale > 1)
+      {
+        session->source = std::move(source);
+      }
+      return session;
+    }
+
+    bool tiled(const graphics_session *session)
+    {
+      return !session->tiles.empty();
+    }
+
+    // Size of the resident image.
+    cv::Size image_size(const graphics_session *session)
+    {
+      return tiled(session) ? session->tiles.size() : session->image.size();
+    }
+
+    // Applies command to the resident image and records it on previews, as
+    // part of the open undo step.
+    bool apply_command(graphics_session *session, graphics::Command &&command)
+    {
+      graphics::simplify_command(command);
+      LOG(INFO) << "execute " << graphics::describe_command(command) << std::endl;
+      const cv::Size size = image_size(session);
+      if (session->undo.enabled())
+      {
+        // The pixels a precomputed mask or stroke covers may reach past the
+        // bounds of the vertices.
+        cv::Rect bounds = graphics::command_bounds(command, size);
+        if (command.mask && command.mask->image_size == size)
+        {
+          bounds |= command.mask->roi;
+        }
+        if (command.stroke && command.stroke->image_size() == size)
+        {
+          bounds |= command.stroke->bounds();
+        }
+        if (tiled(session))
+        {
+          session->undo.save(session->tiles, bounds);
+        }
+        else
+        {
+          session->undo.save(session->image, bounds);
+        }
+      }
+      if (tiled(session) ? !graphics::execute_command(session->tiles, command)
+                         : !graphics::execute_command(session->image, command))
+      {
+        return false;
+      }
+      if (session->layers)
+      {
+        session->layers->invalidate(graphics::command_bounds(command, session->image.size()));
+      }
+      if (!session->source.empty())
+      {
+        // Replays rasterize again at full resolution.
+        command.mask.reset();
+        command.stroke.reset();
+        session->history.push_back(std::move(command));
+        session->undo.record_replay();
+      }
+      return true;
+    }
+
+    // apply_command() as an undo step of its own.
+    bool apply(graphics_session *session, graphics::Command &&command)
+    {
+      bool ok = apply_command(session, std::move(command));
+      session->undo.commit();
+      return ok;
+    }
+
+    // Undoes or redoes one step of the session's undo history.
+    bool step_history(graphics_session *session, bool undo)
+    {
+      std::vector<cv::Rect> changed;
+      bool ok;
+      if (tiled(session))
+      {
+        ok = undo ? session->undo.undo(session->tiles, session->history, changed)
+                  : session->undo.redo(session->tiles, session->history, changed);
+      }
+      else
+      {
+        ok = undo ? session->undo.undo(session->image, session->history, changed)
+                  : session->undo.redo(session->image, session->history, changed);
+      }
+      if (session->layers)
+      {
+        for (const cv::Rect &rect : changed)
+        {
+          session->layers->invalidate(rect);
+        }
+      }
+      return ok;
+    }
+
+    graphics::Command polygon_command(uint16_t op, const float *points, int num_points)
+    {
+      graphics::Command command;
+      command.op = op;
+      command.points.reserve(num_points);
+      for (int i = 0; i < num_points; i++)
+      {
+        command.points.push_back(cv::Point2f(points[i * 2], points[i * 2 + 1]));
+      }
+      return command;
+    }
+
+    // The image at full resolution: the resident one, or for previews the
+    // source decoded again with the recorded edits replayed on it.
+    bool full_image(graphics_session *session, cv::Mat &image)
+    {
+      if (session->source.empty())
+      {
+        image = session->image;
+        return true;
+      }
+
+      if (!graphics::decode_image(session->source.data(), static_cast<int32_t>(session->source.size()),
+                                  cv::IMREAD_COLOR, image))
+      {
+        return false;
+      }
+      float fx = static_cast<float>(image.cols) / session->image.cols;
+      float fy = static_cast<float>(image.rows) / session->image.rows;
+      for (const graphics::Command &command : session->history)
+      {
+        if (!graphics::execute_command(image, graphics::scale_command(command, fx, fy)))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // The image to show or export: the resident one with its layers.
+    const cv::Mat &displayed_image(graphics_session *session)
+    {
+      if (session->layers && !session->layers->empty())
+      {
+        return session->layers->composite(session->image);
+      }
+      return session->image;
+    }
+
+    // full_image() with the layers flattened onto it; previews rebuild them
+    // at full resolution.
+    bool flattened_image(graphics_session *session, cv::Mat &image)
+    {
+      if (!full_image(session, image))
+      {
+        return false;
+      }
+      if (!session->layers || session->layers->empty())
+      {
+        return true;
+      }
+      if (session->source.empty())
+      {
+        image = session->layers->composite(session->image);
+        return true;
+      }
+      graphics::LayerStack layers = session->layers->scaled(image.size());
+      image = layers.composite(image);
+      return true;
+    }
+
+    // Runs encode on the image to export. Tiled sessions are unlocked once
+    // their tiles are snapshotted: edits carry on while the snapshot is
+    // encoded and only copy the tiles they write. Other sessions stay locked.
+    template <typename Encode>
+    bool encode_session(graphics_session *session, const Encode &encode)
+    {
+      std::unique_lock<std::mutex> lock(session->mutex);
+      if (tiled(session))
+      {
+        const graphics::TiledImage snapshot = session->tiles;
+        lock.unlock();
+        return encode(snapshot.to_mat());
+      }
+      cv::Mat image;
+      return flattened_image(session, image) && encode(image);
+    }
+
+    // export_image_rgba() of a snapshot of a tiled session, converted tile by
+    // tile straight into the RGBA buffer.
+    int export_tiles_rgba(const graphics::TiledImage &tiles, uint8_t **out_data, int32_t *width, int32_t *height)
+    {
+      const cv::Size size = tiles.size();
+      size_t length = static_cast<size_t>(size.width) * size.height * 4;
+      uint8_t *buffer = nullptr;
+      if (length == 0 || length > INT32_MAX || (buffer = static_cast<uint8_t *>(malloc(length))) == nullptr)
+      {
+        LOG(ERROR) << "Could not allocate " << length << " bytes of RGBA" << std::endl;
+        return 1;
+      }
+      {
+        graphics::StageTimer timer(GRAPHICS_STAGE_CONVERT);
+        graphics::parallel_for(cv::Range(0, tiles.tile_count()), [&](const cv::Range &range)
+                               {
+                                 for (int i = range.start; i < range.end; i++)
+                                 {
+                                   const cv::Rect rect = tiles.tile_rect(i);
+                                   const cv::Mat &tile = tiles.tile(i);
+                                   for (int y = 0; y < rect.height; y++)
+                                   {
+                                     uint8_t *row =
+                                         buffer + (static_cast<size_t>(rect.y + y) * size.width + rect.x) * 4;
+                                     graphics::bgr_to_rgba_row(tile.ptr<uint8_t>(y), row, rect.width);
+                                   }
+                                 } });
+      }
+      *out_data = buffer;
+      *width = size.width;
+      *height = size.height;
+      return 0;
+    }
+
+    graphics_session *open_tiled(const cv::Mat &image)
+    {
+      graphics_session *session = new graphics_session();
+      session->tiles = graphics::TiledImage(image);
+      return session;
+    }
+
+    // Resolves the filter of a layer (nullptr for paint layers) and checks
+    // the rest of params.
+    bool layer_settings(const graphics_layer_params &params, const graphics::RegionFilter *&filter)
+    {
+      filter = nullptr;
+      if (params.filter != 0)
+      {
+        filter = graphics::find_region_filter(params.filter);
+        if (filter == nullptr || !filter->valid(params.values))
+        {
+          LOG(ERROR) << "Invalid layer filter " << params.filter << std::endl;
+          return false;
+        }
+      }
+      return params.blend_mode >= GRAPHICS_BLEND_NORMAL && params.blend_mode <= GRAPHICS_BLEND_OVERLAY &&
+             isfinite(params.opacity) && params.opacity >= 0 && params.opacity <= 1;
+    }
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT graphics_session *open_image(const char *image_path)
+  try
+  {
+    graphics::OperationScope operation;
+    if (image_path == nullptr)
+    {
+      return nullptr;
+    }
+
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
+    if (image.empty())
+    {
+      LOG(ERROR) << "Could not open or find the image " << image_path << std::endl;
+      return nullptr;
+    }
+
+    graphics_session *session = new graphics_session();
+    session->image = image;
+    return session;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT graphics_session *open_image_encoded(const uint8_t *data, int32_t length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
+    {
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return nullptr;
+    }
+
+    graphics_session *session = new graphics_session();
+    session->image = image;
+    return session;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT graphics_session *open_image_tiled(const char *image_path)
+  try
+  {
+    graphics::OperationScope operation;
+    if (image_path == nullptr)
+    {
+      return nullptr;
+    }
+
+    cv::Mat image = graphics::read_image(image_path, cv::IMREAD_COLOR);
+    if (image.empty())
+    {
+      LOG(ERROR) << "Could not open or find the image " << image_path << std::endl;
+      return nullptr;
+    }
+    return graphics::open_tiled(image);
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT graphics_session *open_image_encoded_tiled(const uint8_t *data, int32_t length)
+  try
+  {
+    graphics::OperationScope operation;
+    cv::Mat image;
+    if (!graphics::decode_image(data, length, cv::IMREAD_COLOR, image))
+    {
+      LOG(ERROR) << "Could not decode the image buffer" << std::endl;
+      return nullptr;
+    }
+    return graphics::open_tiled(image);
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT graphics_session *open_image_preview(const char *image_path, int32_t max_width,
+                                                        int32_t max_height)
+  try
+  {
+    graphics::OperationScope operation;
+    std::vector<uint8_t> source;
+    if (image_path == nullptr || !graphics::read_file(image_path, source))
+    {
+      LOG(ERROR) << "Could not open or find the image " << (image_path ? image_path : "null") << std::endl;
+      return nullptr;
+    }
+    return graphics::open_preview(std::move(source), max_width, max_height);
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT graphics_session *open_image_encoded_preview(const uint8_t *data, int32_t length,
+                                                                int32_t max_width, int32_t max_height)
+  try
+  {
+    graphics::OperationScope operation;
+    if (data == nullptr || length <= 0)
+    {
+      return nullptr;
+    }
+    return graphics::open_preview(std::vector<uint8_t>(data, data + length), max_width, max_height);
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT int session_get_source_size(graphics_session *session, int32_t *width, int32_t *height)
+  try
+  {
+    if (session == nullptr || width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    cv::Size size = session->source.empty() ? graphics::image_size(session) : session->source_size;
+    *width = size.width;
+    *height = size.height;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_get_size(graphics_session *session, int32_t *width, int32_t *height)
+  try
+  {
+    if (session == nullptr || width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    cv::Size size = graphics::image_size(session);
+    *width = size.width;
+    *height = size.height;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_gray_scale(graphics_session *session)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    // The session stays BGR so that later color edits keep working.
+    graphics::Command command;
+    command.op = GRAPHICS_OP_GRAY_SCALE;
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_draw_polygon(graphics_session *session, const float *points, int num_points)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || points == nullptr || num_points <= 0)
+    {
+      return 1;
+    }
+
+    graphics::Command command = graphics::polygon_command(GRAPHICS_OP_DRAW_POLYGON, points, num_points);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_gray_scale_polygon(graphics_session *session, const float *points, int num_points)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || points == nullptr || num_points <= 0)
+    {
+      return 1;
+    }
+
+    graphics::Command command = graphics::polygon_command(GRAPHICS_OP_GRAY_SCALE_POLYGON, points, num_points);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_filter_polygon(graphics_session *session, const float *points, int num_points,
+                                             const graphics_filter_params *params)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || points == nullptr || num_points <= 0 || params == nullptr)
+    {
+      return 1;
+    }
+
+    graphics::Command command = graphics::filter_command(*params, points, num_points);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_apply_selection(graphics_session *session, graphics_selection *selection,
+                                                int32_t op, const float *params, int32_t num_params)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || selection == nullptr || (params == nullptr && num_params > 0) || num_params < 0 ||
+        (op != GRAPHICS_OP_DRAW_POLYGON && op != GRAPHICS_OP_GRAY_SCALE_POLYGON &&
+         op != GRAPHICS_OP_FILTER_POLYGON))
+    {
+      return 1;
+    }
+
+    graphics::Command command;
+    command.op = static_cast<uint16_t>(op);
+    command.params.assign(params, params + num_params);
+    {
+      std::lock_guard<std::mutex> lock(selection->mutex);
+      command.points = selection->mask.polygon();
+      int feather = graphics::feather_param(command.op);
+      if (feather >= 0)
+      {
+        command.mask = selection->mask.mask(feather < num_params ? params[feather] : 0);
+      }
+    }
+    if (command.points.empty())
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_preview_stroke(graphics_session *session, graphics_stroke *stroke,
+                                               uint8_t **out_data, int32_t *x, int32_t *y, int32_t *width,
+                                               int32_t *height)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || stroke == nullptr || out_data == nullptr || x == nullptr || y == nullptr ||
+        width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> stroke_lock(stroke->mutex);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    graphics::BrushStroke &engine = *stroke->engine;
+    if (engine.image_size() != graphics::image_size(session))
+    {
+      LOG(ERROR) << "The stroke was created for an image of another size" << std::endl;
+      return 1;
+    }
+
+    engine.render();
+    cv::Rect dirty = engine.take_dirty();
+    *out_data = nullptr;
+    *x = dirty.x;
+    *y = dirty.y;
+    *width = dirty.width;
+    *height = dirty.height;
+    if (dirty.empty())
+    {
+      return 0;
+    }
+
+    // With layers, the stroke shows over their composite; it is applied
+    // below them.
+    cv::Mat patch;
+    if (graphics::tiled(session))
+    {
+      session->tiles.read(dirty, graphics::pooled(patch));
+    }
+    else
+    {
+      graphics::displayed_image(session)(dirty).copyTo(graphics::pooled(patch));
+    }
+    graphics::record_temporary(patch.total() * patch.elemSize());
+    engine.composite(patch, dirty);
+    size_t length = patch.total() * 4;
+    uint8_t *buffer = static_cast<uint8_t *>(malloc(length));
+    if (buffer == nullptr)
+    {
+      LOG(ERROR) << "Could not allocate " << length << " bytes of RGBA" << std::endl;
+      return 1;
+    }
+    {
+      graphics::StageTimer timer(GRAPHICS_STAGE_CONVERT);
+      graphics::bgr_to_rgba(patch, buffer);
+    }
+    *out_data = buffer;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_apply_stroke(graphics_session *session, graphics_stroke *stroke)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || stroke == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> stroke_lock(stroke->mutex);
+    graphics::BrushStroke &engine = *stroke->engine;
+    if (engine.points().empty())
+    {
+      return 1;
+    }
+    engine.render();
+    graphics::Command command = graphics::stroke_command(engine.brush(), engine.points());
+    command.stroke = stroke->engine;
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::apply(session, std::move(command)) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_add_layer(graphics_session *session, const graphics_layer_params *params,
+                                          int32_t *id)
+  try
+  {
+    graphics::OperationScope operation;
+    const graphics::RegionFilter *filter = nullptr;
+    if (session == nullptr || params == nullptr || id == nullptr || !graphics::layer_settings(*params, filter))
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (graphics::tiled(session))
+    {
+      LOG(ERROR) << "Tiled sessions have no layers" << std::endl;
+      return 1;
+    }
+    if (!session->layers)
+    {
+      session->layers.reset(new graphics::LayerStack(session->image.size()));
+    }
+    *id = session->layers->add(filter, params->values, static_cast<graphics::BlendMode>(params->blend_mode),
+                               params->opacity);
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_update_layer(graphics_session *session, int32_t id,
+                                             const graphics_layer_params *params)
+  try
+  {
+    graphics::OperationScope operation;
+    const graphics::RegionFilter *filter = nullptr;
+    if (session == nullptr || params == nullptr || !graphics::layer_settings(*params, filter))
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    const graphics::Layer *layer = session->layers ? session->layers->find(id) : nullptr;
+    if (layer == nullptr || layer->filter != filter)
+    {
+      return 1;
+    }
+    return session->layers->update(id, static_cast<graphics::BlendMode>(params->blend_mode), params->opacity,
+                                   params->values)
+               ? 0
+               : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_set_layer_visible(graphics_session *session, int32_t id, int32_t visible)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->layers && session->layers->set_visible(id, visible != 0) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_set_layer_mask(graphics_session *session, int32_t id,
+                                               graphics_selection *selection, float feather)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || !isfinite(feather) || feather < 0)
+    {
+      return 1;
+    }
+
+    std::vector<cv::Point2f> polygon;
+    std::shared_ptr<const graphics::PolygonMask> mask;
+    if (selection != nullptr)
+    {
+      std::lock_guard<std::mutex> selection_lock(selection->mutex);
+      polygon = selection->mask.polygon();
+      if (polygon.empty())
+      {
+        return 1;
+      }
+      mask = selection->mask.mask(feather);
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->layers && session->layers->set_mask(id, std::move(mask), polygon, feather) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_paint_layer(graphics_session *session, int32_t id, graphics_stroke *stroke)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || stroke == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> stroke_lock(stroke->mutex);
+    graphics::BrushStroke &engine = *stroke->engine;
+    if (engine.points().empty())
+    {
+      return 1;
+    }
+    engine.render();
+    graphics::Command command = graphics::stroke_command(engine.brush(), engine.points());
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->layers && session->layers->paint(id, engine, command) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_remove_layer(graphics_session *session, int32_t id)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->layers && session->layers->remove(id) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_execute(graphics_session *session, const uint8_t *commands, int32_t length)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    std::vector<graphics::Command> parsed;
+    if (!graphics::parse_commands(commands, length, parsed))
+    {
+      return 1;
+    }
+
+    // The whole buffer is one undo step, commands that ran before a failing
+    // one included.
+    std::lock_guard<std::mutex> lock(session->mutex);
+    bool ok = true;
+    for (size_t i = 0; ok && i < parsed.size(); i++)
+    {
+      ok = graphics::apply_command(session, std::move(parsed[i]));
+    }
+    session->undo.commit();
+    return ok ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_set_undo_budget(graphics_session *session, int64_t memory_bytes, int32_t compression,
+                                                const char *spill_directory)
+  try
+  {
+    if (session == nullptr || memory_bytes < 0)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->undo.configure(static_cast<size_t>(memory_bytes), compression, spill_directory) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_undo(graphics_session *session)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::step_history(session, true) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_redo(graphics_session *session)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return graphics::step_history(session, false) ? 0 : 1;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int session_get_undo_info(graphics_session *session, graphics_undo_info *info)
+  try
+  {
+    if (session == nullptr || info == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    info->undo_steps = session->undo.undo_steps();
+    info->redo_steps = session->undo.redo_steps();
+    info->memory_bytes = static_cast<int64_t>(session->undo.memory_bytes());
+    info->disk_bytes = static_cast<int64_t>(session->undo.disk_bytes());
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int export_image(graphics_session *session, const char *image_path)
+  try
+  {
+    return export_image_with_options(session, image_path, nullptr);
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int export_image_encoded(graphics_session *session, const char *ext,
+                                             uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    if (!graphics::encode_session(session, [&](const cv::Mat &image)
+                                  { return graphics::encode_image(image, ext, out_data, out_length); }))
+    {
+      LOG(ERROR) << "Could not encode the image as " << (ext ? ext : "null") << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int export_image_with_options(graphics_session *session, const char *image_path,
+                                                  const graphics_encode_options *options)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || image_path == nullptr)
+    {
+      return 1;
+    }
+
+    if (!graphics::encode_session(session, [&](const cv::Mat &image)
+                                  { return graphics::write_image(image_path, image, options); }))
+    {
+      LOG(ERROR) << "Could not write the image " << image_path << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int export_image_encoded_with_options(graphics_session *session,
+                                                          const graphics_encode_options *options,
+                                                          uint8_t **out_data, int32_t *out_length)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr)
+    {
+      return 1;
+    }
+
+    if (!graphics::encode_session(session, [&](const cv::Mat &image)
+                                  { return graphics::encode_image(image, nullptr, options, out_data, out_length); }))
+    {
+      LOG(ERROR) << "Could not encode the image as format " << (options ? options->format : 0) << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int export_image_rgba(graphics_session *session, uint8_t **out_data,
+                                          int32_t *width, int32_t *height)
+  try
+  {
+    graphics::OperationScope operation;
+    if (session == nullptr || out_data == nullptr || width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::unique_lock<std::mutex> lock(session->mutex);
+    if (graphics::tiled(session))
+    {
+      const graphics::TiledImage snapshot = session->tiles;
+      lock.unlock();
+      return graphics::export_tiles_rgba(snapshot, out_data, width, height);
+    }
+    const cv::Mat &image = graphics::displayed_image(session);
+    size_t length = image.total() * 4;
+    uint8_t *buffer = nullptr;
+    if (length == 0 || length > INT32_MAX || (buffer = static_cast<uint8_t *>(malloc(length))) == nullptr)
+    {
+      LOG(ERROR) << "Could not allocate " << length << " bytes of RGBA" << std::endl;
+      return 1;
+    }
+    {
+      graphics::StageTimer timer(GRAPHICS_STAGE_CONVERT);
+      graphics::bgr_to_rgba(image, buffer);
+    }
+    *out_data = buffer;
+    *width = image.cols;
+    *height = image.rows;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT void close_image(graphics_session *session)
+  {
+    if (session != nullptr)
+    {
+      graphics::release_session(session);
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef GRAPHICS_IMAGE_SESSION_HPP
+#define GRAPHICS_IMAGE_SESSION_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "command_buffer.hpp"
+#include "layers.hpp"
+#include "tiled_image.hpp"
+#include "undo_history.hpp"
+
+// A decoded image kept resident in native memory between edits. Dart only sees
+// an opaque pointer to it; every access goes through the session_* functions,
+// which take the mutex so a session can be shared between isolates and the
+// native workers. close_image() drops Dart's reference, queued jobs hold their
+// own so the session outlives them.
+struct graphics_session
+{
+  std::mutex mutex;
+  std::atomic<int> references{1};
+  cv::Mat image; // BGR, CV_8UC3
+  // Tiled sessions only: the pixels, with image left empty. Edits touch the
+  // tiles under them and exports work from a copy-on-write snapshot.
+  graphics::TiledImage tiles;
+  // Preview sessions only: image is decoded at a reduced scale from source
+  // (the encoded full resolution image), every edit is recorded in history in
+  // image coordinates and the exports replay them on source.
+  std::vector<uint8_t> source;
+  cv::Size source_size;
+  std::vector<graphics::Command> history;
+  // Layers above image, created by the first session_add_layer(). They are
+  // kept in image coordinates and replayed on the exports like history.
+  std::unique_ptr<graphics::LayerStack> layers;
+  // Off until session_set_undo_budget(). Steps taken back out of history
+  // are kept by the undo step.
+  graphics::UndoHistory undo;
+};
+
+namespace graphics
+{
+  void retain_session(graphics_session *session);
+  void release_session(graphics_session *session);
+  // Logs the exception being handled. Exports catch everything and call it,
+  // so an allocation failure on a huge image returns an error instead of
+  // unwinding into the caller.
+  void log_exception(const char *function);
+}
+
+#endif // GRAPHICS_IMAGE_SESSION_HPP
@@ -0,0 +1,393 @@
+#include "layers.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "buffer_pool.hpp"
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    cv::Rect grow(const cv::Rect &rect, int margin)
+    {
+      return cv::Rect(rect.x - margin, rect.y - margin, rect.width + 2 * margin, rect.height + 2 * margin);
+    }
+
+    // Layers that take part in the composite.
+    bool shown(const Layer &layer)
+    {
+      return layer.visible && layer.opacity > 0;
+    }
+
+    int layer_margin(const Layer &layer)
+    {
+      return layer.filter != nullptr ? layer.filter->margin(layer.values) : 0;
+    }
+
+    void paint_layer(Layer &layer, const BrushStroke &stroke, cv::Size size)
+    {
+      if (layer.color.empty())
+      {
+        pooled(layer.color).create(size, CV_8UC3);
+        layer.color.setTo(0);
+        pooled(layer.alpha).create(size, CV_8UC1);
+        layer.alpha.setTo(0);
+      }
+      stroke.paint(layer.color, layer.alpha);
+      layer.painted |= stroke.bounds();
+    }
+  }
+
+  LayerStack::LayerStack(cv::Size size)
+      : size_(size),
+        tiles_x_((size.width + kTileSize - 1) / kTileSize),
+        tiles_y_((size.height + kTileSize - 1) / kTileSize),
+        dirty_(static_cast<size_t>(tiles_x_) * tiles_y_, 1)
+  {
+  }
+
+  int LayerStack::add(const RegionFilter *filter, const float *values, BlendMode mode, float opacity)
+  {
+    Layer layer;
+    layer.id = next_id_++;
+    layer.mode = mode;
+    layer.opacity = opacity;
+    layer.filter = filter;
+    if (filter != nullptr)
+    {
+      const float *source = values != nullptr ? values : filter->defaults;
+      std::copy(source, source + kFilterValues, layer.values);
+    }
+    layers_.push_back(layer);
+    invalidate_layer(layers_.back());
+    return layer.id;
+  }
+
+  bool LayerStack::remove(int id)
+  {
+    for (auto it = layers_.begin(); it != layers_.end(); ++it)
+    {
+      if (it->id == id)
+      {
+        invalidate_layer(*it);
+        layers_.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const Layer *LayerStack::find(int id) const
+  {
+    for (const Layer &layer : layers_)
+    {
+      if (layer.id == id)
+      {
+        return &layer;
+      }
+    }
+    return nullptr;
+  }
+
+  Layer *LayerStack::find_layer(int id)
+  {
+    return const_cast<Layer *>(find(id));
+  }
+
+  bool LayerStack::update(int id, BlendMode mode, float opacity, const float *values)
+  {
+    Layer *layer = find_layer(id);
+    if (layer == nullptr)
+    {
+      return false;
+    }
+    invalidate_layer(*layer);
+    layer->mode = mode;
+    layer->opacity = opacity;
+    if (layer->filter != nullptr && values != nullptr)
+    {
+      std::copy(values, values + kFilterValues, layer->values);
+    }
+    invalidate_layer(*layer);
+    return true;
+  }
+
+  bool LayerStack::set_visible(int id, bool visible)
+  {
+    Layer *layer = find_layer(id);
+    if (layer == nullptr)
+    {
+      return false;
+    }
+    if (layer->visible != visible)
+    {
+      invalidate_layer(*layer);
+      layer->visible = visible;
+      invalidate_layer(*layer);
+    }
+    return true;
+  }
+
+  bool LayerStack::set_mask(int id, std::shared_ptr<const PolygonMask> mask, const std::vector<cv::Point2f> &polygon,
+                            float feather)
+  {
+    Layer *layer = find_layer(id);
+    if (layer == nullptr || (mask != nullptr && mask->image_size != size_))
+    {
+      return false;
+    }
+    invalidate_layer(*layer);
+    layer->mask = std::move(mask);
+    layer->mask_polygon = layer->mask != nullptr ? polygon : std::vector<cv::Point2f>();
+    layer->mask_feather = layer->mask != nullptr ? feather : 0;
+    invalidate_layer(*layer);
+    return true;
+  }
+
+  bool LayerStack::paint(int id, const BrushStroke &stroke, const Command &command)
+  {
+    Layer *layer = find_layer(id);
+    if (layer == nullptr || layer->filter != nullptr || stroke.image_size() != size_)
+    {
+      return false;
+    }
+    paint_layer(*layer, stroke, size_);
+    Command recorded = command;
+    recorded.mask.reset();
+    recorded.stroke.reset();
+    layer->strokes.push_back(std::move(recorded));
+    invalidate(stroke.bounds());
+    return true;
+  }
+
+  cv::Rect LayerStack::extent(const Layer &layer) const
+  {
+    cv::Rect rect = layer.filter != nullptr ? cv::Rect(0, 0, size_.width, size_.height) : layer.painted;
+    if (layer.mask != nullptr)
+    {
+      rect &= layer.mask->roi;
+    }
+    return rect;
+  }
+
+  int LayerStack::margin() const
+  {
+    int margin = 0;
+    for (const Layer &layer : layers_)
+    {
+      if (shown(layer))
+      {
+        margin += layer_margin(layer);
+      }
+    }
+    return margin;
+  }
+
+  void LayerStack::invalidate_layer(const Layer &layer)
+  {
+    invalidate(extent(layer));
+  }
+
+  void LayerStack::invalidate(const cv::Rect &rect)
+  {
+    const cv::Rect area = grow(rect, margin()) & cv::Rect(0, 0, size_.width, size_.height);
+    if (area.empty())
+    {
+      return;
+    }
+    const int right = (area.x + area.width - 1) / kTileSize;
+    const int bottom = (area.y + area.height - 1) / kTileSize;
+    for (int y = area.y / kTileSize; y <= bottom; y++)
+    {
+      std::fill(dirty_.begin() + y * tiles_x_ + area.x / kTileSize, dirty_.begin() + y * tiles_x_ + right + 1, 1);
+    }
+  }
+
+  void LayerStack::invalidate_all()
+  {
+    std::fill(dirty_.begin(), dirty_.end(), 1);
+  }
+
+  int LayerStack::dirty_tiles() const
+  {
+    return static_cast<int>(std::count(dirty_.begin(), dirty_.end(), 1));
+  }
+
+  const cv::Mat &LayerStack::composite(const cv::Mat &base)
+  {
+    CV_Assert(base.type() == CV_8UC3 && base.size() == size_);
+    if (composite_.empty())
+    {
+      pooled(composite_).create(size_, CV_8UC3);
+      invalidate_all();
+    }
+
+    std::vector<cv::Rect> tiles;
+    for (int y = 0; y < tiles_y_; y++)
+    {
+      for (int x = 0; x < tiles_x_; x++)
+      {
+        if (dirty_[y * tiles_x_ + x])
+        {
+          tiles.push_back(cv::Rect(x * kTileSize, y * kTileSize, kTileSize, kTileSize) &
+                          cv::Rect(0, 0, size_.width, size_.height));
+        }
+      }
+    }
+    if (tiles.empty())
+    {
+      return composite_;
+    }
+
+    StageTimer timer(GRAPHICS_STAGE_COMPOSITE);
+    const int stack_margin = margin();
+    parallel_for(cv::Range(0, static_cast<int>(tiles.size())), [&](const cv::Range &range)
+                 {
+                   cv::Mat work;
+                   pooled(work);
+                   for (int i = range.start; i < range.end; i++)
+                   {
+                     composite_tile(base, tiles[i], stack_margin, work);
+                   } });
+    std::fill(dirty_.begin(), dirty_.end(), 0);
+    record_composited_tiles(tiles.size());
+    const cv::Rect padded = grow(cv::Rect(0, 0, kTileSize, kTileSize), stack_margin);
+    record_temporary(static_cast<size_t>(std::min(static_cast<int>(tiles.size()), job_threads())) *
+                     padded.area() * 3);
+    return composite_;
+  }
+
+  void LayerStack::composite_tile(const cv::Mat &base, const cv::Rect &tile, int margin, cv::Mat &work)
+  {
+    // The tile is composited in a copy of the base grown by the margins the
+    // spatial adjustment layers read. Each layer only has to be right over
+    // the tile grown by the margins of the layers above it, which is where
+    // those layers read it.
+    const cv::Rect image(0, 0, size_.width, size_.height);
+    const cv::Rect padded = grow(tile, margin) & image;
+    base(padded).copyTo(work);
+    int remaining = margin;
+    cv::Mat filtered;
+    for (const Layer &layer : layers_)
+    {
+      if (!shown(layer))
+      {
+        continue;
+      }
+      remaining -= layer_margin(layer);
+      const cv::Rect area = grow(tile, remaining) & image & extent(layer);
+      if (area.empty())
+      {
+        continue;
+      }
+      const cv::Rect local = area - padded.tl();
+      cv::Mat target = work(local);
+      if (layer.filter != nullptr)
+      {
+        layer.filter->apply(work, local, filtered, layer.values);
+        blend_layer(layer, target, filtered, area);
+      }
+      else
+      {
+        blend_layer(layer, target, layer.color(area), area);
+      }
+    }
+    work(tile - padded.tl()).copyTo(composite_(tile));
+  }
+
+  void LayerStack::blend_layer(const Layer &layer, cv::Mat &target, const cv::Mat &pixels,
+                               const cv::Rect &area) const
+  {
+    // Weights are the paint coverage (or everywhere for adjustments) times
+    // the mask times the opacity.
+    const int opacity = static_cast<int>(lroundf(layer.opacity * 255));
+    std::vector<uint8_t> weights(area.width);
+    std::vector<uint8_t> mixed(layer.mode != BlendMode::normal ? static_cast<size_t>(area.width) * 3 : 0);
+    for (int y = 0; y < area.height; y++)
+    {
+      if (layer.filter != nullptr)
+      {
+        std::fill(weights.begin(), weights.end(), 255);
+      }
+      else
+      {
+        const uint8_t *alpha = layer.alpha.ptr<uint8_t>(area.y + y) + area.x;
+        std::copy(alpha, alpha + area.width, weights.begin());
+      }
+      if (layer.mask != nullptr)
+      {
+        const cv::Rect &roi = layer.mask->roi;
+        const uint8_t *coverage = layer.mask->coverage.ptr<uint8_t>(area.y + y - roi.y) + (area.x - roi.x);
+        for (int x = 0; x < area.width; x++)
+        {
+          weights[x] = static_cast<uint8_t>((weights[x] * coverage[x] + 127) / 255);
+        }
+      }
+      if (opacity < 255)
+      {
+        for (int x = 0; x < area.width; x++)
+        {
+          weights[x] = static_cast<uint8_t>((weights[x] * opacity + 127) / 255);
+        }
+      }
+
+      uint8_t *row = target.ptr<uint8_t>(y);
+      const uint8_t *source = pixels.ptr<uint8_t>(y);
+      if (layer.mode != BlendMode::normal)
+      {
+        blend_mode_row(row, source, mixed.data(), area.width * 3, layer.mode);
+        source = mixed.data();
+      }
+      blend_weighted_row(row, source, weights.data(), area.width);
+    }
+  }
+
+  LayerStack LayerStack::scaled(cv::Size size) const
+  {
+    LayerStack stack(size);
+    stack.next_id_ = next_id_;
+    const float fx = static_cast<float>(size.width) / size_.width;
+    const float fy = static_cast<float>(size.height) / size_.height;
+    const float scale = (fx + fy) / 2;
+    for (const Layer &layer : layers_)
+    {
+      Layer copy;
+      copy.id = layer.id;
+      copy.visible = layer.visible;
+      copy.mode = layer.mode;
+      copy.opacity = layer.opacity;
+      copy.filter = layer.filter;
+      for (int i = 0; i < kFilterValues; i++)
+      {
+        copy.values[i] = layer.filter != nullptr && layer.filter->spatial[i] ? layer.values[i] * scale
+                                                                             : layer.values[i];
+      }
+      if (layer.mask != nullptr)
+      {
+        copy.mask_polygon = layer.mask_polygon;
+        for (cv::Point2f &point : copy.mask_polygon)
+        {
+          point.x *= fx;
+          point.y *= fy;
+        }
+        copy.mask_feather = layer.mask_feather * scale;
+        copy.mask = polygon_mask(copy.mask_polygon, copy.mask_feather, size);
+      }
+      for (const Command &command : layer.strokes)
+      {
+        Command replayed = scale_command(command, fx, fy);
+        BrushStroke stroke(size, command_brush(replayed));
+        stroke.append(replayed.points.data(), replayed.points.size());
+        stroke.render();
+        paint_layer(copy, stroke, size);
+        copy.strokes.push_back(std::move(replayed));
+      }
+      stack.layers_.push_back(std::move(copy));
+    }
+    return stack;
+  }
+}
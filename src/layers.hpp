@@ -0,0 +1,115 @@
+#ifndef GRAPHICS_LAYERS_HPP
+#define GRAPHICS_LAYERS_HPP
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "brush.hpp"
+#include "command_buffer.hpp"
+#include "pixel_kernels.hpp"
+#include "polygon_mask.hpp"
+#include "region_filters.hpp"
+
+namespace graphics
+{
+  // One layer of a LayerStack.
+  struct Layer
+  {
+    int id = 0;
+    bool visible = true;
+    BlendMode mode = BlendMode::normal;
+    float opacity = 1;
+    // Adjustment layers filter everything below them; nullptr for paint
+    // layers.
+    const RegionFilter *filter = nullptr;
+    float values[kFilterValues] = {0, 0, 0};
+    // Paint layers: the painted colors (CV_8UC3) and their coverage
+    // (CV_8UC1), image sized and allocated by the first stroke, and the
+    // pixels painted so far.
+    cv::Mat color;
+    cv::Mat alpha;
+    cv::Rect painted;
+    // Strokes painted so far, in image coordinates, for replays.
+    std::vector<Command> strokes;
+    // Limits the layer to a polygon; none when empty. The polygon and
+    // feather are kept for replays.
+    std::shared_ptr<const PolygonMask> mask;
+    std::vector<cv::Point2f> mask_polygon;
+    float mask_feather = 0;
+  };
+
+  // Layers above a base image, bottom to top, and their composite. The
+  // composite is kept in tiles of kTileSize pixels with a dirty flag each:
+  // a change marks the tiles it can affect, including those a spatial
+  // adjustment layer above reads them from, and composite() only blends
+  // those again, tile by tile on all cores. Not thread safe.
+  class LayerStack
+  {
+  public:
+    static const int kTileSize = 256;
+
+    explicit LayerStack(cv::Size size);
+
+    cv::Size size() const { return size_; }
+    const std::vector<Layer> &layers() const { return layers_; }
+    bool empty() const { return layers_.empty(); }
+
+    // Adds a paint layer (filter nullptr) or an adjustment layer on top and
+    // returns its id. values holds kFilterValues entries, or is nullptr for
+    // the filter's defaults.
+    int add(const RegionFilter *filter, const float *values, BlendMode mode, float opacity);
+    bool remove(int id);
+    const Layer *find(int id) const;
+
+    // The layer changes below mark the pixels the layer covers, before and
+    // after the change, dirty. They return false for an unknown id.
+    bool update(int id, BlendMode mode, float opacity, const float *values);
+    bool set_visible(int id, bool visible);
+    // mask nullptr removes the mask; polygon and feather are what it was
+    // built from.
+    bool set_mask(int id, std::shared_ptr<const PolygonMask> mask, const std::vector<cv::Point2f> &polygon,
+                  float feather);
+    // Paints a rendered stroke of an image of size() onto a paint layer and
+    // records it as command. False for adjustment layers.
+    bool paint(int id, const BrushStroke &stroke, const Command &command);
+
+    // Marks the pixels of rect dirty, e.g. after an edit of the base image.
+    void invalidate(const cv::Rect &rect);
+    void invalidate_all();
+    int dirty_tiles() const;
+
+    // Brings the composite of the layers over base, a BGR image of size(),
+    // up to date and returns it. Only dirty tiles are composited; base must
+    // not have changed elsewhere since the previous call.
+    const cv::Mat &composite(const cv::Mat &base);
+
+    // The same layers on a version of the image of size: masks and strokes
+    // are replayed and spatial filter values scaled. Everything is dirty.
+    LayerStack scaled(cv::Size size) const;
+
+  private:
+    Layer *find_layer(int id);
+    // Pixels of the image the layer can change.
+    cv::Rect extent(const Layer &layer) const;
+    // Pixels a change of rect at the bottom of the stack can reach, through
+    // the margins of the visible spatial adjustment layers.
+    int margin() const;
+    void invalidate_layer(const Layer &layer);
+    void composite_tile(const cv::Mat &base, const cv::Rect &tile, int margin, cv::Mat &work);
+    void blend_layer(const Layer &layer, cv::Mat &target, const cv::Mat &pixels, const cv::Rect &area) const;
+
+    cv::Size size_;
+    std::vector<Layer> layers_;
+    int next_id_ = 1;
+    int tiles_x_ = 0;
+    int tiles_y_ = 0;
+    std::vector<uint8_t> dirty_;
+    cv::Mat composite_;
+  };
+}
+
+#endif // GRAPHICS_LAYERS_HPP
@@ -0,0 +1,218 @@
+#include "lz4.hpp"
+
+#include <string.h>
+
+#include <vector>
+
+namespace graphics
+{
+  namespace
+  {
+    const size_t kMinMatch = 4;
+    // The format requires the last 5 bytes to be literals and the last match
+    // to start at least 12 bytes before the end of the block.
+    const size_t kLastLiterals = 5;
+    const size_t kMatchStartLimit = 12;
+    const size_t kMaxOffset = 65535;
+    const int kHashBits = 14;
+
+    uint32_t read32(const uint8_t *p)
+    {
+      uint32_t value;
+      memcpy(&value, p, sizeof(value));
+      return value;
+    }
+
+    uint32_t hash(uint32_t sequence)
+    {
+      return (sequence * 2654435761u) >> (32 - kHashBits);
+    }
+
+    uint8_t *write_length(uint8_t *out, size_t length)
+    {
+      while (length >= 255)
+      {
+        *out++ = 255;
+        length -= 255;
+      }
+      *out++ = static_cast<uint8_t>(length);
+      return out;
+    }
+
+    // Emits literals [anchor, anchor + literals) followed by a match, or only
+    // the literals if match_length is 0 (the last sequence).
+    uint8_t *write_sequence(uint8_t *out, const uint8_t *anchor, size_t literals, size_t offset,
+                            size_t match_length)
+    {
+      uint8_t *token = out++;
+      *token = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+      if (literals >= 15)
+      {
+        out = write_length(out, literals - 15);
+      }
+      if (literals > 0)
+      {
+        memcpy(out, anchor, literals);
+        out += literals;
+      }
+
+      if (match_length == 0)
+      {
+        return out;
+      }
+
+      *out++ = static_cast<uint8_t>(offset);
+      *out++ = static_cast<uint8_t>(offset >> 8);
+      size_t length = match_length - kMinMatch;
+      *token |= static_cast<uint8_t>(length >= 15 ? 15 : length);
+      if (length >= 15)
+      {
+        out = write_length(out, length - 15);
+      }
+      return out;
+    }
+
+    // Reads an extended length; false if the input ends first.
+    bool read_length(const uint8_t *&in, const uint8_t *end, size_t &length)
+    {
+      uint8_t byte;
+      do
+      {
+        if (in == end)
+        {
+          return false;
+        }
+        byte = *in++;
+        length += byte;
+      } while (byte == 255);
+      return true;
+    }
+  }
+
+  size_t lz4_compress_bound(size_t size)
+  {
+    return size + size / 255 + 16;
+  }
+
+  size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst)
+  {
+    uint8_t *out = dst;
+    const uint8_t *anchor = src;
+
+    if (size > kMatchStartLimit)
+    {
+      const uint8_t *end = src + size;
+      const uint8_t *match_start_limit = end - kMatchStartLimit;
+      const uint8_t *match_end_limit = end - kLastLiterals;
+      // Positions of the last occurrence of each hashed 4-byte sequence.
+      // Stale or colliding entries are caught by comparing the bytes.
+      std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+
+      const uint8_t *ip = src + 1;
+      size_t misses = 0;
+      while (ip < match_start_limit)
+      {
+        uint32_t sequence = read32(ip);
+        uint32_t &slot = table[hash(sequence)];
+        const uint8_t *ref = src + slot;
+        slot = static_cast<uint32_t>(ip - src);
+
+        if (static_cast<size_t>(ip - ref) > kMaxOffset || read32(ref) != sequence)
+        {
+          // Skip faster through incompressible data.
+          ip += 1 + (misses++ >> 6);
+          continue;
+        }
+        misses = 0;
+
+        const uint8_t *match_end = ip + kMinMatch;
+        const uint8_t *ref_end = ref + kMinMatch;
+        while (match_end < match_end_limit && *match_end == *ref_end)
+        {
+          match_end++;
+          ref_end++;
+        }
+
+        out = write_sequence(out, anchor, ip - anchor, ip - ref, match_end - ip);
+        ip = match_end;
+        anchor = ip;
+      }
+    }
+
+    out = write_sequence(out, anchor, src + size - anchor, 0, 0);
+    return out - dst;
+  }
+
+  bool lz4_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size)
+  {
+    const uint8_t *in = src;
+    const uint8_t *in_end = src + size;
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + dst_size;
+
+    while (in < in_end)
+    {
+      uint8_t token = *in++;
+
+      size_t literals = token >> 4;
+      if (literals == 15 && !read_length(in, in_end, literals))
+      {
+        return false;
+      }
+      if (literals > static_cast<size_t>(in_end - in) || literals > static_cast<size_t>(out_end - out))
+      {
+        return false;
+      }
+      if (literals > 0)
+      {
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+      }
+
+      if (in == in_end)
+      {
+        break;
+      }
+
+      if (in_end - in < 2)
+      {
+        return false;
+      }
+      size_t offset = in[0] | (in[1] << 8);
+      in += 2;
+      if (offset == 0 || offset > static_cast<size_t>(out - dst))
+      {
+        return false;
+      }
+
+      size_t length = token & 15;
+      if (length == 15 && !read_length(in, in_end, length))
+      {
+        return false;
+      }
+      length += kMinMatch;
+      if (length > static_cast<size_t>(out_end - out))
+      {
+        return false;
+      }
+
+      // Matches may overlap their own output (runs), so copy forward.
+      const uint8_t *ref = out - offset;
+      if (offset >= length)
+      {
+        memcpy(out, ref, length);
+        out += length;
+      }
+      else
+      {
+        for (size_t i = 0; i < length; i++)
+        {
+          *out++ = ref[i];
+        }
+      }
+    }
+
+    return out == out_end;
+  }
+}
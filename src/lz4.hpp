@@ -0,0 +1,26 @@
+#ifndef GRAPHICS_LZ4_HPP
+#define GRAPHICS_LZ4_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace graphics
+{
+  // A small LZ4 block codec (greedy matching, no dictionary), enough for the
+  // lossless working format without pulling in liblz4. The output is a
+  // standard LZ4 block, readable by LZ4_decompress_safe().
+
+  // Worst case compressed size of size input bytes.
+  size_t lz4_compress_bound(size_t size);
+
+  // Compresses size bytes of src into dst, which must hold at least
+  // lz4_compress_bound(size) bytes. Returns the compressed size.
+  size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst);
+
+  // Decompresses a block into exactly dst_size bytes. Returns false on
+  // corrupt input or if the block does not expand to dst_size bytes; never
+  // reads or writes out of bounds.
+  bool lz4_decompress(const uint8_t *src, size_t size, uint8_t *dst, size_t dst_size);
+}
+
+#endif // GRAPHICS_LZ4_HPP
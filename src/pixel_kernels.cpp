@@ -0,0 +1,1132 @@
+#include "pixel_kernels.hpp"
+
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAPHICS_KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define GRAPHICS_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace graphics
+{
+  namespace
+  {
+    // Fixed point weights and shift of cv::COLOR_BGR2GRAY for 8-bit images.
+    const int kB2Y = 1868;
+    const int kG2Y = 9617;
+    const int kR2Y = 4899;
+    const int kYuvShift = 14;
+
+    inline uint8_t luminance(uint8_t b, uint8_t g, uint8_t r)
+    {
+      return static_cast<uint8_t>((b * kB2Y + g * kG2Y + r * kR2Y + (1 << (kYuvShift - 1))) >> kYuvShift);
+    }
+
+    // a * (255 - w) / 255 + b * w / 255, rounded. Exact at w = 0 and 255.
+    inline uint8_t lerp255(uint8_t a, uint8_t b, uint8_t w)
+    {
+      unsigned t = a * (255u - w) + b * w + 128u;
+      return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+    }
+
+    typedef void (*DesaturateRow)(uint8_t *, const uint8_t *, int);
+    typedef void (*DesaturateWeightedRow)(uint8_t *, const uint8_t *, int);
+    typedef void (*BgrToRgbaRow)(const uint8_t *, uint8_t *, int);
+    typedef void (*BgrToGrayRow)(const uint8_t *, uint8_t *, int);
+    typedef void (*BlendWeightedRow)(uint8_t *, const uint8_t *, const uint8_t *, int);
+    typedef void (*BlendModeRow)(const uint8_t *, const uint8_t *, uint8_t *, int, BlendMode);
+
+    // x / 255 rounded, for x < 2^16 - 256.
+    inline uint8_t div255(unsigned x)
+    {
+      x += 128u;
+      return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+    }
+
+    inline uint8_t blend_mode(uint8_t a, uint8_t b, BlendMode mode)
+    {
+      switch (mode)
+      {
+      case BlendMode::multiply:
+        return div255(a * b);
+      case BlendMode::screen:
+        return 255 - div255((255 - a) * (255 - b));
+      case BlendMode::overlay:
+        return a < 128 ? div255(2 * a * b) : 255 - div255(2 * (255 - a) * (255 - b));
+      default:
+        return b;
+      }
+    }
+
+#if GRAPHICS_KERNELS_X86
+    // Byte shuffles splitting three registers of packed BGR into planes and
+    // back. Lane-local, so the AVX2 kernel reuses them per 128-bit lane.
+    struct Shuffles
+    {
+      __m128i b0, b1, b2, g0, g1, g2, r0, r1, r2, e0, e1, e2;
+    };
+
+    __attribute__((target("ssse3"))) Shuffles make_shuffles()
+    {
+      const char z = -1;
+      Shuffles s;
+      s.b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, z, z, z, z, z, z, z, z, z, z);
+      s.b1 = _mm_setr_epi8(z, z, z, z, z, z, 2, 5, 8, 11, 14, z, z, z, z, z);
+      s.b2 = _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, z, 1, 4, 7, 10, 13);
+      s.g0 = _mm_setr_epi8(1, 4, 7, 10, 13, z, z, z, z, z, z, z, z, z, z, z);
+      s.g1 = _mm_setr_epi8(z, z, z, z, z, 0, 3, 6, 9, 12, 15, z, z, z, z, z);
+      s.g2 = _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, z, 2, 5, 8, 11, 14);
+      s.r0 = _mm_setr_epi8(2, 5, 8, 11, 14, z, z, z, z, z, z, z, z, z, z, z);
+      s.r1 = _mm_setr_epi8(z, z, z, z, z, 1, 4, 7, 10, 13, z, z, z, z, z, z);
+      s.r2 = _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, 0, 3, 6, 9, 12, 15);
+      // Expand one byte per pixel to three bytes per pixel.
+      s.e0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+      s.e1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+      s.e2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+      return s;
+    }
+
+    __attribute__((target("sse4.1"))) inline __m128i luminance_sse(__m128i b, __m128i g, __m128i r)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i coeff_bg = _mm_set1_epi32((kG2Y << 16) | kB2Y);
+      const __m128i coeff_r = _mm_set1_epi32((1 << 16) | kR2Y);
+      const __m128i round = _mm_set1_epi16(1 << (kYuvShift - 1));
+
+      __m128i bl = _mm_unpacklo_epi8(b, zero), bh = _mm_unpackhi_epi8(b, zero);
+      __m128i gl = _mm_unpacklo_epi8(g, zero), gh = _mm_unpackhi_epi8(g, zero);
+      __m128i rl = _mm_unpacklo_epi8(r, zero), rh = _mm_unpackhi_epi8(r, zero);
+
+      // b * B2Y + g * G2Y and r * R2Y + round as pairwise multiply-adds.
+      __m128i y0 = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(bl, gl), coeff_bg),
+                                 _mm_madd_epi16(_mm_unpacklo_epi16(rl, round), coeff_r));
+      __m128i y1 = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(bl, gl), coeff_bg),
+                                 _mm_madd_epi16(_mm_unpackhi_epi16(rl, round), coeff_r));
+      __m128i y2 = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(bh, gh), coeff_bg),
+                                 _mm_madd_epi16(_mm_unpacklo_epi16(rh, round), coeff_r));
+      __m128i y3 = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(bh, gh), coeff_bg),
+                                 _mm_madd_epi16(_mm_unpackhi_epi16(rh, round), coeff_r));
+
+      y0 = _mm_srli_epi32(y0, kYuvShift);
+      y1 = _mm_srli_epi32(y1, kYuvShift);
+      y2 = _mm_srli_epi32(y2, kYuvShift);
+      y3 = _mm_srli_epi32(y3, kYuvShift);
+      return _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+    }
+
+    __attribute__((target("sse4.1"))) void desaturate_masked_row_sse41(uint8_t *bgr, const uint8_t *mask, int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m128i zero = _mm_setzero_si128();
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask + x));
+        if (_mm_testz_si128(m, m))
+        {
+          continue;
+        }
+        __m128i select = _mm_xor_si128(_mm_cmpeq_epi8(m, zero), _mm_set1_epi8(-1));
+
+        uint8_t *p = bgr + x * 3;
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.b0), _mm_shuffle_epi8(v1, s.b1)),
+                                 _mm_shuffle_epi8(v2, s.b2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.g0), _mm_shuffle_epi8(v1, s.g1)),
+                                 _mm_shuffle_epi8(v2, s.g2));
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.r0), _mm_shuffle_epi8(v1, s.r1)),
+                                 _mm_shuffle_epi8(v2, s.r2));
+        __m128i y = luminance_sse(b, g, r);
+
+        v0 = _mm_blendv_epi8(v0, _mm_shuffle_epi8(y, s.e0), _mm_shuffle_epi8(select, s.e0));
+        v1 = _mm_blendv_epi8(v1, _mm_shuffle_epi8(y, s.e1), _mm_shuffle_epi8(select, s.e1));
+        v2 = _mm_blendv_epi8(v2, _mm_shuffle_epi8(y, s.e2), _mm_shuffle_epi8(select, s.e2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), v1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), v2);
+      }
+      desaturate_masked_row_scalar(bgr + x * 3, mask + x, width - x);
+    }
+
+    // lerp255 on 16 byte lanes, in 16 bit: a * (255 - w) + b * w + 128 stays
+    // below 2^16.
+    __attribute__((target("sse4.1"))) inline __m128i lerp_sse(__m128i a, __m128i b, __m128i w)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i full = _mm_set1_epi16(255);
+      const __m128i round = _mm_set1_epi16(128);
+
+      __m128i wl = _mm_unpacklo_epi8(w, zero), wh = _mm_unpackhi_epi8(w, zero);
+      __m128i tl = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_sub_epi16(full, wl)),
+                                 _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wl));
+      __m128i th = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_sub_epi16(full, wh)),
+                                 _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wh));
+      tl = _mm_add_epi16(tl, round);
+      th = _mm_add_epi16(th, round);
+      tl = _mm_srli_epi16(_mm_add_epi16(tl, _mm_srli_epi16(tl, 8)), 8);
+      th = _mm_srli_epi16(_mm_add_epi16(th, _mm_srli_epi16(th, 8)), 8);
+      return _mm_packus_epi16(tl, th);
+    }
+
+    // Same layout as desaturate_masked_row_sse41. Blocks whose weights are
+    // all 0 or 255 take the plain select.
+    __attribute__((target("sse4.1"))) void desaturate_weighted_row_sse41(uint8_t *bgr, const uint8_t *weights,
+                                                                       int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i full = _mm_set1_epi8(-1);
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + x));
+        if (_mm_testz_si128(w, w))
+        {
+          continue;
+        }
+
+        uint8_t *p = bgr + x * 3;
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.b0), _mm_shuffle_epi8(v1, s.b1)),
+                                 _mm_shuffle_epi8(v2, s.b2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.g0), _mm_shuffle_epi8(v1, s.g1)),
+                                 _mm_shuffle_epi8(v2, s.g2));
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.r0), _mm_shuffle_epi8(v1, s.r1)),
+                                 _mm_shuffle_epi8(v2, s.r2));
+        __m128i y = luminance_sse(b, g, r);
+
+        __m128i y0 = _mm_shuffle_epi8(y, s.e0), y1 = _mm_shuffle_epi8(y, s.e1), y2 = _mm_shuffle_epi8(y, s.e2);
+        __m128i w0 = _mm_shuffle_epi8(w, s.e0), w1 = _mm_shuffle_epi8(w, s.e1), w2 = _mm_shuffle_epi8(w, s.e2);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(w, zero), _mm_cmpeq_epi8(w, full))) == 0xffff)
+        {
+          v0 = _mm_blendv_epi8(v0, y0, w0);
+          v1 = _mm_blendv_epi8(v1, y1, w1);
+          v2 = _mm_blendv_epi8(v2, y2, w2);
+        }
+        else
+        {
+          v0 = lerp_sse(v0, y0, w0);
+          v1 = lerp_sse(v1, y1, w1);
+          v2 = lerp_sse(v2, y2, w2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), v1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), v2);
+      }
+      desaturate_weighted_row_scalar(bgr + x * 3, weights + x, width - x);
+    }
+
+    // 16 pixels per iteration. The blend is the same for every byte, so the
+    // pixels stay interleaved and only the weights are spread over them.
+    __attribute__((target("sse4.1"))) void blend_weighted_row_sse41(uint8_t *bgr, const uint8_t *filtered,
+                                                                  const uint8_t *weights, int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m128i full = _mm_set1_epi8(-1);
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(weights + x));
+        if (_mm_testz_si128(w, w))
+        {
+          continue;
+        }
+
+        uint8_t *p = bgr + x * 3;
+        const uint8_t *q = filtered + x * 3;
+        __m128i f0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q));
+        __m128i f1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q + 16));
+        __m128i f2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(q + 32));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(w, full)) != 0xffff)
+        {
+          f0 = lerp_sse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), f0, _mm_shuffle_epi8(w, s.e0));
+          f1 = lerp_sse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)), f1, _mm_shuffle_epi8(w, s.e1));
+          f2 = lerp_sse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32)), f2, _mm_shuffle_epi8(w, s.e2));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), f0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), f1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), f2);
+      }
+      blend_weighted_row_scalar(bgr + x * 3, filtered + x * 3, weights + x, width - x);
+    }
+
+    // div255 on 16 bit lanes.
+    __attribute__((target("sse4.1"))) inline __m128i div255_sse(__m128i x)
+    {
+      x = _mm_add_epi16(x, _mm_set1_epi16(128));
+      return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    // div255(a * b << shift) on 16 byte lanes. Lanes whose product overflows
+    // 16 bits come out wrong; overlay only keeps the ones that don't.
+    __attribute__((target("sse4.1"))) inline __m128i multiply_sse(__m128i a, __m128i b, int shift)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      lo = _mm_sll_epi16(lo, _mm_cvtsi32_si128(shift));
+      hi = _mm_sll_epi16(hi, _mm_cvtsi32_si128(shift));
+      return _mm_packus_epi16(div255_sse(lo), div255_sse(hi));
+    }
+
+    __attribute__((target("sse4.1"))) inline __m128i blend_mode_sse(__m128i a, __m128i b, BlendMode mode)
+    {
+      const __m128i full = _mm_set1_epi8(-1);
+      switch (mode)
+      {
+      case BlendMode::multiply:
+        return multiply_sse(a, b, 0);
+      case BlendMode::screen:
+        return _mm_xor_si128(multiply_sse(_mm_xor_si128(a, full), _mm_xor_si128(b, full), 0), full);
+      case BlendMode::overlay:
+      {
+        __m128i dark = _mm_cmpgt_epi8(a, full); // a < 128
+        __m128i low = multiply_sse(a, b, 1);
+        __m128i high = _mm_xor_si128(multiply_sse(_mm_xor_si128(a, full), _mm_xor_si128(b, full), 1), full);
+        return _mm_blendv_epi8(high, low, dark);
+      }
+      default:
+        return b;
+      }
+    }
+
+    // 16 bytes per iteration; the modes work on every channel alike.
+    __attribute__((target("sse4.1"))) void blend_mode_row_sse41(const uint8_t *base, const uint8_t *layer,
+                                                              uint8_t *out, int count, BlendMode mode)
+    {
+      int i = 0;
+      for (; i + 16 <= count; i += 16)
+      {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(layer + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), blend_mode_sse(a, b, mode));
+      }
+      blend_mode_row_scalar(base + i, layer + i, out + i, count - i, mode);
+    }
+
+    // 16 pixels per iteration. Each group of 4 BGR pixels (12 bytes) is moved
+    // to the bottom of a register and shuffled into 16 bytes of RGBA.
+    __attribute__((target("sse4.1"))) void bgr_to_rgba_row_sse41(const uint8_t *bgr, uint8_t *rgba, int width)
+    {
+      const char z = -1;
+      const __m128i shuffle = _mm_setr_epi8(2, 1, 0, z, 5, 4, 3, z, 8, 7, 6, z, 11, 10, 9, z);
+      const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        const uint8_t *p = bgr + x * 3;
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+
+        __m128i c1 = _mm_alignr_epi8(v1, v0, 12);
+        __m128i c2 = _mm_alignr_epi8(v2, v1, 8);
+        __m128i c3 = _mm_srli_si128(v2, 4);
+
+        uint8_t *q = rgba + x * 4;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(q), _mm_or_si128(_mm_shuffle_epi8(v0, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(q + 16), _mm_or_si128(_mm_shuffle_epi8(c1, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(q + 32), _mm_or_si128(_mm_shuffle_epi8(c2, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(q + 48), _mm_or_si128(_mm_shuffle_epi8(c3, shuffle), alpha));
+      }
+      bgr_to_rgba_row_scalar(bgr + x * 3, rgba + x * 4, width - x);
+    }
+
+    // 16 pixels per iteration, deinterleaved like desaturate_masked_row_sse41.
+    __attribute__((target("sse4.1"))) void bgr_to_gray_row_sse41(const uint8_t *bgr, uint8_t *gray, int width)
+    {
+      static const Shuffles s = make_shuffles();
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        const uint8_t *p = bgr + x * 3;
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+
+        __m128i b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.b0), _mm_shuffle_epi8(v1, s.b1)),
+                                 _mm_shuffle_epi8(v2, s.b2));
+        __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.g0), _mm_shuffle_epi8(v1, s.g1)),
+                                 _mm_shuffle_epi8(v2, s.g2));
+        __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, s.r0), _mm_shuffle_epi8(v1, s.r1)),
+                                 _mm_shuffle_epi8(v2, s.r2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(gray + x), luminance_sse(b, g, r));
+      }
+      bgr_to_gray_row_scalar(bgr + x * 3, gray + x, width - x);
+    }
+
+    __attribute__((target("avx2"))) inline __m256i load_lanes(const uint8_t *lo, const uint8_t *hi)
+    {
+      return _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lo))),
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+    }
+
+    __attribute__((target("avx2"))) inline __m256i broadcast(__m128i v)
+    {
+      return _mm256_broadcastsi128_si256(v);
+    }
+
+    __attribute__((target("avx2"))) inline __m256i luminance_avx2(__m256i b, __m256i g, __m256i r)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i coeff_bg = _mm256_set1_epi32((kG2Y << 16) | kB2Y);
+      const __m256i coeff_r = _mm256_set1_epi32((1 << 16) | kR2Y);
+      const __m256i round = _mm256_set1_epi16(1 << (kYuvShift - 1));
+
+      __m256i bl = _mm256_unpacklo_epi8(b, zero), bh = _mm256_unpackhi_epi8(b, zero);
+      __m256i gl = _mm256_unpacklo_epi8(g, zero), gh = _mm256_unpackhi_epi8(g, zero);
+      __m256i rl = _mm256_unpacklo_epi8(r, zero), rh = _mm256_unpackhi_epi8(r, zero);
+
+      __m256i y0 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(bl, gl), coeff_bg),
+                                    _mm256_madd_epi16(_mm256_unpacklo_epi16(rl, round), coeff_r));
+      __m256i y1 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(bl, gl), coeff_bg),
+                                    _mm256_madd_epi16(_mm256_unpackhi_epi16(rl, round), coeff_r));
+      __m256i y2 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(bh, gh), coeff_bg),
+                                    _mm256_madd_epi16(_mm256_unpacklo_epi16(rh, round), coeff_r));
+      __m256i y3 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(bh, gh), coeff_bg),
+                                    _mm256_madd_epi16(_mm256_unpackhi_epi16(rh, round), coeff_r));
+
+      y0 = _mm256_srli_epi32(y0, kYuvShift);
+      y1 = _mm256_srli_epi32(y1, kYuvShift);
+      y2 = _mm256_srli_epi32(y2, kYuvShift);
+      y3 = _mm256_srli_epi32(y3, kYuvShift);
+      return _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+    }
+
+    // 32 pixels per iteration. The BGR bytes are loaded so that each 128-bit
+    // lane holds the same layout as one SSE iteration, which keeps every
+    // shuffle and pack lane-local.
+    __attribute__((target("avx2"))) void desaturate_masked_row_avx2(uint8_t *bgr, const uint8_t *mask, int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m256i b0 = broadcast(s.b0), b1 = broadcast(s.b1), b2 = broadcast(s.b2);
+      const __m256i g0 = broadcast(s.g0), g1 = broadcast(s.g1), g2 = broadcast(s.g2);
+      const __m256i r0 = broadcast(s.r0), r1 = broadcast(s.r1), r2 = broadcast(s.r2);
+      const __m256i e0 = broadcast(s.e0), e1 = broadcast(s.e1), e2 = broadcast(s.e2);
+      const __m256i zero = _mm256_setzero_si256();
+
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask + x));
+        if (_mm256_testz_si256(m, m))
+        {
+          continue;
+        }
+        __m256i select = _mm256_xor_si256(_mm256_cmpeq_epi8(m, zero), _mm256_set1_epi8(-1));
+
+        uint8_t *p = bgr + x * 3;
+        __m256i v0 = load_lanes(p, p + 48);
+        __m256i v1 = load_lanes(p + 16, p + 64);
+        __m256i v2 = load_lanes(p + 32, p + 80);
+
+        __m256i b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, b0), _mm256_shuffle_epi8(v1, b1)),
+                                    _mm256_shuffle_epi8(v2, b2));
+        __m256i g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, g0), _mm256_shuffle_epi8(v1, g1)),
+                                    _mm256_shuffle_epi8(v2, g2));
+        __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, r0), _mm256_shuffle_epi8(v1, r1)),
+                                    _mm256_shuffle_epi8(v2, r2));
+        __m256i y = luminance_avx2(b, g, r);
+
+        v0 = _mm256_blendv_epi8(v0, _mm256_shuffle_epi8(y, e0), _mm256_shuffle_epi8(select, e0));
+        v1 = _mm256_blendv_epi8(v1, _mm256_shuffle_epi8(y, e1), _mm256_shuffle_epi8(select, e1));
+        v2 = _mm256_blendv_epi8(v2, _mm256_shuffle_epi8(y, e2), _mm256_shuffle_epi8(select, e2));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(v0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), _mm256_castsi256_si128(v1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), _mm256_castsi256_si128(v2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 48), _mm256_extracti128_si256(v0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 64), _mm256_extracti128_si256(v1, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 80), _mm256_extracti128_si256(v2, 1));
+      }
+      desaturate_masked_row_sse41(bgr + x * 3, mask + x, width - x);
+    }
+    __attribute__((target("avx2"))) inline __m256i lerp_avx2(__m256i a, __m256i b, __m256i w)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i full = _mm256_set1_epi16(255);
+      const __m256i round = _mm256_set1_epi16(128);
+
+      __m256i wl = _mm256_unpacklo_epi8(w, zero), wh = _mm256_unpackhi_epi8(w, zero);
+      __m256i tl = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_sub_epi16(full, wl)),
+                                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), wl));
+      __m256i th = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_sub_epi16(full, wh)),
+                                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), wh));
+      tl = _mm256_add_epi16(tl, round);
+      th = _mm256_add_epi16(th, round);
+      tl = _mm256_srli_epi16(_mm256_add_epi16(tl, _mm256_srli_epi16(tl, 8)), 8);
+      th = _mm256_srli_epi16(_mm256_add_epi16(th, _mm256_srli_epi16(th, 8)), 8);
+      return _mm256_packus_epi16(tl, th);
+    }
+
+    // 32 pixels per iteration, laid out like desaturate_masked_row_avx2.
+    __attribute__((target("avx2"))) void desaturate_weighted_row_avx2(uint8_t *bgr, const uint8_t *weights,
+                                                                    int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m256i b0 = broadcast(s.b0), b1 = broadcast(s.b1), b2 = broadcast(s.b2);
+      const __m256i g0 = broadcast(s.g0), g1 = broadcast(s.g1), g2 = broadcast(s.g2);
+      const __m256i r0 = broadcast(s.r0), r1 = broadcast(s.r1), r2 = broadcast(s.r2);
+      const __m256i e0 = broadcast(s.e0), e1 = broadcast(s.e1), e2 = broadcast(s.e2);
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i full = _mm256_set1_epi8(-1);
+
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + x));
+        if (_mm256_testz_si256(w, w))
+        {
+          continue;
+        }
+
+        uint8_t *p = bgr + x * 3;
+        __m256i v0 = load_lanes(p, p + 48);
+        __m256i v1 = load_lanes(p + 16, p + 64);
+        __m256i v2 = load_lanes(p + 32, p + 80);
+
+        __m256i b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, b0), _mm256_shuffle_epi8(v1, b1)),
+                                    _mm256_shuffle_epi8(v2, b2));
+        __m256i g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, g0), _mm256_shuffle_epi8(v1, g1)),
+                                    _mm256_shuffle_epi8(v2, g2));
+        __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, r0), _mm256_shuffle_epi8(v1, r1)),
+                                    _mm256_shuffle_epi8(v2, r2));
+        __m256i y = luminance_avx2(b, g, r);
+
+        __m256i y0 = _mm256_shuffle_epi8(y, e0), y1 = _mm256_shuffle_epi8(y, e1), y2 = _mm256_shuffle_epi8(y, e2);
+        __m256i w0 = _mm256_shuffle_epi8(w, e0), w1 = _mm256_shuffle_epi8(w, e1), w2 = _mm256_shuffle_epi8(w, e2);
+        __m256i binary = _mm256_or_si256(_mm256_cmpeq_epi8(w, zero), _mm256_cmpeq_epi8(w, full));
+        if (_mm256_movemask_epi8(binary) == -1)
+        {
+          v0 = _mm256_blendv_epi8(v0, y0, w0);
+          v1 = _mm256_blendv_epi8(v1, y1, w1);
+          v2 = _mm256_blendv_epi8(v2, y2, w2);
+        }
+        else
+        {
+          v0 = lerp_avx2(v0, y0, w0);
+          v1 = lerp_avx2(v1, y1, w1);
+          v2 = lerp_avx2(v2, y2, w2);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(v0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), _mm256_castsi256_si128(v1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), _mm256_castsi256_si128(v2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 48), _mm256_extracti128_si256(v0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 64), _mm256_extracti128_si256(v1, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 80), _mm256_extracti128_si256(v2, 1));
+      }
+      desaturate_weighted_row_sse41(bgr + x * 3, weights + x, width - x);
+    }
+
+    // 32 pixels per iteration, laid out per lane like the SSE kernel.
+    __attribute__((target("avx2"))) void blend_weighted_row_avx2(uint8_t *bgr, const uint8_t *filtered,
+                                                                 const uint8_t *weights, int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m256i e0 = broadcast(s.e0), e1 = broadcast(s.e1), e2 = broadcast(s.e2);
+      const __m256i full = _mm256_set1_epi8(-1);
+
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + x));
+        if (_mm256_testz_si256(w, w))
+        {
+          continue;
+        }
+
+        uint8_t *p = bgr + x * 3;
+        const uint8_t *q = filtered + x * 3;
+        __m256i f0 = load_lanes(q, q + 48);
+        __m256i f1 = load_lanes(q + 16, q + 64);
+        __m256i f2 = load_lanes(q + 32, q + 80);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(w, full)) != -1)
+        {
+          f0 = lerp_avx2(load_lanes(p, p + 48), f0, _mm256_shuffle_epi8(w, e0));
+          f1 = lerp_avx2(load_lanes(p + 16, p + 64), f1, _mm256_shuffle_epi8(w, e1));
+          f2 = lerp_avx2(load_lanes(p + 32, p + 80), f2, _mm256_shuffle_epi8(w, e2));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(f0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), _mm256_castsi256_si128(f1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), _mm256_castsi256_si128(f2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 48), _mm256_extracti128_si256(f0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 64), _mm256_extracti128_si256(f1, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 80), _mm256_extracti128_si256(f2, 1));
+      }
+      blend_weighted_row_sse41(bgr + x * 3, filtered + x * 3, weights + x, width - x);
+    }
+
+    __attribute__((target("avx2"))) inline __m256i div255_avx2(__m256i x)
+    {
+      x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+      return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    }
+
+    // Same as multiply_sse. Unpacking and packing are lane-local, so the
+    // bytes stay in place.
+    __attribute__((target("avx2"))) inline __m256i multiply_avx2(__m256i a, __m256i b, int shift)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+      __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+      lo = _mm256_sll_epi16(lo, _mm_cvtsi32_si128(shift));
+      hi = _mm256_sll_epi16(hi, _mm_cvtsi32_si128(shift));
+      return _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i blend_mode_avx2(__m256i a, __m256i b, BlendMode mode)
+    {
+      const __m256i full = _mm256_set1_epi8(-1);
+      switch (mode)
+      {
+      case BlendMode::multiply:
+        return multiply_avx2(a, b, 0);
+      case BlendMode::screen:
+        return _mm256_xor_si256(multiply_avx2(_mm256_xor_si256(a, full), _mm256_xor_si256(b, full), 0), full);
+      case BlendMode::overlay:
+      {
+        __m256i dark = _mm256_cmpgt_epi8(a, full);
+        __m256i low = multiply_avx2(a, b, 1);
+        __m256i high =
+            _mm256_xor_si256(multiply_avx2(_mm256_xor_si256(a, full), _mm256_xor_si256(b, full), 1), full);
+        return _mm256_blendv_epi8(high, low, dark);
+      }
+      default:
+        return b;
+      }
+    }
+
+    __attribute__((target("avx2"))) void blend_mode_row_avx2(const uint8_t *base, const uint8_t *layer,
+                                                             uint8_t *out, int count, BlendMode mode)
+    {
+      int i = 0;
+      for (; i + 32 <= count; i += 32)
+      {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(layer + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), blend_mode_avx2(a, b, mode));
+      }
+      blend_mode_row_sse41(base + i, layer + i, out + i, count - i, mode);
+    }
+
+    // 32 pixels per iteration, laid out per lane like the SSE kernel; the
+    // lanes are interleaved again on the way out.
+    __attribute__((target("avx2"))) void bgr_to_rgba_row_avx2(const uint8_t *bgr, uint8_t *rgba, int width)
+    {
+      const char z = -1;
+      const __m256i shuffle = broadcast(_mm_setr_epi8(2, 1, 0, z, 5, 4, 3, z, 8, 7, 6, z, 11, 10, 9, z));
+      const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        const uint8_t *p = bgr + x * 3;
+        __m256i v0 = load_lanes(p, p + 48);
+        __m256i v1 = load_lanes(p + 16, p + 64);
+        __m256i v2 = load_lanes(p + 32, p + 80);
+
+        __m256i c0 = _mm256_or_si256(_mm256_shuffle_epi8(v0, shuffle), alpha);
+        __m256i c1 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_alignr_epi8(v1, v0, 12), shuffle), alpha);
+        __m256i c2 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_alignr_epi8(v2, v1, 8), shuffle), alpha);
+        __m256i c3 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_srli_si256(v2, 4), shuffle), alpha);
+
+        __m256i *q = reinterpret_cast<__m256i *>(rgba + x * 4);
+        _mm256_storeu_si256(q, _mm256_permute2x128_si256(c0, c1, 0x20));
+        _mm256_storeu_si256(q + 1, _mm256_permute2x128_si256(c2, c3, 0x20));
+        _mm256_storeu_si256(q + 2, _mm256_permute2x128_si256(c0, c1, 0x31));
+        _mm256_storeu_si256(q + 3, _mm256_permute2x128_si256(c2, c3, 0x31));
+      }
+      bgr_to_rgba_row_sse41(bgr + x * 3, rgba + x * 4, width - x);
+    }
+
+    // 32 pixels per iteration; with the lanes loaded like
+    // desaturate_masked_row_avx2 the packed luminance comes out in order.
+    __attribute__((target("avx2"))) void bgr_to_gray_row_avx2(const uint8_t *bgr, uint8_t *gray, int width)
+    {
+      static const Shuffles s = make_shuffles();
+      const __m256i b0 = broadcast(s.b0), b1 = broadcast(s.b1), b2 = broadcast(s.b2);
+      const __m256i g0 = broadcast(s.g0), g1 = broadcast(s.g1), g2 = broadcast(s.g2);
+      const __m256i r0 = broadcast(s.r0), r1 = broadcast(s.r1), r2 = broadcast(s.r2);
+
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+        const uint8_t *p = bgr + x * 3;
+        __m256i v0 = load_lanes(p, p + 48);
+        __m256i v1 = load_lanes(p + 16, p + 64);
+        __m256i v2 = load_lanes(p + 32, p + 80);
+
+        __m256i b = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, b0), _mm256_shuffle_epi8(v1, b1)),
+                                    _mm256_shuffle_epi8(v2, b2));
+        __m256i g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, g0), _mm256_shuffle_epi8(v1, g1)),
+                                    _mm256_shuffle_epi8(v2, g2));
+        __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(v0, r0), _mm256_shuffle_epi8(v1, r1)),
+                                    _mm256_shuffle_epi8(v2, r2));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(gray + x), luminance_avx2(b, g, r));
+      }
+      bgr_to_gray_row_sse41(bgr + x * 3, gray + x, width - x);
+    }
+#endif // GRAPHICS_KERNELS_X86
+
+#if GRAPHICS_KERNELS_NEON
+    inline uint16x8_t luminance_neon(uint8x8_t b, uint8x8_t g, uint8x8_t r)
+    {
+      uint16x8_t b16 = vmovl_u8(b), g16 = vmovl_u8(g), r16 = vmovl_u8(r);
+
+      uint32x4_t lo = vmull_n_u16(vget_low_u16(b16), kB2Y);
+      lo = vmlal_n_u16(lo, vget_low_u16(g16), kG2Y);
+      lo = vmlal_n_u16(lo, vget_low_u16(r16), kR2Y);
+      uint32x4_t hi = vmull_n_u16(vget_high_u16(b16), kB2Y);
+      hi = vmlal_n_u16(hi, vget_high_u16(g16), kG2Y);
+      hi = vmlal_n_u16(hi, vget_high_u16(r16), kR2Y);
+
+      // Rounding narrow shift: (x + (1 << 13)) >> 14.
+      return vcombine_u16(vrshrn_n_u32(lo, kYuvShift), vrshrn_n_u32(hi, kYuvShift));
+    }
+
+    void desaturate_masked_row_neon(uint8_t *bgr, const uint8_t *mask, int width)
+    {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16_t m = vld1q_u8(mask + x);
+#if defined(__aarch64__)
+        if (vmaxvq_u8(m) == 0)
+        {
+          continue;
+        }
+#endif
+        uint8x16_t select = vtstq_u8(m, m);
+
+        uint8_t *p = bgr + x * 3;
+        uint8x16x3_t v = vld3q_u8(p);
+        uint16x8_t y_lo = luminance_neon(vget_low_u8(v.val[0]), vget_low_u8(v.val[1]), vget_low_u8(v.val[2]));
+        uint16x8_t y_hi = luminance_neon(vget_high_u8(v.val[0]), vget_high_u8(v.val[1]), vget_high_u8(v.val[2]));
+        uint8x16_t y = vcombine_u8(vqmovn_u16(y_lo), vqmovn_u16(y_hi));
+
+        v.val[0] = vbslq_u8(select, y, v.val[0]);
+        v.val[1] = vbslq_u8(select, y, v.val[1]);
+        v.val[2] = vbslq_u8(select, y, v.val[2]);
+        vst3q_u8(p, v);
+      }
+      desaturate_masked_row_scalar(bgr + x * 3, mask + x, width - x);
+    }
+    inline uint8x8_t lerp_neon(uint8x8_t a, uint8x8_t b, uint8x8_t w)
+    {
+      uint16x8_t t = vmlal_u8(vmull_u8(a, vsub_u8(vdup_n_u8(255), w)), b, w);
+      t = vaddq_u16(t, vdupq_n_u16(128));
+      return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+    }
+
+    void desaturate_weighted_row_neon(uint8_t *bgr, const uint8_t *weights, int width)
+    {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16_t w = vld1q_u8(weights + x);
+#if defined(__aarch64__)
+        if (vmaxvq_u8(w) == 0)
+        {
+          continue;
+        }
+#endif
+
+        uint8_t *p = bgr + x * 3;
+        uint8x16x3_t v = vld3q_u8(p);
+        uint16x8_t y_lo = luminance_neon(vget_low_u8(v.val[0]), vget_low_u8(v.val[1]), vget_low_u8(v.val[2]));
+        uint16x8_t y_hi = luminance_neon(vget_high_u8(v.val[0]), vget_high_u8(v.val[1]), vget_high_u8(v.val[2]));
+        uint8x8_t yl = vqmovn_u16(y_lo), yh = vqmovn_u16(y_hi);
+        uint8x8_t wl = vget_low_u8(w), wh = vget_high_u8(w);
+
+        for (int c = 0; c < 3; c++)
+        {
+          v.val[c] = vcombine_u8(lerp_neon(vget_low_u8(v.val[c]), yl, wl), lerp_neon(vget_high_u8(v.val[c]), yh, wh));
+        }
+        vst3q_u8(p, v);
+      }
+      desaturate_weighted_row_scalar(bgr + x * 3, weights + x, width - x);
+    }
+
+    void blend_weighted_row_neon(uint8_t *bgr, const uint8_t *filtered, const uint8_t *weights, int width)
+    {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16_t w = vld1q_u8(weights + x);
+#if defined(__aarch64__)
+        if (vmaxvq_u8(w) == 0)
+        {
+          continue;
+        }
+#endif
+
+        uint8_t *p = bgr + x * 3;
+        uint8x16x3_t v = vld3q_u8(p);
+        uint8x16x3_t f = vld3q_u8(filtered + x * 3);
+        uint8x8_t wl = vget_low_u8(w), wh = vget_high_u8(w);
+        for (int c = 0; c < 3; c++)
+        {
+          v.val[c] = vcombine_u8(lerp_neon(vget_low_u8(v.val[c]), vget_low_u8(f.val[c]), wl),
+                                 lerp_neon(vget_high_u8(v.val[c]), vget_high_u8(f.val[c]), wh));
+        }
+        vst3q_u8(p, v);
+      }
+      blend_weighted_row_scalar(bgr + x * 3, filtered + x * 3, weights + x, width - x);
+    }
+
+    // div255(a * b << shift), see multiply_sse.
+    template <int Shift>
+    inline uint8x8_t multiply_neon(uint8x8_t a, uint8x8_t b)
+    {
+      uint16x8_t t = vshlq_n_u16(vmull_u8(a, b), Shift);
+      t = vaddq_u16(t, vdupq_n_u16(128));
+      return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+    }
+
+    template <int Shift>
+    inline uint8x16_t multiply_neon(uint8x16_t a, uint8x16_t b)
+    {
+      return vcombine_u8(multiply_neon<Shift>(vget_low_u8(a), vget_low_u8(b)),
+                         multiply_neon<Shift>(vget_high_u8(a), vget_high_u8(b)));
+    }
+
+    inline uint8x16_t blend_mode_neon(uint8x16_t a, uint8x16_t b, BlendMode mode)
+    {
+      switch (mode)
+      {
+      case BlendMode::multiply:
+        return multiply_neon<0>(a, b);
+      case BlendMode::screen:
+        return vmvnq_u8(multiply_neon<0>(vmvnq_u8(a), vmvnq_u8(b)));
+      case BlendMode::overlay:
+        return vbslq_u8(vcltq_u8(a, vdupq_n_u8(128)), multiply_neon<1>(a, b),
+                        vmvnq_u8(multiply_neon<1>(vmvnq_u8(a), vmvnq_u8(b))));
+      default:
+        return b;
+      }
+    }
+
+    void blend_mode_row_neon(const uint8_t *base, const uint8_t *layer, uint8_t *out, int count, BlendMode mode)
+    {
+      int i = 0;
+      for (; i + 16 <= count; i += 16)
+      {
+        vst1q_u8(out + i, blend_mode_neon(vld1q_u8(base + i), vld1q_u8(layer + i), mode));
+      }
+      blend_mode_row_scalar(base + i, layer + i, out + i, count - i, mode);
+    }
+
+    void bgr_to_rgba_row_neon(const uint8_t *bgr, uint8_t *rgba, int width)
+    {
+      const uint8x16_t alpha = vdupq_n_u8(255);
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x3_t v = vld3q_u8(bgr + x * 3);
+        uint8x16x4_t out;
+        out.val[0] = v.val[2];
+        out.val[1] = v.val[1];
+        out.val[2] = v.val[0];
+        out.val[3] = alpha;
+        vst4q_u8(rgba + x * 4, out);
+      }
+      bgr_to_rgba_row_scalar(bgr + x * 3, rgba + x * 4, width - x);
+    }
+
+    void bgr_to_gray_row_neon(const uint8_t *bgr, uint8_t *gray, int width)
+    {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x3_t v = vld3q_u8(bgr + x * 3);
+        uint16x8_t y_lo = luminance_neon(vget_low_u8(v.val[0]), vget_low_u8(v.val[1]), vget_low_u8(v.val[2]));
+        uint16x8_t y_hi = luminance_neon(vget_high_u8(v.val[0]), vget_high_u8(v.val[1]), vget_high_u8(v.val[2]));
+        vst1q_u8(gray + x, vcombine_u8(vqmovn_u16(y_lo), vqmovn_u16(y_hi)));
+      }
+      bgr_to_gray_row_scalar(bgr + x * 3, gray + x, width - x);
+    }
+#endif // GRAPHICS_KERNELS_NEON
+
+    bool level_supported(KernelLevel level)
+    {
+      switch (level)
+      {
+      case KernelLevel::scalar:
+        return true;
+#if GRAPHICS_KERNELS_X86
+      case KernelLevel::sse41:
+        return __builtin_cpu_supports("sse4.1");
+      case KernelLevel::avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#if GRAPHICS_KERNELS_NEON
+      case KernelLevel::neon:
+        return true;
+#endif
+      default:
+        return false;
+      }
+    }
+
+    KernelLevel best_level()
+    {
+      const KernelLevel preferred[] = {KernelLevel::avx2, KernelLevel::sse41, KernelLevel::neon};
+      for (KernelLevel level : preferred)
+      {
+        if (level_supported(level))
+        {
+          return level;
+        }
+      }
+      return KernelLevel::scalar;
+    }
+
+    struct Dispatch
+    {
+      KernelLevel level;
+      DesaturateRow desaturate_masked_row;
+      DesaturateWeightedRow desaturate_weighted_row;
+      BgrToRgbaRow bgr_to_rgba_row;
+      BlendWeightedRow blend_weighted_row;
+      BlendModeRow blend_mode_row;
+      BgrToGrayRow bgr_to_gray_row;
+    };
+
+    Dispatch make_dispatch(KernelLevel level)
+    {
+      switch (level)
+      {
+#if GRAPHICS_KERNELS_X86
+      case KernelLevel::avx2:
+        return {level, desaturate_masked_row_avx2, desaturate_weighted_row_avx2, bgr_to_rgba_row_avx2,
+                blend_weighted_row_avx2, blend_mode_row_avx2, bgr_to_gray_row_avx2};
+      case KernelLevel::sse41:
+        return {level, desaturate_masked_row_sse41, desaturate_weighted_row_sse41, bgr_to_rgba_row_sse41,
+                blend_weighted_row_sse41, blend_mode_row_sse41, bgr_to_gray_row_sse41};
+#endif
+#if GRAPHICS_KERNELS_NEON
+      case KernelLevel::neon:
+        return {level, desaturate_masked_row_neon, desaturate_weighted_row_neon, bgr_to_rgba_row_neon,
+                blend_weighted_row_neon, blend_mode_row_neon, bgr_to_gray_row_neon};
+#endif
+      default:
+        return {KernelLevel::scalar, desaturate_masked_row_scalar, desaturate_weighted_row_scalar,
+                bgr_to_rgba_row_scalar, blend_weighted_row_scalar, blend_mode_row_scalar,
+                bgr_to_gray_row_scalar};
+      }
+    }
+
+    // The level the kernels run on. set_kernel_level() may change it while
+    // workers are running kernels, so it is atomic and the tables it picks
+    // from are never written after they are built.
+    std::atomic<int> &active_level()
+    {
+      static std::atomic<int> level{static_cast<int>(best_level())};
+      return level;
+    }
+
+    const Dispatch &dispatch()
+    {
+      static const Dispatch tables[] = {make_dispatch(KernelLevel::scalar), make_dispatch(KernelLevel::sse41),
+                                        make_dispatch(KernelLevel::avx2), make_dispatch(KernelLevel::neon)};
+      return tables[active_level().load(std::memory_order_relaxed)];
+    }
+  }
+
+  bool set_kernel_level(KernelLevel level)
+  {
+    if (!level_supported(level))
+    {
+      return false;
+    }
+    active_level().store(static_cast<int>(level), std::memory_order_relaxed);
+    return true;
+  }
+
+  KernelLevel kernel_level()
+  {
+    return dispatch().level;
+  }
+
+  const char *kernel_level_name(KernelLevel level)
+  {
+    switch (level)
+    {
+    case KernelLevel::sse41:
+      return "sse4.1";
+    case KernelLevel::avx2:
+      return "avx2";
+    case KernelLevel::neon:
+      return "neon";
+    default:
+      return "scalar";
+    }
+  }
+
+  void desaturate_masked_row_scalar(uint8_t *bgr, const uint8_t *mask, int width)
+  {
+    for (int x = 0; x < width; x++, bgr += 3)
+    {
+      if (mask[x] != 0)
+      {
+        uint8_t y = luminance(bgr[0], bgr[1], bgr[2]);
+        bgr[0] = y;
+        bgr[1] = y;
+        bgr[2] = y;
+      }
+    }
+  }
+
+  void desaturate_masked_row(uint8_t *bgr, const uint8_t *mask, int width)
+  {
+    dispatch().desaturate_masked_row(bgr, mask, width);
+  }
+
+  void desaturate_masked(cv::Mat &bgr, const cv::Mat &mask)
+  {
+    CV_Assert(bgr.type() == CV_8UC3 && mask.type() == CV_8UC1 && bgr.size() == mask.size());
+
+    DesaturateRow row = dispatch().desaturate_masked_row;
+    for (int y = 0; y < bgr.rows; y++)
+    {
+      row(bgr.ptr<uint8_t>(y), mask.ptr<uint8_t>(y), bgr.cols);
+    }
+  }
+
+  void desaturate_weighted_row_scalar(uint8_t *bgr, const uint8_t *weights, int width)
+  {
+    for (int x = 0; x < width; x++, bgr += 3)
+    {
+      uint8_t w = weights[x];
+      if (w != 0)
+      {
+        uint8_t y = luminance(bgr[0], bgr[1], bgr[2]);
+        bgr[0] = lerp255(bgr[0], y, w);
+        bgr[1] = lerp255(bgr[1], y, w);
+        bgr[2] = lerp255(bgr[2], y, w);
+      }
+    }
+  }
+
+  void desaturate_weighted_row(uint8_t *bgr, const uint8_t *weights, int width)
+  {
+    dispatch().desaturate_weighted_row(bgr, weights, width);
+  }
+
+  void desaturate_weighted(cv::Mat &bgr, const cv::Mat &weights)
+  {
+    CV_Assert(bgr.type() == CV_8UC3 && weights.type() == CV_8UC1 && bgr.size() == weights.size());
+
+    DesaturateWeightedRow row = dispatch().desaturate_weighted_row;
+    for (int y = 0; y < bgr.rows; y++)
+    {
+      row(bgr.ptr<uint8_t>(y), weights.ptr<uint8_t>(y), bgr.cols);
+    }
+  }
+
+  void bgr_to_rgba_row_scalar(const uint8_t *bgr, uint8_t *rgba, int width)
+  {
+    for (int x = 0; x < width; x++, bgr += 3, rgba += 4)
+    {
+      rgba[0] = bgr[2];
+      rgba[1] = bgr[1];
+      rgba[2] = bgr[0];
+      rgba[3] = 255;
+    }
+  }
+
+  void bgr_to_rgba_row(const uint8_t *bgr, uint8_t *rgba, int width)
+  {
+    dispatch().bgr_to_rgba_row(bgr, rgba, width);
+  }
+
+  void bgr_to_rgba(const cv::Mat &bgr, uint8_t *rgba)
+  {
+    CV_Assert(bgr.type() == CV_8UC3);
+
+    BgrToRgbaRow row = dispatch().bgr_to_rgba_row;
+    if (bgr.isContinuous())
+    {
+      row(bgr.ptr<uint8_t>(), rgba, bgr.cols * bgr.rows);
+      return;
+    }
+    for (int y = 0; y < bgr.rows; y++)
+    {
+      row(bgr.ptr<uint8_t>(y), rgba + static_cast<size_t>(y) * bgr.cols * 4, bgr.cols);
+    }
+  }
+
+  void blend_weighted_row_scalar(uint8_t *bgr, const uint8_t *filtered, const uint8_t *weights, int width)
+  {
+    for (int x = 0; x < width; x++, bgr += 3, filtered += 3)
+    {
+      uint8_t w = weights[x];
+      if (w != 0)
+      {
+        bgr[0] = lerp255(bgr[0], filtered[0], w);
+        bgr[1] = lerp255(bgr[1], filtered[1], w);
+        bgr[2] = lerp255(bgr[2], filtered[2], w);
+      }
+    }
+  }
+
+  void blend_weighted_row(uint8_t *bgr, const uint8_t *filtered, const uint8_t *weights, int width)
+  {
+    dispatch().blend_weighted_row(bgr, filtered, weights, width);
+  }
+
+  void blend_weighted(cv::Mat &bgr, const cv::Mat &filtered, const cv::Mat &weights)
+  {
+    CV_Assert(bgr.type() == CV_8UC3 && filtered.type() == CV_8UC3 && weights.type() == CV_8UC1 &&
+              bgr.size() == filtered.size() && bgr.size() == weights.size());
+
+    BlendWeightedRow row = dispatch().blend_weighted_row;
+    for (int y = 0; y < bgr.rows; y++)
+    {
+      row(bgr.ptr<uint8_t>(y), filtered.ptr<uint8_t>(y), weights.ptr<uint8_t>(y), bgr.cols);
+    }
+  }
+
+  void blend_mode_row_scalar(const uint8_t *base, const uint8_t *layer, uint8_t *out, int count, BlendMode mode)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      out[i] = blend_mode(base[i], layer[i], mode);
+    }
+  }
+
+  void blend_mode_row(const uint8_t *base, const uint8_t *layer, uint8_t *out, int count, BlendMode mode)
+  {
+    dispatch().blend_mode_row(base, layer, out, count, mode);
+  }
+
+  void bgr_to_gray_row_scalar(const uint8_t *bgr, uint8_t *gray, int width)
+  {
+    for (int x = 0; x < width; x++, bgr += 3)
+    {
+      gray[x] = luminance(bgr[0], bgr[1], bgr[2]);
+    }
+  }
+
+  void bgr_to_gray_row(const uint8_t *bgr, uint8_t *gray, int width)
+  {
+    dispatch().bgr_to_gray_row(bgr, gray, width);
+  }
+}
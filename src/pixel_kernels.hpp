@@ -0,0 +1,104 @@
+#ifndef GRAPHICS_PIXEL_KERNELS_HPP
+#define GRAPHICS_PIXEL_KERNELS_HPP
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+namespace graphics
+{
+  // Instruction sets the pixel kernels can run on. The best level supported by
+  // the CPU is picked on first use.
+  enum class KernelLevel
+  {
+    scalar,
+    sse41,
+    avx2,
+    neon,
+  };
+
+  // Forces the kernels onto level. Returns false, leaving the current level in
+  // place, if the CPU or the build does not support it.
+  bool set_kernel_level(KernelLevel level);
+  KernelLevel kernel_level();
+  const char *kernel_level_name(KernelLevel level);
+
+  // Replaces every pixel of a BGR row whose mask byte is non-zero with its
+  // luminance, in a single pass and in place. The luminance uses the 14-bit
+  // fixed point weights of cv::COLOR_BGR2GRAY, so the output matches
+  // cvtColor BGR2GRAY -> GRAY2BGR followed by a masked copyTo bit for bit.
+  void desaturate_masked_row(uint8_t *bgr, const uint8_t *mask, int width);
+
+  // Scalar reference implementation of desaturate_masked_row.
+  void desaturate_masked_row_scalar(uint8_t *bgr, const uint8_t *mask, int width);
+
+  // Applies desaturate_masked_row to every row of a CV_8UC3 image with a
+  // CV_8UC1 mask of the same size.
+  void desaturate_masked(cv::Mat &bgr, const cv::Mat &mask);
+
+  // Blends every pixel of a BGR row towards its luminance by weight / 255, in
+  // place and rounded. Weights of 0 and 255 leave the pixel or replace it
+  // with its luminance exactly, so on a binary mask the result matches
+  // desaturate_masked_row bit for bit.
+  void desaturate_weighted_row(uint8_t *bgr, const uint8_t *weights, int width);
+
+  // Scalar reference implementation of desaturate_weighted_row.
+  void desaturate_weighted_row_scalar(uint8_t *bgr, const uint8_t *weights, int width);
+
+  // Applies desaturate_weighted_row to every row of a CV_8UC3 image with
+  // CV_8UC1 weights of the same size.
+  void desaturate_weighted(cv::Mat &bgr, const cv::Mat &weights);
+
+  // Blends every pixel of a BGR row towards the same pixel of filtered by
+  // weight / 255, in place and rounded like desaturate_weighted_row. Weights
+  // of 0 and 255 keep the pixel or take the filtered one exactly.
+  void blend_weighted_row(uint8_t *bgr, const uint8_t *filtered, const uint8_t *weights, int width);
+
+  // Scalar reference implementation of blend_weighted_row.
+  void blend_weighted_row_scalar(uint8_t *bgr, const uint8_t *filtered, const uint8_t *weights, int width);
+
+  // Applies blend_weighted_row to every row of a CV_8UC3 image with a
+  // CV_8UC3 filtered image and CV_8UC1 weights of the same size.
+  void blend_weighted(cv::Mat &bgr, const cv::Mat &filtered, const cv::Mat &weights);
+
+  // Blend modes of the layer compositor; the values match graphics_blend_mode.
+  enum class BlendMode
+  {
+    normal = 0,
+    multiply = 1,
+    screen = 2,
+    overlay = 3,
+  };
+
+  // Writes count bytes (channels of interleaved pixels) of layer blended
+  // onto base by mode into out, rounded: multiply is base * layer / 255,
+  // screen its inverse on the inverted values, overlay multiplies the dark
+  // half of base and screens the light half, each at twice the strength.
+  // Normal copies layer. Weighting the result by the layer's alpha is left
+  // to blend_weighted_row.
+  void blend_mode_row(const uint8_t *base, const uint8_t *layer, uint8_t *out, int count, BlendMode mode);
+
+  // Scalar reference implementation of blend_mode_row.
+  void blend_mode_row_scalar(const uint8_t *base, const uint8_t *layer, uint8_t *out, int count, BlendMode mode);
+
+  // Converts a row of BGR pixels to opaque RGBA, the layout of Flutter's
+  // PixelFormat.rgba8888.
+  void bgr_to_rgba_row(const uint8_t *bgr, uint8_t *rgba, int width);
+
+  // Scalar reference implementation of bgr_to_rgba_row.
+  void bgr_to_rgba_row_scalar(const uint8_t *bgr, uint8_t *rgba, int width);
+
+  // Converts a CV_8UC3 image into rgba, a tightly packed buffer of
+  // cols * rows * 4 bytes.
+  void bgr_to_rgba(const cv::Mat &bgr, uint8_t *rgba);
+
+  // Converts a row of BGR pixels to their luminance, with the weights of
+  // desaturate_masked_row, so the output matches cvtColor BGR2GRAY bit for
+  // bit.
+  void bgr_to_gray_row(const uint8_t *bgr, uint8_t *gray, int width);
+
+  // Scalar reference implementation of bgr_to_gray_row.
+  void bgr_to_gray_row_scalar(const uint8_t *bgr, uint8_t *gray, int width);
+}
+
+#endif // GRAPHICS_PIXEL_KERNELS_HPP
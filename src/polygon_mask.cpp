@@ -0,0 +1,552 @@
+#include "polygon_mask.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <mutex>
+
+#include "buffer_pool.hpp"
+#include "stats.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Largest coordinate taken into account; keeps the float to int
+    // conversions defined for wild input.
+    const float kMaxCoordinate = 1 << 24;
+
+    const size_t kCacheEntries = 16;
+    const size_t kCacheBytes = 64 * 1024 * 1024;
+
+    // A polygon edge in roi coordinates, shifted so that pixel x covers
+    // [x, x + 1). Oriented top to bottom, dir keeps the winding.
+    struct Edge
+    {
+      float x0, y0, y1;
+      float dxdy;
+      float dir;
+    };
+
+    float clamp_coordinate(float value)
+    {
+      return std::min(kMaxCoordinate, std::max(-kMaxCoordinate, value));
+    }
+
+    // Adds the signed area a segment sweeps between xa and xb (0 <= x <= w)
+    // within one row, where it moves down by d, to acc (w + 2 cells). Each
+    // cell gets the part of the area it holds, the running sum over the row
+    // carries the rest to the cells on the right.
+    void accumulate(float *acc, float xa, float xb, float d)
+    {
+      float x0 = std::min(xa, xb);
+      float x1 = std::max(xa, xb);
+      float x0_floor = std::floor(x0);
+      float x1_ceil = std::ceil(x1);
+      int x0i = static_cast<int>(x0_floor);
+      int x1i = static_cast<int>(x1_ceil);
+
+      if (x1i <= x0i + 1)
+      {
+        // Within one cell: the area right of the midpoint spills over.
+        float mid = 0.5f * (xa + xb) - x0_floor;
+        acc[x0i] += d - d * mid;
+        acc[x0i + 1] += d * mid;
+        return;
+      }
+
+      float s = 1.0f / (x1 - x0);
+      float x0f = x0 - x0_floor;
+      float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+      float x1f = x1 - x1_ceil + 1;
+      float am = 0.5f * s * x1f * x1f;
+      acc[x0i] += d * a0;
+      if (x1i == x0i + 2)
+      {
+        acc[x0i + 1] += d * (1 - a0 - am);
+      }
+      else
+      {
+        float a1 = s * (1.5f - x0f);
+        acc[x0i + 1] += d * (a1 - a0);
+        for (int x = x0i + 2; x < x1i - 1; x++)
+        {
+          acc[x] += d * s;
+        }
+        float a2 = a1 + (x1i - x0i - 3) * s;
+        acc[x1i - 1] += d * (1 - a2 - am);
+      }
+      acc[x1i] += d * am;
+    }
+
+    // accumulate() for a segment that may leave [0, w]: it is split where it
+    // crosses the roi's sides. Parts left of the roi only add their winding to
+    // its first pixel, parts right of it land past the last one.
+    void accumulate_clipped(float *acc, int w, float xa, float xb, float d)
+    {
+      const float width = static_cast<float>(w);
+      float t[4] = {0, 1, 1, 1};
+      int cuts = 1;
+      for (float side : {0.0f, width})
+      {
+        if ((xa < side) != (xb < side) && xa != xb)
+        {
+          t[cuts++] = (side - xa) / (xb - xa);
+        }
+      }
+      std::sort(t, t + cuts);
+      t[cuts] = 1;
+      for (int i = 0; i < cuts; i++)
+      {
+        float x0 = xa + (xb - xa) * t[i];
+        float x1 = i + 1 < cuts ? xa + (xb - xa) * t[i + 1] : xb;
+        x0 = std::min(width, std::max(0.0f, x0));
+        x1 = std::min(width, std::max(0.0f, x1));
+        accumulate(acc, x0, x1, d * (t[i + 1] - t[i]));
+      }
+    }
+
+    // Pixels overlapped by the polygon, before clipping to the image.
+    cv::Rect unclipped_bounds(const std::vector<cv::Point2f> &polygon)
+    {
+      float min_x = kMaxCoordinate, min_y = kMaxCoordinate;
+      float max_x = -kMaxCoordinate, max_y = -kMaxCoordinate;
+      for (const cv::Point2f &point : polygon)
+      {
+        if (!std::isfinite(point.x) || !std::isfinite(point.y))
+        {
+          continue;
+        }
+        min_x = std::min(min_x, clamp_coordinate(point.x));
+        min_y = std::min(min_y, clamp_coordinate(point.y));
+        max_x = std::max(max_x, clamp_coordinate(point.x));
+        max_y = std::max(max_y, clamp_coordinate(point.y));
+      }
+      if (min_x > max_x)
+      {
+        return cv::Rect();
+      }
+
+      int x0 = static_cast<int>(std::floor(min_x + 0.5f));
+      int y0 = static_cast<int>(std::floor(min_y + 0.5f));
+      int x1 = static_cast<int>(std::ceil(max_x + 0.5f));
+      int y1 = static_cast<int>(std::ceil(max_y + 0.5f));
+      return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+    }
+
+    struct CacheEntry
+    {
+      uint64_t key;
+      std::vector<cv::Point2f> polygon;
+      float feather;
+      cv::Size image_size;
+      std::shared_ptr<const PolygonMask> mask;
+    };
+
+    // Most recently used first.
+    struct MaskCache
+    {
+      std::mutex mutex;
+      std::list<CacheEntry> entries;
+      size_t bytes = 0;
+    };
+
+    MaskCache &mask_cache()
+    {
+      static MaskCache instance;
+      return instance;
+    }
+
+    // FNV-1a over the polygon's coordinates and the other inputs of a mask.
+    uint64_t mask_key(const std::vector<cv::Point2f> &polygon, float feather, cv::Size image_size)
+    {
+      uint64_t hash = 14695981039346656037ull;
+      auto mix = [&hash](const void *data, size_t length)
+      {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < length; i++)
+        {
+          hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+      };
+      mix(polygon.data(), polygon.size() * sizeof(cv::Point2f));
+      mix(&feather, sizeof(feather));
+      mix(&image_size.width, sizeof(image_size.width));
+      mix(&image_size.height, sizeof(image_size.height));
+      return hash;
+    }
+
+    float clamp_feather(float feather)
+    {
+      return std::isfinite(feather) ? std::min(std::max(feather, 0.0f), 1024.0f) : 0.0f;
+    }
+
+    int feather_padding(float feather)
+    {
+      return feather > 0 ? static_cast<int>(std::ceil(feather)) : 0;
+    }
+
+    // Blurs coverage over the feather radius. The coverage already holds
+    // feather_padding() empty pixels around the polygon, except where the
+    // image ends; there the selection carries on outward.
+    void soften(cv::Mat &coverage, float feather)
+    {
+      int pad = feather_padding(feather);
+      if (pad > 0)
+      {
+        cv::GaussianBlur(coverage, coverage, cv::Size(2 * pad + 1, 2 * pad + 1), feather / 3.0, feather / 3.0,
+                         cv::BORDER_REPLICATE);
+      }
+    }
+
+    std::shared_ptr<const PolygonMask> build_mask(const std::vector<cv::Point2f> &polygon, float feather,
+                                                  cv::Size image_size)
+    {
+      auto mask = std::make_shared<PolygonMask>();
+      mask->image_size = image_size;
+      int pad = feather_padding(feather);
+      cv::Rect bounds = unclipped_bounds(polygon);
+      if (bounds.area() > 0)
+      {
+        bounds = cv::Rect(bounds.x - pad, bounds.y - pad, bounds.width + 2 * pad, bounds.height + 2 * pad);
+      }
+      mask->roi = bounds & cv::Rect(0, 0, image_size.width, image_size.height);
+      if (mask->roi.empty())
+      {
+        return mask;
+      }
+
+      StageTimer timer(GRAPHICS_STAGE_MASK);
+      cv::Mat coverage;
+      rasterize_coverage(polygon, mask->roi, coverage);
+      soften(coverage, feather);
+      mask->coverage = coverage;
+      record_temporary(coverage.total());
+      return mask;
+    }
+  }
+
+  cv::Rect polygon_bounds(const std::vector<cv::Point2f> &polygon, cv::Size size)
+  {
+    return unclipped_bounds(polygon) & cv::Rect(0, 0, size.width, size.height);
+  }
+
+  void rasterize_coverage(const std::vector<cv::Point2f> &polygon, const cv::Rect &roi, cv::Mat &mask)
+  {
+    pooled(mask).create(roi.size(), CV_8UC1);
+    const int width = roi.width;
+    const float offset_x = 0.5f - roi.x;
+    const float offset_y = 0.5f - roi.y;
+
+    std::vector<Edge> edges;
+    edges.reserve(polygon.size());
+    for (size_t i = 0; i < polygon.size(); i++)
+    {
+      const cv::Point2f &p = polygon[i];
+      const cv::Point2f &q = polygon[(i + 1) % polygon.size()];
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(q.x) || !std::isfinite(q.y))
+      {
+        continue;
+      }
+      float px = clamp_coordinate(p.x) + offset_x, py = clamp_coordinate(p.y) + offset_y;
+      float qx = clamp_coordinate(q.x) + offset_x, qy = clamp_coordinate(q.y) + offset_y;
+      if (py == qy)
+      {
+        continue;
+      }
+      if (py < qy)
+      {
+        edges.push_back(Edge{px, py, qy, (qx - px) / (qy - py), 1.0f});
+      }
+      else
+      {
+        edges.push_back(Edge{qx, qy, py, (px - qx) / (py - qy), -1.0f});
+      }
+    }
+    std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b)
+              { return a.y0 < b.y0; });
+
+    std::vector<float> acc(width + 2);
+    std::vector<const Edge *> active;
+    size_t next = 0;
+    for (int y = 0; y < roi.height; y++)
+    {
+      const float top = static_cast<float>(y);
+      const float bottom = top + 1;
+      while (next < edges.size() && edges[next].y0 < bottom)
+      {
+        active.push_back(&edges[next++]);
+      }
+      active.erase(std::remove_if(active.begin(), active.end(), [top](const Edge *edge)
+                                  { return edge->y1 <= top; }),
+                   active.end());
+
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      for (const Edge *edge : active)
+      {
+        float ya = std::max(top, edge->y0);
+        float yb = std::min(bottom, edge->y1);
+        if (yb <= ya)
+        {
+          continue;
+        }
+        float xa = edge->x0 + (ya - edge->y0) * edge->dxdy;
+        float xb = edge->x0 + (yb - edge->y0) * edge->dxdy;
+        accumulate_clipped(acc.data(), width, xa, xb, (yb - ya) * edge->dir);
+      }
+
+      uint8_t *row = mask.ptr<uint8_t>(y);
+      float winding = 0;
+      for (int x = 0; x < width; x++)
+      {
+        winding += acc[x];
+        row[x] = static_cast<uint8_t>(std::min(1.0f, std::fabs(winding)) * 255.0f + 0.5f);
+      }
+    }
+  }
+
+  std::shared_ptr<const PolygonMask> polygon_mask(const std::vector<cv::Point2f> &polygon, float feather,
+                                                  cv::Size image_size)
+  {
+    feather = clamp_feather(feather);
+    uint64_t key = mask_key(polygon, feather, image_size);
+    MaskCache &cache = mask_cache();
+    {
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      for (auto entry = cache.entries.begin(); entry != cache.entries.end(); ++entry)
+      {
+        if (entry->key == key && entry->feather == feather && entry->image_size == image_size &&
+            entry->polygon == polygon)
+        {
+          cache.entries.splice(cache.entries.begin(), cache.entries, entry);
+          record_mask_lookup(true);
+          return entry->mask;
+        }
+      }
+    }
+    record_mask_lookup(false);
+
+    // Built outside the lock; two threads may race on the same mask, which
+    // only costs a duplicate rasterization.
+    std::shared_ptr<const PolygonMask> mask = build_mask(polygon, feather, image_size);
+    size_t bytes = mask->coverage.total();
+    if (bytes > kCacheBytes)
+    {
+      return mask;
+    }
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.entries.push_front(CacheEntry{key, polygon, feather, image_size, mask});
+    cache.bytes += bytes;
+    while (cache.entries.size() > kCacheEntries || cache.bytes > kCacheBytes)
+    {
+      cache.bytes -= cache.entries.back().mask->coverage.total();
+      cache.entries.pop_back();
+    }
+    return mask;
+  }
+
+  void clear_mask_cache()
+  {
+    MaskCache &cache = mask_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.entries.clear();
+    cache.bytes = 0;
+  }
+
+  IncrementalPolygonMask::IncrementalPolygonMask(cv::Size image_size)
+      : image_size_(image_size)
+  {
+  }
+
+  void IncrementalPolygonMask::append(const cv::Point2f *points, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (!std::isfinite(points[i].x) || !std::isfinite(points[i].y))
+      {
+        continue;
+      }
+      cv::Point2f point(clamp_coordinate(points[i].x), clamp_coordinate(points[i].y));
+      if (polygon_.empty())
+      {
+        min_ = max_ = point;
+      }
+      else
+      {
+        min_ = cv::Point2f(std::min(min_.x, point.x), std::min(min_.y, point.y));
+        max_ = cv::Point2f(std::max(max_.x, point.x), std::max(max_.y, point.y));
+      }
+      bounds_ = polygon_bounds(std::vector<cv::Point2f>{min_, max_}, image_size_);
+      revision_++;
+
+      if ((bounds_ & roi_) != bounds_)
+      {
+        // Room for the selection to grow by a quarter before the cells are
+        // rebuilt again.
+        int margin_x = std::max(64, bounds_.width / 4);
+        int margin_y = std::max(64, bounds_.height / 4);
+        cv::Rect grown(bounds_.x - margin_x, bounds_.y - margin_y, bounds_.width + 2 * margin_x,
+                       bounds_.height + 2 * margin_y);
+        polygon_.push_back(point);
+        grow(grown & cv::Rect(0, 0, image_size_.width, image_size_.height));
+        continue;
+      }
+
+      if (!polygon_.empty())
+      {
+        add_edge(polygon_.back(), point, 1);
+      }
+      polygon_.push_back(point);
+    }
+  }
+
+  void IncrementalPolygonMask::clear()
+  {
+    polygon_.clear();
+    bounds_ = roi_ = cv::Rect();
+    cells_.clear();
+    dirty_begin_ = dirty_end_ = 0;
+    resolved_ = cv::Mat();
+    mask_.reset();
+    feathered_.reset();
+    revision_++;
+  }
+
+  void IncrementalPolygonMask::grow(const cv::Rect &roi)
+  {
+    // Rebuilt from the vertices rather than moved, so no rounding carries
+    // over from the old cell offsets.
+    roi_ = roi;
+    cells_.assign(static_cast<size_t>(roi_.height) * (roi_.width + 2), 0.0f);
+    for (size_t i = 1; i < polygon_.size(); i++)
+    {
+      add_edge(polygon_[i - 1], polygon_[i], 1);
+    }
+    resolved_ = cv::Mat();
+    dirty_begin_ = 0;
+    dirty_end_ = roi_.height;
+  }
+
+  void IncrementalPolygonMask::add_edge(cv::Point2f p, cv::Point2f q, float sign)
+  {
+    const int width = roi_.width;
+    float px = p.x + 0.5f - roi_.x, py = p.y + 0.5f - roi_.y;
+    float qx = q.x + 0.5f - roi_.x, qy = q.y + 0.5f - roi_.y;
+    if (py == qy)
+    {
+      return;
+    }
+    if (py > qy)
+    {
+      std::swap(px, qx);
+      std::swap(py, qy);
+      sign = -sign;
+    }
+
+    float dxdy = (qx - px) / (qy - py);
+    int begin = std::max(0, static_cast<int>(std::floor(py)));
+    int end = std::min(roi_.height, static_cast<int>(std::ceil(qy)));
+    for (int y = begin; y < end; y++)
+    {
+      float ya = std::max(static_cast<float>(y), py);
+      float yb = std::min(static_cast<float>(y + 1), qy);
+      if (yb <= ya)
+      {
+        continue;
+      }
+      float xa = px + (ya - py) * dxdy;
+      float xb = px + (yb - py) * dxdy;
+      accumulate_clipped(&cells_[static_cast<size_t>(y) * (width + 2)], width, xa, xb, (yb - ya) * sign);
+    }
+    if (begin < end)
+    {
+      dirty_begin_ = dirty_begin_ < dirty_end_ ? std::min(dirty_begin_, begin) : begin;
+      dirty_end_ = std::max(dirty_end_, end);
+    }
+  }
+
+  std::shared_ptr<const PolygonMask> IncrementalPolygonMask::mask(float feather)
+  {
+    if (bounds_.empty())
+    {
+      auto empty = std::make_shared<PolygonMask>();
+      empty->image_size = image_size_;
+      return empty;
+    }
+
+    StageTimer timer(GRAPHICS_STAGE_MASK);
+    bool stale = !mask_ || mask_revision_ != revision_;
+    if (resolved_.empty())
+    {
+      pooled(resolved_).create(roi_.size(), CV_8UC1);
+      dirty_begin_ = 0;
+      dirty_end_ = roi_.height;
+    }
+    else if (stale && mask_ && mask_.use_count() > 1)
+    {
+      // Someone still holds the previous mask, which views resolved_.
+      cv::Mat copy;
+      pooled(copy);
+      resolved_.copyTo(copy);
+      resolved_ = copy;
+    }
+
+    if (stale)
+    {
+      // The cells hold the open path; the closing edge moves with every
+      // vertex, so it is only added while resolving.
+      add_edge(polygon_.back(), polygon_.front(), 1);
+      const int width = roi_.width;
+      for (int y = dirty_begin_; y < dirty_end_; y++)
+      {
+        const float *cells = &cells_[static_cast<size_t>(y) * (width + 2)];
+        uint8_t *row = resolved_.ptr<uint8_t>(y);
+        float winding = 0;
+        for (int x = 0; x < width; x++)
+        {
+          winding += cells[x];
+          row[x] = static_cast<uint8_t>(std::min(1.0f, std::fabs(winding)) * 255.0f + 0.5f);
+        }
+      }
+      dirty_begin_ = dirty_end_ = 0;
+      add_edge(polygon_.back(), polygon_.front(), -1);
+
+      mask_ = std::make_shared<PolygonMask>();
+      mask_->roi = bounds_;
+      mask_->coverage = resolved_(bounds_ - roi_.tl());
+      mask_->image_size = image_size_;
+      mask_revision_ = revision_;
+    }
+
+    feather = clamp_feather(feather);
+    int pad = feather_padding(feather);
+    if (pad == 0)
+    {
+      return mask_;
+    }
+    if (feathered_ && feathered_revision_ == revision_ && feathered_radius_ == feather)
+    {
+      return feathered_;
+    }
+
+    auto feathered = std::make_shared<PolygonMask>();
+    feathered->image_size = image_size_;
+    feathered->roi = cv::Rect(bounds_.x - pad, bounds_.y - pad, bounds_.width + 2 * pad, bounds_.height + 2 * pad) &
+                     cv::Rect(0, 0, image_size_.width, image_size_.height);
+    cv::Mat coverage;
+    pooled(coverage).create(feathered->roi.size(), CV_8UC1);
+    coverage.setTo(0);
+    mask_->coverage.copyTo(coverage(bounds_ - feathered->roi.tl()));
+    soften(coverage, feather);
+    feathered->coverage = coverage;
+    record_temporary(coverage.total());
+
+    feathered_ = feathered;
+    feathered_radius_ = feather;
+    feathered_revision_ = revision_;
+    return feathered_;
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef GRAPHICS_POLYGON_MASK_HPP
+#define GRAPHICS_POLYGON_MASK_HPP
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace graphics
+{
+  // A polygon's coverage over the part of an image it can touch.
+  struct PolygonMask
+  {
+    // Bounding box of the polygon, grown by the feather radius and clipped
+    // to the image. Empty when the polygon misses the image.
+    cv::Rect roi;
+    // CV_8UC1, roi sized: 0 outside, 255 inside, partial along the edges.
+    cv::Mat coverage;
+    // The image the mask was built for.
+    cv::Size image_size;
+  };
+
+  // Smallest rectangle of pixels the polygon overlaps, clipped to an image of
+  // the given size. Pixel centers sit on integer coordinates.
+  cv::Rect polygon_bounds(const std::vector<cv::Point2f> &polygon, cv::Size size);
+
+  // Rasterizes polygon (image coordinates, non-zero winding) into a CV_8UC1
+  // mask covering roi, each pixel holding the exact fraction of its area
+  // inside the polygon. Edges are walked row by row, so the cost grows with
+  // the perimeter and the roi area and never with the image size.
+  void rasterize_coverage(const std::vector<cv::Point2f> &polygon, const cv::Rect &roi, cv::Mat &mask);
+
+  // Coverage of polygon on an image of image_size, softened by feather
+  // pixels on both sides of the outline (0 keeps the anti-aliased edge).
+  // Masks are cached by a hash of the polygon, feather and image size, so
+  // repeated edits of one selection rasterize it once. The returned mask is
+  // shared and must not be modified.
+  std::shared_ptr<const PolygonMask> polygon_mask(const std::vector<cv::Point2f> &polygon, float feather,
+                                                  cv::Size image_size);
+
+  // Drops every cached mask.
+  void clear_mask_cache();
+
+  // The coverage of a polygon that grows one vertex at a time, such as a
+  // selection being drawn. Coverage is a sum over the edges, so appending a
+  // vertex only accumulates the one new edge; the closing edge, which moves
+  // with every vertex, is added while a mask is resolved. Only the rows these
+  // edges cross are resolved again. Not thread safe.
+  class IncrementalPolygonMask
+  {
+  public:
+    explicit IncrementalPolygonMask(cv::Size image_size);
+
+    // Appends vertices in image coordinates; non-finite ones are skipped.
+    void append(const cv::Point2f *points, size_t count);
+    void clear();
+
+    const std::vector<cv::Point2f> &polygon() const { return polygon_; }
+    cv::Size image_size() const { return image_size_; }
+
+    // Same as polygon_bounds(polygon(), image_size()), kept up to date as
+    // vertices are appended.
+    cv::Rect bounds() const { return bounds_; }
+
+    // The coverage of the polygon as polygon_mask() would build it. Only the
+    // rows changed since the previous call are resolved; a mask still held
+    // from an earlier call is never modified.
+    std::shared_ptr<const PolygonMask> mask(float feather);
+
+  private:
+    void grow(const cv::Rect &roi);
+    void add_edge(cv::Point2f p, cv::Point2f q, float sign);
+
+    cv::Size image_size_;
+    std::vector<cv::Point2f> polygon_;
+    cv::Rect bounds_;
+    // Running extent of the vertices.
+    cv::Point2f min_, max_;
+    // Area the cells cover: the bounds with some room to grow.
+    cv::Rect roi_;
+    // roi_.height rows of roi_.width + 2 signed area cells.
+    std::vector<float> cells_;
+    int dirty_begin_ = 0, dirty_end_ = 0;
+    // Resolved coverage over roi_; mask_ views its bounds_.
+    cv::Mat resolved_;
+    std::shared_ptr<PolygonMask> mask_;
+    std::shared_ptr<const PolygonMask> feathered_;
+    float feathered_radius_ = 0;
+    uint64_t revision_ = 0, mask_revision_ = 0, feathered_revision_ = 0;
+  };
+}
+
+#endif // GRAPHICS_POLYGON_MASK_HPP
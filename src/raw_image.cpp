@@ -0,0 +1,166 @@
+#include "raw_image.hpp"
+
+#include <string.h>
+
+#include "aixlog.hpp"
+#include "graphics.hpp"
+#include "lz4.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    struct RawHeader
+    {
+      uint32_t magic;
+      uint32_t width;
+      uint32_t height;
+      uint32_t channels;
+      uint32_t compression;
+      uint32_t payload_size;
+    };
+    static_assert(sizeof(RawHeader) == 24, "the raw header is 24 bytes on the wire");
+
+    // Largest image a raw file may hold, the most an int32_t length can
+    // carry through the exports (about 715 MP for 3 channels). Decoding checks
+    // it before allocating, whatever a forged header claims.
+    const uint64_t kMaxPayload = INT32_MAX;
+    // Most bytes one LZ4 payload byte can expand to.
+    const uint64_t kMaxLz4Expansion = 255;
+
+    bool supported(const cv::Mat &image)
+    {
+      int channels = image.channels();
+      return !image.empty() && image.depth() == CV_8U && (channels == 1 || channels == 3 || channels == 4);
+    }
+
+    uint64_t pixel_bytes(const cv::Mat &image)
+    {
+      return static_cast<uint64_t>(image.total()) * image.elemSize();
+    }
+
+    // Converts a decoded image to the layout requested by imread style flags.
+    void apply_flags(cv::Mat &image, int flags)
+    {
+      if (flags == cv::IMREAD_UNCHANGED)
+      {
+        return;
+      }
+      if (flags == cv::IMREAD_GRAYSCALE)
+      {
+        if (image.channels() != 1)
+        {
+          cv::cvtColor(image, image, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        }
+        return;
+      }
+      if (image.channels() == 1)
+      {
+        cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+      }
+      else if (image.channels() == 4)
+      {
+        cv::cvtColor(image, image, cv::COLOR_BGRA2BGR);
+      }
+    }
+  }
+
+  bool is_raw_image(const uint8_t *data, size_t length)
+  {
+    uint32_t magic = 0;
+    if (data == nullptr || length < sizeof(RawHeader))
+    {
+      return false;
+    }
+    memcpy(&magic, data, sizeof(magic));
+    return magic == GRAPHICS_RAW_MAGIC;
+  }
+
+  size_t raw_image_bound(const cv::Mat &image, int32_t compression)
+  {
+    size_t bytes = static_cast<size_t>(pixel_bytes(image));
+    return sizeof(RawHeader) + (compression == GRAPHICS_RAW_LZ4 ? lz4_compress_bound(bytes) : bytes);
+  }
+
+  size_t encode_raw_image(const cv::Mat &image, int32_t compression, uint8_t *out)
+  {
+    if (!supported(image) || pixel_bytes(image) > kMaxPayload ||
+        (compression != GRAPHICS_RAW_UNCOMPRESSED && compression != GRAPHICS_RAW_LZ4))
+    {
+      LOG(ERROR) << "Unsupported raw image " << image.cols << "x" << image.rows << " type " << image.type()
+                 << " compression " << compression << std::endl;
+      return 0;
+    }
+
+    // Rows are packed, a view into a larger image is copied once.
+    cv::Mat packed = image.isContinuous() ? image : image.clone();
+    size_t bytes = static_cast<size_t>(pixel_bytes(packed));
+    uint8_t *payload = out + sizeof(RawHeader);
+
+    size_t payload_size = bytes;
+    if (compression == GRAPHICS_RAW_LZ4)
+    {
+      payload_size = lz4_compress(packed.data, bytes, payload);
+    }
+    else
+    {
+      memcpy(payload, packed.data, bytes);
+    }
+
+    RawHeader header;
+    header.magic = GRAPHICS_RAW_MAGIC;
+    header.width = static_cast<uint32_t>(packed.cols);
+    header.height = static_cast<uint32_t>(packed.rows);
+    header.channels = static_cast<uint32_t>(packed.channels());
+    header.compression = static_cast<uint32_t>(compression);
+    header.payload_size = static_cast<uint32_t>(payload_size);
+    memcpy(out, &header, sizeof(header));
+    return sizeof(header) + payload_size;
+  }
+
+  bool decode_raw_image(const uint8_t *data, size_t length, int flags, cv::Mat &image)
+  {
+    if (!is_raw_image(data, length))
+    {
+      return false;
+    }
+
+    RawHeader header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t bytes = static_cast<uint64_t>(header.width) * header.height * header.channels;
+    // The payload must be able to fill the image before it is allocated.
+    const bool payload_fits = header.compression == GRAPHICS_RAW_UNCOMPRESSED
+                                  ? header.payload_size == bytes
+                                  : header.compression == GRAPHICS_RAW_LZ4 &&
+                                        bytes <= static_cast<uint64_t>(header.payload_size) * kMaxLz4Expansion;
+    if (header.width == 0 || header.height == 0 || header.width > INT32_MAX || header.height > INT32_MAX ||
+        (header.channels != 1 && header.channels != 3 && header.channels != 4) || bytes > kMaxPayload ||
+        header.payload_size > length - sizeof(header) || !payload_fits)
+    {
+      LOG(ERROR) << "Invalid raw image header" << std::endl;
+      return false;
+    }
+
+    const uint8_t *payload = data + sizeof(header);
+    image.create(static_cast<int>(header.height), static_cast<int>(header.width),
+                 CV_8UC(static_cast<int>(header.channels)));
+    bool ok = true;
+    if (header.compression == GRAPHICS_RAW_UNCOMPRESSED)
+    {
+      memcpy(image.data, payload, static_cast<size_t>(bytes));
+    }
+    else
+    {
+      ok = lz4_decompress(payload, header.payload_size, image.data, static_cast<size_t>(bytes));
+    }
+    if (!ok)
+    {
+      LOG(ERROR) << "Corrupt raw image payload" << std::endl;
+      image.release();
+      return false;
+    }
+
+    apply_flags(image, flags);
+    return true;
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef GRAPHICS_RAW_IMAGE_HPP
+#define GRAPHICS_RAW_IMAGE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+namespace graphics
+{
+  // Lossless working format, see GRAPHICS_RAW_MAGIC in graphics.hpp.
+
+  // True if data starts with a raw image header.
+  bool is_raw_image(const uint8_t *data, size_t length);
+
+  // Upper bound of the encoded size of image, header included.
+  size_t raw_image_bound(const cv::Mat &image, int32_t compression);
+
+  // Encodes an 8-bit image with 1, 3 or 4 channels into out, which must hold
+  // raw_image_bound() bytes. Returns the encoded size, 0 on failure.
+  size_t encode_raw_image(const cv::Mat &image, int32_t compression, uint8_t *out);
+
+  // Decodes a raw image. Like cv::imdecode, IMREAD_COLOR converts to BGR and
+  // IMREAD_GRAYSCALE to a single channel.
+  bool decode_raw_image(const uint8_t *data, size_t length, int flags, cv::Mat &image);
+}
+
+#endif // GRAPHICS_RAW_IMAGE_HPP
@@ -0,0 +1,271 @@
+#include "region_filters.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "buffer_pool.hpp"
+#include "graphics.hpp"
+#include "pixel_kernels.hpp"
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Largest blur radius or sigma a command may ask for, in pixels.
+    const float kMaxLength = 256;
+    // Rows filtered per band: enough to amortize the margin a spatial filter
+    // reads above and below, few enough to spread a selection over all cores
+    // and keep a band's temporaries in cache.
+    const int kMinBandRows = 32;
+    const int kMaxBandRows = 128;
+
+    // Fixed point weights and shift of cv::COLOR_BGR2GRAY, as in the pixel
+    // kernels.
+    const int kB2Y = 1868;
+    const int kG2Y = 9617;
+    const int kR2Y = 4899;
+    const int kYuvShift = 14;
+
+    bool in_range(float value, float low, float high)
+    {
+      return isfinite(value) && value >= low && value <= high;
+    }
+
+    // The extent of the Gaussian kernel, 3 sigma on either side.
+    int gaussian_radius(float sigma)
+    {
+      return sigma > 0 ? std::max(1, static_cast<int>(ceilf(3 * sigma))) : 0;
+    }
+
+    void gaussian_blur(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, float sigma)
+    {
+      int radius = gaussian_radius(sigma);
+      if (radius == 0)
+      {
+        source(band).copyTo(filtered);
+        return;
+      }
+      // Not BORDER_ISOLATED: the band is a view into source, so OpenCV reads
+      // the real pixels around it and only extrapolates at source's edges,
+      // which are the image's edges or lie beyond the margin.
+      cv::GaussianBlur(source(band), filtered, cv::Size(2 * radius + 1, 2 * radius + 1), sigma, sigma,
+                       cv::BORDER_REFLECT_101);
+    }
+
+    // values: sigma.
+    bool gaussian_valid(const float *values)
+    {
+      return in_range(values[0], 0, kMaxLength);
+    }
+
+    int gaussian_margin(const float *values)
+    {
+      return gaussian_radius(values[0]);
+    }
+
+    void gaussian_apply(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values)
+    {
+      gaussian_blur(source, band, filtered, values[0]);
+    }
+
+    // values: radius, rounded to whole pixels.
+    bool box_valid(const float *values)
+    {
+      return in_range(values[0], 0, kMaxLength);
+    }
+
+    int box_margin(const float *values)
+    {
+      return static_cast<int>(lroundf(values[0]));
+    }
+
+    void box_apply(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values)
+    {
+      int radius = box_margin(values);
+      if (radius == 0)
+      {
+        source(band).copyTo(filtered);
+        return;
+      }
+      // Running sums, so the cost does not grow with the radius.
+      cv::blur(source(band), filtered, cv::Size(2 * radius + 1, 2 * radius + 1), cv::Point(-1, -1),
+               cv::BORDER_REFLECT_101);
+    }
+
+    // values: sigma, amount, threshold. Adds amount times the difference to
+    // the blurred image to every channel whose difference reaches the
+    // threshold, so flat areas keep their noise level.
+    bool unsharp_valid(const float *values)
+    {
+      return in_range(values[0], 0, kMaxLength) && in_range(values[1], 0, 16) && in_range(values[2], 0, 255);
+    }
+
+    int unsharp_margin(const float *values)
+    {
+      return gaussian_radius(values[0]);
+    }
+
+    void unsharp_apply(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values)
+    {
+      gaussian_blur(source, band, filtered, values[0]);
+
+      // 8.8 fixed point amount.
+      const int amount = static_cast<int>(lroundf(values[1] * 256));
+      const int threshold = static_cast<int>(ceilf(values[2]));
+      const int width = band.width * 3;
+      for (int y = 0; y < band.height; y++)
+      {
+        const uint8_t *original = source.ptr<uint8_t>(band.y + y) + band.x * 3;
+        uint8_t *out = filtered.ptr<uint8_t>(y);
+        for (int x = 0; x < width; x++)
+        {
+          int difference = original[x] - out[x];
+          out[x] = std::abs(difference) < threshold
+                       ? original[x]
+                       : cv::saturate_cast<uint8_t>(original[x] + ((difference * amount + 128) >> 8));
+        }
+      }
+    }
+
+    // values: brightness (added, -255 to 255), contrast (a factor around mid
+    // gray) and gamma, applied as gamma, contrast, brightness through one
+    // lookup table.
+    bool levels_valid(const float *values)
+    {
+      return in_range(values[0], -255, 255) && in_range(values[1], 0, 16) && in_range(values[2], 0.01f, 100);
+    }
+
+    int levels_margin(const float *)
+    {
+      return 0;
+    }
+
+    void levels_apply(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values)
+    {
+      uint8_t table[256];
+      for (int i = 0; i < 256; i++)
+      {
+        double value = 255.0 * pow(i / 255.0, 1.0 / values[2]);
+        table[i] = cv::saturate_cast<uint8_t>((value - 127.5) * values[1] + 127.5 + values[0]);
+      }
+      cv::LUT(source(band), cv::Mat(1, 256, CV_8UC1, table), filtered);
+    }
+
+    // values: saturation factor; 0 is grayscale, 1 leaves the image as is
+    // and higher values push the channels away from the luminance.
+    bool saturation_valid(const float *values)
+    {
+      return in_range(values[0], 0, 16);
+    }
+
+    int saturation_margin(const float *)
+    {
+      return 0;
+    }
+
+    void saturation_apply(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values)
+    {
+      // 8.8 fixed point factor.
+      const int factor = static_cast<int>(lroundf(values[0] * 256));
+      filtered.create(band.size(), CV_8UC3);
+      for (int y = 0; y < band.height; y++)
+      {
+        const uint8_t *in = source.ptr<uint8_t>(band.y + y) + band.x * 3;
+        uint8_t *out = filtered.ptr<uint8_t>(y);
+        for (int x = 0; x < band.width; x++, in += 3, out += 3)
+        {
+          int luma = (in[0] * kB2Y + in[1] * kG2Y + in[2] * kR2Y + (1 << (kYuvShift - 1))) >> kYuvShift;
+          out[0] = cv::saturate_cast<uint8_t>(luma + (((in[0] - luma) * factor + 128) >> 8));
+          out[1] = cv::saturate_cast<uint8_t>(luma + (((in[1] - luma) * factor + 128) >> 8));
+          out[2] = cv::saturate_cast<uint8_t>(luma + (((in[2] - luma) * factor + 128) >> 8));
+        }
+      }
+    }
+
+    const RegionFilter kFilters[] = {
+        {GRAPHICS_FILTER_GAUSSIAN_BLUR, "gaussian_blur", {4, 0, 0}, {true, false, false}, gaussian_valid,
+         gaussian_margin, gaussian_apply},
+        {GRAPHICS_FILTER_BOX_BLUR, "box_blur", {4, 0, 0}, {true, false, false}, box_valid, box_margin, box_apply},
+        {GRAPHICS_FILTER_UNSHARP_MASK, "unsharp_mask", {2, 1, 0}, {true, false, false}, unsharp_valid,
+         unsharp_margin, unsharp_apply},
+        {GRAPHICS_FILTER_BRIGHTNESS_CONTRAST, "brightness_contrast", {0, 1, 1}, {false, false, false},
+         levels_valid, levels_margin, levels_apply},
+        {GRAPHICS_FILTER_SATURATION, "saturation", {1, 0, 0}, {false, false, false}, saturation_valid,
+         saturation_margin, saturation_apply},
+    };
+  }
+
+  const RegionFilter *find_region_filter(int id)
+  {
+    for (const RegionFilter &filter : kFilters)
+    {
+      if (filter.id == id)
+      {
+        return &filter;
+      }
+    }
+    return nullptr;
+  }
+
+  void filter_mask(cv::Mat &image, const PolygonMask &mask, const RegionFilter &filter, const float *values)
+  {
+    const cv::Rect &roi = mask.roi;
+    if (roi.empty())
+    {
+      return;
+    }
+    CV_Assert(image.type() == CV_8UC3 && mask.image_size == image.size());
+
+    StageTimer timer(GRAPHICS_STAGE_FILTER);
+    int margin = filter.margin(values);
+    cv::Rect padded = cv::Rect(roi.x - margin, roi.y - margin, roi.width + 2 * margin, roi.height + 2 * margin) &
+                      cv::Rect(0, 0, image.cols, image.rows);
+
+    // Bands blend into the image while their neighbours may still read it,
+    // so spatial filters read a copy of the pixels around the mask. Per-pixel
+    // filters only read the rows they write.
+    cv::Mat source;
+    if (margin > 0)
+    {
+      image(padded).copyTo(pooled(source));
+      record_temporary(source.total() * source.elemSize());
+    }
+    else
+    {
+      source = image(padded);
+    }
+
+    const cv::Point offset = roi.tl() - padded.tl();
+    const int band_rows = std::max(kMinBandRows, std::min(2 * margin, kMaxBandRows));
+    const int bands = (roi.height + band_rows - 1) / band_rows;
+    parallel_for(cv::Range(0, bands), [&](const cv::Range &range)
+                 {
+                   cv::Mat filtered;
+                   pooled(filtered);
+                   for (int band = range.start; band < range.end; band++)
+                   {
+                     int y = band * band_rows;
+                     int rows = std::min(band_rows, roi.height - y);
+                     // Bands the polygon does not reach, e.g. between
+                     // the arms of a concave selection, stay untouched.
+                     cv::Mat weights = mask.coverage.rowRange(y, y + rows);
+                     if (cv::countNonZero(weights) == 0)
+                     {
+                       continue;
+                     }
+                     filter.apply(source, cv::Rect(offset.x, offset.y + y, roi.width, rows), filtered, values);
+                     cv::Mat target = image(cv::Rect(roi.x, roi.y + y, roi.width, rows));
+                     blend_weighted(target, filtered, weights);
+                   } });
+    record_temporary(static_cast<size_t>(std::min(bands, job_threads())) * band_rows * roi.width * 3);
+  }
+
+  void filter_polygon(cv::Mat &image, const std::vector<cv::Point2f> &polygon, float feather,
+                      const RegionFilter &filter, const float *values)
+  {
+    filter_mask(image, *polygon_mask(polygon, feather, image.size()), filter, values);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef GRAPHICS_REGION_FILTERS_HPP
+#define GRAPHICS_REGION_FILTERS_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "polygon_mask.hpp"
+
+namespace graphics
+{
+  // Filter specific values of a region filter, see graphics_filter.
+  const int kFilterValues = 3;
+
+  // One local adjustment of the registry behind GRAPHICS_OP_FILTER_POLYGON.
+  struct RegionFilter
+  {
+    int id;
+    const char *name;
+    // Values used when a command leaves them out.
+    float defaults[kFilterValues];
+    // Values that are lengths in pixels and scale with the image.
+    bool spatial[kFilterValues];
+    // Rejects values the filter can't run with, e.g. a negative radius.
+    bool (*valid)(const float *values);
+    // Pixels beyond a row band the filter reads; 0 for per-pixel filters.
+    int (*margin)(const float *values);
+    // Writes the filtered pixels of band, a rectangle of source, into
+    // filtered. Reads at most margin() pixels around band.
+    void (*apply)(const cv::Mat &source, const cv::Rect &band, cv::Mat &filtered, const float *values);
+  };
+
+  // The filter registered under id (a graphics_filter), or nullptr.
+  const RegionFilter *find_region_filter(int id);
+
+  // Filters the pixels of a BGR image covered by mask and blends the result
+  // in by the coverage, so the outline stays anti-aliased and feathered.
+  // Only the mask's bounding box, plus the filter's margin, is read; the
+  // rows are filtered in bands on all cores. values holds kFilterValues
+  // entries. mask must have been built for an image of this size.
+  void filter_mask(cv::Mat &image, const PolygonMask &mask, const RegionFilter &filter, const float *values);
+
+  // filter_mask() with the cached coverage of polygon (see polygon_mask()).
+  void filter_polygon(cv::Mat &image, const std::vector<cv::Point2f> &polygon, float feather,
+                      const RegionFilter &filter, const float *values);
+}
+
+#endif // GRAPHICS_REGION_FILTERS_HPP
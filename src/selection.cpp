@@ -0,0 +1,133 @@
+#include "selection.hpp"
+
+#include <cmath>
+#include <vector>
+
+#include "graphics.hpp"
+#include "image_session.hpp"
+
+namespace graphics
+{
+  void retain_selection(graphics_selection *selection)
+  {
+    selection->references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release_selection(graphics_selection *selection)
+  {
+    if (selection->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      delete selection;
+    }
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT graphics_selection *create_selection(int32_t width, int32_t height, float scale_x,
+                                                        float scale_y)
+  try
+  {
+    if (width <= 0 || height <= 0 || !std::isfinite(scale_x) || !std::isfinite(scale_y))
+    {
+      return nullptr;
+    }
+    return new graphics_selection(cv::Size(width, height), cv::Point2f(scale_x, scale_y));
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT int selection_append_points(graphics_selection *selection, const float *points,
+                                                int32_t num_points)
+  try
+  {
+    // points holds 2 * num_points floats, which must fit an int32_t count.
+    if (selection == nullptr || points == nullptr || num_points < 0 || num_points > INT32_MAX / 2)
+    {
+      return 1;
+    }
+
+    std::vector<cv::Point2f> scaled(static_cast<size_t>(num_points));
+    for (size_t i = 0; i < scaled.size(); i++)
+    {
+      scaled[i] = cv::Point2f(points[i * 2] * selection->scale.x, points[i * 2 + 1] * selection->scale.y);
+    }
+    std::lock_guard<std::mutex> lock(selection->mutex);
+    selection->mask.append(scaled.data(), scaled.size());
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int selection_clear(graphics_selection *selection)
+  try
+  {
+    if (selection == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(selection->mutex);
+    selection->mask.clear();
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int32_t selection_get_length(graphics_selection *selection)
+  try
+  {
+    if (selection == nullptr)
+    {
+      return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(selection->mutex);
+    return static_cast<int32_t>(selection->mask.polygon().size());
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 0;
+  }
+
+  FFI_PLUGIN_EXPORT int selection_get_bounds(graphics_selection *selection, int32_t *x, int32_t *y,
+                                             int32_t *width, int32_t *height)
+  try
+  {
+    if (selection == nullptr || x == nullptr || y == nullptr || width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(selection->mutex);
+    cv::Rect bounds = selection->mask.bounds();
+    *x = bounds.x;
+    *y = bounds.y;
+    *width = bounds.width;
+    *height = bounds.height;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT void close_selection(graphics_selection *selection)
+  {
+    if (selection != nullptr)
+    {
+      graphics::release_selection(selection);
+    }
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef GRAPHICS_SELECTION_HPP
+#define GRAPHICS_SELECTION_HPP
+
+#include <atomic>
+#include <mutex>
+
+#include <opencv2/opencv.hpp>
+
+#include "polygon_mask.hpp"
+
+// A polygon selection kept in native memory while the user draws it. Points
+// arrive in view coordinates and are mapped to image pixels by scale as they
+// are appended, the coverage mask follows incrementally. Like sessions, a
+// selection is shared between Dart and queued jobs through a reference count
+// and every access takes the mutex.
+struct graphics_selection
+{
+  graphics_selection(cv::Size image_size, cv::Point2f scale)
+      : scale(scale), mask(image_size)
+  {
+  }
+
+  std::mutex mutex;
+  std::atomic<int> references{1};
+  cv::Point2f scale;
+  graphics::IncrementalPolygonMask mask;
+};
+
+namespace graphics
+{
+  void retain_selection(graphics_selection *selection);
+  void release_selection(graphics_selection *selection);
+}
+
+#endif // GRAPHICS_SELECTION_HPP
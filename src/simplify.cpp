@@ -0,0 +1,118 @@
+#include "simplify.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <utility>
+
+#include "graphics.hpp"
+#include "stats.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    std::atomic<float> default_tolerance{0.0f};
+
+    // Squared distance from p to the segment ab.
+    float distance_squared(const cv::Point2f &p, const cv::Point2f &a, const cv::Point2f &b)
+    {
+      float dx = b.x - a.x, dy = b.y - a.y;
+      float px = p.x - a.x, py = p.y - a.y;
+      float length_squared = dx * dx + dy * dy;
+      float t = length_squared > 0 ? std::min(1.0f, std::max(0.0f, (px * dx + py * dy) / length_squared)) : 0.0f;
+      float ex = px - t * dx, ey = py - t * dy;
+      return ex * ex + ey * ey;
+    }
+  }
+
+  std::vector<cv::Point2f> simplify_polygon(const std::vector<cv::Point2f> &polygon, float tolerance)
+  {
+    const size_t n = polygon.size();
+    if (!(tolerance > 0) || n <= 3)
+    {
+      return polygon;
+    }
+
+    // A closed outline has no end points to anchor on: it is split at the
+    // vertex farthest from the first one into two open chains.
+    size_t split = 0;
+    float farthest = -1;
+    for (size_t i = 1; i < n; i++)
+    {
+      cv::Point2f d = polygon[i] - polygon[0];
+      float distance = d.x * d.x + d.y * d.y;
+      if (distance > farthest)
+      {
+        farthest = distance;
+        split = i;
+      }
+    }
+
+    // Chains are index ranges [first, last] where last == n stands for the
+    // first vertex again. An explicit stack keeps long outlines off the call
+    // stack.
+    const float limit = tolerance * tolerance;
+    std::vector<uint8_t> keep(n, 0);
+    keep[0] = keep[split] = 1;
+    std::vector<std::pair<size_t, size_t>> chains = {{0, split}, {split, n}};
+    while (!chains.empty())
+    {
+      size_t first = chains.back().first;
+      size_t last = chains.back().second;
+      chains.pop_back();
+
+      const cv::Point2f &a = polygon[first];
+      const cv::Point2f &b = polygon[last % n];
+      float worst = limit;
+      size_t worst_index = 0;
+      for (size_t i = first + 1; i < last; i++)
+      {
+        float distance = distance_squared(polygon[i], a, b);
+        if (distance > worst)
+        {
+          worst = distance;
+          worst_index = i;
+        }
+      }
+      if (worst_index != 0)
+      {
+        keep[worst_index] = 1;
+        chains.push_back({first, worst_index});
+        chains.push_back({worst_index, last});
+      }
+    }
+
+    std::vector<cv::Point2f> simplified;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (keep[i])
+      {
+        simplified.push_back(polygon[i]);
+      }
+    }
+    record_simplification(n, simplified.size());
+    return simplified;
+  }
+
+  float simplify_tolerance()
+  {
+    return default_tolerance.load(std::memory_order_relaxed);
+  }
+
+  void set_simplify_tolerance(float tolerance)
+  {
+    default_tolerance.store(std::isfinite(tolerance) && tolerance > 0 ? tolerance : 0.0f,
+                            std::memory_order_relaxed);
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT void set_simplify_tolerance(float pixels)
+  {
+    graphics::set_simplify_tolerance(pixels);
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef GRAPHICS_SIMPLIFY_HPP
+#define GRAPHICS_SIMPLIFY_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace graphics
+{
+  // Ramer-Douglas-Peucker simplification of a closed polygon: drops every
+  // vertex whose removal moves the outline by at most tolerance pixels.
+  // Freehand outlines are mostly runs of near-collinear touch points, so a
+  // sub-pixel tolerance already removes most of them without a visible change.
+  // A tolerance <= 0 returns the polygon unchanged.
+  std::vector<cv::Point2f> simplify_polygon(const std::vector<cv::Point2f> &polygon, float tolerance);
+
+  // The tolerance used when a call does not pick one, 0 (off) by default.
+  float simplify_tolerance();
+  void set_simplify_tolerance(float tolerance);
+}
+
+#endif // GRAPHICS_SIMPLIFY_HPP
@@ -0,0 +1,215 @@
+#include "stats.hpp"
+
+#include <atomic>
+
+#include "image_session.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    struct StageCounters
+    {
+      std::atomic<uint64_t> calls{0};
+      std::atomic<uint64_t> total_ns{0};
+      std::atomic<uint64_t> max_ns{0};
+      std::atomic<uint64_t> last_ns{0};
+    };
+
+    struct Registry
+    {
+      StageCounters stages[GRAPHICS_STAGE_COUNT];
+      std::atomic<uint64_t> operations{0};
+      std::atomic<uint64_t> bytes_decoded{0};
+      std::atomic<uint64_t> bytes_encoded{0};
+      std::atomic<uint64_t> mask_cache_hits{0};
+      std::atomic<uint64_t> mask_cache_misses{0};
+      std::atomic<uint64_t> simplified_vertices_in{0};
+      std::atomic<uint64_t> simplified_vertices_out{0};
+      std::atomic<uint64_t> composited_tiles{0};
+      std::atomic<uint64_t> copied_tiles{0};
+      std::atomic<uint64_t> parallel_loops{0};
+      std::atomic<uint64_t> parallel_wall_ns{0};
+      std::atomic<uint64_t> parallel_busy_ns{0};
+      std::atomic<uint64_t> peak_running_jobs{0};
+      std::atomic<uint64_t> peak_temporary_bytes{0};
+      std::atomic<uint64_t> last_temporary_bytes{0};
+    };
+
+    Registry &registry()
+    {
+      static Registry instance;
+      return instance;
+    }
+
+    void store_max(std::atomic<uint64_t> &target, uint64_t value)
+    {
+      uint64_t current = target.load(std::memory_order_relaxed);
+      while (current < value && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    thread_local int operation_depth = 0;
+    thread_local uint64_t operation_temporary_bytes = 0;
+  }
+
+  void record_stage(graphics_stage stage, uint64_t nanoseconds)
+  {
+    if (stage < 0 || stage >= GRAPHICS_STAGE_COUNT)
+    {
+      return;
+    }
+
+    StageCounters &counters = registry().stages[stage];
+    counters.calls.fetch_add(1, std::memory_order_relaxed);
+    counters.total_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+    counters.last_ns.store(nanoseconds, std::memory_order_relaxed);
+    store_max(counters.max_ns, nanoseconds);
+  }
+
+  void record_bytes_decoded(uint64_t bytes)
+  {
+    registry().bytes_decoded.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void record_bytes_encoded(uint64_t bytes)
+  {
+    registry().bytes_encoded.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void record_mask_lookup(bool hit)
+  {
+    (hit ? registry().mask_cache_hits : registry().mask_cache_misses).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void record_simplification(uint64_t vertices_in, uint64_t vertices_out)
+  {
+    registry().simplified_vertices_in.fetch_add(vertices_in, std::memory_order_relaxed);
+    registry().simplified_vertices_out.fetch_add(vertices_out, std::memory_order_relaxed);
+  }
+
+  void record_composited_tiles(uint64_t tiles)
+  {
+    registry().composited_tiles.fetch_add(tiles, std::memory_order_relaxed);
+  }
+
+  void record_copied_tiles(uint64_t tiles)
+  {
+    registry().copied_tiles.fetch_add(tiles, std::memory_order_relaxed);
+  }
+
+  void record_parallel_loop(uint64_t wall_ns, uint64_t busy_ns)
+  {
+    registry().parallel_loops.fetch_add(1, std::memory_order_relaxed);
+    registry().parallel_wall_ns.fetch_add(wall_ns, std::memory_order_relaxed);
+    registry().parallel_busy_ns.fetch_add(busy_ns, std::memory_order_relaxed);
+  }
+
+  void record_running_jobs(uint64_t jobs)
+  {
+    store_max(registry().peak_running_jobs, jobs);
+  }
+
+  void record_temporary(size_t bytes)
+  {
+    operation_temporary_bytes += bytes;
+  }
+
+  void snapshot_stats(graphics_stats &stats)
+  {
+    Registry &r = registry();
+    for (int i = 0; i < GRAPHICS_STAGE_COUNT; i++)
+    {
+      stats.stages[i].calls = r.stages[i].calls.load(std::memory_order_relaxed);
+      stats.stages[i].total_ns = r.stages[i].total_ns.load(std::memory_order_relaxed);
+      stats.stages[i].max_ns = r.stages[i].max_ns.load(std::memory_order_relaxed);
+      stats.stages[i].last_ns = r.stages[i].last_ns.load(std::memory_order_relaxed);
+    }
+    stats.operations = r.operations.load(std::memory_order_relaxed);
+    stats.bytes_decoded = r.bytes_decoded.load(std::memory_order_relaxed);
+    stats.bytes_encoded = r.bytes_encoded.load(std::memory_order_relaxed);
+    stats.mask_cache_hits = r.mask_cache_hits.load(std::memory_order_relaxed);
+    stats.mask_cache_misses = r.mask_cache_misses.load(std::memory_order_relaxed);
+    stats.simplified_vertices_in = r.simplified_vertices_in.load(std::memory_order_relaxed);
+    stats.simplified_vertices_out = r.simplified_vertices_out.load(std::memory_order_relaxed);
+    stats.composited_tiles = r.composited_tiles.load(std::memory_order_relaxed);
+    stats.copied_tiles = r.copied_tiles.load(std::memory_order_relaxed);
+    stats.parallel_loops = r.parallel_loops.load(std::memory_order_relaxed);
+    stats.parallel_wall_ns = r.parallel_wall_ns.load(std::memory_order_relaxed);
+    stats.parallel_busy_ns = r.parallel_busy_ns.load(std::memory_order_relaxed);
+    stats.peak_running_jobs = r.peak_running_jobs.load(std::memory_order_relaxed);
+    stats.peak_temporary_bytes = r.peak_temporary_bytes.load(std::memory_order_relaxed);
+    stats.last_temporary_bytes = r.last_temporary_bytes.load(std::memory_order_relaxed);
+  }
+
+  void clear_stats()
+  {
+    Registry &r = registry();
+    for (StageCounters &counters : r.stages)
+    {
+      counters.calls.store(0, std::memory_order_relaxed);
+      counters.total_ns.store(0, std::memory_order_relaxed);
+      counters.max_ns.store(0, std::memory_order_relaxed);
+      counters.last_ns.store(0, std::memory_order_relaxed);
+    }
+    r.operations.store(0, std::memory_order_relaxed);
+    r.bytes_decoded.store(0, std::memory_order_relaxed);
+    r.bytes_encoded.store(0, std::memory_order_relaxed);
+    r.mask_cache_hits.store(0, std::memory_order_relaxed);
+    r.mask_cache_misses.store(0, std::memory_order_relaxed);
+    r.simplified_vertices_in.store(0, std::memory_order_relaxed);
+    r.simplified_vertices_out.store(0, std::memory_order_relaxed);
+    r.composited_tiles.store(0, std::memory_order_relaxed);
+    r.copied_tiles.store(0, std::memory_order_relaxed);
+    r.parallel_loops.store(0, std::memory_order_relaxed);
+    r.parallel_wall_ns.store(0, std::memory_order_relaxed);
+    r.parallel_busy_ns.store(0, std::memory_order_relaxed);
+    r.peak_running_jobs.store(0, std::memory_order_relaxed);
+    r.peak_temporary_bytes.store(0, std::memory_order_relaxed);
+    r.last_temporary_bytes.store(0, std::memory_order_relaxed);
+  }
+
+  OperationScope::OperationScope()
+  {
+    if (operation_depth++ == 0)
+    {
+      operation_temporary_bytes = 0;
+    }
+  }
+
+  OperationScope::~OperationScope()
+  {
+    if (--operation_depth == 0)
+    {
+      Registry &r = registry();
+      r.operations.fetch_add(1, std::memory_order_relaxed);
+      r.last_temporary_bytes.store(operation_temporary_bytes, std::memory_order_relaxed);
+      store_max(r.peak_temporary_bytes, operation_temporary_bytes);
+    }
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT int get_stats(graphics_stats *stats)
+  try
+  {
+    if (stats == nullptr)
+    {
+      return 1;
+    }
+    graphics::snapshot_stats(*stats);
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT void reset_stats()
+  {
+    graphics::clear_stats();
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef GRAPHICS_STATS_HPP
+#define GRAPHICS_STATS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Process wide, lock-free counters behind get_stats(). Every native
+  // operation reports its stages here, from any thread.
+  void record_stage(graphics_stage stage, uint64_t nanoseconds);
+  void record_bytes_decoded(uint64_t bytes);
+  void record_bytes_encoded(uint64_t bytes);
+  void record_mask_lookup(bool hit);
+  void record_simplification(uint64_t vertices_in, uint64_t vertices_out);
+  void record_composited_tiles(uint64_t tiles);
+  void record_copied_tiles(uint64_t tiles);
+  void record_parallel_loop(uint64_t wall_ns, uint64_t busy_ns);
+  void record_running_jobs(uint64_t jobs);
+
+  // Adds bytes to the temporaries held by the operation running on this thread.
+  void record_temporary(size_t bytes);
+
+  void snapshot_stats(graphics_stats &stats);
+  void clear_stats();
+
+  // Times the enclosing scope as one run of stage.
+  class StageTimer
+  {
+  public:
+    explicit StageTimer(graphics_stage stage)
+        : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer()
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start_;
+      record_stage(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+  private:
+    graphics_stage stage_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  // Marks one exported operation. Nested scopes on the same thread count as
+  // a single operation; when the outermost one ends, the temporaries recorded
+  // on this thread are folded into the peak and reset.
+  class OperationScope
+  {
+  public:
+    OperationScope();
+    ~OperationScope();
+
+    OperationScope(const OperationScope &) = delete;
+    OperationScope &operator=(const OperationScope &) = delete;
+  };
+}
+
+#endif // GRAPHICS_STATS_HPP
@@ -0,0 +1,813 @@
+#include "stream_transcode.hpp"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if GRAPHICS_HAS_STREAMING_CODECS
+#include <jpeglib.h>
+#include <png.h>
+#include <zlib.h>
+#endif
+
+#include "image_io.hpp"
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+#if GRAPHICS_HAS_STREAMING_CODECS
+  namespace
+  {
+    // Rows per band, and bands circulating between each pair of stages.
+    const int kBandRows = 64;
+    const int kBandsInFlight = 3;
+
+    enum class Codec
+    {
+      none,
+      jpeg,
+      png,
+    };
+
+    Codec codec_of_extension(const char *ext)
+    {
+      if (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0 || strcasecmp(ext, ".jpe") == 0)
+      {
+        return Codec::jpeg;
+      }
+      return strcasecmp(ext, ".png") == 0 ? Codec::png : Codec::none;
+    }
+
+    Codec codec_of_signature(FILE *file)
+    {
+      static const uint8_t kPngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+      uint8_t header[8];
+      size_t length = fread(header, 1, sizeof(header), file);
+      rewind(file);
+      if (length >= 3 && header[0] == 0xff && header[1] == 0xd8 && header[2] == 0xff)
+      {
+        return Codec::jpeg;
+      }
+      return length == sizeof(header) && memcmp(header, kPngSignature, sizeof(header)) == 0 ? Codec::png
+                                                                                              : Codec::none;
+    }
+
+    uint64_t file_size(const char *path)
+    {
+      struct stat info;
+      return stat(path, &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+    }
+
+    // Orientation tag (0x0112) of IFD0 in a TIFF structured EXIF payload, 1
+    // (upright) if there is none.
+    int exif_orientation(const uint8_t *data, size_t length)
+    {
+      if (length < 8 || (memcmp(data, "II", 2) != 0 && memcmp(data, "MM", 2) != 0))
+      {
+        return 1;
+      }
+      const bool big_endian = data[0] == 'M';
+      auto u16 = [&](size_t at)
+      { return big_endian ? (data[at] << 8) | data[at + 1] : data[at] | (data[at + 1] << 8); };
+      auto u32 = [&](size_t at)
+      {
+        uint32_t a = u16(at), b = u16(at + 2);
+        return big_endian ? (a << 16) | b : (b << 16) | a;
+      };
+
+      size_t ifd = u32(4);
+      if (ifd + 2 > length)
+      {
+        return 1;
+      }
+      int entries = u16(ifd);
+      for (int i = 0; i < entries; i++)
+      {
+        size_t entry = ifd + 2 + i * 12;
+        if (entry + 12 > length)
+        {
+          break;
+        }
+        if (u16(entry) == 0x0112)
+        {
+          return u16(entry + 8);
+        }
+      }
+      return 1;
+    }
+
+    struct Band
+    {
+      std::vector<uint8_t> pixels;
+      int rows = 0;
+    };
+
+    // Hands bands from one stage of the pipeline to the next. close() wakes
+    // every waiter and fails every later pop, which is how a failing stage
+    // stops the others.
+    class BandQueue
+    {
+    public:
+      void push(std::unique_ptr<Band> band)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          bands_.push_back(std::move(band));
+        }
+        ready_.notify_one();
+      }
+
+      bool pop(std::unique_ptr<Band> &band)
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [&]()
+                    { return closed_ || !bands_.empty(); });
+        if (closed_)
+        {
+          return false;
+        }
+        band = std::move(bands_.front());
+        bands_.pop_front();
+        return true;
+      }
+
+      void close()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          closed_ = true;
+        }
+        ready_.notify_all();
+      }
+
+    private:
+      std::mutex mutex_;
+      std::condition_variable ready_;
+      std::deque<std::unique_ptr<Band>> bands_;
+      bool closed_ = false;
+    };
+
+    class BandDecoder
+    {
+    public:
+      virtual ~BandDecoder() {}
+
+      // Reads the header and sets up the conversion to BGR.
+      virtual TranscodeResult open() = 0;
+
+      // Decodes the next rows into bgr, rows of width * 3 bytes packed.
+      virtual bool read(uint8_t *bgr, int rows) = 0;
+
+      int width() const { return width_; }
+      int height() const { return height_; }
+
+    protected:
+      int width_ = 0;
+      int height_ = 0;
+    };
+
+    class BandEncoder
+    {
+    public:
+      virtual ~BandEncoder() {}
+
+      // Writes the header of a width x height image of channels channels.
+      virtual bool open(int width, int height, int channels, const graphics_encode_options *options) = 0;
+
+      // Encodes the next rows, packed.
+      virtual bool write(const uint8_t *pixels, int rows) = 0;
+
+      virtual bool finish() = 0;
+    };
+
+    // libjpeg reports errors through error_exit, which must not return.
+    struct JpegError
+    {
+      jpeg_error_mgr manager;
+      jmp_buf jump;
+    };
+
+    void jpeg_error_exit(j_common_ptr info)
+    {
+      longjmp(reinterpret_cast<JpegError *>(info->err)->jump, 1);
+    }
+
+    void jpeg_silence(j_common_ptr) {}
+
+    void init_jpeg_error(JpegError &error)
+    {
+      jpeg_std_error(&error.manager);
+      error.manager.error_exit = jpeg_error_exit;
+      error.manager.output_message = jpeg_silence;
+    }
+
+    // Swaps the outer channels of packed 3 channel pixels, RGB <-> BGR.
+    void swap_red_blue(const uint8_t *in, uint8_t *out, int width)
+    {
+      for (int x = 0; x < width; x++, in += 3, out += 3)
+      {
+        const uint8_t first = in[0];
+        out[0] = in[2];
+        out[1] = in[1];
+        out[2] = first;
+      }
+    }
+
+    class JpegDecoder : public BandDecoder
+    {
+    public:
+      explicit JpegDecoder(FILE *file) : file_(file)
+      {
+        init_jpeg_error(error_);
+        info_.err = &error_.manager;
+      }
+
+      ~JpegDecoder() override
+      {
+        if (created_)
+        {
+          jpeg_destroy_decompress(&info_);
+        }
+      }
+
+      TranscodeResult open() override
+      {
+        if (setjmp(error_.jump))
+        {
+          return TranscodeResult::failed;
+        }
+        jpeg_create_decompress(&info_);
+        created_ = true;
+        jpeg_stdio_src(&info_, file_);
+        jpeg_save_markers(&info_, JPEG_APP0 + 1, 0xffff);
+        jpeg_read_header(&info_, TRUE);
+
+        // imread rotates the pixels by the orientation, which needs them all.
+        for (jpeg_saved_marker_ptr marker = info_.marker_list; marker != nullptr; marker = marker->next)
+        {
+          if (marker->data_length > 6 && memcmp(marker->data, "Exif\0\0", 6) == 0 &&
+              exif_orientation(marker->data + 6, marker->data_length - 6) > 1)
+          {
+            return TranscodeResult::unsupported;
+          }
+        }
+
+        switch (info_.jpeg_color_space)
+        {
+        case JCS_GRAYSCALE:
+          info_.out_color_space = JCS_GRAYSCALE;
+          gray_ = true;
+          break;
+        case JCS_YCbCr:
+        case JCS_RGB:
+#ifdef JCS_EXTENSIONS
+          info_.out_color_space = JCS_EXT_BGR;
+#else
+          info_.out_color_space = JCS_RGB;
+          swap_ = true;
+#endif
+          break;
+        default:
+          return TranscodeResult::unsupported;
+        }
+
+        jpeg_start_decompress(&info_);
+        width_ = static_cast<int>(info_.output_width);
+        height_ = static_cast<int>(info_.output_height);
+        if (gray_ || swap_)
+        {
+          row_.resize(static_cast<size_t>(width_) * info_.output_components);
+        }
+        return TranscodeResult::done;
+      }
+
+      bool read(uint8_t *bgr, int rows) override
+      {
+        if (setjmp(error_.jump))
+        {
+          return false;
+        }
+        const size_t stride = static_cast<size_t>(width_) * 3;
+        for (int y = 0; y < rows; y++)
+        {
+          uint8_t *out = bgr + y * stride;
+          JSAMPROW row = gray_ || swap_ ? row_.data() : out;
+          if (jpeg_read_scanlines(&info_, &row, 1) != 1)
+          {
+            return false;
+          }
+          if (gray_)
+          {
+            for (int x = 0; x < width_; x++)
+            {
+              out[x * 3] = out[x * 3 + 1] = out[x * 3 + 2] = row_[x];
+            }
+          }
+          else if (swap_)
+          {
+            swap_red_blue(row_.data(), out, width_);
+          }
+        }
+        return true;
+      }
+
+    private:
+      FILE *file_;
+      jpeg_decompress_struct info_;
+      JpegError error_;
+      bool created_ = false;
+      bool gray_ = false;
+      bool swap_ = false;
+      std::vector<uint8_t> row_;
+    };
+
+    class JpegEncoder : public BandEncoder
+    {
+    public:
+      explicit JpegEncoder(FILE *file) : file_(file)
+      {
+        init_jpeg_error(error_);
+        info_.err = &error_.manager;
+      }
+
+      ~JpegEncoder() override
+      {
+        if (created_)
+        {
+          jpeg_destroy_compress(&info_);
+        }
+      }
+
+      bool open(int width, int height, int channels, const graphics_encode_options *options) override
+      {
+        if (setjmp(error_.jump))
+        {
+          return false;
+        }
+        jpeg_create_compress(&info_);
+        created_ = true;
+        jpeg_stdio_dest(&info_, file_);
+        info_.image_width = static_cast<JDIMENSION>(width);
+        info_.image_height = static_cast<JDIMENSION>(height);
+        info_.input_components = channels;
+        if (channels == 1)
+        {
+          info_.in_color_space = JCS_GRAYSCALE;
+        }
+        else
+        {
+#ifdef JCS_EXTENSIONS
+          info_.in_color_space = JCS_EXT_BGR;
+#else
+          info_.in_color_space = JCS_RGB;
+          row_.resize(static_cast<size_t>(width) * 3);
+#endif
+        }
+        jpeg_set_defaults(&info_);
+
+        // The defaults of cv::imwrite.
+        int quality = options != nullptr && options->quality >= 0 ? std::min(options->quality, 100) : 95;
+        jpeg_set_quality(&info_, quality, TRUE);
+        if (options != nullptr && options->progressive > 0)
+        {
+          jpeg_simple_progression(&info_);
+        }
+        info_.optimize_coding = options != nullptr && options->optimize > 0;
+        jpeg_start_compress(&info_, TRUE);
+        stride_ = static_cast<size_t>(width) * channels;
+        return true;
+      }
+
+      bool write(const uint8_t *pixels, int rows) override
+      {
+        if (setjmp(error_.jump))
+        {
+          return false;
+        }
+        for (int y = 0; y < rows; y++)
+        {
+          JSAMPROW row = const_cast<uint8_t *>(pixels + y * stride_);
+          if (!row_.empty())
+          {
+            swap_red_blue(row, row_.data(), static_cast<int>(info_.image_width));
+            row = row_.data();
+          }
+          jpeg_write_scanlines(&info_, &row, 1);
+        }
+        return true;
+      }
+
+      bool finish() override
+      {
+        if (setjmp(error_.jump))
+        {
+          return false;
+        }
+        jpeg_finish_compress(&info_);
+        return true;
+      }
+
+    private:
+      FILE *file_;
+      jpeg_compress_struct info_;
+      JpegError error_;
+      bool created_ = false;
+      size_t stride_ = 0;
+      std::vector<uint8_t> row_;
+    };
+
+    // libpng's error handler must not return either; it unwinds to the
+    // setjmp on png_jmpbuf.
+    void png_error_exit(png_structp png, png_const_charp)
+    {
+      png_longjmp(png, 1);
+    }
+
+    void png_silence(png_structp, png_const_charp) {}
+
+    class PngDecoder : public BandDecoder
+    {
+    public:
+      explicit PngDecoder(FILE *file) : file_(file) {}
+
+      ~PngDecoder() override
+      {
+        png_destroy_read_struct(&png_, &info_, nullptr);
+      }
+
+      TranscodeResult open() override
+      {
+        png_ = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, png_error_exit, png_silence);
+        info_ = png_ != nullptr ? png_create_info_struct(png_) : nullptr;
+        if (info_ == nullptr || setjmp(png_jmpbuf(png_)))
+        {
+          return TranscodeResult::failed;
+        }
+        png_init_io(png_, file_);
+        png_read_info(png_, info_);
+
+        png_uint_32 width, height;
+        int depth, color, interlace;
+        png_get_IHDR(png_, info_, &width, &height, &depth, &color, &interlace, nullptr, nullptr);
+        // Interlaced rows only come out after the last pass over the image.
+        if (interlace != PNG_INTERLACE_NONE)
+        {
+          return TranscodeResult::unsupported;
+        }
+#ifdef PNG_eXIf_SUPPORTED
+        png_uint_32 exif_length = 0;
+        png_bytep exif = nullptr;
+        if (png_get_eXIf_1(png_, info_, &exif_length, &exif) != 0 && exif_orientation(exif, exif_length) > 1)
+        {
+          return TranscodeResult::unsupported;
+        }
+#endif
+
+        // The conversions of imread IMREAD_COLOR: 8 bits, no alpha, BGR.
+        if (depth == 16)
+        {
+          png_set_strip_16(png_);
+        }
+        if (color == PNG_COLOR_TYPE_PALETTE)
+        {
+          png_set_palette_to_rgb(png_);
+        }
+        if (color == PNG_COLOR_TYPE_GRAY && depth < 8)
+        {
+          png_set_expand_gray_1_2_4_to_8(png_);
+        }
+        if ((color & PNG_COLOR_MASK_ALPHA) != 0 || png_get_valid(png_, info_, PNG_INFO_tRNS) != 0)
+        {
+          png_set_strip_alpha(png_);
+        }
+        if ((color & PNG_COLOR_MASK_COLOR) == 0)
+        {
+          png_set_gray_to_rgb(png_);
+        }
+        png_set_bgr(png_);
+        png_read_update_info(png_, info_);
+        if (png_get_channels(png_, info_) != 3 || png_get_bit_depth(png_, info_) != 8)
+        {
+          return TranscodeResult::unsupported;
+        }
+
+        width_ = static_cast<int>(width);
+        height_ = static_cast<int>(height);
+        return TranscodeResult::done;
+      }
+
+      bool read(uint8_t *bgr, int rows) override
+      {
+        if (setjmp(png_jmpbuf(png_)))
+        {
+          return false;
+        }
+        const size_t stride = static_cast<size_t>(width_) * 3;
+        for (int y = 0; y < rows; y++)
+        {
+          png_read_row(png_, bgr + y * stride, nullptr);
+        }
+        return true;
+      }
+
+    private:
+      FILE *file_;
+      png_structp png_ = nullptr;
+      png_infop info_ = nullptr;
+    };
+
+    class PngEncoder : public BandEncoder
+    {
+    public:
+      explicit PngEncoder(FILE *file) : file_(file) {}
+
+      ~PngEncoder() override
+      {
+        png_destroy_write_struct(&png_, &info_);
+      }
+
+      bool open(int width, int height, int channels, const graphics_encode_options *options) override
+      {
+        png_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, png_error_exit, png_silence);
+        info_ = png_ != nullptr ? png_create_info_struct(png_) : nullptr;
+        if (info_ == nullptr || setjmp(png_jmpbuf(png_)))
+        {
+          return false;
+        }
+        png_init_io(png_, file_);
+        png_set_IHDR(png_, info_, static_cast<png_uint_32>(width), static_cast<png_uint_32>(height), 8,
+                     channels == 1 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+        // The settings of cv::imwrite: an explicit level takes the default
+        // strategy, otherwise it tunes for speed.
+        if (options != nullptr && options->png_compression >= 0)
+        {
+          png_set_compression_level(png_, std::min(options->png_compression, Z_BEST_COMPRESSION));
+          png_set_compression_strategy(png_, Z_DEFAULT_STRATEGY);
+        }
+        else
+        {
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+          png_set_compression_level(png_, Z_BEST_SPEED);
+          png_set_compression_strategy(png_, Z_RLE);
+        }
+        png_write_info(png_, info_);
+        if (channels == 3)
+        {
+          png_set_bgr(png_);
+        }
+        stride_ = static_cast<size_t>(width) * channels;
+        return true;
+      }
+
+      bool write(const uint8_t *pixels, int rows) override
+      {
+        if (setjmp(png_jmpbuf(png_)))
+        {
+          return false;
+        }
+        for (int y = 0; y < rows; y++)
+        {
+          png_write_row(png_, pixels + y * stride_);
+        }
+        return true;
+      }
+
+      bool finish() override
+      {
+        if (setjmp(png_jmpbuf(png_)))
+        {
+          return false;
+        }
+        png_write_end(png_, nullptr);
+        return true;
+      }
+
+    private:
+      FILE *file_;
+      png_structp png_ = nullptr;
+      png_infop info_ = nullptr;
+      size_t stride_ = 0;
+    };
+
+    std::unique_ptr<Band> make_band(size_t row_bytes)
+    {
+      std::unique_ptr<Band> band(new Band());
+      band->pixels.resize(row_bytes * kBandRows);
+      return band;
+    }
+
+    uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start)
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    // Decodes on one thread, runs op on another and encodes on the calling
+    // one. Each side of the op has kBandsInFlight bands: a stage waits for a
+    // free band from the stage after it, so a slow stage holds the others
+    // back instead of letting decoded rows pile up.
+    bool run_pipeline(BandDecoder &decoder, BandEncoder &encoder, TranscodeRowOp op, int channels)
+    {
+      const int width = decoder.width();
+      const int height = decoder.height();
+      const size_t in_stride = static_cast<size_t>(width) * 3;
+      const size_t out_stride = static_cast<size_t>(width) * channels;
+
+      BandQueue free_in, decoded, free_out, processed;
+      for (int i = 0; i < kBandsInFlight; i++)
+      {
+        free_in.push(make_band(in_stride));
+        free_out.push(make_band(out_stride));
+      }
+      record_temporary(kBandsInFlight * kBandRows * (in_stride + out_stride));
+
+      std::atomic<bool> failed{false};
+      auto abort = [&]()
+      {
+        failed = true;
+        free_in.close();
+        decoded.close();
+        free_out.close();
+        processed.close();
+      };
+
+      uint64_t decode_ns = 0, convert_ns = 0, encode_ns = 0;
+      std::thread decode_thread([&]()
+                                {
+                                  apply_affinity();
+                                  for (int y = 0; y < height;)
+                                  {
+                                    std::unique_ptr<Band> band;
+                                    if (!free_in.pop(band))
+                                    {
+                                      return;
+                                    }
+                                    auto start = std::chrono::steady_clock::now();
+                                    band->rows = std::min(kBandRows, height - y);
+                                    if (!decoder.read(band->pixels.data(), band->rows))
+                                    {
+                                      abort();
+                                      return;
+                                    }
+                                    decode_ns += nanoseconds_since(start);
+                                    y += band->rows;
+                                    decoded.push(std::move(band));
+                                  } });
+      std::thread process_thread([&]()
+                                 {
+                                   apply_affinity();
+                                   for (int y = 0; y < height;)
+                                   {
+                                     std::unique_ptr<Band> in, out;
+                                     if (!decoded.pop(in) || !free_out.pop(out))
+                                     {
+                                       return;
+                                     }
+                                     auto start = std::chrono::steady_clock::now();
+                                     out->rows = in->rows;
+                                     for (int row = 0; row < in->rows; row++)
+                                     {
+                                       op(in->pixels.data() + row * in_stride, out->pixels.data() + row * out_stride,
+                                          width);
+                                     }
+                                     convert_ns += nanoseconds_since(start);
+                                     y += in->rows;
+                                     free_in.push(std::move(in));
+                                     processed.push(std::move(out));
+                                   } });
+
+      for (int y = 0; y < height;)
+      {
+        std::unique_ptr<Band> band;
+        if (!processed.pop(band))
+        {
+          break;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (!encoder.write(band->pixels.data(), band->rows))
+        {
+          abort();
+          break;
+        }
+        encode_ns += nanoseconds_since(start);
+        y += band->rows;
+        free_out.push(std::move(band));
+      }
+      decode_thread.join();
+      process_thread.join();
+
+      bool ok = !failed;
+      if (ok)
+      {
+        auto start = std::chrono::steady_clock::now();
+        ok = encoder.finish();
+        encode_ns += nanoseconds_since(start);
+      }
+      record_stage(GRAPHICS_STAGE_DECODE, decode_ns);
+      record_stage(GRAPHICS_STAGE_CONVERT, convert_ns);
+      record_stage(GRAPHICS_STAGE_ENCODE, encode_ns);
+      return ok;
+    }
+
+    std::unique_ptr<BandDecoder> make_decoder(Codec codec, FILE *file)
+    {
+      if (codec == Codec::jpeg)
+      {
+        return std::unique_ptr<BandDecoder>(new JpegDecoder(file));
+      }
+      return std::unique_ptr<BandDecoder>(new PngDecoder(file));
+    }
+
+    std::unique_ptr<BandEncoder> make_encoder(Codec codec, FILE *file)
+    {
+      if (codec == Codec::jpeg)
+      {
+        return std::unique_ptr<BandEncoder>(new JpegEncoder(file));
+      }
+      return std::unique_ptr<BandEncoder>(new PngEncoder(file));
+    }
+
+    struct FileCloser
+    {
+      void operator()(FILE *file) const { fclose(file); }
+    };
+  }
+
+  TranscodeResult stream_transcode(const char *input_path, const char *output_path,
+                                   const graphics_encode_options *options, TranscodeRowOp op, int channels)
+  {
+    const char *dot = strrchr(output_path, '.');
+    const Codec output_codec = codec_of_extension(codec_extension(options, dot != nullptr ? dot : ""));
+    if (output_codec == Codec::none || (channels != 1 && channels != 3))
+    {
+      return TranscodeResult::unsupported;
+    }
+
+    std::unique_ptr<FILE, FileCloser> input(fopen(input_path, "rb"));
+    if (input == nullptr)
+    {
+      return TranscodeResult::failed;
+    }
+    const Codec input_codec = codec_of_signature(input.get());
+    if (input_codec == Codec::none)
+    {
+      return TranscodeResult::unsupported;
+    }
+    std::unique_ptr<BandDecoder> decoder = make_decoder(input_codec, input.get());
+    const TranscodeResult opened = decoder->open();
+    if (opened != TranscodeResult::done)
+    {
+      return opened;
+    }
+
+    const std::string partial = std::string(output_path) + ".part";
+    std::unique_ptr<FILE, FileCloser> output(fopen(partial.c_str(), "wb"));
+    if (output == nullptr)
+    {
+      return TranscodeResult::failed;
+    }
+    bool ok;
+    {
+      std::unique_ptr<BandEncoder> encoder = make_encoder(output_codec, output.get());
+      ok = encoder->open(decoder->width(), decoder->height(), channels, options) &&
+           run_pipeline(*decoder, *encoder, op, channels);
+    }
+    ok = fclose(output.release()) == 0 && ok;
+#if _WIN32
+    if (ok)
+    {
+      remove(output_path);
+    }
+#endif
+    if (!ok || rename(partial.c_str(), output_path) != 0)
+    {
+      remove(partial.c_str());
+      return TranscodeResult::failed;
+    }
+    record_bytes_decoded(file_size(input_path));
+    record_bytes_encoded(file_size(output_path));
+    return TranscodeResult::done;
+  }
+#else
+  TranscodeResult stream_transcode(const char *, const char *, const graphics_encode_options *, TranscodeRowOp, int)
+  {
+    return TranscodeResult::unsupported;
+  }
+#endif // GRAPHICS_HAS_STREAMING_CODECS
+}
@@ -0,0 +1,38 @@
+#ifndef GRAPHICS_STREAM_TRANSCODE_HPP
+#define GRAPHICS_STREAM_TRANSCODE_HPP
+
+#include <stdint.h>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Converts a row of width BGR pixels into the output row, which has the
+  // channel count passed to stream_transcode().
+  typedef void (*TranscodeRowOp)(const uint8_t *bgr, uint8_t *out, int width);
+
+  enum class TranscodeResult
+  {
+    done,
+    // The build, the input or the output format is not covered by the
+    // streaming codecs; nothing was written and the caller should take the
+    // whole image path instead.
+    unsupported,
+    failed,
+  };
+
+  // Decodes the JPEG or PNG at input_path in bands of rows, runs op on every
+  // row and encodes the result (1 channel gray or 3 channel BGR) to
+  // output_path as JPEG or PNG, picked like write_image(). Decoding,
+  // processing and encoding run on three threads connected by a fixed set of
+  // band buffers, so memory stays at a few bands of rows whatever the image
+  // height. The decoded pixels match cv::imread IMREAD_COLOR: JPEGs with an
+  // EXIF orientation, interlaced PNGs and CMYK JPEGs are unsupported. The
+  // output is written to a sibling file renamed over output_path on success,
+  // so output_path may be input_path. Progressive or optimized JPEG output
+  // keeps the coefficients of the whole image inside libjpeg.
+  TranscodeResult stream_transcode(const char *input_path, const char *output_path,
+                                   const graphics_encode_options *options, TranscodeRowOp op, int channels);
+}
+
+#endif // GRAPHICS_STREAM_TRANSCODE_HPP
@@ -0,0 +1,133 @@
+#include "stroke.hpp"
+
+#include <cmath>
+#include <vector>
+
+#include "graphics.hpp"
+#include "image_session.hpp"
+
+namespace graphics
+{
+  void retain_stroke(graphics_stroke *stroke)
+  {
+    stroke->references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release_stroke(graphics_stroke *stroke)
+  {
+    if (stroke->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      delete stroke;
+    }
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT graphics_stroke *create_stroke(int32_t width, int32_t height, const graphics_brush *brush,
+                                                   float scale_x, float scale_y)
+  try
+  {
+    if (width <= 0 || height <= 0 || brush == nullptr || !graphics::valid_brush(*brush) ||
+        !std::isfinite(scale_x) || !std::isfinite(scale_y))
+    {
+      return nullptr;
+    }
+    return new graphics_stroke(cv::Size(width, height), *brush, cv::Point2f(scale_x, scale_y));
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return nullptr;
+  }
+
+  FFI_PLUGIN_EXPORT int stroke_append_points(graphics_stroke *stroke, const float *points, int32_t num_points)
+  try
+  {
+    // points holds 2 * num_points floats, which must fit an int32_t count.
+    if (stroke == nullptr || points == nullptr || num_points < 0 || num_points > INT32_MAX / 2)
+    {
+      return 1;
+    }
+
+    std::vector<cv::Point2f> scaled(static_cast<size_t>(num_points));
+    for (size_t i = 0; i < scaled.size(); i++)
+    {
+      scaled[i] = cv::Point2f(points[i * 2] * stroke->scale.x, points[i * 2 + 1] * stroke->scale.y);
+    }
+    std::lock_guard<std::mutex> lock(stroke->mutex);
+    stroke->engine->append(scaled.data(), scaled.size());
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int stroke_clear(graphics_stroke *stroke)
+  try
+  {
+    if (stroke == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(stroke->mutex);
+    stroke->engine->clear();
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int32_t stroke_get_length(graphics_stroke *stroke)
+  try
+  {
+    if (stroke == nullptr)
+    {
+      return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(stroke->mutex);
+    return static_cast<int32_t>(stroke->engine->points().size());
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 0;
+  }
+
+  FFI_PLUGIN_EXPORT int stroke_get_bounds(graphics_stroke *stroke, int32_t *x, int32_t *y, int32_t *width,
+                                          int32_t *height)
+  try
+  {
+    if (stroke == nullptr || x == nullptr || y == nullptr || width == nullptr || height == nullptr)
+    {
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(stroke->mutex);
+    cv::Rect bounds = stroke->engine->extent();
+    *x = bounds.x;
+    *y = bounds.y;
+    *width = bounds.width;
+    *height = bounds.height;
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT void close_stroke(graphics_stroke *stroke)
+  {
+    if (stroke != nullptr)
+    {
+      graphics::release_stroke(stroke);
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef GRAPHICS_STROKE_HPP
+#define GRAPHICS_STROKE_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <opencv2/opencv.hpp>
+
+#include "brush.hpp"
+
+// A brush stroke kept in native memory while the user paints it. Points
+// arrive in view coordinates and are mapped to image pixels by scale, the
+// stamps are rendered into the engine's layer in batches. Like selections, a
+// stroke is shared between Dart and queued jobs through a reference count and
+// every access takes the mutex. The engine is shared with the command that
+// commits it, which only reads it while the mutex is held.
+struct graphics_stroke
+{
+  graphics_stroke(cv::Size image_size, const graphics_brush &brush, cv::Point2f scale)
+      : scale(scale), engine(std::make_shared<graphics::BrushStroke>(image_size, brush))
+  {
+  }
+
+  std::mutex mutex;
+  std::atomic<int> references{1};
+  cv::Point2f scale;
+  std::shared_ptr<graphics::BrushStroke> engine;
+};
+
+namespace graphics
+{
+  void retain_stroke(graphics_stroke *stroke);
+  void release_stroke(graphics_stroke *stroke);
+}
+
+#endif // GRAPHICS_STROKE_HPP
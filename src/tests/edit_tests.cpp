@@ -0,0 +1,293 @@
+#include "tests.hpp"
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../bench/bench_util.hpp"
+#include "../bench/scenes.hpp"
+#include "../brush.hpp"
+#include "../command_buffer.hpp"
+#include "../layers.hpp"
+#include "../pixel_kernels.hpp"
+#include "../polygon_mask.hpp"
+#include "../region_filters.hpp"
+#include "../tiled_image.hpp"
+#include "../undo_history.hpp"
+
+namespace tests
+{
+  namespace
+  {
+    // Runs edits with history, then undoes them all and redoes them all,
+    // comparing the image with the one every step left.
+    template <typename Image>
+    bool check_undo(const char *name, Image image, const std::vector<graphics::Command> &edits, size_t budget,
+                    int32_t compression, const char *spill_directory)
+    {
+      graphics::UndoHistory history;
+      history.configure(budget, compression, spill_directory);
+      std::vector<cv::Mat> states = {bench::pixels_of(image)};
+      for (const graphics::Command &command : edits)
+      {
+        bench::edit_with_history(history, image, command);
+        states.push_back(bench::pixels_of(image));
+      }
+
+      std::vector<graphics::Command> replays;
+      std::vector<cv::Rect> changed;
+      const int steps = history.undo_steps();
+      bool ok = steps == static_cast<int>(edits.size()) || (spill_directory == nullptr && steps >= 1);
+      for (int i = 1; ok && i <= steps; i++)
+      {
+        ok = history.undo(image, replays, changed) &&
+             cv::norm(bench::pixels_of(image), states[states.size() - 1 - i], cv::NORM_INF) == 0;
+      }
+      for (int i = steps - 1; ok && i >= 0; i--)
+      {
+        ok = history.redo(image, replays, changed) &&
+             cv::norm(bench::pixels_of(image), states[states.size() - 1 - i], cv::NORM_INF) == 0;
+      }
+      ok = ok && !history.redo(image, replays, changed);
+      if (!ok)
+      {
+        fprintf(stderr, "undo history %s does not restore the edits (%d steps kept)\n", name, steps);
+      }
+      return ok;
+    }
+  }
+
+  bool region_filters()
+  {
+    // Every filter case run in bands over a feathered freehand selection
+    // matches one pass of the filter over the whole image blended by the
+    // same coverage.
+    const cv::Size size(640, 480);
+    cv::Mat image = bench::make_image(size);
+    std::vector<cv::Point2f> polygon = bench::make_freehand(size, 0.3, 2000);
+    std::shared_ptr<const graphics::PolygonMask> mask = graphics::polygon_mask(polygon, 3, size);
+    bool ok = true;
+
+    for (const bench::FilterCase &filter_case : bench::filter_cases())
+    {
+      const graphics::RegionFilter &filter = *graphics::find_region_filter(filter_case.filter);
+      cv::Mat actual = image.clone();
+      graphics::filter_mask(actual, *mask, filter, filter_case.values);
+
+      // Filtered as a view, like the bands, so OpenCV takes the same code
+      // path (its IPP kernels only run on whole images). The selection stays
+      // clear of the edges, where the two extrapolate differently.
+      cv::Mat canvas, filtered;
+      cv::copyMakeBorder(image, canvas, 1, 1, 1, 1, cv::BORDER_REFLECT_101);
+      filter.apply(canvas, cv::Rect(1, 1, size.width, size.height), filtered, filter_case.values);
+      cv::Mat expected = image.clone();
+      cv::Mat region = expected(mask->roi);
+      graphics::blend_weighted(region, filtered(mask->roi), mask->coverage);
+
+      if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+      {
+        fprintf(stderr, "%s %s differs from the whole image pass\n", filter.name, filter_case.variant);
+        ok = false;
+      }
+    }
+    return ok;
+  }
+
+  bool strokes()
+  {
+    // A stroke previewed frame by frame from its dirty patches, and the same
+    // stroke replayed as a command buffer entry, both match the stroke
+    // rendered in one batch, whose bounds were known before rendering.
+    const cv::Size size(640, 480);
+    cv::Mat image = bench::make_image(size);
+    std::vector<cv::Point2f> path = bench::make_freehand(size, 0.4, 1500);
+    bool ok = true;
+
+    for (const graphics_brush &brush : bench::brushes())
+    {
+      graphics::BrushStroke stroke(size, brush);
+      stroke.append(path.data(), path.size());
+      const cv::Rect extent = stroke.extent();
+      stroke.render();
+      cv::Mat expected = image.clone();
+      stroke.composite(expected);
+
+      cv::Mat preview = image.clone();
+      bench::paint_frames(preview, image, path, brush, false);
+      cv::Mat replayed = image.clone();
+      graphics::Command command = graphics::stroke_command(brush, path);
+      bool executed = graphics::execute_command(replayed, command);
+
+      if (cv::norm(preview, expected, cv::NORM_INF) != 0 || !executed ||
+          cv::norm(replayed, expected, cv::NORM_INF) != 0 || extent != stroke.bounds())
+      {
+        fprintf(stderr, "stroke of size %.0f differs between batches\n", brush.size);
+        ok = false;
+      }
+    }
+    return ok;
+  }
+
+  bool layers()
+  {
+    // The tiled composite matches the layers flattened over the whole image
+    // after every kind of change, and toggling a small layer leaves most
+    // tiles alone.
+    const cv::Size size(1000, 700);
+    cv::Mat image = bench::make_image(size);
+    graphics::LayerStack stack(size);
+    bench::LayerIds ids = bench::make_layers(stack);
+    bool ok = true;
+
+    auto check = [&](const char *change)
+    {
+      if (cv::norm(stack.composite(image), bench::flatten_layers(image, stack), cv::NORM_INF) != 0)
+      {
+        fprintf(stderr, "layer composite differs after %s\n", change);
+        ok = false;
+      }
+    };
+    check("adding the layers");
+
+    stack.set_visible(ids.paint, false);
+    int tiles = stack.dirty_tiles();
+    if (tiles * 2 > ((size.width + 255) / 256) * ((size.height + 255) / 256))
+    {
+      fprintf(stderr, "toggling a small layer dirtied %d tiles\n", tiles);
+      ok = false;
+    }
+    check("hiding a layer");
+    stack.set_visible(ids.paint, true);
+    check("showing a layer");
+
+    const float sigma[graphics::kFilterValues] = {7, 0, 0};
+    stack.update(ids.blur, graphics::BlendMode::multiply, 0.7f, sigma);
+    check("updating a layer");
+
+    std::vector<cv::Point2f> polygon = bench::make_freehand(size, 0.1, 300);
+    graphics::Command command;
+    command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+    command.points = polygon;
+    graphics::execute_command(image, command);
+    stack.invalidate(graphics::command_bounds(command, size));
+    check("editing the image");
+
+    stack.set_mask(ids.blur, nullptr, std::vector<cv::Point2f>(), 0);
+    stack.remove(ids.saturation);
+    check("removing a mask and a layer");
+    return ok;
+  }
+
+  bool tiled_image()
+  {
+    // Every kind of command gives the same pixels on a tiled image as on the
+    // whole image, and an edit after a snapshot only copies the tiles it
+    // writes while the snapshot keeps the old pixels.
+    const cv::Size size(1000, 700);
+    cv::Mat image = bench::make_image(size);
+    graphics::TiledImage tiles(image.clone());
+    bool ok = true;
+
+    auto check = [&](const char *name, const graphics::Command &command)
+    {
+      const bool whole = graphics::execute_command(image, command);
+      const bool tiled = graphics::execute_command(tiles, command);
+      if (whole != tiled || cv::norm(tiles.to_mat(), image, cv::NORM_INF) != 0)
+      {
+        fprintf(stderr, "tiled %s differs from the whole image\n", name);
+        ok = false;
+      }
+    };
+
+    graphics::Command command;
+    command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+    command.params = {4.5f};
+    command.points = bench::make_freehand(size, 0.1, 300);
+    check("gray_scale_polygon", command);
+
+    command.op = GRAPHICS_OP_DRAW_POLYGON;
+    command.params = {10, 20, 250, 7};
+    command.points = {cv::Point2f(-20, 600), cv::Point2f(300, 720), cv::Point2f(150, 500)};
+    check("draw_polygon over the edge", command);
+
+    command.op = GRAPHICS_OP_FILTER_POLYGON;
+    command.params = {GRAPHICS_FILTER_GAUSSIAN_BLUR, 3, 6};
+    command.points = bench::make_freehand(size, 0.3, 1000);
+    check("filter_polygon", command);
+
+    const graphics_brush brush = {40, 60, 220, 30, 0.6f, 0.8f, 0.1f};
+    const std::vector<cv::Point2f> path = bench::make_freehand(size, 0.2, 400);
+    check("stroke replay", graphics::stroke_command(brush, path));
+    auto stroke = std::make_shared<graphics::BrushStroke>(size, brush);
+    stroke->append(path.data(), path.size());
+    stroke->render();
+    command = graphics::stroke_command(brush, path);
+    command.stroke = stroke;
+    check("rendered stroke", command);
+
+    const graphics::TiledImage snapshot = tiles;
+    const cv::Mat before = snapshot.to_mat();
+    command = graphics::Command();
+    command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+    command.points = {cv::Point2f(10, 10), cv::Point2f(100, 20), cv::Point2f(60, 90)};
+    check("edit after a snapshot", command);
+    if (snapshot.shared_tiles() != snapshot.tile_count() - 1 || cv::norm(snapshot.to_mat(), before, cv::NORM_INF) != 0)
+    {
+      fprintf(stderr, "a small edit copied %d tiles or changed the snapshot\n",
+              snapshot.tile_count() - snapshot.shared_tiles());
+      ok = false;
+    }
+
+    command.op = GRAPHICS_OP_GRAY_SCALE;
+    check("gray_scale", command);
+    return ok;
+  }
+
+  bool undo_history()
+  {
+    const cv::Size size(1500, 1000);
+    const cv::Mat image = bench::make_image(size);
+    std::vector<graphics::Command> edits;
+    graphics::Command command;
+    command.op = GRAPHICS_OP_GRAY_SCALE_POLYGON;
+    command.params = {4.5f};
+    command.points = bench::make_freehand(size, 0.1, 300);
+    edits.push_back(command);
+    command.op = GRAPHICS_OP_DRAW_POLYGON;
+    command.params = {10, 20, 250, 7};
+    command.points = {cv::Point2f(-20, 600), cv::Point2f(300, 720), cv::Point2f(150, 500)};
+    edits.push_back(command);
+    command.op = GRAPHICS_OP_FILTER_POLYGON;
+    command.params = {GRAPHICS_FILTER_GAUSSIAN_BLUR, 3, 6};
+    command.points = bench::make_freehand(size, 0.3, 1000);
+    edits.push_back(command);
+    const graphics_brush brush = {40, 60, 220, 30, 0.6f, 0.8f, 0.1f};
+    const std::vector<cv::Point2f> path = bench::make_freehand(size, 0.2, 400);
+    auto stroke = std::make_shared<graphics::BrushStroke>(size, brush);
+    stroke->append(path.data(), path.size());
+    stroke->render();
+    command = graphics::stroke_command(brush, path);
+    command.stroke = stroke;
+    edits.push_back(command);
+    command = graphics::Command();
+    command.op = GRAPHICS_OP_GRAY_SCALE;
+    edits.push_back(command);
+
+    // A budget of one byte spills or drops every step but the last.
+    const std::string spill = bench::temp_directory();
+    const size_t unlimited = size_t(1) << 40;
+    const graphics::TiledImage tiles(image.clone());
+    return check_undo("image", image.clone(), edits, unlimited, GRAPHICS_RAW_UNCOMPRESSED, nullptr) &&
+           check_undo("tiled", tiles, edits, unlimited, GRAPHICS_RAW_UNCOMPRESSED, nullptr) &&
+           check_undo("image lz4", image.clone(), edits, unlimited, GRAPHICS_RAW_LZ4, nullptr) &&
+           check_undo("tiled lz4", tiles, edits, unlimited, GRAPHICS_RAW_LZ4, nullptr) &&
+           check_undo("image spilled", image.clone(), edits, 1, GRAPHICS_RAW_UNCOMPRESSED, spill.c_str()) &&
+           check_undo("tiled spilled lz4", tiles, edits, 1, GRAPHICS_RAW_LZ4, spill.c_str()) &&
+           check_undo("image dropped", image.clone(), edits, 1, GRAPHICS_RAW_UNCOMPRESSED, nullptr) &&
+           check_undo("tiled dropped", tiles, edits, 1, GRAPHICS_RAW_LZ4, nullptr);
+  }
+}
@@ -0,0 +1,82 @@
+// Correctness tests of the native image operations.
+//
+// Build with -DGRAPHICS_BUILD_TESTS=ON and run them all through CTest, or
+// some of them by name:
+//
+//   graphics_tests [TEST...]
+//
+// Prints one line per test to stderr and exits non-zero if any failed.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tests.hpp"
+
+namespace
+{
+  struct Test
+  {
+    const char *name;
+    bool (*run)();
+  };
+
+  const Test kTests[] = {
+      {"desaturate_kernels", tests::desaturate_kernels},
+      {"rgba_kernels", tests::rgba_kernels},
+      {"gray_kernels", tests::gray_kernels},
+      {"weighted_kernels", tests::weighted_kernels},
+      {"blend_kernels", tests::blend_kernels},
+      {"blend_mode_kernels", tests::blend_mode_kernels},
+      {"polygon_coverage", tests::polygon_coverage},
+      {"region_filters", tests::region_filters},
+      {"strokes", tests::strokes},
+      {"layers", tests::layers},
+      {"tiled_image", tests::tiled_image},
+      {"undo_history", tests::undo_history},
+      {"streaming_transcode", tests::streaming_transcode},
+      {"raw_round_trip", tests::raw_round_trip},
+      {"corrupt_inputs", tests::corrupt_inputs},
+      {"log_compiled_out", tests::log_compiled_out},
+  };
+
+  bool selected(const char *name, int argc, char **argv)
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], name) == 0)
+      {
+        return true;
+      }
+    }
+    return argc == 1;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int run = 0;
+  int failed = 0;
+  for (const Test &test : kTests)
+  {
+    if (!selected(test.name, argc, argv))
+    {
+      continue;
+    }
+    const bool passed = test.run();
+    fprintf(stderr, "%-24s %s\n", test.name, passed ? "passed" : "FAILED");
+    run++;
+    failed += passed ? 0 : 1;
+  }
+
+  if (run == 0)
+  {
+    fprintf(stderr, "usage: %s [TEST...], TEST one of:\n", argv[0]);
+    for (const Test &test : kTests)
+    {
+      fprintf(stderr, "  %s\n", test.name);
+    }
+    return 2;
+  }
+  fprintf(stderr, "%d of %d tests failed\n", failed, run);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+#include "tests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../bench/bench_util.hpp"
+#include "../bench/scenes.hpp"
+#include "../graphics.hpp"
+#include "../image_io.hpp"
+
+namespace tests
+{
+  namespace
+  {
+    bool copy_file(const std::string &from, const std::string &to)
+    {
+      std::vector<uint8_t> bytes;
+      FILE *file = graphics::read_file(from.c_str(), bytes) ? fopen(to.c_str(), "wb") : nullptr;
+      if (file == nullptr)
+      {
+        return false;
+      }
+      bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+      return fclose(file) == 0 && written;
+    }
+  }
+
+  bool streaming_transcode()
+  {
+    // A JPEG and a PNG converted to grayscale by process_image and by
+    // process_image_streaming, on a size that leaves a partial last band. The
+    // PNG outputs must match bit for bit; the JPEG ones may be a level or two
+    // apart when OpenCV links another libjpeg than the streaming codecs.
+    const std::string base = bench::temp_directory() + "/graphics_tests_" + std::to_string(getpid());
+    const cv::Mat image = bench::make_image(cv::Size(1203, 917));
+    bool ok = true;
+    for (const char *ext : {".jpg", ".png"})
+    {
+      const std::string input = base + "_input" + ext;
+      const std::string whole = base + "_whole" + ext;
+      const std::string streamed = base + "_streamed" + ext;
+      cv::imwrite(input, image);
+      if (!copy_file(input, whole) || process_image(whole.c_str()) != 0 ||
+          process_image_streaming(input.c_str(), streamed.c_str(), nullptr) != 0)
+      {
+        fprintf(stderr, "could not transcode %s\n", ext);
+        ok = false;
+      }
+      else
+      {
+        cv::Mat expected = cv::imread(whole, cv::IMREAD_GRAYSCALE);
+        cv::Mat actual = cv::imread(streamed, cv::IMREAD_GRAYSCALE);
+        const double tolerance = ext[1] == 'j' ? 2 : 0;
+        if (expected.empty() || actual.size() != expected.size() ||
+            cv::norm(actual, expected, cv::NORM_INF) > tolerance)
+        {
+          fprintf(stderr, "streamed %s differs from the whole image\n", ext);
+          ok = false;
+        }
+      }
+      remove(input.c_str());
+      remove(whole.c_str());
+      remove(streamed.c_str());
+    }
+    return ok;
+  }
+
+  bool raw_round_trip()
+  {
+    // format, quality, progressive, optimize, png compression, raw compression
+    const graphics_encode_options configs[] = {
+        {GRAPHICS_FORMAT_RAW, -1, -1, -1, -1, GRAPHICS_RAW_UNCOMPRESSED},
+        {GRAPHICS_FORMAT_RAW, -1, -1, -1, -1, GRAPHICS_RAW_LZ4},
+    };
+    const cv::Mat image = bench::make_image(cv::Size(1001, 333));
+    bool ok = true;
+    for (const graphics_encode_options &options : configs)
+    {
+      uint8_t *data = nullptr;
+      int32_t length = 0;
+      cv::Mat decoded;
+      if (!graphics::encode_image(image, nullptr, &options, &data, &length) ||
+          !graphics::decode_image(data, length, cv::IMREAD_COLOR, decoded) ||
+          decoded.size() != image.size() || cv::norm(decoded, image, cv::NORM_INF) != 0)
+      {
+        fprintf(stderr, "raw compression %d did not round trip losslessly\n", options.raw_compression);
+        ok = false;
+      }
+      free(data);
+    }
+    return ok;
+  }
+
+  bool corrupt_inputs()
+  {
+    // Forged, damaged and oversized inputs make the entry points fail with
+    // an error status instead of crashing or throwing into the caller.
+    const cv::Mat image = bench::make_image(cv::Size(64, 48));
+    const graphics_encode_options lz4 = {GRAPHICS_FORMAT_RAW, -1, -1, -1, -1, GRAPHICS_RAW_LZ4};
+    uint8_t *data = nullptr;
+    int32_t length = 0;
+    if (!graphics::encode_image(image, nullptr, &lz4, &data, &length))
+    {
+      fprintf(stderr, "could not encode the raw image\n");
+      return false;
+    }
+    const std::vector<uint8_t> valid(data, data + length);
+    free(data);
+
+    // The raw header is six uint32 fields: magic, width, height, channels,
+    // compression and payload size.
+    auto with_field = [&](int field, uint32_t value)
+    {
+      std::vector<uint8_t> bytes = valid;
+      memcpy(bytes.data() + field * sizeof(uint32_t), &value, sizeof(value));
+      return bytes;
+    };
+    std::vector<uint8_t> garbage_payload = valid;
+    for (size_t i = 24; i < garbage_payload.size(); i++)
+    {
+      garbage_payload[i] = static_cast<uint8_t>(i * 131);
+    }
+    std::vector<uint8_t> noise(4096);
+    for (size_t i = 0; i < noise.size(); i++)
+    {
+      noise[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    const struct
+    {
+      const char *name;
+      std::vector<uint8_t> bytes;
+    } inputs[] = {
+        {"a huge width", with_field(1, 0x7fffffffu)},
+        {"a huge height", with_field(2, 0x7fffffffu)},
+        {"an unknown compression", with_field(4, 7)},
+        {"a payload past the end", with_field(5, 0xffffffffu)},
+        {"a truncated payload", std::vector<uint8_t>(valid.begin(), valid.begin() + valid.size() / 2)},
+        {"a garbage payload", garbage_payload},
+        {"noise", noise},
+    };
+
+    bool ok = true;
+    for (const auto &input : inputs)
+    {
+      uint8_t *out_data = nullptr;
+      int32_t out_length = 0;
+      const int status = process_image_encoded(input.bytes.data(), static_cast<int32_t>(input.bytes.size()), ".png",
+                                               &out_data, &out_length);
+      if (status == 0)
+      {
+        fprintf(stderr, "process_image_encoded accepted %s\n", input.name);
+        ok = false;
+      }
+      free(out_data);
+    }
+
+    // The buffer is never touched: the sizes are rejected first.
+    std::vector<uint8_t> pixels(64);
+    const int32_t sizes[][3] = {{INT32_MAX, 2, 0}, {1 << 16, 1 << 16, 0}, {4, 4, 1}, {-1, 4, 0}};
+    for (const auto &size : sizes)
+    {
+      if (process_image_pixels(pixels.data(), size[0], size[1], size[2], GRAPHICS_PIXEL_RGBA8) == 0)
+      {
+        fprintf(stderr, "process_image_pixels accepted %dx%d with stride %d\n", size[0], size[1], size[2]);
+        ok = false;
+      }
+    }
+    return ok;
+  }
+}
@@ -0,0 +1,324 @@
+#include "tests.hpp"
+
+#include <stdio.h>
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../bench/scenes.hpp"
+#include "../pixel_kernels.hpp"
+#include "../polygon_mask.hpp"
+
+namespace tests
+{
+  namespace
+  {
+    const cv::Size kSizes[] = {cv::Size(1, 1),   cv::Size(15, 3),   cv::Size(16, 2),    cv::Size(33, 17),
+                               cv::Size(97, 31), cv::Size(640, 480), cv::Size(1023, 129)};
+
+    // A random image viewed inside a wider one, so rows are not contiguous.
+    cv::Mat padded_image(cv::Size size)
+    {
+      cv::Mat canvas(size.height, size.width + 5, CV_8UC3);
+      cv::randu(canvas, cv::Scalar::all(0), cv::Scalar::all(256));
+      return canvas(cv::Rect(2, 0, size.width, size.height));
+    }
+
+    // Puts the kernels back on the level they ran on when it was created.
+    class KernelLevelScope
+    {
+    public:
+      KernelLevelScope() : initial_(graphics::kernel_level()) {}
+      ~KernelLevelScope() { graphics::set_kernel_level(initial_); }
+
+    private:
+      graphics::KernelLevel initial_;
+    };
+
+    const graphics::BlendMode kBlendModes[] = {graphics::BlendMode::normal, graphics::BlendMode::multiply,
+                                                graphics::BlendMode::screen, graphics::BlendMode::overlay};
+    const char *const kBlendModeNames[] = {"normal", "multiply", "screen", "overlay"};
+  }
+
+  bool desaturate_kernels()
+  {
+    KernelLevelScope scope;
+    bool ok = true;
+    for (const cv::Size &size : kSizes)
+    {
+      cv::Mat image = padded_image(size);
+      cv::Mat mask(size, CV_8UC1);
+      cv::randu(mask, cv::Scalar::all(0), cv::Scalar::all(4));
+      mask.setTo(cv::Scalar(0), mask == 1);
+
+      cv::Mat expected = image.clone();
+      bench::four_pass_desaturate(expected, mask);
+
+      for (graphics::KernelLevel level : bench::kernel_levels())
+      {
+        if (!graphics::set_kernel_level(level))
+        {
+          continue;
+        }
+        cv::Mat actual = image.clone();
+        graphics::desaturate_masked(actual, mask);
+        if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+        {
+          fprintf(stderr, "desaturate_masked %s differs from cvtColor at %dx%d\n",
+                  graphics::kernel_level_name(level), size.width, size.height);
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool rgba_kernels()
+  {
+    KernelLevelScope scope;
+    bool ok = true;
+    for (const cv::Size &size : kSizes)
+    {
+      cv::Mat image = padded_image(size);
+      cv::Mat expected;
+      cv::cvtColor(image, expected, cv::COLOR_BGR2RGBA);
+
+      for (graphics::KernelLevel level : bench::kernel_levels())
+      {
+        if (!graphics::set_kernel_level(level))
+        {
+          continue;
+        }
+        cv::Mat actual(size, CV_8UC4);
+        graphics::bgr_to_rgba(image, actual.ptr<uint8_t>());
+        if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+        {
+          fprintf(stderr, "bgr_to_rgba %s differs from cvtColor at %dx%d\n", graphics::kernel_level_name(level),
+                  size.width, size.height);
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool gray_kernels()
+  {
+    // Row by row like the streaming transcoder.
+    const int widths[] = {1, 15, 16, 17, 31, 32, 33, 97, 1023};
+    KernelLevelScope scope;
+    bool ok = true;
+    for (int width : widths)
+    {
+      cv::Mat image(7, width, CV_8UC3);
+      cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+      cv::Mat expected;
+      cv::cvtColor(image, expected, cv::COLOR_BGR2GRAY);
+
+      for (graphics::KernelLevel level : bench::kernel_levels())
+      {
+        if (!graphics::set_kernel_level(level))
+        {
+          continue;
+        }
+        cv::Mat actual(image.size(), CV_8UC1);
+        for (int y = 0; y < image.rows; y++)
+        {
+          graphics::bgr_to_gray_row(image.ptr<uint8_t>(y), actual.ptr<uint8_t>(y), width);
+        }
+        if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+        {
+          fprintf(stderr, "bgr_to_gray %s differs from cvtColor at width %d\n", graphics::kernel_level_name(level),
+                  width);
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool weighted_kernels()
+  {
+    // The scalar kernel is the reference on soft masks, the four pass
+    // pipeline on hard ones.
+    KernelLevelScope scope;
+    bool ok = true;
+    for (const cv::Size &size : kSizes)
+    {
+      cv::Mat image = padded_image(size);
+      cv::Mat soft(size, CV_8UC1);
+      cv::randu(soft, cv::Scalar::all(0), cv::Scalar::all(256));
+      cv::Mat hard = soft >= 128;
+
+      graphics::set_kernel_level(graphics::KernelLevel::scalar);
+      cv::Mat expected_soft = image.clone();
+      graphics::desaturate_weighted(expected_soft, soft);
+      cv::Mat expected_hard = image.clone();
+      bench::four_pass_desaturate(expected_hard, hard);
+
+      for (graphics::KernelLevel level : bench::kernel_levels())
+      {
+        if (!graphics::set_kernel_level(level))
+        {
+          continue;
+        }
+        cv::Mat actual = image.clone();
+        graphics::desaturate_weighted(actual, soft);
+        cv::Mat actual_hard = image.clone();
+        graphics::desaturate_weighted(actual_hard, hard);
+        if (cv::norm(actual, expected_soft, cv::NORM_INF) != 0 ||
+            cv::norm(actual_hard, expected_hard, cv::NORM_INF) != 0)
+        {
+          fprintf(stderr, "desaturate_weighted %s differs at %dx%d\n", graphics::kernel_level_name(level),
+                  size.width, size.height);
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool blend_kernels()
+  {
+    KernelLevelScope scope;
+    bool ok = true;
+    for (const cv::Size &size : kSizes)
+    {
+      cv::Mat image = padded_image(size);
+      cv::Mat filtered(size, CV_8UC3);
+      cv::randu(filtered, cv::Scalar::all(0), cv::Scalar::all(256));
+      cv::Mat weights(size, CV_8UC1);
+      cv::randu(weights, cv::Scalar::all(0), cv::Scalar::all(256));
+      // Runs of fully covered pixels take the copy path.
+      weights.colRange(0, size.width / 2).setTo(cv::Scalar(255));
+
+      cv::Mat expected = image.clone();
+      for (int y = 0; y < size.height; y++)
+      {
+        graphics::blend_weighted_row_scalar(expected.ptr<uint8_t>(y), filtered.ptr<uint8_t>(y),
+                                            weights.ptr<uint8_t>(y), size.width);
+      }
+
+      for (graphics::KernelLevel level : bench::kernel_levels())
+      {
+        if (!graphics::set_kernel_level(level))
+        {
+          continue;
+        }
+        cv::Mat actual = image.clone();
+        graphics::blend_weighted(actual, filtered, weights);
+        if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+        {
+          fprintf(stderr, "blend_weighted %s differs at %dx%d\n", graphics::kernel_level_name(level), size.width,
+                  size.height);
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool blend_mode_kernels()
+  {
+    // The scalar blend modes against their formulas in floating point, the
+    // other levels against the scalar ones.
+    const int counts[] = {1, 15, 16, 17, 31, 32, 33, 97, 65536};
+    KernelLevelScope scope;
+    bool ok = true;
+    for (int count : counts)
+    {
+      cv::Mat base(1, count, CV_8UC1), layer(1, count, CV_8UC1);
+      cv::randu(base, cv::Scalar::all(0), cv::Scalar::all(256));
+      cv::randu(layer, cv::Scalar::all(0), cv::Scalar::all(256));
+      uint8_t *a = base.ptr<uint8_t>();
+      uint8_t *b = layer.ptr<uint8_t>();
+      if (count == 65536)
+      {
+        // Every pair of values.
+        for (int i = 0; i < count; i++)
+        {
+          a[i] = static_cast<uint8_t>(i & 255);
+          b[i] = static_cast<uint8_t>(i >> 8);
+        }
+      }
+
+      for (size_t m = 0; m < sizeof(kBlendModes) / sizeof(kBlendModes[0]); m++)
+      {
+        cv::Mat expected(1, count, CV_8UC1);
+        graphics::blend_mode_row_scalar(a, b, expected.ptr<uint8_t>(), count, kBlendModes[m]);
+        for (int i = 0; i < count; i++)
+        {
+          double x = a[i] / 255.0, y = b[i] / 255.0;
+          double value = y;
+          switch (kBlendModes[m])
+          {
+          case graphics::BlendMode::multiply:
+            value = x * y;
+            break;
+          case graphics::BlendMode::screen:
+            value = 1 - (1 - x) * (1 - y);
+            break;
+          case graphics::BlendMode::overlay:
+            value = x < 0.5 ? 2 * x * y : 1 - 2 * (1 - x) * (1 - y);
+            break;
+          default:
+            break;
+          }
+          if (std::fabs(value * 255 - expected.ptr<uint8_t>()[i]) > 1)
+          {
+            fprintf(stderr, "blend mode %s is off at %d, %d\n", kBlendModeNames[m], a[i], b[i]);
+            ok = false;
+            break;
+          }
+        }
+
+        for (graphics::KernelLevel level : bench::kernel_levels())
+        {
+          if (!graphics::set_kernel_level(level))
+          {
+            continue;
+          }
+          cv::Mat actual(1, count, CV_8UC1);
+          graphics::blend_mode_row(a, b, actual.ptr<uint8_t>(), count, kBlendModes[m]);
+          if (cv::norm(actual, expected, cv::NORM_INF) != 0)
+          {
+            fprintf(stderr, "blend mode %s %s differs at %d bytes\n", kBlendModeNames[m],
+                    graphics::kernel_level_name(level), count);
+            ok = false;
+          }
+        }
+      }
+    }
+    return ok;
+  }
+
+  bool polygon_coverage()
+  {
+    // The coverage of fractional polygons adds up to their area.
+    const cv::Size size(640, 480);
+    bool ok = true;
+    for (int vertices : {3, 5, 64, 1000})
+    {
+      std::vector<cv::Point2f> polygon;
+      for (int i = 0; i < vertices; i++)
+      {
+        double angle = 2 * CV_PI * i / vertices + 0.1;
+        double radius = 150.0 + (vertices > 5 ? 40.0 * std::sin(7.0 * angle) : 0.0);
+        polygon.push_back(cv::Point2f(static_cast<float>(320.3 + radius * std::cos(angle)),
+                                      static_cast<float>(240.7 + radius * std::sin(angle))));
+      }
+      cv::Mat coverage;
+      graphics::rasterize_coverage(polygon, graphics::polygon_bounds(polygon, size), coverage);
+      double expected = cv::contourArea(polygon);
+      double actual = cv::sum(coverage)[0] / 255.0;
+      if (std::fabs(actual - expected) > 0.001 * expected + 1)
+      {
+        fprintf(stderr, "coverage of a %d-gon is %.1f, its area %.1f\n", vertices, actual, expected);
+        ok = false;
+      }
+    }
+    return ok;
+  }
+}
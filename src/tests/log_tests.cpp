@@ -0,0 +1,32 @@
+#include "tests.hpp"
+
+#include <stdio.h>
+
+#include "../aixlog.hpp"
+#include "../bench/log_probes.hpp"
+
+namespace tests
+{
+  bool log_compiled_out()
+  {
+    // A statement below AIXLOG_MIN_SEVERITY skips its arguments, the same
+    // statement enabled evaluates them once.
+    AixLog::Log::init({std::make_shared<AixLog::SinkNull>()});
+    const long before = bench::log_argument_evaluations.load();
+    for (int i = 0; i < 1000; i++)
+    {
+      bench::log_probe_compiled_out(i);
+    }
+    const long compiled_out = bench::log_argument_evaluations.load() - before;
+    bench::log_probe_enabled(0);
+    const long enabled = bench::log_argument_evaluations.load() - before - compiled_out;
+    AixLog::Log::init();
+    if (compiled_out != 0 || enabled != 1)
+    {
+      fprintf(stderr, "compiled out LOG statements evaluated their arguments %ld times, enabled ones %ld\n",
+              compiled_out, enabled);
+      return false;
+    }
+    return true;
+  }
+}
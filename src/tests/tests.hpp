@@ -0,0 +1,36 @@
+#ifndef GRAPHICS_TESTS_HPP
+#define GRAPHICS_TESTS_HPP
+
+// Correctness checks of the native code, run by graphics_tests. Each returns
+// whether it passed, after printing what differed to stderr.
+namespace tests
+{
+  // kernel_tests.cpp: every kernel level supported here against its OpenCV
+  // or scalar reference, on sizes that exercise the vector bodies, their
+  // tails and padded row strides.
+  bool desaturate_kernels();
+  bool rgba_kernels();
+  bool gray_kernels();
+  bool weighted_kernels();
+  bool blend_kernels();
+  bool blend_mode_kernels();
+  bool polygon_coverage();
+
+  // edit_tests.cpp: the banded, batched, tiled and incremental paths of the
+  // edits against the same edit done in one pass.
+  bool region_filters();
+  bool strokes();
+  bool layers();
+  bool tiled_image();
+  bool undo_history();
+
+  // io_tests.cpp: codecs and entry points.
+  bool streaming_transcode();
+  bool raw_round_trip();
+  bool corrupt_inputs();
+
+  // log_tests.cpp
+  bool log_compiled_out();
+}
+
+#endif // GRAPHICS_TESTS_HPP
@@ -0,0 +1,337 @@
+#include "thread_policy.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aixlog.hpp"
+#include "image_session.hpp"
+#include "stats.hpp"
+#include "worker_pool.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Chunks per thread of a parallel_for(), so threads finishing early take
+    // over the work of the slower ones.
+    const int kChunksPerThread = 4;
+    // CPUs a cpu_mask can name.
+    const int kMaskCpus = 64;
+
+    struct PolicyState
+    {
+      std::mutex mutex;
+      bool set = false;
+      graphics_thread_policy policy = {0, 0, GRAPHICS_AFFINITY_ANY, 0};
+      // CPUs threads move to, empty while no thread was ever moved.
+      std::vector<int> cpus;
+      // Bumped by every change of cpus.
+      std::atomic<uint64_t> generation{0};
+      std::atomic<int> job_threads{0};
+    };
+
+    PolicyState &state()
+    {
+      static PolicyState instance;
+      return instance;
+    }
+
+    thread_local uint64_t applied_generation = 0;
+
+    uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start)
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+#ifdef __linux__
+    // The CPUs the process was allowed on before any policy moved a thread.
+    const std::vector<int> &startup_cpus()
+    {
+      static const std::vector<int> cpus = []()
+      {
+        std::vector<int> allowed;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+          for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+          {
+            if (CPU_ISSET(cpu, &set))
+            {
+              allowed.push_back(cpu);
+            }
+          }
+        }
+        return allowed;
+      }();
+      return cpus;
+    }
+
+    // In kHz, or -1 where the kernel does not say.
+    long max_frequency(int cpu)
+    {
+      char path[96];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+      FILE *file = fopen(path, "r");
+      if (file == nullptr)
+      {
+        return -1;
+      }
+      long frequency = -1;
+      if (fscanf(file, "%ld", &frequency) != 1)
+      {
+        frequency = -1;
+      }
+      fclose(file);
+      return frequency;
+    }
+
+    // The CPUs of cpus faster than the slowest cluster. All of them on
+    // uniform cores or when a frequency is unknown.
+    std::vector<int> fast_cpus(const std::vector<int> &cpus)
+    {
+      std::vector<long> frequencies;
+      for (int cpu : cpus)
+      {
+        frequencies.push_back(max_frequency(cpu));
+      }
+      if (frequencies.empty() || *std::min_element(frequencies.begin(), frequencies.end()) < 0)
+      {
+        return cpus;
+      }
+      const long slowest = *std::min_element(frequencies.begin(), frequencies.end());
+      std::vector<int> fast;
+      for (size_t i = 0; i < cpus.size(); i++)
+      {
+        if (frequencies[i] > slowest)
+        {
+          fast.push_back(cpus[i]);
+        }
+      }
+      return fast.empty() ? cpus : fast;
+    }
+#else
+    // Thread affinity is not available, policies leave threads where they are.
+    const std::vector<int> &startup_cpus()
+    {
+      static const std::vector<int> none;
+      return none;
+    }
+
+    std::vector<int> fast_cpus(const std::vector<int> &cpus)
+    {
+      return cpus;
+    }
+#endif
+
+    // Fills resolved and the CPUs threads move to from requested. moved is
+    // whether threads were moved before, and must be moved back by a policy
+    // without affinity.
+    bool resolve(const graphics_thread_policy &requested, bool moved, graphics_thread_policy &resolved,
+                 std::vector<int> &cpus)
+    {
+      if (requested.total_threads < 0 || requested.job_threads < 0 || requested.affinity < GRAPHICS_AFFINITY_ANY ||
+          requested.affinity > GRAPHICS_AFFINITY_MASK)
+      {
+        return false;
+      }
+
+      const std::vector<int> &allowed = startup_cpus();
+      cpus.clear();
+      if (requested.affinity == GRAPHICS_AFFINITY_FAST_CORES)
+      {
+        cpus = fast_cpus(allowed);
+      }
+      else if (requested.affinity == GRAPHICS_AFFINITY_MASK)
+      {
+        for (int cpu : allowed)
+        {
+          if (cpu < kMaskCpus && (requested.cpu_mask >> cpu & 1) != 0)
+          {
+            cpus.push_back(cpu);
+          }
+        }
+        if (cpus.empty() && !allowed.empty())
+        {
+          return false;
+        }
+      }
+      const bool pinned = !cpus.empty();
+
+      const int cores = pinned ? static_cast<int>(cpus.size()) : std::max(1u, std::thread::hardware_concurrency());
+      resolved.total_threads = requested.total_threads > 0 ? requested.total_threads : cores;
+      resolved.job_threads = std::min(requested.job_threads > 0 ? requested.job_threads : resolved.total_threads,
+                                      resolved.total_threads);
+      resolved.affinity = pinned ? requested.affinity : GRAPHICS_AFFINITY_ANY;
+      resolved.cpu_mask = 0;
+      for (int cpu : cpus)
+      {
+        resolved.cpu_mask |= cpu < kMaskCpus ? uint64_t(1) << cpu : 0;
+      }
+      if (!pinned && moved)
+      {
+        cpus = allowed;
+      }
+      return true;
+    }
+  }
+
+  bool set_thread_policy(const graphics_thread_policy &policy)
+  {
+    PolicyState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    graphics_thread_policy resolved;
+    std::vector<int> cpus;
+    if (!resolve(policy, !s.cpus.empty(), resolved, cpus))
+    {
+      return false;
+    }
+    s.set = true;
+    s.policy = resolved;
+    if (cpus != s.cpus)
+    {
+      s.cpus = cpus;
+      s.generation.fetch_add(1, std::memory_order_release);
+    }
+    s.job_threads.store(resolved.job_threads, std::memory_order_relaxed);
+    cv::setNumThreads(resolved.job_threads);
+    worker_pool().set_concurrency(static_cast<size_t>(resolved.total_threads / resolved.job_threads));
+    LOG(INFO) << "Thread policy: " << resolved.total_threads << " threads, " << resolved.job_threads
+              << " per job, cpu mask " << std::hex << resolved.cpu_mask << std::dec << std::endl;
+    return true;
+  }
+
+  graphics_thread_policy thread_policy()
+  {
+    PolicyState &s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.set)
+    {
+      return s.policy;
+    }
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    return {cores, std::max(1, cv::getNumThreads()), GRAPHICS_AFFINITY_ANY, 0};
+  }
+
+  int job_threads()
+  {
+    // cv::setNumThreads() called after the policy still has the last word.
+    const int threads = state().job_threads.load(std::memory_order_relaxed);
+    const int opencv_threads = std::max(1, cv::getNumThreads());
+    return threads > 0 ? std::min(threads, opencv_threads) : opencv_threads;
+  }
+
+  void apply_affinity()
+  {
+    PolicyState &s = state();
+    const uint64_t generation = s.generation.load(std::memory_order_acquire);
+    if (applied_generation == generation)
+    {
+      return;
+    }
+    applied_generation = generation;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      for (int cpu : s.cpus)
+      {
+        CPU_SET(cpu, &set);
+      }
+    }
+    if (CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+      LOG(WARNING) << "Could not move a thread to the CPUs of the thread policy" << std::endl;
+    }
+#endif
+  }
+
+  void parallel_for(const cv::Range &range, const std::function<void(const cv::Range &)> &body)
+  {
+    const int count = range.size();
+    if (count <= 0)
+    {
+      return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const int threads = std::min(job_threads(), count);
+    if (threads == 1)
+    {
+      body(range);
+      const uint64_t elapsed = nanoseconds_since(start);
+      record_parallel_loop(elapsed, elapsed);
+      return;
+    }
+
+    // Stripes run on OpenCV's pool, which keeps loops nested in body on
+    // their thread; pool threads follow the policy's affinity, the calling
+    // thread is left where its owner put it.
+    const int chunk = std::max(1, count / (threads * kChunksPerThread));
+    const std::thread::id caller = std::this_thread::get_id();
+    std::atomic<int> next{range.start};
+    std::atomic<uint64_t> busy_ns{0};
+    cv::parallel_for_(
+        cv::Range(0, threads), [&](const cv::Range &)
+        {
+          if (std::this_thread::get_id() != caller)
+          {
+            apply_affinity();
+          }
+          const auto stripe_start = std::chrono::steady_clock::now();
+          for (int begin = next.fetch_add(chunk); begin < range.end; begin = next.fetch_add(chunk))
+          {
+            body(cv::Range(begin, std::min(begin + chunk, range.end)));
+          }
+          busy_ns.fetch_add(nanoseconds_since(stripe_start), std::memory_order_relaxed); },
+        threads);
+    record_parallel_loop(nanoseconds_since(start), busy_ns.load());
+  }
+}
+
+extern "C"
+{
+  FFI_PLUGIN_EXPORT int set_thread_policy(const graphics_thread_policy *policy)
+  try
+  {
+    if (policy == nullptr || !graphics::set_thread_policy(*policy))
+    {
+      LOG(ERROR) << "Invalid thread policy" << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+
+  FFI_PLUGIN_EXPORT int get_thread_policy(graphics_thread_policy *policy)
+  try
+  {
+    if (policy == nullptr)
+    {
+      return 1;
+    }
+    *policy = graphics::thread_policy();
+    return 0;
+  }
+  catch (...)
+  {
+    graphics::log_exception(__func__);
+    return 1;
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef GRAPHICS_THREAD_POLICY_HPP
+#define GRAPHICS_THREAD_POLICY_HPP
+
+#include <functional>
+
+#include <opencv2/opencv.hpp>
+
+#include "graphics.hpp"
+
+namespace graphics
+{
+  // Validates policy, resolves its zeros and puts it in force: OpenCV's pool
+  // and every parallel_for() get job_threads, the worker pool runs
+  // total_threads / job_threads jobs at once, and threads doing native work
+  // move to the policy's CPUs. False leaves the current policy alone.
+  bool set_thread_policy(const graphics_thread_policy &policy);
+
+  // The policy in force, with cpu_mask the CPUs threads are pinned to, or 0.
+  graphics_thread_policy thread_policy();
+
+  // Threads one operation may keep busy.
+  int job_threads();
+
+  // Moves the calling thread to the policy's CPUs if the policy changed since
+  // it last did. Cheap enough to call at the start of every task.
+  void apply_affinity();
+
+  // Runs body over chunks of range on at most job_threads() threads,
+  // including the calling one. Chunks are handed out as threads free up, so
+  // uneven chunks still balance. Records the parallelism it achieved.
+  void parallel_for(const cv::Range &range, const std::function<void(const cv::Range &)> &body);
+}
+
+#endif // GRAPHICS_THREAD_POLICY_HPP
@@ -0,0 +1,156 @@
+#include "tiled_image.hpp"
+
+#include <algorithm>
+
+#include "buffer_pool.hpp"
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    // Index range of the tiles covering [begin, end) along one axis.
+    void tile_span(int begin, int end, int &first, int &last)
+    {
+      first = begin / TiledImage::kTileSize;
+      last = (end - 1) / TiledImage::kTileSize;
+    }
+  }
+
+  TiledImage::TiledImage(const cv::Mat &image)
+      : size_(image.size()),
+        tiles_x_((image.cols + kTileSize - 1) / kTileSize),
+        tiles_y_((image.rows + kTileSize - 1) / kTileSize)
+  {
+    CV_Assert(image.type() == CV_8UC3);
+    tiles_.reserve(static_cast<size_t>(tiles_x_) * tiles_y_);
+    for (int y = 0; y < tiles_y_; y++)
+    {
+      for (int x = 0; x < tiles_x_; x++)
+      {
+        tiles_.push_back(std::make_shared<cv::Mat>(image(tile_rect(y * tiles_x_ + x))));
+      }
+    }
+  }
+
+  cv::Rect TiledImage::tile_rect(int index) const
+  {
+    const int tile = kTileSize;
+    const int x = index % tiles_x_ * tile;
+    const int y = index / tiles_x_ * tile;
+    return cv::Rect(x, y, std::min(tile, size_.width - x), std::min(tile, size_.height - y));
+  }
+
+  cv::Mat &TiledImage::writable_tile(int index)
+  {
+    std::shared_ptr<cv::Mat> &tile = tiles_[index];
+    if (tile.use_count() > 1)
+    {
+      auto copy = std::make_shared<cv::Mat>();
+      tile->copyTo(pooled(*copy));
+      tile = std::move(copy);
+      record_copied_tiles(1);
+    }
+    return *tile;
+  }
+
+  void TiledImage::set_tile(int index, std::shared_ptr<cv::Mat> pixels)
+  {
+    CV_Assert(pixels->type() == CV_8UC3 && pixels->size() == tile_rect(index).size());
+    tiles_[index] = std::move(pixels);
+  }
+
+  std::vector<int> TiledImage::tiles_in(const cv::Rect &rect) const
+  {
+    std::vector<int> indices;
+    const cv::Rect area = rect & cv::Rect(0, 0, size_.width, size_.height);
+    if (area.empty())
+    {
+      return indices;
+    }
+    int left, right, top, bottom;
+    tile_span(area.x, area.x + area.width, left, right);
+    tile_span(area.y, area.y + area.height, top, bottom);
+    indices.reserve(static_cast<size_t>(right - left + 1) * (bottom - top + 1));
+    for (int y = top; y <= bottom; y++)
+    {
+      for (int x = left; x <= right; x++)
+      {
+        indices.push_back(y * tiles_x_ + x);
+      }
+    }
+    return indices;
+  }
+
+  int TiledImage::shared_tiles() const
+  {
+    return static_cast<int>(std::count_if(tiles_.begin(), tiles_.end(),
+                                          [](const std::shared_ptr<cv::Mat> &tile)
+                                          { return tile.use_count() > 1; }));
+  }
+
+  void TiledImage::read(const cv::Rect &rect, cv::Mat &out) const
+  {
+    CV_Assert((rect & cv::Rect(0, 0, size_.width, size_.height)) == rect);
+    out.create(rect.size(), CV_8UC3);
+    if (rect.empty())
+    {
+      return;
+    }
+    int left, right, top, bottom;
+    tile_span(rect.x, rect.x + rect.width, left, right);
+    tile_span(rect.y, rect.y + rect.height, top, bottom);
+    for (int y = top; y <= bottom; y++)
+    {
+      for (int x = left; x <= right; x++)
+      {
+        const int index = y * tiles_x_ + x;
+        const cv::Rect area = tile_rect(index) & rect;
+        const cv::Rect tile = tile_rect(index);
+        (*tiles_[index])(area - tile.tl()).copyTo(out(area - rect.tl()));
+      }
+    }
+  }
+
+  void TiledImage::write(const cv::Rect &rect, const cv::Mat &pixels)
+  {
+    CV_Assert(pixels.type() == CV_8UC3 && pixels.size() == rect.size());
+    for_each_tile(rect, [&](cv::Mat &tile, const cv::Rect &tile_area)
+                  {
+                    const cv::Rect area = tile_area & rect;
+                    pixels(area - rect.tl()).copyTo(tile(area - tile_area.tl()));
+                  });
+  }
+
+  void TiledImage::for_each_tile(const cv::Rect &rect, const std::function<void(cv::Mat &, const cv::Rect &)> &op)
+  {
+    // Shared tiles are copied up front, so the tasks below only touch their
+    // own tile.
+    const std::vector<int> indices = tiles_in(rect);
+    for (int index : indices)
+    {
+      writable_tile(index);
+    }
+    parallel_for(cv::Range(0, static_cast<int>(indices.size())), [&](const cv::Range &range)
+                 {
+                   for (int i = range.start; i < range.end; i++)
+                   {
+                     op(*tiles_[indices[i]], tile_rect(indices[i]));
+                   } });
+  }
+
+  cv::Mat TiledImage::to_mat() const
+  {
+    cv::Mat image;
+    pooled(image).create(size_, CV_8UC3);
+    parallel_for(cv::Range(0, tile_count()), [&](const cv::Range &range)
+                 {
+                   for (int i = range.start; i < range.end; i++)
+                   {
+                     tiles_[i]->copyTo(image(tile_rect(i)));
+                   } });
+    record_temporary(image.total() * image.elemSize());
+    return image;
+  }
+}
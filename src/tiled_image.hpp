@@ -0,0 +1,83 @@
+#ifndef GRAPHICS_TILED_IMAGE_HPP
+#define GRAPHICS_TILED_IMAGE_HPP
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace graphics
+{
+  // A BGR image kept as kTileSize x kTileSize tiles with copy-on-write
+  // semantics. Copying a TiledImage shares every tile; a tile is copied the
+  // first time it is written while shared, so a copy taken before an edit
+  // costs the tiles the edit touches rather than the image. Edits read the
+  // pixels they need into a temporary of their bounding box and write them
+  // back, so nothing image sized is allocated after the tiles exist. Not
+  // thread safe; tiles may be written from parallel tasks as long as each
+  // task writes its own.
+  class TiledImage
+  {
+  public:
+    static const int kTileSize = 256;
+
+    TiledImage() = default;
+
+    // Tiles viewing the pixels of image (CV_8UC3) without copying them. The
+    // tiles keep image's buffer alive and write into it until they are
+    // copied.
+    explicit TiledImage(const cv::Mat &image);
+
+    cv::Size size() const { return size_; }
+    bool empty() const { return tiles_.empty(); }
+    int tiles_x() const { return tiles_x_; }
+    int tiles_y() const { return tiles_y_; }
+    int tile_count() const { return static_cast<int>(tiles_.size()); }
+
+    // Pixels of the image the tile at index covers; the last row and column
+    // of tiles are cut off at the image's edges.
+    cv::Rect tile_rect(int index) const;
+    const cv::Mat &tile(int index) const { return *tiles_[index]; }
+
+    // The tile at index, copied first if another image shares it.
+    cv::Mat &writable_tile(int index);
+
+    // The tile at index itself; the image copies it before its next write
+    // while the pointer is held.
+    std::shared_ptr<cv::Mat> share_tile(int index) const { return tiles_[index]; }
+
+    // Replaces the tile at index with pixels of the tile's size, taking a
+    // share in them.
+    void set_tile(int index, std::shared_ptr<cv::Mat> pixels);
+
+    // Indices of the tiles overlapping rect, row by row.
+    std::vector<int> tiles_in(const cv::Rect &rect) const;
+
+    // Tiles shared with another image.
+    int shared_tiles() const;
+
+    // Copies the pixels of rect, which must lie inside the image, into out.
+    void read(const cv::Rect &rect, cv::Mat &out) const;
+
+    // Copies pixels (rect sized) into the tiles rect overlaps.
+    void write(const cv::Rect &rect, const cv::Mat &pixels);
+
+    // Runs op on every tile overlapping rect, on all cores. op gets the
+    // tile's writable pixels and their position in the image.
+    void for_each_tile(const cv::Rect &rect, const std::function<void(cv::Mat &, const cv::Rect &)> &op);
+
+    // The whole image in one buffer.
+    cv::Mat to_mat() const;
+
+  private:
+    cv::Size size_;
+    int tiles_x_ = 0;
+    int tiles_y_ = 0;
+    std::vector<std::shared_ptr<cv::Mat>> tiles_;
+  };
+}
+
+#endif // GRAPHICS_TILED_IMAGE_HPP
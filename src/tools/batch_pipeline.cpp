@@ -0,0 +1,287 @@
+#include "batch_pipeline.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../image_io.hpp"
+#include "batch_script.hpp"
+
+namespace batch
+{
+  namespace
+  {
+    typedef std::chrono::steady_clock Clock;
+
+    double ms_since(Clock::time_point start)
+    {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // A counting semaphore of the CPU slots.
+    class CpuSlots
+    {
+    public:
+      explicit CpuSlots(int slots) : free_(slots) {}
+
+      void acquire()
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        available_.wait(lock, [this]()
+                        { return free_ > 0; });
+        free_--;
+      }
+
+      void release()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_++;
+        available_.notify_one();
+      }
+
+    private:
+      std::mutex mutex_;
+      std::condition_variable available_;
+      int free_;
+    };
+
+    // Holds a CPU slot for the enclosing scope, adding the time it waited
+    // for it to wait_ms.
+    class CpuSlot
+    {
+    public:
+      CpuSlot(CpuSlots &slots, double &wait_ms) : slots_(slots)
+      {
+        const Clock::time_point start = Clock::now();
+        slots_.acquire();
+        wait_ms += ms_since(start);
+      }
+
+      ~CpuSlot() { slots_.release(); }
+
+      CpuSlot(const CpuSlot &) = delete;
+      CpuSlot &operator=(const CpuSlot &) = delete;
+
+    private:
+      CpuSlots &slots_;
+    };
+
+    // A file on its way through the stages.
+    struct Item
+    {
+      FileResult result;
+      cv::Mat image;
+      Clock::time_point start;
+      // When it entered the queue it is in.
+      Clock::time_point queued;
+    };
+
+    // Writes a sibling file renamed over path, so a failed write never
+    // leaves a truncated output behind.
+    bool write_output(const std::string &path, const uint8_t *data, size_t length)
+    {
+      const std::string partial = path + ".part";
+      FILE *file = fopen(partial.c_str(), "wb");
+      if (file == nullptr)
+      {
+        return false;
+      }
+      bool ok = fwrite(data, 1, length, file) == length;
+      ok = fclose(file) == 0 && ok;
+      if (!ok || rename(partial.c_str(), path.c_str()) != 0)
+      {
+        remove(partial.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    std::string extension_of(const std::string &path)
+    {
+      const size_t dot = path.rfind('.');
+      const size_t slash = path.rfind('/');
+      return dot != std::string::npos && (slash == std::string::npos || dot > slash) ? path.substr(dot) : "";
+    }
+  }
+
+  void run_pipeline(const std::vector<FileJob> &jobs, const std::vector<graphics::Command> &script,
+                    const PipelineOptions &options, const std::function<void(const FileResult &)> &done)
+  {
+    BoundedQueue<Item> decoded(options.queue_depth);
+    BoundedQueue<Item> processed(options.queue_depth);
+    CpuSlots slots(options.cpu_slots);
+    std::atomic<size_t> next{0};
+    std::atomic<int> readers_left{options.readers};
+    std::atomic<int> workers_left{options.workers};
+    std::mutex done_mutex;
+
+    auto finish = [&](Item &item, const char *error)
+    {
+      item.result.ok = error == nullptr;
+      item.result.error = error != nullptr ? error : "";
+      item.result.total_ms = ms_since(item.start);
+      item.image.release();
+      std::lock_guard<std::mutex> lock(done_mutex);
+      done(item.result);
+    };
+
+    auto read = [&]()
+    {
+      for (size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1))
+      {
+        Item item;
+        item.result.input = jobs[i].input;
+        item.result.output = jobs[i].output;
+        item.start = Clock::now();
+        try
+        {
+          std::vector<uint8_t> bytes;
+          if (!graphics::read_file(jobs[i].input.c_str(), bytes))
+          {
+            finish(item, "could not read the file");
+            continue;
+          }
+          item.result.input_bytes = bytes.size();
+          item.result.read_ms = ms_since(item.start);
+
+          bool decoded_ok;
+          {
+            CpuSlot slot(slots, item.result.wait_ms);
+            const Clock::time_point start = Clock::now();
+            decoded_ok = bytes.size() <= INT32_MAX &&
+                         graphics::decode_image(bytes.data(), static_cast<int32_t>(bytes.size()), cv::IMREAD_COLOR,
+                                                item.image);
+            item.result.decode_ms = ms_since(start);
+          }
+          if (!decoded_ok)
+          {
+            finish(item, "could not decode the image");
+            continue;
+          }
+          item.result.size = item.image.size();
+          item.queued = Clock::now();
+          decoded.push(std::move(item));
+        }
+        catch (const std::exception &e)
+        {
+          finish(item, e.what());
+        }
+        catch (...)
+        {
+          finish(item, "unknown error");
+        }
+      }
+      if (readers_left.fetch_sub(1) == 1)
+      {
+        decoded.close();
+      }
+    };
+
+    auto work = [&]()
+    {
+      Item item;
+      while (decoded.pop(item))
+      {
+        try
+        {
+          item.result.wait_ms += ms_since(item.queued);
+          bool ok = true;
+          {
+            CpuSlot slot(slots, item.result.wait_ms);
+            const Clock::time_point start = Clock::now();
+            for (const graphics::Command &command : script_for(script, item.image.size(), options.relative))
+            {
+              if (!(ok = graphics::execute_command(item.image, command)))
+              {
+                break;
+              }
+            }
+            item.result.process_ms = ms_since(start);
+          }
+          if (!ok)
+          {
+            finish(item, "the script failed");
+            continue;
+          }
+          item.queued = Clock::now();
+          processed.push(std::move(item));
+        }
+        catch (const std::exception &e)
+        {
+          finish(item, e.what());
+        }
+        catch (...)
+        {
+          finish(item, "unknown error");
+        }
+      }
+      if (workers_left.fetch_sub(1) == 1)
+      {
+        processed.close();
+      }
+    };
+
+    auto encode = [&]()
+    {
+      Item item;
+      while (processed.pop(item))
+      {
+        try
+        {
+          item.result.wait_ms += ms_since(item.queued);
+          const std::string ext = extension_of(item.result.output);
+          uint8_t *data = nullptr;
+          int32_t length = 0;
+          bool ok;
+          {
+            CpuSlot slot(slots, item.result.wait_ms);
+            const Clock::time_point start = Clock::now();
+            ok = graphics::encode_image(item.image, ext.c_str(), &options.encode, &data, &length);
+            item.result.encode_ms = ms_since(start);
+          }
+          item.image.release();
+          if (!ok)
+          {
+            finish(item, "could not encode the image");
+            continue;
+          }
+          const Clock::time_point start = Clock::now();
+          ok = write_output(item.result.output, data, static_cast<size_t>(length));
+          item.result.write_ms = ms_since(start);
+          item.result.output_bytes = static_cast<size_t>(length);
+          free_buffer(data);
+          finish(item, ok ? nullptr : "could not write the output");
+        }
+        catch (const std::exception &e)
+        {
+          finish(item, e.what());
+        }
+        catch (...)
+        {
+          finish(item, "unknown error");
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.readers; i++)
+    {
+      threads.emplace_back(read);
+    }
+    for (int i = 0; i < options.workers; i++)
+    {
+      threads.emplace_back(work);
+    }
+    for (int i = 0; i < options.encoders; i++)
+    {
+      threads.emplace_back(encode);
+    }
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+  }
+}
@@ -0,0 +1,124 @@
+#ifndef GRAPHICS_BATCH_PIPELINE_HPP
+#define GRAPHICS_BATCH_PIPELINE_HPP
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../command_buffer.hpp"
+#include "../graphics.hpp"
+
+namespace batch
+{
+  // A FIFO of at most capacity items between two pipeline stages. push()
+  // blocks while it is full, which holds the producers back to the pace of
+  // the consumers, so the images in flight stay bounded.
+  template <typename T>
+  class BoundedQueue
+  {
+  public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    void push(T &&item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]()
+                     { return items_.size() < capacity_; });
+      items_.push_back(std::move(item));
+      not_empty_.notify_one();
+    }
+
+    // False once the queue is closed and drained.
+    bool pop(T &item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]()
+                      { return !items_.empty() || closed_; });
+      if (items_.empty())
+      {
+        return false;
+      }
+      item = std::move(items_.front());
+      items_.pop_front();
+      not_full_.notify_one();
+      return true;
+    }
+
+    // Called by the last producer; consumers drain what is left.
+    void close()
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      not_empty_.notify_all();
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+  };
+
+  struct PipelineOptions
+  {
+    // Threads reading and decoding files, running the script, and encoding
+    // and writing the results.
+    int readers = 1;
+    int workers = 1;
+    int encoders = 1;
+    // Threads decoding, running the script or encoding at once, whatever
+    // their stage, so the stages can be oversized to follow the slowest one
+    // without running more threads than cores. Reading and writing files
+    // do not count.
+    int cpu_slots = 1;
+    // Images waiting between two stages.
+    size_t queue_depth = 1;
+    // Script points are fractions of the image size.
+    bool relative = false;
+    graphics_encode_options encode = {GRAPHICS_FORMAT_AUTO, -1, -1, -1, -1, GRAPHICS_RAW_UNCOMPRESSED};
+  };
+
+  // What happened to one file; the times are in milliseconds. wait is the
+  // time the file's image spent in the queues and waiting for a CPU slot.
+  struct FileResult
+  {
+    std::string input;
+    std::string output;
+    bool ok = false;
+    std::string error;
+    cv::Size size;
+    size_t input_bytes = 0;
+    size_t output_bytes = 0;
+    double read_ms = 0;
+    double decode_ms = 0;
+    double process_ms = 0;
+    double encode_ms = 0;
+    double write_ms = 0;
+    double wait_ms = 0;
+    double total_ms = 0;
+  };
+
+  struct FileJob
+  {
+    std::string input;
+    std::string output;
+  };
+
+  // Applies script to every job's input, writing its output, on
+  // options.readers + workers + encoders threads connected by bounded
+  // queues. At most readers + workers + encoders + 2 * queue_depth images
+  // are in memory. done is called once per job, from one thread at a time.
+  void run_pipeline(const std::vector<FileJob> &jobs, const std::vector<graphics::Command> &script,
+                    const PipelineOptions &options, const std::function<void(const FileResult &)> &done);
+}
+
+#endif // GRAPHICS_BATCH_PIPELINE_HPP
@@ -0,0 +1,290 @@
+#include "batch_script.hpp"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <sstream>
+
+#include "../region_filters.hpp"
+
+namespace batch
+{
+  namespace
+  {
+    // A named run of count params starting at index, each in [min, max].
+    struct ParamName
+    {
+      const char *name;
+      size_t index;
+      size_t count;
+      float min = -FLT_MAX;
+      float max = FLT_MAX;
+    };
+
+    struct Syntax
+    {
+      const char *name;
+      uint16_t op;
+      std::vector<ParamName> params;
+      // Values of the params left out before the last one given.
+      std::vector<float> defaults;
+    };
+
+    const size_t kFilterParam = 0;
+    const size_t kFilterValuesParam = 2;
+
+    const std::vector<Syntax> &syntaxes()
+    {
+      static const std::vector<Syntax> table = {
+          {"gray_scale", GRAPHICS_OP_GRAY_SCALE, {}, {}},
+          {"draw_polygon",
+           GRAPHICS_OP_DRAW_POLYGON,
+           {{"bgr", 0, 3, 0, 255}, {"thickness", 3, 1, 1, 32767}, {"tolerance", 4, 1}},
+           {0, 255, 0, 2}},
+          {"gray_scale_polygon", GRAPHICS_OP_GRAY_SCALE_POLYGON, {{"feather", 0, 1}, {"tolerance", 1, 1}}, {0}},
+          // The defaults of the values are the filter's.
+          {"filter_polygon",
+           GRAPHICS_OP_FILTER_POLYGON,
+           {{"filter", kFilterParam, 1},
+            {"feather", 1, 1},
+            {"values", kFilterValuesParam, graphics::kFilterValues},
+            {"tolerance", kFilterValuesParam + graphics::kFilterValues, 1}},
+           {0, 0}},
+          {"stroke",
+           GRAPHICS_OP_STROKE,
+           {{"bgr", 0, 3, 0, 255},
+            {"size", 3, 1, 0.5f, 4096},
+            {"hardness", 4, 1, 0, 1},
+            {"opacity", 5, 1, 0, 1},
+            {"spacing", 6, 1, 0.01f, 10}},
+           {0, 255, 0, 12, 0.8f, 1, 0.1f}},
+      };
+      return table;
+    }
+
+    // Comma separated finite numbers.
+    bool parse_numbers(const std::string &text, std::vector<float> &numbers)
+    {
+      numbers.clear();
+      const char *cursor = text.c_str();
+      while (true)
+      {
+        char *end = nullptr;
+        float value = strtof(cursor, &end);
+        if (end == cursor || !isfinite(value))
+        {
+          return false;
+        }
+        numbers.push_back(value);
+        if (*end == '\0')
+        {
+          return true;
+        }
+        if (*end != ',')
+        {
+          return false;
+        }
+        cursor = end + 1;
+      }
+    }
+
+    // A region filter by name or graphics_filter id.
+    const graphics::RegionFilter *parse_filter(const std::string &text)
+    {
+      for (int id = GRAPHICS_FILTER_GAUSSIAN_BLUR; id <= GRAPHICS_FILTER_SATURATION; id++)
+      {
+        const graphics::RegionFilter *filter = graphics::find_region_filter(id);
+        if (filter != nullptr && text == filter->name)
+        {
+          return filter;
+        }
+      }
+      char *end = nullptr;
+      long id = strtol(text.c_str(), &end, 10);
+      return end != text.c_str() && *end == '\0' ? graphics::find_region_filter(static_cast<int>(id)) : nullptr;
+    }
+
+    bool parse_line(const std::string &line, std::vector<graphics::Command> &commands, std::string &error)
+    {
+      std::istringstream tokens(line.substr(0, line.find('#')));
+      std::string name;
+      if (!(tokens >> name))
+      {
+        return true;
+      }
+      const Syntax *syntax = nullptr;
+      for (const Syntax &candidate : syntaxes())
+      {
+        if (name == candidate.name)
+        {
+          syntax = &candidate;
+        }
+      }
+      if (syntax == nullptr)
+      {
+        error = "unknown operation " + name;
+        return false;
+      }
+
+      graphics::Command command;
+      command.op = syntax->op;
+      std::vector<float> params;
+      std::vector<bool> given;
+      const graphics::RegionFilter *filter = nullptr;
+      std::string token;
+      std::vector<float> numbers;
+      while (tokens >> token)
+      {
+        const size_t equals = token.find('=');
+        if (equals == std::string::npos)
+        {
+          if (!parse_numbers(token, numbers) || numbers.size() != 2)
+          {
+            error = "expected a point x,y, got " + token;
+            return false;
+          }
+          command.points.push_back(cv::Point2f(numbers[0], numbers[1]));
+          continue;
+        }
+
+        const std::string key = token.substr(0, equals);
+        const std::string value = token.substr(equals + 1);
+        const ParamName *param = nullptr;
+        for (const ParamName &candidate : syntax->params)
+        {
+          if (key == candidate.name)
+          {
+            param = &candidate;
+          }
+        }
+        if (param == nullptr)
+        {
+          error = name + " has no param " + key;
+          return false;
+        }
+        if (command.op == GRAPHICS_OP_FILTER_POLYGON && param->index == kFilterParam)
+        {
+          if ((filter = parse_filter(value)) == nullptr)
+          {
+            error = "unknown filter " + value;
+            return false;
+          }
+          numbers = {static_cast<float>(filter->id)};
+        }
+        else if (!parse_numbers(value, numbers) || numbers.size() > param->count ||
+                 (numbers.size() < param->count && key != "values"))
+        {
+          error = key + " takes " + std::to_string(param->count) + " number(s), got " + value;
+          return false;
+        }
+        if (params.size() < param->index + numbers.size())
+        {
+          params.resize(param->index + numbers.size());
+          given.resize(params.size());
+        }
+        for (size_t i = 0; i < numbers.size(); i++)
+        {
+          if (numbers[i] < param->min || numbers[i] > param->max)
+          {
+            std::ostringstream range;
+            range << key << " must be in [" << param->min << ", " << param->max << "], got " << value;
+            error = range.str();
+            return false;
+          }
+          params[param->index + i] = numbers[i];
+          given[param->index + i] = true;
+        }
+      }
+
+      if (command.op == GRAPHICS_OP_FILTER_POLYGON && filter == nullptr)
+      {
+        error = "filter_polygon needs filter=NAME";
+        return false;
+      }
+      for (size_t i = 0; i < params.size(); i++)
+      {
+        if (given[i])
+        {
+          continue;
+        }
+        if (filter != nullptr && i >= kFilterValuesParam && i < kFilterValuesParam + graphics::kFilterValues)
+        {
+          params[i] = filter->defaults[i - kFilterValuesParam];
+        }
+        else if (i < syntax->defaults.size())
+        {
+          params[i] = syntax->defaults[i];
+        }
+      }
+      if (filter != nullptr && params.size() > kFilterValuesParam)
+      {
+        float values[graphics::kFilterValues];
+        for (int i = 0; i < graphics::kFilterValues; i++)
+        {
+          size_t index = kFilterValuesParam + i;
+          values[i] = index < params.size() ? params[index] : filter->defaults[i];
+        }
+        if (!filter->valid(values))
+        {
+          error = std::string("invalid values for ") + filter->name;
+          return false;
+        }
+      }
+      if ((command.op == GRAPHICS_OP_GRAY_SCALE) != command.points.empty())
+      {
+        error = command.op == GRAPHICS_OP_GRAY_SCALE ? "gray_scale takes no points" : name + " needs points";
+        return false;
+      }
+      command.params = std::move(params);
+      if (!graphics::valid_command(command))
+      {
+        error = "invalid params for " + name;
+        return false;
+      }
+      commands.push_back(std::move(command));
+      return true;
+    }
+  }
+
+  bool parse_script(const std::string &text, std::vector<graphics::Command> &commands, std::string &error)
+  {
+    std::vector<graphics::Command> parsed;
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++)
+    {
+      if (!parse_line(line, parsed, error))
+      {
+        error = "line " + std::to_string(number) + ": " + error;
+        return false;
+      }
+    }
+    if (parsed.empty())
+    {
+      error = "the script has no operations";
+      return false;
+    }
+    commands = std::move(parsed);
+    return true;
+  }
+
+  std::vector<graphics::Command> script_for(const std::vector<graphics::Command> &script, cv::Size size,
+                                            bool relative)
+  {
+    std::vector<graphics::Command> commands = script;
+    for (graphics::Command &command : commands)
+    {
+      if (relative)
+      {
+        for (cv::Point2f &point : command.points)
+        {
+          point.x *= size.width;
+          point.y *= size.height;
+        }
+      }
+      graphics::simplify_command(command);
+    }
+    return commands;
+  }
+}
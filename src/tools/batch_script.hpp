@@ -0,0 +1,33 @@
+#ifndef GRAPHICS_BATCH_SCRIPT_HPP
+#define GRAPHICS_BATCH_SCRIPT_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../command_buffer.hpp"
+
+namespace batch
+{
+  // Parses an operation script, one command per line with the params of its
+  // op (see graphics_command_op) by name, then the points as x,y pairs:
+  //
+  //   # '#' starts a comment
+  //   gray_scale
+  //   draw_polygon [bgr=B,G,R] [thickness=T] [tolerance=T] X,Y X,Y ...
+  //   gray_scale_polygon [feather=F] [tolerance=T] X,Y X,Y ...
+  //   filter_polygon filter=NAME [feather=F] [values=A,B,C] [tolerance=T] X,Y ...
+  //   stroke [bgr=B,G,R] [size=S] [hardness=H] [opacity=O] [spacing=S] X,Y ...
+  //
+  // Params left out keep the op's defaults. On a malformed script error
+  // names the line and nothing is returned.
+  bool parse_script(const std::string &text, std::vector<graphics::Command> &commands, std::string &error);
+
+  // The script's commands for an image of size. With relative set, points
+  // are fractions of the width and height rather than pixels.
+  std::vector<graphics::Command> script_for(const std::vector<graphics::Command> &script, cv::Size size,
+                                            bool relative);
+}
+
+#endif // GRAPHICS_BATCH_SCRIPT_HPP
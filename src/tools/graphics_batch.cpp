@@ -0,0 +1,472 @@
+// Headless batch processing: applies an operation script to many image
+// files with the same native code as the Flutter plugin.
+//
+// Build with -DGRAPHICS_BUILD_TOOLS=ON and run on a Linux box:
+//
+//   graphics_batch --script edits.txt --output DIR [--relative]
+//                  [--format jpeg|png|webp|raw] [--quality N] [--overwrite]
+//                  [--threads N] [--readers N] [--workers N] [--encoders N]
+//                  [--queue N] [--opencv-threads N] [--report results.csv]
+//                  INPUT...
+//
+// Inputs are image files or directories of them. Every output is written to
+// DIR under the input's name, with the extension of --format if given; two
+// inputs that would write the same output stop the batch before it starts. See
+// batch_script.hpp for the script syntax; with --relative its points are
+// fractions of each image's width and height.
+//
+// Files go through reader, worker and encoder threads connected by bounded
+// queues, and at most --threads of them (all cores by default) decode, edit
+// or encode at once. OpenCV runs single threaded inside each of them unless
+// --opencv-threads says otherwise, so the files rather than the pixels of
+// one file are spread over the cores. The per-file timings go to the --report
+// CSV and a summary with the throughput to stderr. The exit status is 1 if
+// any file failed.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "../image_io.hpp"
+#include "batch_pipeline.hpp"
+#include "batch_script.hpp"
+
+namespace
+{
+  struct Options
+  {
+    std::string script_path;
+    std::string output_directory;
+    std::string report_path;
+    std::vector<std::string> inputs;
+    bool overwrite = false;
+    int threads = 0;
+    int readers = 0;
+    int workers = 0;
+    int encoders = 0;
+    int queue_depth = 0;
+    int opencv_threads = 1;
+    batch::PipelineOptions pipeline;
+  };
+
+  const char *const kImageExtensions[] = {".jpg", ".jpeg", ".png", ".webp", ".bmp", ".tif", ".tiff", ".graw"};
+
+  bool is_directory(const std::string &path)
+  {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+  }
+
+  bool exists(const std::string &path)
+  {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0;
+  }
+
+  std::string lower(std::string text)
+  {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c)
+                   { return static_cast<char>(tolower(c)); });
+    return text;
+  }
+
+  std::string extension_of(const std::string &name)
+  {
+    const size_t dot = name.rfind('.');
+    return dot != std::string::npos && dot > 0 ? name.substr(dot) : "";
+  }
+
+  // The image files of a directory, not recursing, by name.
+  bool list_images(const std::string &directory, std::vector<std::string> &files)
+  {
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+      return false;
+    }
+    std::vector<std::string> names;
+    while (const dirent *entry = readdir(dir))
+    {
+      const std::string ext = lower(extension_of(entry->d_name));
+      if (entry->d_name[0] != '.' &&
+          std::find_if(std::begin(kImageExtensions), std::end(kImageExtensions), [&](const char *known)
+                       { return ext == known; }) != std::end(kImageExtensions))
+      {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const std::string &name : names)
+    {
+      const std::string path = directory + "/" + name;
+      if (!is_directory(path))
+      {
+        files.push_back(path);
+      }
+    }
+    return true;
+  }
+
+  // Output path of input: its name in the output directory, with the
+  // extension of the output format.
+  std::string output_for(const Options &options, const std::string &input)
+  {
+    const size_t slash = input.rfind('/');
+    std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+    const std::string ext = extension_of(name);
+    if (options.pipeline.encode.format != GRAPHICS_FORMAT_AUTO)
+    {
+      name = name.substr(0, name.size() - ext.size()) + graphics::codec_extension(&options.pipeline.encode, nullptr);
+    }
+    return options.output_directory + "/" + name;
+  }
+
+  bool parse_format(const std::string &name, int32_t &format)
+  {
+    const struct
+    {
+      const char *name;
+      int32_t format;
+    } formats[] = {{"jpeg", GRAPHICS_FORMAT_JPEG}, {"jpg", GRAPHICS_FORMAT_JPEG}, {"png", GRAPHICS_FORMAT_PNG},
+                   {"webp", GRAPHICS_FORMAT_WEBP}, {"raw", GRAPHICS_FORMAT_RAW}};
+    for (const auto &candidate : formats)
+    {
+      if (name == candidate.name)
+      {
+        format = candidate.format;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool parse_count(const char *text, int &value)
+  {
+    char *end = nullptr;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < 1 || parsed > 4096)
+    {
+      return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+  }
+
+  void usage(const char *program)
+  {
+    fprintf(stderr,
+            "usage: %s --script FILE --output DIR [--relative] [--format jpeg|png|webp|raw] [--quality N] "
+            "[--overwrite] [--threads N] [--readers N] [--workers N] [--encoders N] [--queue N] "
+            "[--opencv-threads N] [--report PATH] INPUT...\n",
+            program);
+  }
+
+  bool parse_options(int argc, char **argv, Options &options)
+  {
+    bool ok = true;
+    for (int i = 1; ok && i < argc; i++)
+    {
+      std::string arg = argv[i];
+      bool has_value = i + 1 < argc;
+      if (arg == "--script" && has_value)
+      {
+        options.script_path = argv[++i];
+      }
+      else if (arg == "--output" && has_value)
+      {
+        options.output_directory = argv[++i];
+      }
+      else if (arg == "--report" && has_value)
+      {
+        options.report_path = argv[++i];
+      }
+      else if (arg == "--relative")
+      {
+        options.pipeline.relative = true;
+      }
+      else if (arg == "--overwrite")
+      {
+        options.overwrite = true;
+      }
+      else if (arg == "--format" && has_value)
+      {
+        ok = parse_format(argv[++i], options.pipeline.encode.format);
+      }
+      else if (arg == "--quality" && has_value)
+      {
+        ok = parse_count(argv[++i], options.pipeline.encode.quality);
+      }
+      else if (arg == "--threads" && has_value)
+      {
+        ok = parse_count(argv[++i], options.threads);
+      }
+      else if (arg == "--readers" && has_value)
+      {
+        ok = parse_count(argv[++i], options.readers);
+      }
+      else if (arg == "--workers" && has_value)
+      {
+        ok = parse_count(argv[++i], options.workers);
+      }
+      else if (arg == "--encoders" && has_value)
+      {
+        ok = parse_count(argv[++i], options.encoders);
+      }
+      else if (arg == "--queue" && has_value)
+      {
+        ok = parse_count(argv[++i], options.queue_depth);
+      }
+      else if (arg == "--opencv-threads" && has_value)
+      {
+        ok = parse_count(argv[++i], options.opencv_threads);
+      }
+      else if (arg.compare(0, 2, "--") != 0)
+      {
+        options.inputs.push_back(arg);
+      }
+      else
+      {
+        ok = false;
+      }
+    }
+    if (!ok || options.script_path.empty() || options.output_directory.empty() || options.inputs.empty())
+    {
+      usage(argv[0]);
+      return false;
+    }
+
+    // Every stage can take the whole budget, so the threads follow whichever
+    // stage is the slowest for these files; the CPU slots keep the busy ones
+    // to the budget and the queues the images in memory.
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const int threads = options.threads > 0 ? options.threads : std::max(1, cores / options.opencv_threads);
+    batch::PipelineOptions &pipeline = options.pipeline;
+    pipeline.cpu_slots = threads;
+    pipeline.readers = options.readers > 0 ? options.readers : std::max(1, threads / 2);
+    pipeline.workers = options.workers > 0 ? options.workers : threads;
+    pipeline.encoders = options.encoders > 0 ? options.encoders : std::max(1, threads / 2);
+    pipeline.queue_depth = static_cast<size_t>(options.queue_depth > 0 ? options.queue_depth
+                                                                       : std::max(1, threads / 2));
+    return true;
+  }
+
+  bool read_text(const std::string &path, std::string &text)
+  {
+    std::vector<uint8_t> bytes;
+    if (!graphics::read_file(path.c_str(), bytes))
+    {
+      return false;
+    }
+    text.assign(bytes.begin(), bytes.end());
+    return true;
+  }
+
+  std::string csv_field(const std::string &text)
+  {
+    if (text.find_first_of(",\"\n") == std::string::npos)
+    {
+      return text;
+    }
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+      quoted += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    return quoted + "\"";
+  }
+
+  void write_csv_row(FILE *file, const batch::FileResult &r)
+  {
+    fprintf(file, "%s,%s,%s,%d,%d,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n", csv_field(r.input).c_str(),
+            csv_field(r.output).c_str(), r.ok ? "ok" : "failed", r.size.width, r.size.height, r.input_bytes,
+            r.output_bytes, r.read_ms, r.decode_ms, r.process_ms, r.encode_ms, r.write_ms, r.wait_ms, r.total_ms,
+            csv_field(r.error).c_str());
+  }
+
+  double cpu_seconds()
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  }
+
+  // Sums of the per-file results, for the summary.
+  struct Totals
+  {
+    size_t ok = 0;
+    size_t failed = 0;
+    double megapixels = 0;
+    double input_mb = 0;
+    double output_mb = 0;
+    double read_ms = 0;
+    double decode_ms = 0;
+    double process_ms = 0;
+    double encode_ms = 0;
+    double write_ms = 0;
+    double wait_ms = 0;
+
+    void add(const batch::FileResult &r)
+    {
+      (r.ok ? ok : failed)++;
+      megapixels += r.size.area() / 1e6;
+      input_mb += r.input_bytes / 1e6;
+      output_mb += r.output_bytes / 1e6;
+      read_ms += r.read_ms;
+      decode_ms += r.decode_ms;
+      process_ms += r.process_ms;
+      encode_ms += r.encode_ms;
+      write_ms += r.write_ms;
+      wait_ms += r.wait_ms;
+    }
+  };
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, options))
+  {
+    return 2;
+  }
+
+  std::string text;
+  std::string error;
+  std::vector<graphics::Command> script;
+  if (!read_text(options.script_path, text))
+  {
+    fprintf(stderr, "could not read %s\n", options.script_path.c_str());
+    return 2;
+  }
+  if (!batch::parse_script(text, script, error))
+  {
+    fprintf(stderr, "%s: %s\n", options.script_path.c_str(), error.c_str());
+    return 2;
+  }
+  if (!is_directory(options.output_directory))
+  {
+    fprintf(stderr, "%s is not a directory\n", options.output_directory.c_str());
+    return 2;
+  }
+
+  std::vector<std::string> inputs;
+  for (const std::string &input : options.inputs)
+  {
+    if (!is_directory(input))
+    {
+      inputs.push_back(input);
+    }
+    else if (!list_images(input, inputs))
+    {
+      fprintf(stderr, "could not list %s\n", input.c_str());
+      return 2;
+    }
+  }
+  // Inputs of the same name in different directories, or differing only in
+  // the extension --format replaces, would overwrite each other's output.
+  std::map<std::string, std::string> writers;
+  bool collided = false;
+  for (const std::string &input : inputs)
+  {
+    const std::string output = output_for(options, input);
+    auto inserted = writers.emplace(output, input);
+    if (!inserted.second)
+    {
+      fprintf(stderr, "%s and %s would both write %s\n", inserted.first->second.c_str(), input.c_str(),
+              output.c_str());
+      collided = true;
+    }
+  }
+  if (collided)
+  {
+    return 2;
+  }
+
+  std::vector<batch::FileJob> jobs;
+  size_t skipped = 0;
+  for (const std::string &input : inputs)
+  {
+    batch::FileJob job = {input, output_for(options, input)};
+    if (!options.overwrite && exists(job.output))
+    {
+      fprintf(stderr, "skipping %s: %s exists, pass --overwrite to replace it\n", input.c_str(), job.output.c_str());
+      skipped++;
+      continue;
+    }
+    jobs.push_back(job);
+  }
+  if (jobs.empty())
+  {
+    fprintf(stderr, "no files to process\n");
+    return skipped > 0 ? 1 : 0;
+  }
+
+  FILE *report = nullptr;
+  if (!options.report_path.empty())
+  {
+    report = options.report_path == "-" ? stdout : fopen(options.report_path.c_str(), "w");
+    if (report == nullptr)
+    {
+      fprintf(stderr, "could not write %s\n", options.report_path.c_str());
+      return 2;
+    }
+    fprintf(report, "input,output,status,width,height,input_bytes,output_bytes,read_ms,decode_ms,process_ms,"
+                    "encode_ms,write_ms,wait_ms,total_ms,error\n");
+  }
+
+  // The pipeline spreads the files over the cores; OpenCV splitting each
+  // image again would only oversubscribe them.
+  cv::setNumThreads(options.opencv_threads);
+  const batch::PipelineOptions &pipeline = options.pipeline;
+  fprintf(stderr, "%zu files, %d cpu slots (%d readers, %d workers, %d encoders, queues of %zu), opencv threads %d\n",
+          jobs.size(), pipeline.cpu_slots, pipeline.readers, pipeline.workers, pipeline.encoders,
+          pipeline.queue_depth, options.opencv_threads);
+
+  Totals totals;
+  const double cpu_start = cpu_seconds();
+  const auto start = std::chrono::steady_clock::now();
+  batch::run_pipeline(jobs, script, pipeline, [&](const batch::FileResult &result)
+                      {
+                        totals.add(result);
+                        if (!result.ok)
+                        {
+                          fprintf(stderr, "%s: %s\n", result.input.c_str(), result.error.c_str());
+                        }
+                        if (report != nullptr)
+                        {
+                          write_csv_row(report, result);
+                        } });
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const double cpu = cpu_seconds() - cpu_start;
+  if (report != nullptr && report != stdout)
+  {
+    fclose(report);
+  }
+
+  const size_t done = totals.ok + totals.failed;
+  const double per_file = done > 0 ? 1.0 / done : 0;
+  fprintf(stderr, "%zu ok, %zu failed, %zu skipped in %.2f s: %.1f files/s, %.1f MP/s, %.1f MB/s read, %.1f MB/s "
+                  "written\n",
+          totals.ok, totals.failed, skipped, seconds, done / seconds, totals.megapixels / seconds,
+          totals.input_mb / seconds, totals.output_mb / seconds);
+  fprintf(stderr, "per file: read %.2f ms, decode %.2f ms, script %.2f ms, encode %.2f ms, write %.2f ms, "
+                  "waiting %.2f ms\n",
+          totals.read_ms * per_file, totals.decode_ms * per_file, totals.process_ms * per_file,
+          totals.encode_ms * per_file, totals.write_ms * per_file, totals.wait_ms * per_file);
+  fprintf(stderr, "cores busy: %.1f of %d cpu slots (%.0f%%)\n", cpu / seconds, pipeline.cpu_slots,
+          100.0 * cpu / seconds / pipeline.cpu_slots);
+  return totals.failed > 0 ? 1 : 0;
+}
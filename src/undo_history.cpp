@@ -0,0 +1,417 @@
+#include "undo_history.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#if !_WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <iterator>
+
+#include "aixlog.hpp"
+#include "graphics.hpp"
+#include "lz4.hpp"
+
+namespace graphics
+{
+  namespace
+  {
+    bool seek(FILE *file, int64_t offset)
+    {
+#if _WIN32
+      return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+      return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    // An anonymous file in directory, gone once closed.
+    FILE *open_spill_file(const std::string &directory)
+    {
+#if _WIN32
+      char *name = _tempnam(directory.c_str(), "undo");
+      if (name == nullptr)
+      {
+        return nullptr;
+      }
+      FILE *file = fopen(name, "w+bTD");
+      free(name);
+      return file;
+#else
+      std::string path = directory + "/graphics-undo-XXXXXX";
+      int fd = mkstemp(&path[0]);
+      if (fd < 0)
+      {
+        return nullptr;
+      }
+      unlink(path.c_str());
+      FILE *file = fdopen(fd, "w+b");
+      if (file == nullptr)
+      {
+        close(fd);
+      }
+      return file;
+#endif
+    }
+
+    // Copies pixels over rect of image and returns the pixels they replaced.
+    auto pixel_swap(cv::Mat &image)
+    {
+      return [&image](const cv::Rect &rect, int, std::shared_ptr<cv::Mat> &&pixels)
+      {
+        auto current = std::make_shared<cv::Mat>();
+        image(rect).copyTo(*current);
+        pixels->copyTo(image(rect));
+        return current;
+      };
+    }
+
+    // Puts pixels in as the tile and returns the one it replaced.
+    auto pixel_swap(TiledImage &image)
+    {
+      return [&image](const cv::Rect &, int tile, std::shared_ptr<cv::Mat> &&pixels)
+      {
+        std::shared_ptr<cv::Mat> current = image.share_tile(tile);
+        image.set_tile(tile, std::move(pixels));
+        return current;
+      };
+    }
+
+    size_t pixel_bytes(const cv::Rect &rect)
+    {
+      return static_cast<size_t>(rect.area()) * 3;
+    }
+  }
+
+  UndoHistory::~UndoHistory()
+  {
+    close_spill();
+  }
+
+  bool UndoHistory::configure(size_t memory_budget, int32_t compression, const char *spill_directory)
+  {
+    if (compression != GRAPHICS_RAW_UNCOMPRESSED && compression != GRAPHICS_RAW_LZ4)
+    {
+      return false;
+    }
+    budget_ = memory_budget;
+    compression_ = compression;
+    // Steps already spilled stay in the current file.
+    spill_directory_ = spill_directory != nullptr ? spill_directory : "";
+    if (budget_ == 0)
+    {
+      drop(undo_, undo_.size());
+      drop(redo_, redo_.size());
+      for (Patch &patch : open_.patches)
+      {
+        release(patch);
+      }
+      open_ = Step();
+      return true;
+    }
+    enforce_budget();
+    return true;
+  }
+
+  void UndoHistory::save(const cv::Mat &image, const cv::Rect &rect)
+  {
+    const cv::Rect area = rect & cv::Rect(0, 0, image.cols, image.rows);
+    if (!enabled() || area.empty())
+    {
+      return;
+    }
+    Patch patch;
+    patch.rect = area;
+    patch.pixels = std::make_shared<cv::Mat>();
+    image(area).copyTo(*patch.pixels);
+    store(patch);
+    open_.patches.push_back(std::move(patch));
+  }
+
+  void UndoHistory::save(const TiledImage &image, const cv::Rect &rect)
+  {
+    if (!enabled())
+    {
+      return;
+    }
+    for (int index : image.tiles_in(rect))
+    {
+      // The first save of a tile in a step holds its pixels before the step.
+      if (std::any_of(open_.patches.begin(), open_.patches.end(), [index](const Patch &patch)
+                      { return patch.tile == index; }))
+      {
+        continue;
+      }
+      Patch patch;
+      patch.rect = image.tile_rect(index);
+      patch.tile = index;
+      patch.pixels = image.share_tile(index);
+      store(patch);
+      open_.patches.push_back(std::move(patch));
+    }
+  }
+
+  void UndoHistory::record_replay()
+  {
+    if (enabled())
+    {
+      open_.replays++;
+    }
+  }
+
+  void UndoHistory::commit()
+  {
+    if (open_.patches.empty() && open_.replays == 0)
+    {
+      return;
+    }
+    drop(redo_, redo_.size());
+    undo_.push_back(std::move(open_));
+    open_ = Step();
+    enforce_budget();
+  }
+
+  bool UndoHistory::undo(cv::Mat &image, std::vector<Command> &history, std::vector<cv::Rect> &changed)
+  {
+    return transfer(undo_, redo_, true, history, changed, pixel_swap(image));
+  }
+
+  bool UndoHistory::undo(TiledImage &image, std::vector<Command> &history, std::vector<cv::Rect> &changed)
+  {
+    return transfer(undo_, redo_, true, history, changed, pixel_swap(image));
+  }
+
+  bool UndoHistory::redo(cv::Mat &image, std::vector<Command> &history, std::vector<cv::Rect> &changed)
+  {
+    return transfer(redo_, undo_, false, history, changed, pixel_swap(image));
+  }
+
+  bool UndoHistory::redo(TiledImage &image, std::vector<Command> &history, std::vector<cv::Rect> &changed)
+  {
+    return transfer(redo_, undo_, false, history, changed, pixel_swap(image));
+  }
+
+  void UndoHistory::store(Patch &patch)
+  {
+    if (compression_ == GRAPHICS_RAW_LZ4 && patch.pixels)
+    {
+      cv::Mat pixels = *patch.pixels;
+      if (!pixels.isContinuous())
+      {
+        pixels = pixels.clone();
+      }
+      const size_t bytes = pixels.total() * pixels.elemSize();
+      patch.compressed.resize(lz4_compress_bound(bytes));
+      patch.compressed.resize(lz4_compress(pixels.data, bytes, patch.compressed.data()));
+      patch.compressed.shrink_to_fit();
+      patch.pixels.reset();
+      patch.packed = true;
+    }
+    memory_bytes_ += patch.pixels ? pixel_bytes(patch.rect) : patch.compressed.size();
+  }
+
+  std::shared_ptr<cv::Mat> UndoHistory::load(const Patch &patch)
+  {
+    if (patch.pixels)
+    {
+      return patch.pixels;
+    }
+    auto pixels = std::make_shared<cv::Mat>(patch.rect.size(), CV_8UC3);
+    const size_t bytes = pixel_bytes(patch.rect);
+    if (!patch.compressed.empty())
+    {
+      return lz4_decompress(patch.compressed.data(), patch.compressed.size(), pixels->data, bytes) ? pixels
+                                                                                                 : nullptr;
+    }
+    if (spill_ == nullptr || patch.offset < 0 || !seek(spill_, patch.offset))
+    {
+      return nullptr;
+    }
+    if (!patch.packed)
+    {
+      return patch.length == bytes && fread(pixels->data, 1, bytes, spill_) == bytes ? pixels : nullptr;
+    }
+    std::vector<uint8_t> block(patch.length);
+    if (fread(block.data(), 1, block.size(), spill_) != block.size() ||
+        !lz4_decompress(block.data(), block.size(), pixels->data, bytes))
+    {
+      return nullptr;
+    }
+    return pixels;
+  }
+
+  bool UndoHistory::spill(Patch &patch)
+  {
+    if (!patch.pixels && patch.compressed.empty())
+    {
+      return true;
+    }
+    if (spill_ == nullptr && (spill_ = open_spill_file(spill_directory_)) == nullptr)
+    {
+      LOG(WARNING) << "Could not create an undo file in " << spill_directory_ << std::endl;
+      return false;
+    }
+    cv::Mat pixels;
+    const uint8_t *data = patch.compressed.data();
+    size_t length = patch.compressed.size();
+    if (patch.pixels)
+    {
+      pixels = patch.pixels->isContinuous() ? *patch.pixels : patch.pixels->clone();
+      data = pixels.data;
+      length = pixels.total() * pixels.elemSize();
+    }
+    if (!seek(spill_, spill_end_) || fwrite(data, 1, length, spill_) != length)
+    {
+      LOG(WARNING) << "Could not write " << length << " bytes of undo history" << std::endl;
+      return false;
+    }
+    memory_bytes_ -= patch.pixels ? pixel_bytes(patch.rect) : patch.compressed.size();
+    patch.pixels.reset();
+    std::vector<uint8_t>().swap(patch.compressed);
+    patch.offset = spill_end_;
+    patch.length = length;
+    spill_end_ += static_cast<int64_t>(length);
+    disk_bytes_ += length;
+    return true;
+  }
+
+  void UndoHistory::release(Patch &patch)
+  {
+    memory_bytes_ -= patch.pixels ? pixel_bytes(patch.rect) : patch.compressed.size();
+    patch.pixels.reset();
+    std::vector<uint8_t>().swap(patch.compressed);
+    if (patch.offset >= 0)
+    {
+      disk_bytes_ -= patch.length;
+      // The file only grows; it goes once nothing in it is used.
+      if (disk_bytes_ == 0)
+      {
+        close_spill();
+      }
+    }
+    patch.offset = -1;
+    patch.length = 0;
+    patch.packed = false;
+  }
+
+  void UndoHistory::drop(std::vector<Step> &steps, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      for (Patch &patch : steps[i].patches)
+      {
+        release(patch);
+      }
+    }
+    steps.erase(steps.begin(), steps.begin() + count);
+  }
+
+  void UndoHistory::close_spill()
+  {
+    if (spill_ != nullptr)
+    {
+      fclose(spill_);
+      spill_ = nullptr;
+    }
+    spill_end_ = 0;
+  }
+
+  void UndoHistory::enforce_budget()
+  {
+    // Evicts the oldest step still in memory, undo steps first, short of the
+    // next undo and redo steps. A step that cannot be spilled is dropped
+    // with the steps behind it, which it cut off.
+    while (memory_bytes_ > budget_)
+    {
+      bool evicted = false;
+      for (std::vector<Step> *steps : {&undo_, &redo_})
+      {
+        for (size_t i = 0; !evicted && i + 1 < steps->size(); i++)
+        {
+          Step &step = (*steps)[i];
+          if (std::none_of(step.patches.begin(), step.patches.end(), [](const Patch &patch)
+                           { return patch.pixels || !patch.compressed.empty(); }))
+          {
+            continue;
+          }
+          bool spilled = !spill_directory_.empty();
+          for (size_t j = 0; spilled && j < step.patches.size(); j++)
+          {
+            spilled = spill(step.patches[j]);
+          }
+          if (!spilled)
+          {
+            drop(*steps, i + 1);
+          }
+          evicted = true;
+        }
+        if (evicted)
+        {
+          break;
+        }
+      }
+      if (!evicted)
+      {
+        return;
+      }
+    }
+  }
+
+  bool UndoHistory::transfer(std::vector<Step> &from, std::vector<Step> &to, bool undo,
+                             std::vector<Command> &history, std::vector<cv::Rect> &changed,
+                             const SwapPatch &swap_patch)
+  {
+    if (from.empty())
+    {
+      return false;
+    }
+    Step step = std::move(from.back());
+    from.pop_back();
+
+    // Everything is read back before the image changes, so a step that
+    // cannot be leaves the image as it was, along with the steps past it.
+    std::vector<std::shared_ptr<cv::Mat>> saved;
+    saved.reserve(step.patches.size());
+    for (const Patch &patch : step.patches)
+    {
+      saved.push_back(load(patch));
+      if (!saved.back())
+      {
+        LOG(ERROR) << "Could not read back " << (undo ? "an undo" : "a redo") << " step" << std::endl;
+        from.push_back(std::move(step));
+        drop(from, from.size());
+        return false;
+      }
+    }
+
+    // Undo swaps the patches from the last saved, redo from the first, so
+    // overlapping patches end up as their step left them.
+    const size_t count = step.patches.size();
+    for (size_t k = 0; k < count; k++)
+    {
+      const size_t i = undo ? count - 1 - k : k;
+      Patch &patch = step.patches[i];
+      release(patch);
+      patch.pixels = swap_patch(patch.rect, patch.tile, std::move(saved[i]));
+      store(patch);
+      changed.push_back(patch.rect);
+    }
+
+    if (undo)
+    {
+      const size_t replays = std::min(step.replays, history.size());
+      step.replayed.assign(std::make_move_iterator(history.end() - replays), std::make_move_iterator(history.end()));
+      history.erase(history.end() - replays, history.end());
+    }
+    else
+    {
+      history.insert(history.end(), std::make_move_iterator(step.replayed.begin()),
+                     std::make_move_iterator(step.replayed.end()));
+      step.replayed.clear();
+    }
+    to.push_back(std::move(step));
+    enforce_budget();
+    return true;
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef GRAPHICS_UNDO_HISTORY_HPP
+#define GRAPHICS_UNDO_HISTORY_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "command_buffer.hpp"
+#include "tiled_image.hpp"
+
+namespace graphics
+{
+  // Undo and redo of the edits of one image. Before an edit changes pixels
+  // they are saved as patches: a copy of a rectangle of a whole image, or
+  // the tiles of a tiled image themselves, which the edit then copies on
+  // write. Undoing a step swaps its patches with the pixels under them, in
+  // reverse order, so the same patches redo it; either way the cost is the
+  // edited area. Patches can be LZ4 compressed as they are saved. Once the
+  // patches in memory exceed the budget, the oldest steps are appended to a
+  // spill file, or dropped without one; the next undo and redo steps stay
+  // in memory. Not thread safe.
+  class UndoHistory
+  {
+  public:
+    UndoHistory() = default;
+    ~UndoHistory();
+
+    UndoHistory(const UndoHistory &) = delete;
+    UndoHistory &operator=(const UndoHistory &) = delete;
+
+    // A budget of 0 turns the history off and drops it. compression is a
+    // graphics_raw_compression; spill_directory may be NULL or empty to drop
+    // steps over the budget. False on invalid settings.
+    bool configure(size_t memory_budget, int32_t compression, const char *spill_directory);
+    bool enabled() const { return budget_ > 0; }
+
+    // Saves the pixels of rect, clipped to the image, for the open step.
+    void save(const cv::Mat &image, const cv::Rect &rect);
+    void save(const TiledImage &image, const cv::Rect &rect);
+
+    // Notes that the open step appended a command to a replay history (the
+    // edits of a preview session), which undo takes back out of it.
+    void record_replay();
+
+    // Ends the open step, which becomes the next undo and drops the redo
+    // steps. A step that saved nothing is dropped.
+    void commit();
+
+    // Undoes or redoes one step on image, moving the commands it recorded
+    // out of or back into history. changed receives the rectangles written.
+    // False if there is no step or its pixels could not be read back.
+    bool undo(cv::Mat &image, std::vector<Command> &history, std::vector<cv::Rect> &changed);
+    bool undo(TiledImage &image, std::vector<Command> &history, std::vector<cv::Rect> &changed);
+    bool redo(cv::Mat &image, std::vector<Command> &history, std::vector<cv::Rect> &changed);
+    bool redo(TiledImage &image, std::vector<Command> &history, std::vector<cv::Rect> &changed);
+
+    int undo_steps() const { return static_cast<int>(undo_.size()); }
+    int redo_steps() const { return static_cast<int>(redo_.size()); }
+    size_t memory_bytes() const { return memory_bytes_; }
+    size_t disk_bytes() const { return disk_bytes_; }
+
+  private:
+    // Saved pixels of rect in one of three places: resident as pixels,
+    // resident as an LZ4 block, or length bytes (LZ4 if packed) at offset of
+    // the spill file.
+    struct Patch
+    {
+      cv::Rect rect;
+      int tile = -1; // tiled images only
+      std::shared_ptr<cv::Mat> pixels;
+      std::vector<uint8_t> compressed;
+      int64_t offset = -1;
+      size_t length = 0;
+      bool packed = false;
+    };
+
+    struct Step
+    {
+      std::vector<Patch> patches;
+      size_t replays = 0;
+      std::vector<Command> replayed;
+    };
+
+    // Puts the pixels of a patch (rect, tile) in place and returns the ones
+    // they replaced.
+    typedef std::function<std::shared_ptr<cv::Mat>(const cv::Rect &, int, std::shared_ptr<cv::Mat> &&)> SwapPatch;
+
+    void store(Patch &patch);
+    std::shared_ptr<cv::Mat> load(const Patch &patch);
+    bool spill(Patch &patch);
+    void release(Patch &patch);
+    void drop(std::vector<Step> &steps, size_t count);
+    void close_spill();
+    void enforce_budget();
+    bool transfer(std::vector<Step> &from, std::vector<Step> &to, bool undo, std::vector<Command> &history,
+                  std::vector<cv::Rect> &changed, const SwapPatch &swap_patch);
+
+    size_t budget_ = 0;
+    int32_t compression_ = 0;
+    std::string spill_directory_;
+    FILE *spill_ = nullptr;
+    int64_t spill_end_ = 0;
+
+    Step open_;
+    std::vector<Step> undo_; // oldest first
+    std::vector<Step> redo_; // farthest first
+    size_t memory_bytes_ = 0;
+    size_t disk_bytes_ = 0;
+  };
+}
+
+#endif // GRAPHICS_UNDO_HISTORY_HPP
@@ -0,0 +1,102 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+#include "stats.hpp"
+#include "thread_policy.hpp"
+
+namespace graphics
+{
+  WorkerPool::WorkerPool(size_t threads)
+  {
+    threads = std::max<size_t>(threads, 1);
+    limit_ = threads;
+    for (size_t i = 0; i < threads; i++)
+    {
+      threads_.emplace_back(&WorkerPool::run, this);
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (std::thread &thread : threads_)
+    {
+      thread.join();
+    }
+  }
+
+  void WorkerPool::submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+    ready_.notify_one();
+  }
+
+  size_t WorkerPool::size()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return threads_.size();
+  }
+
+  void WorkerPool::set_concurrency(size_t jobs)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      limit_ = std::max<size_t>(jobs, 1);
+      while (threads_.size() < limit_)
+      {
+        threads_.emplace_back(&WorkerPool::run, this);
+      }
+    }
+    ready_.notify_all();
+  }
+
+  size_t WorkerPool::concurrency()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limit_;
+  }
+
+  void WorkerPool::run()
+  {
+    for (;;)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Queued jobs still run when stopping.
+        ready_.wait(lock, [this]
+                    { return (stopping_ && jobs_.empty()) || (!jobs_.empty() && running_ < limit_); });
+        if (jobs_.empty())
+        {
+          return;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+        record_running_jobs(++running_);
+      }
+      apply_affinity();
+      job();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_--;
+      }
+      // Wakes a thread for the next job, or all of them to stop.
+      ready_.notify_all();
+    }
+  }
+
+  WorkerPool &worker_pool()
+  {
+    // Leave a core to the Flutter UI and raster threads.
+    static WorkerPool pool(std::min(4u, std::max(2u, std::thread::hardware_concurrency()) - 1));
+    return pool;
+  }
+}
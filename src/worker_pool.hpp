@@ -0,0 +1,51 @@
+#ifndef GRAPHICS_WORKER_POOL_HPP
+#define GRAPHICS_WORKER_POOL_HPP
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace graphics
+{
+  // A set of native threads draining a FIFO of jobs. Image jobs run here
+  // instead of on Dart threads, so the UI isolate never blocks on them. At
+  // most concurrency() jobs run at once, one per thread at first.
+  class WorkerPool
+  {
+  public:
+    explicit WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void submit(std::function<void()> job);
+    size_t size();
+
+    // Lets jobs run at once, starting threads if there are fewer. Threads
+    // beyond it stay idle rather than stopping.
+    void set_concurrency(size_t jobs);
+    size_t concurrency();
+
+  private:
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> threads_;
+    size_t limit_;
+    size_t running_ = 0;
+    bool stopping_ = false;
+  };
+
+  // The pool shared by all asynchronous exports, started on first use.
+  WorkerPool &worker_pool();
+}
+
+#endif // GRAPHICS_WORKER_POOL_HPP